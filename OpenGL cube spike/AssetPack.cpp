@@ -0,0 +1,443 @@
+#include "AssetPack.h"
+#include "Benchmark.h"
+#include "RenderStats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <SOIL/SOIL.h>
+#include <SOIL/image_helper.h>
+extern "C"
+{
+#include <SOIL/image_DXT.h>
+}
+
+static uint64_t alignTo(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void writeBlob(FILE* file, uint64_t offset, const void* data, size_t size)
+{
+	static const char zeros[64] = {};
+	long position = ftell(file);
+	while (uint64_t(position) < offset)
+	{
+		size_t padding = size_t(std::min<uint64_t>(offset - position, sizeof(zeros)));
+		fwrite(zeros, 1, padding, file);
+		position += long(padding);
+	}
+	if (size)
+		fwrite(data, 1, size, file);
+}
+
+unsigned char* loadImage(const char* path, int* width, int* height, int forceChannels)
+{
+	SOIL_context context;
+	SOIL_init_context(&context);
+	unsigned char* image = SOIL_load_image_ctx(&context, path, width, height, 0, forceChannels);
+	if (!image)
+		fprintf(stderr, "%s: %s\n", path, context.result_string);
+	return image;
+}
+
+// body(i) for i in [0, count), spread over jobs when there are any
+static void forEachLevel(JobSystem* jobs, size_t count, const std::function<void(size_t)>& body)
+{
+	if (!jobs)
+	{
+		for (size_t i = 0; i < count; i++)
+			body(i);
+		return;
+	}
+	jobs->parallelFor(count, 1, [&body](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			body(i);
+	});
+}
+
+// Level 0 plus the box-filtered chain down to 1x1, each level reduced from
+// the full image the way SOIL does it for glTexImage2D
+static void buildMipChain(const unsigned char* image, int width, int height, int channels,
+	std::vector<std::vector<unsigned char>>& levels, std::vector<PackLevel>& sizes, JobSystem* jobs = nullptr)
+{
+	int levelCount = 1;
+	while ((width >> levelCount) > 0 || (height >> levelCount) > 0)
+		levelCount++;
+	levels.resize(levelCount);
+	sizes.resize(levelCount);
+
+	// Levels don't depend on each other, so they are built in parallel
+	forEachLevel(jobs, levelCount, [&](size_t level)
+	{
+		int levelWidth = std::max(width >> level, 1);
+		int levelHeight = std::max(height >> level, 1);
+		PackLevel size = { uint32_t(levelWidth), uint32_t(levelHeight), 0, 0 };
+		sizes[level] = size;
+		if (level == 0)
+		{
+			levels[0].assign(image, image + size_t(width) * height * channels);
+			return;
+		}
+		levels[level].resize(size_t(levelWidth) * levelHeight * channels);
+		mipmap_image(image, width, height, channels, levels[level].data(), 1 << level, 1 << level);
+	});
+}
+
+AssetPackBuilder::~AssetPackBuilder()
+{
+	if (jobs)
+		jobs->wait(baking);
+}
+
+bool AssetPackBuilder::addTexture(const char* name, const char* path, int channels, bool compress)
+{
+	pending.emplace_back();
+	Pending& texture = pending.back();
+	texture.entry = PackEntry();
+	strncpy(texture.entry.name, name, sizeof(texture.entry.name) - 1);
+	texture.entry.type = PACK_TEXTURE;
+
+	if (jobs)
+	{
+		std::string file(path);
+		jobs->run([this, &texture, file, channels, compress]
+		{
+			texture.failed = !bakeTexture(texture, file, channels, compress);
+		}, &baking);
+		return true;
+	}
+	if (!bakeTexture(texture, path, channels, compress))
+	{
+		pending.pop_back();
+		return false;
+	}
+	return true;
+}
+
+bool AssetPackBuilder::bakeTexture(Pending& texture, const std::string& path, int channels, bool compress)
+{
+	int width, height;
+	unsigned char* image = loadImage(path.c_str(), &width, &height, channels == 4 ? SOIL_LOAD_RGBA : SOIL_LOAD_RGB);
+	if (!image)
+		return false;
+
+	buildMipChain(image, width, height, channels, texture.blobs, texture.levels, jobs);
+	SOIL_free_image_data(image);
+
+	if (compress)
+	{
+		forEachLevel(jobs, texture.blobs.size(), [&texture, channels](size_t i)
+		{
+			int size = 0;
+			unsigned char* dxt = channels == 4 ?
+				convert_image_to_DXT5(texture.blobs[i].data(), texture.levels[i].width, texture.levels[i].height, channels, &size) :
+				convert_image_to_DXT1(texture.blobs[i].data(), texture.levels[i].width, texture.levels[i].height, channels, &size);
+			texture.blobs[i].assign(dxt, dxt + size);
+			free(dxt);
+		});
+		texture.entry.internalFormat = channels == 4 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		texture.entry.format = 0;
+	}
+	else
+	{
+		texture.entry.internalFormat = channels == 4 ? GL_RGBA8 : GL_RGB8;
+		texture.entry.format = channels == 4 ? GL_RGBA : GL_RGB;
+	}
+	texture.entry.levelCount = uint32_t(texture.levels.size());
+	return true;
+}
+
+void AssetPackBuilder::addShader(const char* name, const char* source)
+{
+	Pending shader;
+	shader.entry = PackEntry();
+	strncpy(shader.entry.name, name, sizeof(shader.entry.name) - 1);
+	shader.entry.type = PACK_SHADER;
+	shader.blobs.emplace_back(source, source + strlen(source) + 1);
+	shader.entry.size = shader.blobs[0].size();
+	pending.push_back(std::move(shader));
+}
+
+bool AssetPackBuilder::write(const char* path)
+{
+	if (jobs)
+		jobs->wait(baking);
+	for (const Pending& p : pending)
+		if (p.failed)
+			return false;
+
+	// Sorted so lookups can binary search the mapped table
+	std::sort(pending.begin(), pending.end(), [](const Pending& a, const Pending& b)
+	{
+		return strcmp(a.entry.name, b.entry.name) < 0;
+	});
+
+	std::vector<PackEntry> entries;
+	std::vector<PackLevel> levels;
+	for (const Pending& p : pending)
+	{
+		entries.push_back(p.entry);
+		if (p.entry.type == PACK_TEXTURE)
+		{
+			entries.back().firstLevel = uint32_t(levels.size());
+			levels.insert(levels.end(), p.levels.begin(), p.levels.end());
+		}
+	}
+
+	PackHeader header = {};
+	header.magic = PACK_MAGIC;
+	header.version = PACK_VERSION;
+	header.entryCount = uint32_t(entries.size());
+	header.levelCount = uint32_t(levels.size());
+	header.entriesOffset = alignTo(sizeof(PackHeader), 64);
+	header.levelsOffset = alignTo(header.entriesOffset + entries.size() * sizeof(PackEntry), 64);
+
+	// Lay out the blobs in entry order
+	uint64_t offset = header.levelsOffset + levels.size() * sizeof(PackLevel);
+	for (size_t i = 0; i < pending.size(); i++)
+	{
+		for (size_t j = 0; j < pending[i].blobs.size(); j++)
+		{
+			offset = alignTo(offset, 64);
+			if (entries[i].type == PACK_TEXTURE)
+			{
+				PackLevel& level = levels[entries[i].firstLevel + j];
+				level.offset = offset;
+				level.size = pending[i].blobs[j].size();
+			}
+			else
+				entries[i].offset = offset;
+			offset += pending[i].blobs[j].size();
+		}
+	}
+	header.fileSize = offset;
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+	fwrite(&header, sizeof(header), 1, file);
+	writeBlob(file, header.entriesOffset, entries.data(), entries.size() * sizeof(PackEntry));
+	writeBlob(file, header.levelsOffset, levels.data(), levels.size() * sizeof(PackLevel));
+	for (size_t i = 0; i < pending.size(); i++)
+	{
+		for (size_t j = 0; j < pending[i].blobs.size(); j++)
+		{
+			uint64_t blobOffset = entries[i].type == PACK_TEXTURE ? levels[entries[i].firstLevel + j].offset : entries[i].offset;
+			writeBlob(file, blobOffset, pending[i].blobs[j].data(), pending[i].blobs[j].size());
+		}
+	}
+	bool ok = ftell(file) == long(header.fileSize);
+	fclose(file);
+	return ok;
+}
+
+// Bytes GL reads for a level of the entry's format, 0 for formats packs don't hold
+static uint64_t levelBytes(const PackEntry& entry, uint32_t width, uint32_t height)
+{
+	uint64_t blocks = uint64_t((width + 3) / 4) * ((height + 3) / 4);
+	switch (entry.format ? entry.format : entry.internalFormat)
+	{
+	case GL_RGB: return uint64_t(width) * height * 3;
+	case GL_RGBA: return uint64_t(width) * height * 4;
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return blocks * 8;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return blocks * 16;
+	default: return 0;
+	}
+}
+
+bool AssetPack::open(const char* path)
+{
+	close();
+	if (!file.open(path))
+		return false;
+
+	const PackHeader* h = reinterpret_cast<const PackHeader*>(file.data());
+	const char* error = nullptr;
+	if (file.size() < sizeof(PackHeader) || h->magic != PACK_MAGIC)
+		error = "not an asset pack";
+	else if (h->version != PACK_VERSION)
+		error = "unsupported version";
+	else if (h->fileSize != file.size())
+		error = "truncated";
+	else if (h->entriesOffset > h->fileSize || uint64_t(h->entryCount) * sizeof(PackEntry) > h->fileSize - h->entriesOffset ||
+		h->levelsOffset > h->fileSize || uint64_t(h->levelCount) * sizeof(PackLevel) > h->fileSize - h->levelsOffset ||
+		(h->entriesOffset | h->levelsOffset) % 8)
+		error = "bad table of contents";
+
+	if (!error)
+	{
+		// Every blob has to lie inside the file before anything is handed to GL
+		const PackEntry* e = reinterpret_cast<const PackEntry*>(file.data() + h->entriesOffset);
+		const PackLevel* l = reinterpret_cast<const PackLevel*>(file.data() + h->levelsOffset);
+		for (uint32_t i = 0; i < h->entryCount && !error; i++)
+		{
+			if (e[i].type == PACK_TEXTURE)
+			{
+				if (uint64_t(e[i].firstLevel) + e[i].levelCount > h->levelCount)
+					error = "bad level range";
+				for (uint32_t j = 0; j < e[i].levelCount && !error; j++)
+				{
+					const PackLevel& level = l[e[i].firstLevel + j];
+					if (level.offset > h->fileSize || level.size > h->fileSize - level.offset)
+						error = "bad level offset";
+					// GL reads what the format and size say, whatever the level's size
+					else if (level.size != levelBytes(e[i], level.width, level.height))
+						error = "bad level size";
+				}
+			}
+			else if (e[i].offset > h->fileSize || e[i].size > h->fileSize - e[i].offset || e[i].size == 0 ||
+				file.data()[e[i].offset + e[i].size - 1] != 0)
+				error = "bad shader entry";
+		}
+	}
+
+	if (error)
+	{
+		fprintf(stderr, "%s: %s\n", path, error);
+		file.close();
+		return false;
+	}
+	header = h;
+	entries = reinterpret_cast<const PackEntry*>(file.data() + h->entriesOffset);
+	return true;
+}
+
+const PackEntry* AssetPack::find(const char* name) const
+{
+	if (!header)
+		return nullptr;
+	const PackEntry* end = entries + header->entryCount;
+	const PackEntry* it = std::lower_bound(entries, end, name, [](const PackEntry& entry, const char* key)
+	{
+		return strncmp(entry.name, key, sizeof(entry.name)) < 0;
+	});
+	if (it == end || strncmp(it->name, name, sizeof(it->name)) != 0)
+		return nullptr;
+	return it;
+}
+
+const PackLevel* AssetPack::levels(const PackEntry& entry) const
+{
+	return reinterpret_cast<const PackLevel*>(file.data() + header->levelsOffset) + entry.firstLevel;
+}
+
+bool AssetPack::uploadTexture(const char* name) const
+{
+	const PackEntry* entry = find(name);
+	if (!entry || entry->type != PACK_TEXTURE)
+		return false;
+
+	for (uint32_t i = 0; i < entry->levelCount; i++)
+		uploadLevel(*entry, i);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry->levelCount - 1);
+	return true;
+}
+
+void AssetPack::uploadLevel(const PackEntry& entry, uint32_t level) const
+{
+	const PackLevel& l = levels(entry)[level];
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (entry.format)
+		glTexImage2D(GL_TEXTURE_2D, level, entry.internalFormat, l.width, l.height, 0,
+			entry.format, GL_UNSIGNED_BYTE, data(l.offset));
+	else
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, entry.internalFormat, l.width, l.height, 0,
+			GLsizei(l.size), data(l.offset));
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	renderStats.add(RENDER_TEXTURE_UPLOADS);
+	renderStats.add(RENDER_TEXTURE_BYTES, l.size);
+}
+
+const char* AssetPack::shaderSource(const char* name) const
+{
+	const PackEntry* entry = find(name);
+	if (!entry || entry->type != PACK_SHADER)
+		return nullptr;
+	return reinterpret_cast<const char*>(data(entry->offset));
+}
+
+void benchmarkAssetPack()
+{
+	const char* packPath = "bench_assets.pak";
+	const char* textures[] = { "Textures/sample.png", "Textures/sample2.png" };
+
+	// Loose files: decode and build the mip chain the way a cold start would
+	auto t_start = std::chrono::high_resolution_clock::now();
+	size_t decodedBytes = 0;
+	for (const char* path : textures)
+	{
+		int width, height;
+		unsigned char* image = SOIL_load_image(path, &width, &height, 0, SOIL_LOAD_RGB);
+		if (!image)
+		{
+			printf("Could not load %s, run from the project directory\n", path);
+			return;
+		}
+		std::vector<std::vector<unsigned char>> levels;
+		std::vector<PackLevel> sizes;
+		buildMipChain(image, width, height, 3, levels, sizes);
+		for (const std::vector<unsigned char>& level : levels)
+			decodedBytes += level.size();
+		SOIL_free_image_data(image);
+	}
+	double looseSeconds = secondsSince(t_start);
+	printf("Loose files: decode + mips %.1f ms, %.1f KB of levels\n", looseSeconds * 1e3, decodedBytes / 1024.0);
+
+	JobSystem jobs;
+	for (int compress = 0; compress < 2; compress++)
+	{
+		// Baked once on this thread, then again with the textures, levels and
+		// compression spread over the job system
+		double bakeSeconds = 0.0, parallelBakeSeconds = 0.0;
+		bool written = true;
+		for (int parallel = 0; parallel < 2; parallel++)
+		{
+			AssetPackBuilder builder(parallel ? &jobs : nullptr);
+			t_start = std::chrono::high_resolution_clock::now();
+			for (const char* path : textures)
+				builder.addTexture(path, path, 3, compress != 0);
+			written = builder.write(packPath) && written;
+			(parallel ? parallelBakeSeconds : bakeSeconds) = secondsSince(t_start);
+		}
+		if (!written)
+		{
+			printf("Could not write the benchmark pack\n");
+			return;
+		}
+
+		// Pack: map, validate, then touch every page an upload would read
+		AssetPack pack;
+		t_start = std::chrono::high_resolution_clock::now();
+		bool opened = pack.open(packPath);
+		double openSeconds = secondsSince(t_start);
+		size_t packedBytes = 0;
+		unsigned checksum = 0;
+		t_start = std::chrono::high_resolution_clock::now();
+		for (const char* path : textures)
+		{
+			const PackEntry* entry = opened ? pack.find(path) : nullptr;
+			if (!entry)
+				continue;
+			const PackLevel* level = pack.levels(*entry);
+			for (uint32_t i = 0; i < entry->levelCount; i++)
+			{
+				const unsigned char* bytes = pack.data(level[i].offset);
+				for (uint64_t j = 0; j < level[i].size; j += 4096)
+					checksum += bytes[j];
+				packedBytes += size_t(level[i].size);
+			}
+		}
+		double touchSeconds = secondsSince(t_start);
+
+		printf("%s pack: baked in %.1f ms (%.1f ms on %u threads), %s, map %.3f ms + touch %.2f ms, %.1f KB of levels (checksum %u)\n",
+			compress ? "DXT1" : "RGB ", bakeSeconds * 1e3, parallelBakeSeconds * 1e3, jobs.workerCount() + 1, opened ? "ok" : "FAILED",
+			openSeconds * 1e3, touchSeconds * 1e3, packedBytes / 1024.0, checksum);
+		printf("           %.0fx faster than decoding loose files\n", looseSeconds / (openSeconds + touchSeconds));
+		pack.close();
+	}
+	remove(packPath);
+}
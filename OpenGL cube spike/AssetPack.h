@@ -0,0 +1,126 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "MappedFile.h"
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Asset pack layout, version 1. Every blob starts on a 64-byte boundary.
+//
+//   PackHeader
+//   PackEntry[entryCount]		sorted by name
+//   PackLevel[levelCount]		mip levels of all textures
+//   blobs						texture levels ready for glTexImage2D /
+//								glCompressedTexImage2D, NUL-terminated shader text
+
+const uint32_t PACK_MAGIC = 0x314B4150;	// "PAK1"
+const uint32_t PACK_VERSION = 1;
+
+enum PackEntryType
+{
+	PACK_TEXTURE = 1,
+	PACK_SHADER = 2
+};
+
+struct PackHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t levelCount;
+	uint64_t entriesOffset;
+	uint64_t levelsOffset;
+	uint64_t fileSize;
+};
+
+struct PackEntry
+{
+	char name[64];
+	uint32_t type;
+	uint32_t internalFormat;	// GL internal format for textures
+	uint32_t format;			// GL pixel format, 0 when compressed
+	uint32_t firstLevel;		// Index into the level table
+	uint32_t levelCount;
+	uint32_t padding;
+	uint64_t offset;			// Shader text
+	uint64_t size;				// Including the terminating NUL
+};
+
+struct PackLevel
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset;
+	uint64_t size;
+};
+
+static_assert(sizeof(PackHeader) == 40, "PackHeader layout is part of the file format");
+static_assert(sizeof(PackEntry) == 104, "PackEntry layout is part of the file format");
+static_assert(sizeof(PackLevel) == 24, "PackLevel layout is part of the file format");
+
+// SOIL_load_image that may be called from jobs. Each call keeps its error
+// in its own SOIL_context, so decodes run in parallel; failures are
+// reported on stderr.
+unsigned char* loadImage(const char* path, int* width, int* height, int forceChannels);
+
+// Offline side: decodes, mips and optionally DXT-compresses textures.
+// With a job system every texture is baked by its own job, which splits
+// mip generation and compression by level; write() waits for them.
+class AssetPackBuilder
+{
+public:
+	explicit AssetPackBuilder(JobSystem* jobs = nullptr) : jobs(jobs) {}
+	~AssetPackBuilder();
+
+	// channels: 3 or 4. compress: DXT1 for RGB, DXT5 for RGBA.
+	// Queued textures that fail to load make write() fail instead.
+	bool addTexture(const char* name, const char* path, int channels, bool compress);
+	void addShader(const char* name, const char* source);
+	bool write(const char* path);
+
+private:
+	struct Pending
+	{
+		PackEntry entry;
+		std::vector<PackLevel> levels;
+		std::vector<std::vector<unsigned char>> blobs;	// One per level, or the shader text
+		bool failed = false;
+	};
+
+	bool bakeTexture(Pending& texture, const std::string& path, int channels, bool compress);
+
+	JobSystem* jobs;
+	JobCounter baking;
+	std::deque<Pending> pending;	// Jobs hold references, which a deque keeps valid
+};
+
+// Runtime side: the archive is mapped and levels are uploaded straight
+// from the mapping, without decoding or copying
+class AssetPack
+{
+public:
+	bool open(const char* path);
+	void close() { file.close(); header = nullptr; }
+	bool isOpen() const { return header != nullptr; }
+
+	const PackEntry* find(const char* name) const;
+
+	// Upload every level into the texture bound to GL_TEXTURE_2D
+	bool uploadTexture(const char* name) const;
+	// Upload one level of a texture entry into the texture bound to GL_TEXTURE_2D
+	void uploadLevel(const PackEntry& entry, uint32_t level) const;
+	// NUL-terminated source living in the mapping, or nullptr
+	const char* shaderSource(const char* name) const;
+
+	const PackLevel* levels(const PackEntry& entry) const;
+	const unsigned char* data(uint64_t offset) const { return file.data() + offset; }
+
+private:
+	MappedFile file;
+	const PackHeader* header = nullptr;
+	const PackEntry* entries = nullptr;
+};
@@ -0,0 +1,121 @@
+#include "Benchmark.h"
+
+#include <cstdio>
+#include <cstring>
+
+// Benchmarks live next to the code they measure
+void benchmarkVoxelMeshing();
+void benchmarkClusteredLighting();
+void benchmarkSceneLoad();
+void benchmarkAssetPack();
+void benchmarkOcclusionCulling();
+void benchmarkFrameCapture();
+void benchmarkTransformHierarchy();
+void benchmarkJobSystem();
+void benchmarkTextureResidency();
+void benchmarkMeshImport();
+void benchmarkVirtualTexture();
+void benchmarkImageDecoding();
+void benchmarkImageBatch();
+void benchmarkTexturePrepare();
+void benchmarkTextureTransforms();
+void benchmarkMipPyramid();
+void benchmarkDXTThreads();
+void benchmarkDecodeArena();
+void benchmarkTextureCache();
+void benchmarkImageIndex();
+void benchmarkPNGSave();
+
+struct BenchmarkEntry
+{
+	const char* name;
+	const char* description;
+	void (*run)();
+};
+
+static const BenchmarkEntry benchmarks[] = {
+	{ "voxel-mesh", "Greedy meshing throughput and triangle reduction", benchmarkVoxelMeshing },
+	{ "light-binning", "Clustered light binning, sweeping the light count", benchmarkClusteredLighting },
+	{ "scene-load", "Memory-mapped binary scene vs JSON, 1M instances", benchmarkSceneLoad },
+	{ "asset-pack", "Mapped asset pack vs decoding loose textures", benchmarkAssetPack },
+	{ "occlusion", "Software occlusion culling, SIMD vs scalar raster and thread scaling", benchmarkOcclusionCulling },
+	{ "capture", "Background Y4M and TGA encoders fed at 60 fps", benchmarkFrameCapture },
+	{ "transforms", "Dirty transform propagation over a 1M node hierarchy", benchmarkTransformHierarchy },
+	{ "jobs", "Work-stealing scheduler scaling and per-job overhead", benchmarkJobSystem },
+	{ "residency", "Mip streaming under a texture budget, camera sweeping 32 textures", benchmarkTextureResidency },
+	{ "mesh-import", "OBJ/glTF parsing throughput and warm loads from the mapped mesh cache", benchmarkMeshImport },
+	{ "virtual-texture", "Virtual texture paging: 8K build, flight over the plane, page hit rate and uploads", benchmarkVirtualTexture },
+	{ "image-threads", "Parallel SOIL decodes of every sample format against serial ones, with per-thread errors", benchmarkImageDecoding },
+	{ "image-batch", "Batch decoding of the SOIL samples on the job system vs one file after another", benchmarkImageBatch },
+	{ "texture-prepare", "SOIL texture preparation without a GL context, serial and on the job system", benchmarkTexturePrepare },
+	{ "texture-transforms", "SOIL load-time flags on 4K and 8K images, fused SIMD rows vs a pass per flag", benchmarkTextureTransforms },
+	{ "mip-pyramid", "MIP chains in one buffer with SIMD box, Kaiser, Lanczos and linear light vs SOIL's old levels", benchmarkMipPyramid },
+	{ "dxt-threads", "DXT compression of a whole MIP chain over 1 to 64 threads, byte-identical to serial", benchmarkDXTThreads },
+	{ "decode-arena", "Allocations per decode, and decoding out of a preallocated arena into a caller's buffer", benchmarkDecodeArena },
+	{ "texture-cache", "Processed SOIL textures cached on disk by content hash: first launch, cached launch and LRU eviction", benchmarkTextureCache },
+	{ "image-index", "Header-only metadata of 2000 images on the job system against full decodes, and incremental rescans", benchmarkImageIndex },
+	{ "png-save", "SOIL's PNG writer at each level against TGA on the samples, and a 1080p capture on the job system", benchmarkPNGSave },
+};
+
+bool runBenchmarks(int argc, char *argv[])
+{
+	if (argc < 2 || strcmp(argv[1], "--bench") != 0)
+		return false;
+
+	const char* name = argc > 2 ? argv[2] : "all";
+	bool found = false;
+	for (const BenchmarkEntry& entry : benchmarks)
+	{
+		if (strcmp(name, "all") != 0 && strcmp(name, entry.name) != 0)
+			continue;
+		printf("== %s: %s\n", entry.name, entry.description);
+		entry.run();
+		found = true;
+	}
+
+	if (!found)
+	{
+		printf("Unknown benchmark '%s'. Available:\n", name);
+		for (const BenchmarkEntry& entry : benchmarks)
+			printf("  %-16s %s\n", entry.name, entry.description);
+	}
+	return true;
+}
+
+static const char* const SOIL_SAMPLES = "../deps/Simple OpenGL Image Library/";
+
+std::vector<std::string> sampleImagePaths()
+{
+	std::vector<std::string> paths = { "Textures/sample.png", "Textures/sample2.png" };
+	const char* samples[] = { "img_test.png", "img_test.bmp", "img_test.tga", "img_test_indexed.tga",
+		"img_test.dds", "field_128_cube.dds", "img_cheryl.jpg", "test_rect.png" };
+	for (const char* sample : samples)
+		paths.push_back(std::string(SOIL_SAMPLES) + sample);
+	return paths;
+}
+
+std::vector<std::string> sampleTexturePaths()
+{
+	return { "Textures/sample.png", "Textures/sample2.png",
+		std::string(SOIL_SAMPLES) + "img_cheryl.jpg", std::string(SOIL_SAMPLES) + "test_rect.png" };
+}
+
+bool readSampleImages(const std::vector<std::string>& paths, std::vector<std::vector<unsigned char>>& files)
+{
+	files.clear();
+	for (const std::string& path : paths)
+	{
+		FILE* file = fopen(path.c_str(), "rb");
+		if (!file)
+		{
+			printf("Could not open %s, run from the project directory\n", path.c_str());
+			return false;
+		}
+		fseek(file, 0, SEEK_END);
+		files.emplace_back(size_t(ftell(file)));
+		fseek(file, 0, SEEK_SET);
+		files.back().resize(fread(files.back().data(), 1, files.back().size(), file));
+		fclose(file);
+	}
+	return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Headless benchmarks, run with "--bench <name>" (or "--bench all")
+// before any window or GL context is created.
+// Returns true if the command line asked for a benchmark.
+bool runBenchmarks(int argc, char *argv[]);
+
+// Seconds elapsed since start
+inline double secondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+	auto now = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration_cast<std::chrono::duration<double>>(now - start).count();
+}
+
+// The cube's textures, then the SOIL samples with one of every format it
+// decodes. Paths are relative to the project directory, which benchmarks
+// run from; the first is always a PNG.
+std::vector<std::string> sampleImagePaths();
+
+// The cube's textures and the photographic SOIL samples, for benchmarks
+// that want texture-sized images rather than every format
+std::vector<std::string> sampleTexturePaths();
+
+// Reads each file whole. On failure says which one is missing and returns false.
+bool readSampleImages(const std::vector<std::string>& paths, std::vector<std::vector<unsigned char>>& files);
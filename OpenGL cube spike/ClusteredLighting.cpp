@@ -0,0 +1,284 @@
+#include "ClusteredLighting.h"
+#include "Benchmark.h"
+#include "RenderStats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <glm/gtc/matrix_transform.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define CLUSTER_SSE 1
+#endif
+
+const GLchar* clusteredLightingSource =
+"uniform samplerBuffer lightData;"
+"uniform usamplerBuffer clusterRanges;"
+"uniform usamplerBuffer lightIndices;"
+"uniform uvec3 clusterGrid;"
+"uniform vec2 tileSize;"
+"uniform vec2 sliceParams;"
+"vec3 clusteredLighting(vec3 viewPos, vec3 normal, vec3 albedo) {"
+"	uint slice = uint(max(log(-viewPos.z) * sliceParams.x - sliceParams.y, 0.0));"
+"	uvec2 tile = min(uvec2(gl_FragCoord.xy / tileSize), clusterGrid.xy - 1u);"
+"	uint cluster = tile.x + clusterGrid.x * (tile.y + clusterGrid.y * min(slice, clusterGrid.z - 1u));"
+"	uvec2 range = texelFetch(clusterRanges, int(cluster)).xy;"
+"	vec3 result = vec3(0.0);"
+"	for (uint i = 0u; i < range.y; i++) {"
+"		int light = int(texelFetch(lightIndices, int(range.x + i)).x);"
+"		vec4 positionRadius = texelFetch(lightData, light * 2);"
+"		vec3 color = texelFetch(lightData, light * 2 + 1).rgb;"
+"		vec3 toLight = positionRadius.xyz - viewPos;"
+"		float distance = length(toLight);"
+"		float falloff = max(1.0 - distance / positionRadius.w, 0.0);"
+"		result += color * albedo * max(dot(normal, toLight / distance), 0.0) * falloff * falloff;"
+"	}"
+"	return result;"
+"}";
+
+ClusteredLighting::ClusteredLighting(int tilesX, int tilesY, int slices)
+	: tilesX(tilesX), tilesY(tilesY), slices(slices)
+{
+	tilesPerSlice = (tilesX * tilesY + 3) & ~3;
+}
+
+ClusteredLighting::~ClusteredLighting()
+{
+	// GL objects only exist once upload() ran, headless users never create them
+	if (buffers[0])
+	{
+		glDeleteTextures(3, textures);
+		glDeleteBuffers(3, buffers);
+	}
+}
+
+void ClusteredLighting::buildClusters(const glm::mat4& proj, int width, int height)
+{
+	if (proj == clusterProj && width == viewportWidth && height == viewportHeight)
+		return;
+	clusterProj = proj;
+	viewportWidth = width;
+	viewportHeight = height;
+
+	// Recover the clip distances of a standard perspective projection
+	zNear = proj[3][2] / (proj[2][2] - 1.0f);
+	zFar = proj[3][2] / (proj[2][2] + 1.0f);
+
+	size_t count = size_t(tilesPerSlice) * slices;
+	// Padding lanes get inverted boxes that no light can touch
+	minX.assign(count, 1e30f); minY.assign(count, 1e30f); minZ.assign(count, 1e30f);
+	maxX.assign(count, -1e30f); maxY.assign(count, -1e30f); maxZ.assign(count, -1e30f);
+
+	glm::mat4 invProj = glm::inverse(proj);
+	for (int k = 0; k < slices; k++)
+	{
+		float sliceNear = zNear * std::pow(zFar / zNear, float(k) / slices);
+		float sliceFar = zNear * std::pow(zFar / zNear, float(k + 1) / slices);
+
+		for (int y = 0; y < tilesY; y++)
+		{
+			for (int x = 0; x < tilesX; x++)
+			{
+				glm::vec3 lo(1e30f), hi(-1e30f);
+				for (int corner = 0; corner < 4; corner++)
+				{
+					float ndcX = -1.0f + 2.0f * (x + (corner & 1)) / tilesX;
+					float ndcY = -1.0f + 2.0f * (y + (corner >> 1)) / tilesY;
+					glm::vec4 p = invProj * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+					glm::vec3 ray = glm::vec3(p) / p.w;
+					ray /= -ray.z;	// Point at view depth 1
+					lo = glm::min(lo, glm::min(ray * sliceNear, ray * sliceFar));
+					hi = glm::max(hi, glm::max(ray * sliceNear, ray * sliceFar));
+				}
+				size_t i = size_t(k) * tilesPerSlice + x + y * tilesX;
+				minX[i] = lo.x; minY[i] = lo.y; minZ[i] = lo.z;
+				maxX[i] = hi.x; maxY[i] = hi.y; maxZ[i] = hi.z;
+			}
+		}
+	}
+}
+
+void ClusteredLighting::binLights(const std::vector<PointLight>& lights, const glm::mat4& view, bool simd)
+{
+	auto t_start = std::chrono::high_resolution_clock::now();
+
+	lightData.resize(std::max<size_t>(1, lights.size() * 2));
+	pairClusters.clear();
+	pairLights.clear();
+
+	float logDepthRange = std::log(zFar / zNear);
+	auto sliceOf = [&](float depth)
+	{
+		int slice = int(std::log(depth / zNear) / logDepthRange * slices);
+		return std::min(std::max(slice, 0), slices - 1);
+	};
+
+	for (uint32_t l = 0; l < lights.size(); l++)
+	{
+		const PointLight& light = lights[l];
+		glm::vec3 c = glm::vec3(view * glm::vec4(light.position, 1.0f));
+		float r = light.radius;
+		lightData[l * 2] = glm::vec4(c, r);
+		lightData[l * 2 + 1] = glm::vec4(light.color * light.intensity, 0.0f);
+
+		float depth = -c.z;
+		if (depth + r < zNear || depth - r > zFar)
+			continue;
+		int firstSlice = sliceOf(std::max(depth - r, zNear));
+		int lastSlice = sliceOf(std::min(depth + r, zFar));
+
+		for (int k = firstSlice; k <= lastSlice; k++)
+		{
+			size_t base = size_t(k) * tilesPerSlice;
+#ifdef CLUSTER_SSE
+			if (simd)
+			{
+				__m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z);
+				__m128 r2 = _mm_set1_ps(r * r);
+				__m128 zero = _mm_setzero_ps();
+				for (int t = 0; t < tilesPerSlice; t += 4)
+				{
+					size_t i = base + t;
+					// Distance from the sphere centre to each box, 4 boxes at a time
+					__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[i]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&maxX[i]))), zero);
+					__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY[i]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&maxY[i]))), zero);
+					__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minZ[i]), cz), _mm_sub_ps(cz, _mm_loadu_ps(&maxZ[i]))), zero);
+					__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+					int hits = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+					while (hits)
+					{
+						int lane = 0;
+						while (!(hits & (1 << lane)))
+							lane++;
+						hits &= hits - 1;
+						pairClusters.push_back(uint32_t(k * tilesX * tilesY + t + lane));
+						pairLights.push_back(l);
+					}
+				}
+				continue;
+			}
+#endif
+			for (int t = 0; t < tilesX * tilesY; t++)
+			{
+				size_t i = base + t;
+				float dx = std::max(std::max(minX[i] - c.x, c.x - maxX[i]), 0.0f);
+				float dy = std::max(std::max(minY[i] - c.y, c.y - maxY[i]), 0.0f);
+				float dz = std::max(std::max(minZ[i] - c.z, c.z - maxZ[i]), 0.0f);
+				if (dx * dx + dy * dy + dz * dz <= r * r)
+				{
+					pairClusters.push_back(uint32_t(k * tilesX * tilesY + t));
+					pairLights.push_back(l);
+				}
+			}
+		}
+	}
+
+	// Counting sort of the (cluster, light) pairs into per-cluster lists
+	int count = clusterCount();
+	clusterRanges.assign(size_t(count) * 2, 0);
+	for (uint32_t cluster : pairClusters)
+		clusterRanges[cluster * 2 + 1]++;
+	GLuint offset = 0;
+	maxPerCluster = 0;
+	for (int i = 0; i < count; i++)
+	{
+		clusterRanges[i * 2] = offset;
+		offset += clusterRanges[i * 2 + 1];
+		maxPerCluster = std::max(maxPerCluster, clusterRanges[i * 2 + 1]);
+		clusterRanges[i * 2 + 1] = 0;
+	}
+	lightIndices.resize(std::max<size_t>(1, pairLights.size()));
+	for (size_t p = 0; p < pairLights.size(); p++)
+	{
+		GLuint* range = &clusterRanges[pairClusters[p] * 2];
+		lightIndices[range[0] + range[1]++] = pairLights[p];
+	}
+
+	binSeconds = secondsSince(t_start);
+}
+
+void ClusteredLighting::upload()
+{
+	if (!buffers[0])
+	{
+		glGenBuffers(3, buffers);
+		glGenTextures(3, textures);
+	}
+
+	const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+	const void* data[3] = { lightData.data(), clusterRanges.data(), lightIndices.data() };
+	const size_t sizes[3] = {
+		lightData.size() * sizeof(glm::vec4),
+		clusterRanges.size() * sizeof(GLuint),
+		lightIndices.size() * sizeof(GLuint)
+	};
+	for (int i = 0; i < 3; i++)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, sizes[i], data[i], GL_STREAM_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+		renderStats.add(RENDER_BUFFER_BYTES, sizes[i]);
+		renderStats.add(RENDER_TEXTURE_BINDS);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void ClusteredLighting::bind(GLuint program, GLint firstUnit)
+{
+	const char* samplers[3] = { "lightData", "clusterRanges", "lightIndices" };
+	for (int i = 0; i < 3; i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+		glUniform1i(glGetUniformLocation(program, samplers[i]), firstUnit + i);
+	}
+	renderStats.add(RENDER_TEXTURE_BINDS, 3);
+
+	float logDepthRange = std::log(zFar / zNear);
+	glUniform3ui(glGetUniformLocation(program, "clusterGrid"), tilesX, tilesY, slices);
+	glUniform2f(glGetUniformLocation(program, "tileSize"), float(viewportWidth) / tilesX, float(viewportHeight) / tilesY);
+	glUniform2f(glGetUniformLocation(program, "sliceParams"), slices / logDepthRange, slices * std::log(zNear) / logDepthRange);
+	renderStats.add(RENDER_UNIFORM_BYTES, 3 * sizeof(GLint) + 3 * sizeof(GLuint) + 4 * sizeof(float));
+}
+
+void benchmarkClusteredLighting()
+{
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, -10.0f, 5.0f), glm::vec3(0.0f, 20.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), 1920.0f / 1080.0f, 0.5f, 200.0f);
+
+	ClusteredLighting clusters;
+	auto t_start = std::chrono::high_resolution_clock::now();
+	clusters.buildClusters(proj, 1920, 1080);
+	printf("%d froxels built in %.2f ms\n", clusters.clusterCount(), secondsSince(t_start) * 1e3);
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	for (int count = 256; count <= 65536; count *= 4)
+	{
+		std::vector<PointLight> lights(count);
+		for (PointLight& light : lights)
+		{
+			light.position = glm::vec3(unit(rng) * 80.0f - 40.0f, unit(rng) * 160.0f, unit(rng) * 10.0f);
+			light.radius = 1.0f + unit(rng) * 4.0f;
+			light.color = glm::vec3(unit(rng), unit(rng), unit(rng));
+			light.intensity = 1.0f;
+		}
+
+		const int iterations = 10;
+		double seconds[2];
+		for (int simd = 0; simd < 2; simd++)
+		{
+			clusters.binLights(lights, view, simd != 0);	// Warm up
+			t_start = std::chrono::high_resolution_clock::now();
+			for (int i = 0; i < iterations; i++)
+				clusters.binLights(lights, view, simd != 0);
+			seconds[simd] = secondsSince(t_start) / iterations;
+		}
+		printf("%6d lights: scalar %7.3f ms, SIMD %7.3f ms (%.1fx), %zu indices, avg %.1f / max %u lights per cluster\n",
+			count, seconds[0] * 1e3, seconds[1] * 1e3, seconds[0] / seconds[1], clusters.indexCount(),
+			double(clusters.indexCount()) / clusters.clusterCount(), clusters.maxLightsPerCluster());
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+struct PointLight
+{
+	glm::vec3 position;	// World space
+	float radius;		// Light has no effect beyond this distance
+	glm::vec3 color;
+	float intensity;
+};
+
+// GLSL providing vec3 clusteredLighting(vec3 viewPos, vec3 normal, vec3 albedo).
+// Paste it after the #version line of a fragment shader.
+extern const GLchar* clusteredLightingSource;
+
+// Clustered forward shading. The view frustum is split into screen tiles
+// and exponential depth slices (froxels); every frame lights are binned
+// into the froxels they touch and the per-cluster light lists are uploaded
+// into texture buffers that the fragment shader walks.
+class ClusteredLighting
+{
+public:
+	ClusteredLighting(int tilesX = 16, int tilesY = 9, int slices = 24);
+	~ClusteredLighting();
+
+	// Rebuild froxel bounds in view space; cheap when proj did not change
+	void buildClusters(const glm::mat4& proj, int viewportWidth, int viewportHeight);
+	// Bin lights into froxels. simd = false runs the scalar reference path.
+	void binLights(const std::vector<PointLight>& lights, const glm::mat4& view, bool simd = true);
+
+	// Upload the last binning and bind it to program, using three texture
+	// units starting at firstUnit
+	void upload();
+	void bind(GLuint program, GLint firstUnit);
+
+	int clusterCount() const { return tilesX * tilesY * slices; }
+	size_t indexCount() const { return lightIndices.size(); }
+	uint32_t maxLightsPerCluster() const { return maxPerCluster; }
+	double lastBinSeconds() const { return binSeconds; }
+
+private:
+	int tilesX, tilesY, slices;
+	int tilesPerSlice;		// tilesX * tilesY rounded up to a multiple of 4
+	int viewportWidth = 0, viewportHeight = 0;
+	glm::mat4 clusterProj;
+	float zNear = 0.0f, zFar = 0.0f;
+
+	// Froxel AABBs in view space, structure-of-arrays for 4-wide tests
+	std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+
+	// Binning output: 2 texels per light, (offset, count) per cluster, light indices
+	std::vector<glm::vec4> lightData;
+	std::vector<GLuint> clusterRanges;
+	std::vector<GLuint> lightIndices;
+	std::vector<uint32_t> pairClusters, pairLights;
+	uint32_t maxPerCluster = 0;
+	double binSeconds = 0.0;
+
+	GLuint buffers[3] = { 0, 0, 0 };
+	GLuint textures[3] = { 0, 0, 0 };
+};
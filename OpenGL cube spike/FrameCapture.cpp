@@ -0,0 +1,456 @@
+#include "FrameCapture.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cstring>
+#include <SOIL/SOIL.h>
+
+// Full range BT.601, the C420jpeg colour space Y4M players expect.
+// GL rows are bottom-up, so the output is flipped on the way.
+static void rgbaToI420(const unsigned char* rgba, int width, int height, unsigned char* yuv)
+{
+	int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+	unsigned char* planeY = yuv;
+	unsigned char* planeU = planeY + size_t(width) * height;
+	unsigned char* planeV = planeU + size_t(chromaWidth) * chromaHeight;
+
+	for (int y = 0; y < height; y++)
+	{
+		const unsigned char* src = rgba + size_t(height - 1 - y) * width * 4;
+		unsigned char* dst = planeY + size_t(y) * width;
+		for (int x = 0; x < width; x++, src += 4)
+			dst[x] = (unsigned char)((77 * src[0] + 150 * src[1] + 29 * src[2] + 128) >> 8);
+	}
+
+	for (int cy = 0; cy < chromaHeight; cy++)
+	{
+		const unsigned char* row0 = rgba + size_t(height - 1 - cy * 2) * width * 4;
+		const unsigned char* row1 = rgba + size_t(std::max(height - 2 - cy * 2, 0)) * width * 4;
+		for (int cx = 0; cx < chromaWidth; cx++)
+		{
+			int x0 = cx * 2 * 4, x1 = std::min(cx * 2 + 1, width - 1) * 4;
+			int r = row0[x0] + row0[x1] + row1[x0] + row1[x1];
+			int g = row0[x0 + 1] + row0[x1 + 1] + row1[x0 + 1] + row1[x1 + 1];
+			int b = row0[x0 + 2] + row0[x1 + 2] + row1[x0 + 2] + row1[x1 + 2];
+			// Sums of four pixels, hence the extra shift by 2
+			int u = (-43 * r - 85 * g + 128 * b + (32896 << 2)) >> 10;
+			int v = (128 * r - 107 * g - 21 * b + (32896 << 2)) >> 10;
+			planeU[size_t(cy) * chromaWidth + cx] = (unsigned char)std::min(u, 255);
+			planeV[size_t(cy) * chromaWidth + cx] = (unsigned char)std::min(v, 255);
+		}
+	}
+}
+
+// Uncompressed 32-bit TGA in one write. TGA rows are bottom-up like GL's,
+// so only the channel order changes; SOIL's writer goes pixel by pixel.
+static bool writeTga(const char* path, const unsigned char* rgba, int width, int height)
+{
+	std::vector<unsigned char> bytes(18 + size_t(width) * height * 4);
+	unsigned char* header = bytes.data();
+	header[2] = 2;	// Uncompressed true colour
+	header[12] = (unsigned char)(width & 0xFF);
+	header[13] = (unsigned char)(width >> 8);
+	header[14] = (unsigned char)(height & 0xFF);
+	header[15] = (unsigned char)(height >> 8);
+	header[16] = 32;
+	header[17] = 8;	// Alpha bits, bottom-left origin
+	unsigned char* bgra = header + 18;
+	for (size_t i = 0; i < size_t(width) * height * 4; i += 4)
+	{
+		bgra[i] = rgba[i + 2];
+		bgra[i + 1] = rgba[i + 1];
+		bgra[i + 2] = rgba[i];
+		bgra[i + 3] = rgba[i + 3];
+	}
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+	bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+	fclose(file);
+	return ok;
+}
+
+static bool endsWith(const std::string& text, const char* suffix)
+{
+	size_t length = strlen(suffix);
+	return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+CaptureEncoder::CaptureEncoder(const char* path, CaptureFormat format, int width, int height, int fps,
+	unsigned threadCount, size_t maxFrames)
+	: format(format), path(path ? path : ""), width(width), height(height)
+{
+	if (format == CAPTURE_Y4M)
+	{
+		file = fopen(path, "wb");
+		if (!file)
+			return;
+		fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+	}
+
+	// Buffers are allocated on demand, up to maxFrames
+	buffers.reserve(maxFrames);
+	if (threadCount == 0)
+		threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+	for (unsigned i = 0; i < threadCount; i++)
+		workers.emplace_back(&CaptureEncoder::workerLoop, this);
+}
+
+CaptureEncoder::~CaptureEncoder()
+{
+	finish();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+	if (file)
+		fclose(file);
+}
+
+unsigned char* CaptureEncoder::acquire()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!isOpen())
+		return nullptr;
+	if (freeBuffers.empty())
+	{
+		if (buffers.size() == buffers.capacity())
+		{
+			counters.framesDropped++;
+			return nullptr;
+		}
+		buffers.emplace_back(new unsigned char[size_t(width) * height * 4]);
+		freeBuffers.push_back(buffers.back().get());
+	}
+	unsigned char* pixels = freeBuffers.back();
+	freeBuffers.pop_back();
+	return pixels;
+}
+
+void CaptureEncoder::submit(unsigned char* pixels, const char* path)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Job job;
+		job.index = nextIndex++;
+		job.pixels = pixels;
+		if (path)
+			job.path = path;
+		jobs.push_back(std::move(job));
+		inFlight++;
+		counters.framesSubmitted++;
+		counters.peakQueued = std::max(counters.peakQueued, inFlight);
+	}
+	wake.notify_one();
+}
+
+void CaptureEncoder::finish()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this] { return inFlight == 0; });
+}
+
+CaptureStats CaptureEncoder::stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return counters;
+}
+
+void CaptureEncoder::workerLoop()
+{
+	while (true)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (jobs.empty())
+				return;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+
+		auto t_start = std::chrono::high_resolution_clock::now();
+		encode(job);
+		double seconds = secondsSince(t_start);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		counters.framesEncoded++;
+		counters.encodeSeconds += seconds;
+		freeBuffers.push_back(job.pixels);
+		if (--inFlight == 0)
+			idle.notify_all();
+	}
+}
+
+void CaptureEncoder::encode(const Job& job)
+{
+	if (format == CAPTURE_Y4M)
+	{
+		std::vector<unsigned char> yuv(size_t(width) * height + 2 * size_t((width + 1) / 2) * ((height + 1) / 2));
+		rgbaToI420(job.pixels, width, height, yuv.data());
+		writeInOrder(job.index, yuv);
+		return;
+	}
+
+	std::string target = job.path;
+	if (format == CAPTURE_TGA)
+	{
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), "_%06llu.tga", (unsigned long long)job.index);
+		target = path + suffix;
+	}
+
+	bool written;
+	if (endsWith(target, ".bmp") || endsWith(target, ".png"))
+	{
+		// SOIL writes top-down images
+		size_t rowBytes = size_t(width) * 4;
+		std::vector<unsigned char> flipped(rowBytes * height);
+		for (int y = 0; y < height; y++)
+			memcpy(flipped.data() + y * rowBytes, job.pixels + (height - 1 - y) * rowBytes, rowBytes);
+		if (endsWith(target, ".png"))
+			written = SOIL_save_image_PNG(target.c_str(), width, height, 4, flipped.data(), SOIL_PNG_FASTEST) != 0;
+		else
+			written = SOIL_save_image(target.c_str(), SOIL_SAVE_TYPE_BMP, width, height, 4, flipped.data()) != 0;
+	}
+	else
+		written = writeTga(target.c_str(), job.pixels, width, height);
+	if (!written)
+		fprintf(stderr, "Could not write %s\n", target.c_str());
+}
+
+void CaptureEncoder::writeInOrder(uint64_t index, std::vector<unsigned char>& yuv)
+{
+	std::lock_guard<std::mutex> lock(writeMutex);
+	reorder[index].swap(yuv);
+	while (!reorder.empty() && reorder.begin()->first == nextWrite)
+	{
+		const std::vector<unsigned char>& frame = reorder.begin()->second;
+		fputs("FRAME\n", file);
+		fwrite(frame.data(), 1, frame.size(), file);
+		reorder.erase(reorder.begin());
+		nextWrite++;
+	}
+}
+
+FrameCapture::FrameCapture(int width, int height, int ringSize)
+	: width(width), height(height), ring(std::max(ringSize, 2))
+{
+}
+
+FrameCapture::~FrameCapture()
+{
+	stopRecording();
+	drain();
+	for (Slot& slot : ring)
+		if (slot.pbo)
+			glDeleteBuffers(1, &slot.pbo);
+}
+
+bool FrameCapture::startRecording(const char* path, int fps)
+{
+	stopRecording();
+	CaptureFormat format = endsWith(path, ".y4m") ? CAPTURE_Y4M : CAPTURE_TGA;
+	recorder.reset(new CaptureEncoder(path, format, width, height, fps));
+	if (!recorder->isOpen())
+	{
+		recorder.reset();
+		return false;
+	}
+	return true;
+}
+
+void FrameCapture::stopRecording()
+{
+	if (!recorder)
+		return;
+	drain();
+	recorder->finish();
+	CaptureStats stats = recorder->stats();
+	recorded.framesSubmitted += stats.framesSubmitted;
+	recorded.framesEncoded += stats.framesEncoded;
+	recorded.framesDropped += stats.framesDropped;
+	recorded.encodeSeconds += stats.encodeSeconds;
+	recorded.peakQueued = std::max(recorded.peakQueued, stats.peakQueued);
+	recorder.reset();
+}
+
+void FrameCapture::screenshot(const char* path)
+{
+	pendingScreenshot = path;
+}
+
+void FrameCapture::resolve(Slot& slot, bool wait)
+{
+	if (wait)
+	{
+		auto t_wait = std::chrono::high_resolution_clock::now();
+		glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+		stallSeconds += secondsSince(t_wait);
+		stalls++;
+	}
+	glDeleteSync(slot.fence);
+	slot.fence = 0;
+
+	auto t_start = std::chrono::high_resolution_clock::now();
+	size_t size = size_t(width) * height * 4;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	if (data)
+	{
+		unsigned char* frame;
+		if (slot.record && recorder && (frame = recorder->acquire()) != nullptr)
+		{
+			memcpy(frame, data, size);
+			recorder->submit(frame);
+		}
+		if (!slot.screenshot.empty())
+		{
+			if (!screenshots)
+				screenshots.reset(new CaptureEncoder(nullptr, CAPTURE_SCREENSHOTS, width, height, 0, 1, 2));
+			if ((frame = screenshots->acquire()) != nullptr)
+			{
+				memcpy(frame, data, size);
+				screenshots->submit(frame, slot.screenshot.c_str());
+			}
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	readbackSeconds += secondsSince(t_start);
+	framesRead++;
+
+	slot.record = false;
+	slot.screenshot.clear();
+}
+
+void FrameCapture::drain()
+{
+	for (size_t i = 0; i < ring.size(); i++)
+	{
+		Slot& slot = ring[(head + i) % ring.size()];
+		if (slot.fence)
+			resolve(slot, true);
+	}
+}
+
+void FrameCapture::capture()
+{
+	// Map whatever the GPU has finished, oldest first so frames stay in order
+	for (size_t i = 0; i < ring.size(); i++)
+	{
+		Slot& slot = ring[(head + i) % ring.size()];
+		if (!slot.fence)
+			continue;
+		GLenum state = glClientWaitSync(slot.fence, 0, 0);
+		if (state != GL_ALREADY_SIGNALED && state != GL_CONDITION_SATISFIED)
+			break;
+		resolve(slot, false);
+	}
+
+	if (!recorder && pendingScreenshot.empty())
+		return;
+
+	// The ring is full when the GPU is more than ringSize frames behind
+	Slot& slot = ring[head];
+	if (slot.fence)
+		resolve(slot, true);
+	if (!slot.pbo)
+	{
+		glGenBuffers(1, &slot.pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, size_t(width) * height * 4, nullptr, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.record = recorder != nullptr;
+	slot.screenshot.swap(pendingScreenshot);
+	pendingScreenshot.clear();
+	head = (head + 1) % ring.size();
+}
+
+void FrameCapture::printStats() const
+{
+	if (!framesRead)
+		return;
+	CaptureStats stats = recorded;
+	if (recorder)
+	{
+		CaptureStats active = recorder->stats();
+		stats.framesSubmitted += active.framesSubmitted;
+		stats.framesEncoded += active.framesEncoded;
+		stats.framesDropped += active.framesDropped;
+		stats.encodeSeconds += active.encodeSeconds;
+	}
+	printf("Capture: %llu frames read back, %.3f ms map + copy per frame, %llu fence stalls (%.2f ms total)\n",
+		(unsigned long long)framesRead, readbackSeconds * 1e3 / framesRead,
+		(unsigned long long)stalls, stallSeconds * 1e3);
+	if (stats.framesSubmitted || stats.framesDropped)
+		printf("         %llu frames recorded, %llu dropped, %.2f ms encode per frame, at most %zu queued\n",
+			(unsigned long long)stats.framesEncoded, (unsigned long long)stats.framesDropped,
+			stats.framesEncoded ? stats.encodeSeconds * 1e3 / stats.framesEncoded : 0.0, stats.peakQueued);
+}
+
+void benchmarkFrameCapture()
+{
+	// Encoders fed at 60 Hz, as the render loop would; drops mean they fell behind
+	const int width = 1280, height = 720, frames = 90;
+	std::vector<unsigned char> source(size_t(width) * height * 4);
+	for (size_t i = 0; i < source.size(); i++)
+		source[i] = (unsigned char)((i * 2654435761u) >> 24);
+
+	std::vector<unsigned> threadCounts(1, 1);
+	if (std::thread::hardware_concurrency() > 2)
+		threadCounts.push_back(std::thread::hardware_concurrency() - 1);
+
+	const CaptureFormat formats[] = { CAPTURE_Y4M, CAPTURE_TGA };
+	for (CaptureFormat format : formats)
+	{
+		const char* path = format == CAPTURE_Y4M ? "bench_capture.y4m" : "bench_capture";
+		for (unsigned threads : threadCounts)
+		{
+			CaptureStats stats;
+			double seconds;
+			{
+				CaptureEncoder encoder(path, format, width, height, 60, threads);
+				auto t_start = std::chrono::high_resolution_clock::now();
+				for (int f = 0; f < frames; f++)
+				{
+					if (unsigned char* frame = encoder.acquire())
+					{
+						memcpy(frame, source.data(), source.size());
+						encoder.submit(frame);
+					}
+					std::this_thread::sleep_until(t_start + std::chrono::microseconds((f + 1) * 16667));
+				}
+				encoder.finish();
+				seconds = secondsSince(t_start);
+				stats = encoder.stats();
+			}
+			double perFrame = stats.framesEncoded ? stats.encodeSeconds / stats.framesEncoded : 0.0;
+			printf("%s, %u thread%s: %.2f ms per frame, capacity %.0f fps, %llu of %d dropped at 60 fps, peak queue %zu, %.2f s\n",
+				format == CAPTURE_Y4M ? "Y4M" : "TGA", threads, threads > 1 ? "s" : " ", perFrame * 1e3,
+				perFrame > 0.0 ? threads / perFrame : 0.0, (unsigned long long)stats.framesDropped, frames,
+				stats.peakQueued, seconds);
+		}
+
+		if (format == CAPTURE_Y4M)
+			remove(path);
+		else
+		{
+			for (int f = 0; f < frames; f++)
+			{
+				char name[64];
+				snprintf(name, sizeof(name), "%s_%06d.tga", path, f);
+				remove(name);
+			}
+		}
+	}
+}
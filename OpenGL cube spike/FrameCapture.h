@@ -0,0 +1,135 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum CaptureFormat
+{
+	CAPTURE_Y4M,			// One raw 4:2:0 video file
+	CAPTURE_TGA,			// Numbered images, path is the prefix
+	CAPTURE_SCREENSHOTS		// Every frame names its own file; .bmp, .png or .tga
+};
+
+struct CaptureStats
+{
+	uint64_t framesSubmitted = 0;
+	uint64_t framesEncoded = 0;
+	uint64_t framesDropped = 0;		// No free buffer, the encoders fell behind
+	double encodeSeconds = 0.0;		// Summed over all encoder threads
+	size_t peakQueued = 0;
+};
+
+// Encodes bottom-up RGBA frames on background threads. Frames are
+// converted in parallel; Y4M frames are still written in submission order.
+class CaptureEncoder
+{
+public:
+	// maxFrames bounds the memory held by queued frames
+	CaptureEncoder(const char* path, CaptureFormat format, int width, int height, int fps,
+		unsigned threadCount = 0, size_t maxFrames = 8);
+	~CaptureEncoder();
+
+	bool isOpen() const { return format != CAPTURE_Y4M || file != nullptr; }
+
+	// width * height * 4 bytes to fill, or nullptr when every buffer is queued
+	unsigned char* acquire();
+	// Hand an acquired buffer to the encoders. path names the file for screenshots.
+	void submit(unsigned char* pixels, const char* path = nullptr);
+	// Block until everything submitted so far has been written
+	void finish();
+
+	CaptureStats stats() const;
+
+private:
+	struct Job
+	{
+		uint64_t index;
+		unsigned char* pixels;
+		std::string path;
+	};
+
+	void workerLoop();
+	void encode(const Job& job);
+	void writeInOrder(uint64_t index, std::vector<unsigned char>& yuv);
+
+	CaptureFormat format;
+	std::string path;
+	int width, height;
+	FILE* file = nullptr;
+
+	std::vector<std::unique_ptr<unsigned char[]>> buffers;
+	std::vector<unsigned char*> freeBuffers;
+	std::deque<Job> jobs;
+	uint64_t nextIndex = 0;
+	size_t inFlight = 0;
+
+	// Converted Y4M frames waiting for their predecessors
+	std::map<uint64_t, std::vector<unsigned char>> reorder;
+	uint64_t nextWrite = 0;
+	std::mutex writeMutex;
+
+	std::vector<std::thread> workers;
+	mutable std::mutex mutex;
+	std::condition_variable wake, idle;
+	bool stopping = false;
+	CaptureStats counters;
+};
+
+// Asynchronous back buffer readback. capture() queues a glReadPixels into
+// one pixel pack buffer of a ring and maps the older ones once their fences
+// have signalled, so the CPU reads frames a few frames late instead of
+// stalling on the GPU like SOIL_save_screenshot.
+class FrameCapture
+{
+public:
+	FrameCapture(int width, int height, int ringSize = 3);
+	~FrameCapture();
+
+	// A path ending in .y4m records video, anything else numbered TGA images
+	bool startRecording(const char* path, int fps);
+	void stopRecording();
+	bool isRecording() const { return recorder != nullptr; }
+
+	// Written from the next captured frame; the extension picks BMP, PNG or TGA
+	void screenshot(const char* path);
+
+	// Call after drawing and before swapping buffers
+	void capture();
+
+	void printStats() const;
+
+private:
+	struct Slot
+	{
+		GLuint pbo = 0;
+		GLsync fence = 0;
+		bool record = false;
+		std::string screenshot;
+	};
+
+	void resolve(Slot& slot, bool wait);
+	void drain();
+
+	int width, height;
+	std::vector<Slot> ring;
+	size_t head = 0;	// Next slot to write, also the oldest in flight
+
+	std::unique_ptr<CaptureEncoder> recorder;
+	std::unique_ptr<CaptureEncoder> screenshots;
+	std::string pendingScreenshot;
+
+	uint64_t framesRead = 0;
+	uint64_t stalls = 0;
+	double stallSeconds = 0.0;		// Waiting on fences that had not signalled
+	double readbackSeconds = 0.0;	// Mapping and copying
+	CaptureStats recorded;			// Totals of finished recordings
+};
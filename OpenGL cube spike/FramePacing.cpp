@@ -0,0 +1,164 @@
+#include "FramePacing.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cstdio>
+
+FramePacer::FramePacer(unsigned maxFramesInFlight, size_t historySize)
+	: maxInFlight(maxFramesInFlight), historySize(std::max<size_t>(historySize, 1))
+{
+	// GL_TIME_ELAPSED is core in 3.3; the context asks for 3.2
+	timerQueries = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	history.reserve(this->historySize);
+	created = std::chrono::high_resolution_clock::now();
+}
+
+FramePacer::~FramePacer()
+{
+	for (Frame& frame : inFlight)
+	{
+		glDeleteSync(frame.fence);
+		if (frame.query)
+			freeQueries.push_back(frame.query);
+	}
+	if (query)
+		freeQueries.push_back(query);
+	if (!freeQueries.empty())
+		glDeleteQueries(GLsizei(freeQueries.size()), freeQueries.data());
+}
+
+void FramePacer::beginFrame()
+{
+	// Frames the GPU has already finished cost nothing to retire
+	while (!inFlight.empty() && retire(false))
+		;
+
+	// Then block while the queue is full
+	auto t_start = std::chrono::high_resolution_clock::now();
+	while (maxInFlight && inFlight.size() >= maxInFlight)
+		retire(true);
+	waitSeconds = secondsSince(t_start);
+	totalWaitSeconds += waitSeconds;
+
+	begun = std::chrono::high_resolution_clock::now();
+	if (timerQueries)
+	{
+		if (freeQueries.empty())
+		{
+			freeQueries.push_back(0);
+			glGenQueries(1, &freeQueries.back());
+		}
+		query = freeQueries.back();
+		freeQueries.pop_back();
+		glBeginQuery(GL_TIME_ELAPSED, query);
+	}
+	recording = true;
+}
+
+void FramePacer::endFrame()
+{
+	if (!recording)
+		return;
+	if (query)
+		glEndQuery(GL_TIME_ELAPSED);
+	Frame frame;
+	frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	frame.query = query;
+	frame.begun = begun;
+	frame.cpuSeconds = secondsSince(begun);
+	frame.waitSeconds = waitSeconds;
+	inFlight.push_back(frame);
+	query = 0;
+	recording = false;
+}
+
+bool FramePacer::retire(bool block)
+{
+	Frame& frame = inFlight.front();
+	// The flush makes sure the fence reaches the GPU, or the wait could never end
+	GLenum state = glClientWaitSync(frame.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	while (block && state == GL_TIMEOUT_EXPIRED)
+		state = glClientWaitSync(frame.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);	// 1 ms
+	if (state == GL_TIMEOUT_EXPIRED)
+		return false;
+
+	FrameTiming timing;
+	timing.cpuSeconds = frame.cpuSeconds;
+	timing.waitSeconds = frame.waitSeconds;
+	timing.latencySeconds = secondsSince(frame.begun);
+	if (frame.query)
+	{
+		// Available once the fence behind it has signalled, so this doesn't stall
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(frame.query, GL_QUERY_RESULT, &nanoseconds);
+		timing.gpuSeconds = nanoseconds * 1e-9;
+		freeQueries.push_back(frame.query);
+	}
+	glDeleteSync(frame.fence);
+	inFlight.pop_front();
+
+	if (history.size() < historySize)
+		history.push_back(timing);
+	else
+		history[historyNext] = timing;
+	historyNext = (historyNext + 1) % historySize;
+	last = timing;
+	finished++;
+	return true;
+}
+
+FrameTiming FramePacer::average() const
+{
+	FrameTiming sum;
+	for (const FrameTiming& timing : history)
+	{
+		sum.cpuSeconds += timing.cpuSeconds;
+		sum.waitSeconds += timing.waitSeconds;
+		sum.gpuSeconds += timing.gpuSeconds;
+		sum.latencySeconds += timing.latencySeconds;
+	}
+	if (!history.empty())
+	{
+		double scale = 1.0 / history.size();
+		sum.cpuSeconds *= scale;
+		sum.waitSeconds *= scale;
+		sum.gpuSeconds *= scale;
+		sum.latencySeconds *= scale;
+	}
+	return sum;
+}
+
+FrameTiming FramePacer::peak() const
+{
+	FrameTiming worst;
+	for (const FrameTiming& timing : history)
+	{
+		worst.cpuSeconds = std::max(worst.cpuSeconds, timing.cpuSeconds);
+		worst.waitSeconds = std::max(worst.waitSeconds, timing.waitSeconds);
+		worst.gpuSeconds = std::max(worst.gpuSeconds, timing.gpuSeconds);
+		worst.latencySeconds = std::max(worst.latencySeconds, timing.latencySeconds);
+	}
+	return worst;
+}
+
+void FramePacer::printStats() const
+{
+	if (!finished)
+		return;
+	double wall = secondsSince(created);
+	FrameTiming mean = average(), worst = peak();
+	char depth[16];
+	if (maxInFlight)
+		snprintf(depth, sizeof(depth), "%u", maxInFlight);
+	else
+		snprintf(depth, sizeof(depth), "driver");
+	printf("Frames: %s in flight, %llu frames at %.1f fps, %.1f%% of the time waiting on the GPU\n",
+		depth, (unsigned long long)finished, finished / wall, totalWaitSeconds / wall * 100.0);
+	printf("        last %zu frames, average (worst): CPU %.2f (%.2f) ms, wait %.2f (%.2f) ms, ",
+		history.size(), mean.cpuSeconds * 1e3, worst.cpuSeconds * 1e3, mean.waitSeconds * 1e3, worst.waitSeconds * 1e3);
+	if (timerQueries)
+		printf("GPU %.2f (%.2f) ms, ", mean.gpuSeconds * 1e3, worst.gpuSeconds * 1e3);
+	else
+		printf("GPU n/a, ");
+	printf("latency %.2f (%.2f) ms\n", mean.latencySeconds * 1e3, worst.latencySeconds * 1e3);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+struct FrameTiming
+{
+	double cpuSeconds = 0.0;		// Recording the frame, from beginFrame() to endFrame()
+	double waitSeconds = 0.0;		// Blocked in beginFrame() on the frame that left the queue
+	double gpuSeconds = 0.0;		// GPU busy with the frame's commands, 0 without timer queries
+	double latencySeconds = 0.0;	// From beginFrame() until the frame's fence was seen signalled
+};
+
+// Bounds how many frames the CPU may queue ahead of the GPU. endFrame()
+// puts a fence after the frame; beginFrame() waits on the oldest fence
+// while maxFramesInFlight frames are still unfinished. One frame in flight
+// gives the lowest latency, more keep the GPU fed when frame costs vary.
+// Finished frames are timed into a rolling history.
+class FramePacer
+{
+public:
+	// maxFramesInFlight 0 never waits and leaves queuing to the driver, frames are only timed
+	explicit FramePacer(unsigned maxFramesInFlight = 2, size_t historySize = 240);
+	~FramePacer();
+
+	void setMaxFramesInFlight(unsigned frames) { maxInFlight = frames; }
+	unsigned maxFramesInFlight() const { return maxInFlight; }
+	size_t framesInFlight() const { return inFlight.size(); }
+
+	// Call before recording the frame's commands
+	void beginFrame();
+	// Call after swapping buffers, so the fence covers the whole frame
+	void endFrame();
+
+	// Timings of the most recently finished frame
+	const FrameTiming& latest() const { return last; }
+	// Mean and worst over the history
+	FrameTiming average() const;
+	FrameTiming peak() const;
+	uint64_t framesFinished() const { return finished; }
+	bool hasGpuTimings() const { return timerQueries; }
+
+	void printStats() const;
+
+private:
+	struct Frame
+	{
+		GLsync fence;
+		GLuint query;
+		std::chrono::high_resolution_clock::time_point begun;
+		double cpuSeconds;
+		double waitSeconds;
+	};
+
+	// Retire the oldest frame; waits for it when block is set
+	bool retire(bool block);
+
+	unsigned maxInFlight;
+	bool timerQueries;
+	std::deque<Frame> inFlight;
+	std::vector<GLuint> freeQueries;
+
+	// Current frame
+	GLuint query = 0;
+	std::chrono::high_resolution_clock::time_point begun;
+	double waitSeconds = 0.0;
+	bool recording = false;
+
+	std::vector<FrameTiming> history;	// Ring of the last historySize finished frames
+	size_t historySize;
+	size_t historyNext = 0;
+	FrameTiming last;
+	uint64_t finished = 0;
+	double totalWaitSeconds = 0.0;
+	std::chrono::high_resolution_clock::time_point created;
+};
@@ -0,0 +1,249 @@
+#include "ImageBatch.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <SOIL/SOIL.h>
+
+ImageBatch::ImageBatch(JobSystem& jobs, std::vector<ImageRequest> requests, ImageCallback callback)
+	: jobs(jobs), requests(std::move(requests)), callback(std::move(callback))
+{
+	images.resize(this->requests.size());
+	counters.reset(new JobCounter[this->requests.size()]);
+	started = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < this->requests.size(); i++)
+		jobs.run([this, i] { decode(i); }, &counters[i]);
+}
+
+ImageBatch::~ImageBatch()
+{
+	// Decode jobs write into images
+	wait();
+	for (DecodedImage& image : images)
+		SOIL_free_image_data(image.pixels);
+}
+
+void ImageBatch::decode(size_t index)
+{
+	const ImageRequest& request = requests[index];
+	DecodedImage& image = images[index];
+	auto t_start = std::chrono::high_resolution_clock::now();
+
+	SOIL_context context;
+	SOIL_init_context(&context);
+	int fileChannels = 0;
+	if (request.memory)
+		image.pixels = SOIL_load_image_from_memory_ctx(&context, request.memory, int(request.size),
+			&image.width, &image.height, &fileChannels, request.forceChannels);
+	else
+		image.pixels = SOIL_load_image_ctx(&context, request.path.c_str(),
+			&image.width, &image.height, &fileChannels, request.forceChannels);
+	image.allocations = context.allocations;
+	image.peakBytes = context.peak_bytes;
+	if (image.pixels)
+		image.channels = request.forceChannels ? request.forceChannels : fileChannels;
+	else
+	{
+		image.width = image.height = 0;
+		image.error = context.result_string;
+		fprintf(stderr, "%s: %s\n", request.path.c_str(), image.error);
+	}
+
+	image.decodeSeconds = secondsSince(t_start);
+	image.latencySeconds = secondsSince(started);
+	if (callback)
+		callback(index, image);
+}
+
+bool ImageBatch::done() const
+{
+	for (size_t i = 0; i < requests.size(); i++)
+		if (!counters[i].done())
+			return false;
+	return true;
+}
+
+DecodedImage& ImageBatch::get(size_t index)
+{
+	jobs.wait(counters[index]);
+	return images[index];
+}
+
+void ImageBatch::wait()
+{
+	for (size_t i = 0; i < requests.size(); i++)
+		jobs.wait(counters[i]);
+}
+
+unsigned char* ImageBatch::release(size_t index)
+{
+	DecodedImage& image = get(index);
+	unsigned char* pixels = image.pixels;
+	image.pixels = nullptr;
+	return pixels;
+}
+
+ImageBatchStats ImageBatch::stats() const
+{
+	ImageBatchStats s;
+	std::vector<double> latencies;
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		if (!counters[i].done())
+			continue;
+		const DecodedImage& image = images[i];
+		s.decoded++;
+		s.failed += image.error != nullptr;
+		s.bytes += image.bytes();
+		s.decodeSeconds += image.decodeSeconds;
+		s.seconds = std::max(s.seconds, image.latencySeconds);
+		latencies.push_back(image.latencySeconds);
+	}
+	if (!latencies.empty())
+	{
+		std::sort(latencies.begin(), latencies.end());
+		s.medianLatency = latencies[latencies.size() / 2];
+		s.worstLatency = latencies.back();
+	}
+	return s;
+}
+
+void ImageBatch::printStats(bool perImage) const
+{
+	ImageBatchStats s = stats();
+	printf("Image batch: %zu of %zu decoded (%zu failed), %.2f MB in %.1f ms, %.1f MB/s, %.1f ms of decoding, latency median %.2f ms, worst %.2f ms\n",
+		s.decoded, requests.size(), s.failed, s.bytes / 1e6, s.seconds * 1e3, s.megabytesPerSecond(),
+		s.decodeSeconds * 1e3, s.medianLatency * 1e3, s.worstLatency * 1e3);
+	if (!perImage)
+		return;
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		if (!counters[i].done())
+			continue;
+		const DecodedImage& image = images[i];
+		printf("  %-56s %5d x %-5d %d ch  decode %7.2f ms  latency %7.2f ms  %2u allocations, peak %6.2f MB%s\n", requests[i].path.c_str(),
+			image.width, image.height, image.channels, image.decodeSeconds * 1e3, image.latencySeconds * 1e3,
+			image.allocations, image.peakBytes / 1e6, image.error ? "  FAILED" : "");
+	}
+}
+
+static void soilParallelFor(void* context, int count, SOIL_task task, void* data)
+{
+	// SOIL's tasks are already a useful size each
+	static_cast<JobSystem*>(context)->parallelFor(size_t(count), 1, [task, data](size_t begin, size_t end)
+	{
+		task(data, int(begin), int(end));
+	});
+}
+
+SOILJobScope::SOILJobScope(JobSystem& jobs)
+{
+	SOIL_set_parallel_for(soilParallelFor, &jobs);
+}
+
+SOILJobScope::~SOILJobScope()
+{
+	SOIL_set_parallel_for(nullptr, nullptr);
+}
+
+DecodeArena::DecodeArena(size_t capacity)
+	: block(new unsigned char[capacity]), size(capacity)
+{
+}
+
+void DecodeArena::attach(SOIL_context& context)
+{
+	context.allocator.alloc = allocate;
+	context.allocator.resize = resize;
+	context.allocator.release = nullptr;
+	context.allocator.user = this;
+}
+
+void* DecodeArena::allocate(void* arena, size_t bytes)
+{
+	// 16 bytes keeps SIMD loads over decoded rows aligned
+	DecodeArena& a = *static_cast<DecodeArena*>(arena);
+	size_t start = (a.used + 15) & ~size_t(15);
+	if (start > a.size || bytes > a.size - start)
+		return nullptr;
+	a.last = a.block.get() + start;
+	a.used = start + bytes;
+	a.mostUsed = std::max(a.mostUsed, a.used);
+	return a.last;
+}
+
+void* DecodeArena::resize(void* arena, void* p, size_t oldBytes, size_t bytes)
+{
+	// The zlib output and PNG chunk buffers grow while they are the newest
+	DecodeArena& a = *static_cast<DecodeArena*>(arena);
+	if (p == a.last && bytes <= a.size - size_t(a.last - a.block.get()))
+	{
+		a.used = size_t(a.last - a.block.get()) + bytes;
+		a.mostUsed = std::max(a.mostUsed, a.used);
+		return p;
+	}
+	void* moved = allocate(arena, bytes);
+	if (moved)
+		memcpy(moved, p, std::min(oldBytes, bytes));
+	return moved;
+}
+
+void benchmarkImageBatch()
+{
+	// Copies make a batch worth splitting
+	std::vector<std::string> paths = sampleImagePaths();
+	std::vector<std::vector<unsigned char>> files;
+	if (!readSampleImages(paths, files))
+		return;
+	const int copies = 8;
+
+	std::vector<ImageRequest> fromFiles, fromMemory;
+	for (int copy = 0; copy < copies; copy++)
+	{
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			fromFiles.emplace_back(paths[i]);
+			fromMemory.emplace_back(paths[i], files[i].data(), files[i].size());
+		}
+	}
+
+	// One SOIL_load_image after another, the way a material set loads today
+	auto t_start = std::chrono::high_resolution_clock::now();
+	uint64_t serialBytes = 0;
+	for (const ImageRequest& request : fromFiles)
+	{
+		int width, height, channels;
+		unsigned char* image = SOIL_load_image(request.path.c_str(), &width, &height, &channels, SOIL_LOAD_AUTO);
+		serialBytes += uint64_t(width) * height * channels * (image != nullptr);
+		SOIL_free_image_data(image);
+	}
+	double serialSeconds = secondsSince(t_start);
+	printf("Serial:  %zu files, %.1f ms, %.1f MB/s decoded\n", fromFiles.size(), serialSeconds * 1e3, serialBytes / serialSeconds / 1e6);
+
+	std::vector<unsigned> threadCounts(1, 1);
+	if (std::thread::hardware_concurrency() > 1)
+		threadCounts.push_back(std::thread::hardware_concurrency());
+	for (unsigned threads : threadCounts)
+	{
+		JobSystem jobs(threads - 1);
+		for (int memory = 0; memory < 2; memory++)
+		{
+			std::atomic<size_t> called(0);
+			ImageBatch batch(jobs, memory ? fromMemory : fromFiles, [&called](size_t, DecodedImage&) { called++; });
+			batch.wait();
+			ImageBatchStats s = batch.stats();
+			printf("%2u threads, %s: %.1f ms, %.1f MB/s decoded, %.2fx serial, latency median %.2f ms, worst %.2f ms, %zu callbacks, %zu failed\n",
+				threads, memory ? "memory" : "files ", s.seconds * 1e3, s.megabytesPerSecond(), serialSeconds / s.seconds,
+				s.medianLatency * 1e3, s.worstLatency * 1e3, size_t(called), s.failed);
+		}
+	}
+
+	// Per-file latency of a single copy of the corpus on every thread
+	JobSystem jobs(threadCounts.back() - 1);
+	ImageBatch batch(jobs, std::vector<ImageRequest>(fromFiles.begin(), fromFiles.begin() + paths.size()));
+	batch.wait();
+	batch.printStats(true);
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "JobSystem.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <SOIL/SOIL.h>
+
+// One image to decode: a file, or an encoded image already in memory
+struct ImageRequest
+{
+	std::string path;						// Also names memory images in errors
+	const unsigned char* memory = nullptr;	// Not copied, must outlive the decode
+	size_t size = 0;
+	int forceChannels = 0;					// SOIL_LOAD_AUTO, or the SOIL_LOAD_* channels wanted
+
+	ImageRequest() {}
+	ImageRequest(std::string path, int forceChannels = 0)
+		: path(std::move(path)), forceChannels(forceChannels) {}
+	ImageRequest(std::string name, const void* memory, size_t size, int forceChannels = 0)
+		: path(std::move(name)), memory(static_cast<const unsigned char*>(memory)), size(size), forceChannels(forceChannels) {}
+};
+
+struct DecodedImage
+{
+	unsigned char* pixels = nullptr;	// Owned by the batch unless released
+	int width = 0;
+	int height = 0;
+	int channels = 0;					// Of pixels: forceChannels, or the file's without it
+	const char* error = nullptr;		// SOIL's reason when the decode failed
+	double decodeSeconds = 0.0;			// On the job
+	double latencySeconds = 0.0;		// From the batch starting until decoded, queueing included
+	unsigned allocations = 0;			// Made by SOIL for the decode, the pixels included
+	size_t peakBytes = 0;				// The most SOIL had allocated at once
+
+	size_t bytes() const { return size_t(width) * height * channels; }
+};
+
+struct ImageBatchStats
+{
+	size_t decoded = 0;
+	size_t failed = 0;
+	uint64_t bytes = 0;				// Decoded pixels
+	double seconds = 0.0;			// From the batch starting until its last image was decoded
+	double decodeSeconds = 0.0;		// Summed over jobs
+	double medianLatency = 0.0;
+	double worstLatency = 0.0;
+
+	double megabytesPerSecond() const { return seconds > 0.0 ? bytes / seconds / 1e6 : 0.0; }
+};
+
+// Called on the job that decoded the image, so it must be thread safe.
+// It may keep the pixels by setting image.pixels to null and freeing them
+// itself with SOIL_free_image_data.
+typedef std::function<void(size_t index, DecodedImage& image)> ImageCallback;
+
+// Decodes a list of images on the job system, one job per image, and is
+// the handle to the results: wait for one image or for all of them, or be
+// called back as each one finishes. Failures are reported on stderr. The
+// batch frees the pixels it still owns when destroyed, after its jobs finish.
+class ImageBatch
+{
+public:
+	ImageBatch(JobSystem& jobs, std::vector<ImageRequest> requests, ImageCallback callback = ImageCallback());
+	~ImageBatch();
+	ImageBatch(const ImageBatch&) = delete;
+	ImageBatch& operator=(const ImageBatch&) = delete;
+
+	size_t size() const { return requests.size(); }
+	const ImageRequest& request(size_t index) const { return requests[index]; }
+	bool ready(size_t index) const { return counters[index].done(); }
+	bool done() const;
+
+	// Run queued jobs on the calling thread until the image, or every image, is decoded
+	DecodedImage& get(size_t index);
+	void wait();
+	// The caller frees the pixels with SOIL_free_image_data
+	unsigned char* release(size_t index);
+
+	// Over the images decoded so far
+	ImageBatchStats stats() const;
+	void printStats(bool perImage = false) const;
+
+private:
+	void decode(size_t index);
+
+	JobSystem& jobs;
+	std::vector<ImageRequest> requests;
+	std::vector<DecodedImage> images;
+	std::unique_ptr<JobCounter[]> counters;
+	ImageCallback callback;
+	std::chrono::high_resolution_clock::time_point started;
+};
+
+// Lends the jobs to SOIL while alive, which spreads the DXT compression of
+// prepared textures over them. SOIL has a single hook, so one at a time.
+class SOILJobScope
+{
+public:
+	explicit SOILJobScope(JobSystem& jobs);
+	~SOILJobScope();
+	SOILJobScope(const SOILJobScope&) = delete;
+	SOILJobScope& operator=(const SOILJobScope&) = delete;
+};
+
+// Serves the allocations of decodes through a SOIL_context from one block,
+// so a streaming loop that decodes, uses the pixels and resets makes no
+// heap calls. Allocating past the block fails the decode. Nothing is freed
+// until reset, which frees everything, pixels the arena returned included.
+class DecodeArena
+{
+public:
+	explicit DecodeArena(size_t capacity);
+	DecodeArena(const DecodeArena&) = delete;
+	DecodeArena& operator=(const DecodeArena&) = delete;
+
+	// Decodes through the context allocate here from now on
+	void attach(SOIL_context& context);
+	void reset() { used = 0; last = nullptr; }
+
+	size_t capacity() const { return size; }
+	size_t highWater() const { return mostUsed; }
+
+private:
+	static void* allocate(void* arena, size_t bytes);
+	static void* resize(void* arena, void* p, size_t oldBytes, size_t bytes);
+
+	std::unique_ptr<unsigned char[]> block;
+	size_t size;
+	size_t used = 0;
+	size_t mostUsed = 0;
+	unsigned char* last = nullptr;	// The newest allocation, which grows in place
+};
@@ -0,0 +1,399 @@
+#include "ImageIndex.h"
+#include "Benchmark.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+static void makeDirectory(const char* path)
+{
+#ifdef _WIN32
+	_mkdir(path);
+#else
+	mkdir(path, 0755);
+#endif
+}
+
+static void removeDirectory(const char* path)
+{
+#ifdef _WIN32
+	_rmdir(path);
+#else
+	rmdir(path);
+#endif
+}
+
+static bool isImagePath(const std::string& name)
+{
+	static const char* const extensions[] = { "png", "jpg", "jpeg", "bmp", "tga", "psd", "hdr", "dds" };
+	size_t dot = name.rfind('.');
+	if (dot == std::string::npos)
+		return false;
+	std::string extension = name.substr(dot + 1);
+	for (char& c : extension)
+		c = char(tolower(static_cast<unsigned char>(c)));
+	for (const char* known : extensions)
+		if (extension == known)
+			return true;
+	return false;
+}
+
+// Lists one directory, queueing a job for each of its subdirectories
+static void listDirectory(JobSystem& jobs, JobCounter& counter, std::mutex& mutex,
+	std::vector<std::string>& files, const std::string& directory)
+{
+	std::vector<std::string> found, subdirectories;
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE handle = FindFirstFileA((directory + "/*").c_str(), &data);
+	if (handle == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		std::string name = data.cFileName;
+		if (name == "." || name == ".." || (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+			continue;
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			subdirectories.push_back(directory + "/" + name);
+		else if (isImagePath(name))
+			found.push_back(directory + "/" + name);
+	} while (FindNextFileA(handle, &data));
+	FindClose(handle);
+#else
+	DIR* dir = opendir(directory.c_str());
+	if (!dir)
+		return;
+	while (dirent* entry = readdir(dir))
+	{
+		std::string name = entry->d_name;
+		if (name == "." || name == "..")
+			continue;
+		std::string path = directory + "/" + name;
+		// Links are skipped, as they may lead back up the tree
+		unsigned char type = entry->d_type;
+		if (type == DT_UNKNOWN)
+		{
+			struct stat info;
+			if (lstat(path.c_str(), &info) != 0 || S_ISLNK(info.st_mode))
+				continue;
+			type = S_ISDIR(info.st_mode) ? DT_DIR : DT_REG;
+		}
+		if (type == DT_LNK)
+			continue;
+		if (type == DT_DIR)
+			subdirectories.push_back(std::move(path));
+		else if (isImagePath(name))
+			found.push_back(std::move(path));
+	}
+	closedir(dir);
+#endif
+	for (const std::string& subdirectory : subdirectories)
+	{
+		jobs.run([&jobs, &counter, &mutex, &files, subdirectory]
+		{
+			listDirectory(jobs, counter, mutex, files, subdirectory);
+		}, &counter);
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	files.insert(files.end(), found.begin(), found.end());
+}
+
+void ImageIndex::scan(JobSystem& jobs, const std::string& directory)
+{
+	auto t_start = std::chrono::high_resolution_clock::now();
+	std::vector<std::string> paths;
+	{
+		std::mutex mutex;
+		JobCounter counter;
+		jobs.run([&] { listDirectory(jobs, counter, mutex, paths, directory); }, &counter);
+		jobs.wait(counter);
+	}
+	std::sort(paths.begin(), paths.end());
+	counters.listSeconds = secondsSince(t_start);
+
+	// Both are sorted, so one pass pairs every file with what the index knew of it
+	t_start = std::chrono::high_resolution_clock::now();
+	std::vector<const ImageMetadata*> previous(paths.size(), nullptr);
+	size_t known = 0;
+	for (size_t i = 0, j = 0; i < paths.size(); i++)
+	{
+		while (j < entries.size() && entries[j].path < paths[i])
+			j++;
+		if (j < entries.size() && entries[j].path == paths[i])
+		{
+			previous[i] = &entries[j];
+			known++;
+		}
+	}
+
+	std::vector<ImageMetadata> scanned(paths.size());
+	std::vector<uint8_t> probed(paths.size(), 0);
+	jobs.parallelFor(paths.size(), 16, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			ImageMetadata& image = scanned[i];
+			image.path = std::move(paths[i]);
+			statFile(image.path.c_str(), image.stamp);
+			const ImageMetadata* old = previous[i];
+			if (old && old->stamp == image.stamp)
+			{
+				image.info = old->info;
+				continue;
+			}
+			probed[i] = 1;
+			if (!SOIL_probe_image(image.path.c_str(), &image.info))
+				image.info.format = SOIL_IMAGE_UNKNOWN;
+		}
+	});
+	counters.probeSeconds = secondsSince(t_start);
+
+	counters.images = scanned.size();
+	counters.probed = 0;
+	counters.unreadable = 0;
+	for (size_t i = 0; i < scanned.size(); i++)
+	{
+		counters.probed += probed[i];
+		counters.unreadable += probed[i] && scanned[i].info.format == SOIL_IMAGE_UNKNOWN;
+	}
+	counters.unchanged = counters.images - counters.probed;
+	counters.removed = entries.size() - known;
+	entries.swap(scanned);
+}
+
+const ImageMetadata* ImageIndex::find(const std::string& path) const
+{
+	auto it = std::lower_bound(entries.begin(), entries.end(), path, [](const ImageMetadata& image, const std::string& p)
+	{
+		return image.path < p;
+	});
+	return it != entries.end() && it->path == path ? &*it : nullptr;
+}
+
+bool ImageIndex::load(const char* path)
+{
+	entries.clear();
+	auto t_start = std::chrono::high_resolution_clock::now();
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+
+	const ImageIndexHeader* h = reinterpret_cast<const ImageIndexHeader*>(file.data());
+	const char* error = nullptr;
+	if (file.size() < sizeof(ImageIndexHeader) || h->magic != IMAGE_INDEX_MAGIC)
+		error = "not an image index";
+	else if (h->version != IMAGE_INDEX_VERSION)
+		error = "unsupported version";
+	else if (h->fileSize != file.size())
+		error = "truncated";
+	else if (h->recordCount > (h->fileSize - sizeof(ImageIndexHeader)) / sizeof(ImageIndexRecord) ||
+		h->pathsOffset < sizeof(ImageIndexHeader) + h->recordCount * sizeof(ImageIndexRecord) ||
+		h->pathsOffset > h->fileSize || h->pathsSize > h->fileSize - h->pathsOffset)
+		error = "bad section offsets";
+
+	const ImageIndexRecord* records = reinterpret_cast<const ImageIndexRecord*>(h + 1);
+	const char* paths = reinterpret_cast<const char*>(file.data() + (error ? 0 : h->pathsOffset));
+	for (uint64_t i = 0; !error && i < h->recordCount; i++)
+		if (uint64_t(records[i].pathOffset) + records[i].pathLength >= h->pathsSize ||
+			paths[records[i].pathOffset + records[i].pathLength] != '\0')
+			error = "bad path";
+
+	if (error)
+	{
+		fprintf(stderr, "%s: %s\n", path, error);
+		return false;
+	}
+	entries.resize(size_t(h->recordCount));
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		const ImageIndexRecord& record = records[i];
+		ImageMetadata& image = entries[i];
+		image.path.assign(paths + record.pathOffset, record.pathLength);
+		image.stamp.size = record.fileSize;
+		image.stamp.modifiedTime = record.modifiedTime;
+		image.stamp.changeTime = record.changeTime;
+		image.info.width = record.width;
+		image.info.height = record.height;
+		image.info.channels = record.channels;
+		image.info.format = record.format;
+		image.info.mipmap_count = record.mipmapCount;
+		image.info.cubemap = record.cubemap;
+		image.info.DXT = record.DXT;
+	}
+	counters.loadSeconds = secondsSince(t_start);
+	return true;
+}
+
+bool ImageIndex::save(const char* path)
+{
+	auto t_start = std::chrono::high_resolution_clock::now();
+	std::vector<ImageIndexRecord> records(entries.size());
+	std::string paths;
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		const ImageMetadata& image = entries[i];
+		ImageIndexRecord& record = records[i];
+		record.fileSize = image.stamp.size;
+		record.modifiedTime = image.stamp.modifiedTime;
+		record.changeTime = image.stamp.changeTime;
+		record.pathOffset = uint32_t(paths.size());
+		record.pathLength = uint32_t(image.path.size());
+		record.width = image.info.width;
+		record.height = image.info.height;
+		record.channels = uint8_t(image.info.channels);
+		record.format = uint8_t(image.info.format);
+		record.DXT = uint8_t(image.info.DXT);
+		record.cubemap = uint8_t(image.info.cubemap);
+		record.mipmapCount = uint16_t(std::min(image.info.mipmap_count, 0xFFFF));
+		record.padding = 0;
+		paths.append(image.path.c_str(), image.path.size() + 1);
+	}
+
+	ImageIndexHeader header;
+	header.magic = IMAGE_INDEX_MAGIC;
+	header.version = IMAGE_INDEX_VERSION;
+	header.recordCount = records.size();
+	header.pathsOffset = sizeof(ImageIndexHeader) + records.size() * sizeof(ImageIndexRecord);
+	header.pathsSize = paths.size();
+	header.fileSize = header.pathsOffset + header.pathsSize;
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(records.data(), sizeof(ImageIndexRecord), records.size(), file);
+	fwrite(paths.data(), 1, paths.size(), file);
+	bool ok = ftell(file) == long(header.fileSize);
+	ok = fclose(file) == 0 && ok;
+	counters.saveSeconds = secondsSince(t_start);
+	return ok;
+}
+
+void ImageIndex::printStats() const
+{
+	const ImageIndexStats& s = counters;
+	printf("Image index: %zu images, %zu probed (%zu unreadable), %zu unchanged, %zu removed; "
+		"listing %.1f ms, checking and probing %.1f ms\n",
+		s.images, s.probed, s.unreadable, s.unchanged, s.removed, s.listSeconds * 1e3, s.probeSeconds * 1e3);
+}
+
+static bool writeFile(const std::string& path, const std::vector<unsigned char>& bytes)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+	bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+	return fclose(file) == 0 && ok;
+}
+
+void benchmarkImageIndex()
+{
+	std::vector<std::string> samples = sampleImagePaths();
+	const size_t sampleCount = samples.size();
+	std::vector<std::vector<unsigned char>> sampleBytes;
+	if (!readSampleImages(samples, sampleBytes))
+		return;
+
+	// A tree of copies of the samples, as an asset directory would have
+	const std::string directory = "bench_image_index";
+	const std::string indexPath = "bench_image_index.bin";
+	const size_t directoryCount = 16;
+	const size_t fileCount = 2000;
+	std::vector<std::string> directories, files;
+	auto extensionOf = [&](size_t sample) { return samples[sample].substr(samples[sample].rfind('.')); };
+	makeDirectory(directory.c_str());
+	for (size_t d = 0; d < directoryCount; d++)
+	{
+		directories.push_back(directory + "/set" + std::to_string(d));
+		makeDirectory(directories.back().c_str());
+	}
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		files.push_back(directories[i % directoryCount] + "/image" + std::to_string(i) + extensionOf(i % sampleCount));
+		if (!writeFile(files.back(), sampleBytes[i % sampleCount]))
+		{
+			printf("Could not write %s\n", files.back().c_str());
+			return;
+		}
+	}
+
+	// What finding the sizes costs without probing: a full decode each
+	auto t_start = std::chrono::high_resolution_clock::now();
+	std::vector<int> decoded(fileCount * 3);
+	for (size_t i = 0; i < fileCount; i++)
+		SOIL_free_image_data(SOIL_load_image(files[i].c_str(), &decoded[i * 3], &decoded[i * 3 + 1], &decoded[i * 3 + 2], SOIL_LOAD_AUTO));
+	double decodeSeconds = secondsSince(t_start);
+	printf("Full decodes:       %zu files in %7.1f ms\n", fileCount, decodeSeconds * 1e3);
+
+	std::vector<unsigned> threadCounts(1, 1);
+	if (std::thread::hardware_concurrency() > 1)
+		threadCounts.push_back(std::thread::hardware_concurrency());
+	for (unsigned threads : threadCounts)
+	{
+		JobSystem jobs(threads - 1);
+		ImageIndex index;
+		index.scan(jobs, directory);
+		const ImageIndexStats& s = index.stats();
+		double seconds = s.listSeconds + s.probeSeconds;
+		printf("Probe, %2u threads:  %zu files in %7.1f ms (%.0fx)\n", threads, s.images, seconds * 1e3, decodeSeconds / seconds);
+	}
+
+	// Headers agree with decodes. A DDS reports the channels it can hold,
+	// where a decode drops opaque RGBA to RGB, and cubemaps a face each.
+	JobSystem jobs;
+	ImageIndex index;
+	index.scan(jobs, directory);
+	size_t mismatched = 0;
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		const ImageMetadata* image = index.find(files[i]);
+		bool dds = image && image->info.format == SOIL_IMAGE_DDS;
+		mismatched += !image || image->info.width != decoded[i * 3] ||
+			image->info.height * (image->info.cubemap ? 6 : 1) != decoded[i * 3 + 1] ||
+			(!dds && image->info.channels != decoded[i * 3 + 2]);
+	}
+	printf("Headers vs decodes: %zu of %zu differ\n", mismatched, fileCount);
+	index.save(indexPath.c_str());
+
+	// The next run: nothing changed, then a few files rewritten, removed and added
+	ImageIndex next;
+	next.load(indexPath.c_str());
+	printf("Index file: %zu images loaded in %.2f ms, saved in %.2f ms\n",
+		next.images().size(), next.stats().loadSeconds * 1e3, index.stats().saveSeconds * 1e3);
+	next.scan(jobs, directory);
+	next.printStats();
+	const size_t changes = fileCount / 100;
+	for (size_t i = 0; i < changes; i++)
+	{
+		// The next sample differs in size, so the scan sees the rewrite even
+		// within the same second
+		writeFile(files[i * 7], sampleBytes[(i * 7 + 1) % sampleCount]);
+		remove(files[i * 7 + 1].c_str());
+		files.push_back(directories[i % directoryCount] + "/added" + std::to_string(i) + extensionOf(i % sampleCount));
+		writeFile(files.back(), sampleBytes[i % sampleCount]);
+	}
+	next.scan(jobs, directory);
+	next.printStats();
+	next.save(indexPath.c_str());
+
+	for (const std::string& file : files)
+		remove(file.c_str());
+	for (const std::string& d : directories)
+		removeDirectory(d.c_str());
+	removeDirectory(directory.c_str());
+	remove(indexPath.c_str());
+}
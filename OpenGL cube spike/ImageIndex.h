@@ -0,0 +1,97 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <SOIL/SOIL.h>
+
+// Image index layout, version 2. Records are sorted by path; paths are
+// NUL terminated and follow the records.
+//
+//   ImageIndexHeader
+//   ImageIndexRecord[recordCount]
+//   paths
+
+const uint32_t IMAGE_INDEX_MAGIC = 0x31584D49;	// "IMX1"
+const uint32_t IMAGE_INDEX_VERSION = 2;
+
+struct ImageIndexHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t recordCount;
+	uint64_t pathsOffset;
+	uint64_t pathsSize;
+	uint64_t fileSize;
+};
+
+struct ImageIndexRecord
+{
+	uint64_t fileSize;			// FileStamp of the file when probed, to tell if it changed
+	uint64_t modifiedTime;
+	uint64_t changeTime;
+	uint32_t pathOffset;		// Into the paths
+	uint32_t pathLength;
+	int32_t width;
+	int32_t height;
+	uint8_t channels;
+	uint8_t format;				// SOIL_IMAGE_*
+	uint8_t DXT;
+	uint8_t cubemap;
+	uint16_t mipmapCount;
+	uint16_t padding;
+};
+
+static_assert(sizeof(ImageIndexHeader) == 40, "ImageIndexHeader layout is part of the file format");
+static_assert(sizeof(ImageIndexRecord) == 48, "ImageIndexRecord layout is part of the file format");
+
+struct ImageMetadata
+{
+	std::string path;					// The scanned directory joined with the file's path under it
+	FileStamp stamp;
+	SOIL_image_info info = SOIL_image_info();	// SOIL_IMAGE_UNKNOWN for files SOIL can't read
+};
+
+struct ImageIndexStats
+{
+	size_t images = 0;				// Found by the last scan
+	size_t probed = 0;				// New or changed since the index was written
+	size_t unchanged = 0;
+	size_t removed = 0;
+	size_t unreadable = 0;			// Probed, but not an image SOIL reads
+	double listSeconds = 0.0;		// Walking the directories
+	double probeSeconds = 0.0;		// Checking and probing the files
+	double loadSeconds = 0.0;
+	double saveSeconds = 0.0;
+};
+
+// Size, channels and format of every image under a directory, read from
+// the headers alone for planning atlases and memory budgets. The index is
+// kept in a file between runs, and a scan only probes the images whose size
+// or modification time differ from the index.
+class ImageIndex
+{
+public:
+	// Fails, leaving the index empty, if the file is missing or damaged
+	bool load(const char* path);
+	bool save(const char* path);
+
+	// Replaces the index with the images under the directory, walking it and
+	// checking the images on the jobs. Files are images by extension: png,
+	// jpg, jpeg, bmp, tga, psd, hdr and dds.
+	void scan(JobSystem& jobs, const std::string& directory);
+
+	// Sorted by path
+	const std::vector<ImageMetadata>& images() const { return entries; }
+	const ImageMetadata* find(const std::string& path) const;
+
+	const ImageIndexStats& stats() const { return counters; }
+	void printStats() const;
+
+private:
+	std::vector<ImageMetadata> entries;
+	ImageIndexStats counters;
+};
@@ -0,0 +1,340 @@
+#include "JobSystem.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+// Which pool the current thread works for, and its queue there
+static thread_local const JobSystem* currentSystem = nullptr;
+static thread_local unsigned currentQueue = 0;
+// Jobs run inside wait() are already counted in the outer job's busy time
+static thread_local unsigned jobDepth = 0;
+static thread_local uint32_t stealSeed = 0;
+
+JobSystem::JobSystem(unsigned workerCount)
+	: queued(0), sleeping(0)
+{
+	for (unsigned i = 0; i <= workerCount; i++)
+		queues.emplace_back(new Queue);
+	statsStart = std::chrono::high_resolution_clock::now();
+	for (unsigned i = 1; i <= workerCount; i++)
+		workers.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+unsigned JobSystem::defaultWorkerCount()
+{
+	return std::max(2u, std::thread::hardware_concurrency()) - 1;
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+unsigned JobSystem::currentIndex() const
+{
+	return currentSystem == this ? currentQueue : 0;
+}
+
+void JobSystem::run(std::function<void()> fn, JobCounter* counter)
+{
+	if (counter)
+		counter->pending++;
+	Job job = { std::move(fn), counter };
+	push(std::move(job));
+}
+
+void JobSystem::runAfter(JobCounter& dependency, std::function<void()> fn, JobCounter* counter)
+{
+	if (counter)
+		counter->pending++;
+	{
+		std::lock_guard<std::mutex> lock(dependency.mutex);
+		if (dependency.pending.load() != 0)
+		{
+			JobCounter::Continuation continuation = { std::move(fn), counter };
+			dependency.continuations.push_back(std::move(continuation));
+			return;
+		}
+	}
+	Job job = { std::move(fn), counter };
+	push(std::move(job));
+}
+
+void JobSystem::push(Job job)
+{
+	Queue& queue = *queues[currentIndex()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(std::move(job));
+	}
+	queued++;
+	if (sleeping.load() > 0)
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		wake.notify_one();
+	}
+}
+
+bool JobSystem::tryRunOne(unsigned self)
+{
+	Job job;
+	bool found = false;
+
+	// Newest of our own jobs first, its data is most likely still in cache
+	{
+		Queue& own = *queues[self];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.jobs.empty())
+		{
+			job = std::move(own.jobs.back());
+			own.jobs.pop_back();
+			found = true;
+		}
+	}
+	if (found)
+	{
+		queued--;
+		execute(job, self, false);
+		return true;
+	}
+
+	// Otherwise the oldest job of a victim, starting somewhere random so
+	// thieves spread out instead of all hitting the same deque
+	unsigned count = unsigned(queues.size());
+	stealSeed = stealSeed * 1664525u + 1013904223u + self;
+	unsigned start = (stealSeed >> 8) % count;
+	for (unsigned i = 0; i < count && !found; i++)
+	{
+		unsigned victim = (start + i) % count;
+		if (victim == self)
+			continue;
+		Queue& queue = *queues[victim];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.jobs.empty())
+		{
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+			found = true;
+		}
+	}
+	if (!found)
+		return false;
+	queued--;
+	execute(job, self, true);
+	return true;
+}
+
+void JobSystem::execute(Job& job, unsigned self, bool stolen)
+{
+	Queue& stats = *queues[self];
+	if (jobDepth++ == 0)
+	{
+		auto t_start = std::chrono::high_resolution_clock::now();
+		job.fn();
+		stats.busyNanoseconds += uint64_t(secondsSince(t_start) * 1e9);
+	}
+	else
+		job.fn();
+	jobDepth--;
+	stats.executed++;
+	if (stolen)
+		stats.steals++;
+	finish(job.counter);
+}
+
+void JobSystem::finish(JobCounter* counter)
+{
+	if (!counter)
+		return;
+
+	// Decremented under the lock so wait() can't return, and the counter
+	// go out of scope, while we still hold it
+	std::vector<JobCounter::Continuation> ready;
+	{
+		std::lock_guard<std::mutex> lock(counter->mutex);
+		if (--counter->pending == 0)
+			ready.swap(counter->continuations);
+	}
+	for (JobCounter::Continuation& continuation : ready)
+	{
+		Job job = { std::move(continuation.fn), continuation.counter };
+		push(std::move(job));
+	}
+}
+
+void JobSystem::wait(JobCounter& counter)
+{
+	unsigned self = currentIndex();
+	while (!counter.done())
+	{
+		if (!tryRunOne(self))
+			std::this_thread::yield();
+	}
+	std::lock_guard<std::mutex> lock(counter.mutex);
+}
+
+void JobSystem::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body)
+{
+	grain = std::max<size_t>(grain, 1);
+	if (count <= grain || workers.empty())
+	{
+		for (size_t begin = 0; begin < count; begin += grain)
+			body(begin, std::min(begin + grain, count));
+		return;
+	}
+
+	// The caller keeps the first range and helps with the rest while waiting
+	JobCounter counter;
+	for (size_t begin = grain; begin < count; begin += grain)
+	{
+		size_t end = std::min(begin + grain, count);
+		run([&body, begin, end] { body(begin, end); }, &counter);
+	}
+	body(0, grain);
+	wait(counter);
+}
+
+void JobSystem::workerLoop(unsigned index)
+{
+	currentSystem = this;
+	currentQueue = index;
+	stealSeed = index * 2654435761u;
+	while (true)
+	{
+		if (tryRunOne(index))
+			continue;
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		sleeping++;
+		wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+		sleeping--;
+		if (stopping && queued.load() == 0)
+			return;
+	}
+}
+
+std::vector<JobWorkerStats> JobSystem::stats() const
+{
+	std::vector<JobWorkerStats> result(queues.size());
+	for (size_t i = 0; i < queues.size(); i++)
+	{
+		result[i].jobs = queues[i]->executed.load();
+		result[i].steals = queues[i]->steals.load();
+		result[i].busySeconds = queues[i]->busyNanoseconds.load() * 1e-9;
+	}
+	return result;
+}
+
+void JobSystem::resetStats()
+{
+	for (auto& queue : queues)
+	{
+		queue->executed = 0;
+		queue->steals = 0;
+		queue->busyNanoseconds = 0;
+	}
+	statsStart = std::chrono::high_resolution_clock::now();
+}
+
+void JobSystem::printStats() const
+{
+	double wall = secondsSince(statsStart);
+	std::vector<JobWorkerStats> s = stats();
+	uint64_t jobs = 0, steals = 0;
+	double busy = 0.0;
+	for (const JobWorkerStats& worker : s)
+	{
+		jobs += worker.jobs;
+		steals += worker.steals;
+		busy += worker.busySeconds;
+	}
+	printf("Jobs: %u workers, %llu jobs, %llu stolen, %.1f%% average worker utilization over %.1f s\n",
+		workerCount(), (unsigned long long)jobs, (unsigned long long)steals,
+		workerCount() ? (busy - s[0].busySeconds) / (wall * workerCount()) * 100.0 : 0.0, wall);
+	for (size_t i = 0; i < s.size(); i++)
+		printf("  %s %2zu: %8llu jobs, %7llu stolen, %5.1f%% busy\n", i ? "worker" : "caller", i,
+			(unsigned long long)s[i].jobs, (unsigned long long)s[i].steals, s[i].busySeconds / wall * 100.0);
+}
+
+// Synthetic job of roughly fixed cost
+static float spin(size_t iterations, float seed)
+{
+	float x = seed;
+	for (size_t i = 0; i < iterations; i++)
+		x = x * 0.999f + std::sqrt(x + 1.0f);
+	return x;
+}
+
+void benchmarkJobSystem()
+{
+	const size_t items = 1 << 14;
+	const size_t work = 2000;
+	std::vector<float> out(items);
+
+	auto t_start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < items; i++)
+		out[i] = spin(work, float(i));
+	double serial = secondsSince(t_start);
+	printf("Serial: %zu items in %.1f ms\n", items, serial * 1e3);
+
+	unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned threads = 1; ; threads = std::min(threads * 2, cores))
+	{
+		JobSystem jobs(threads - 1);
+
+		// Uniform parallel-for
+		t_start = std::chrono::high_resolution_clock::now();
+		jobs.parallelFor(items, 64, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+				out[i] = spin(work, float(i));
+		});
+		double uniform = secondsSince(t_start);
+
+		// Skewed tree of jobs spawning jobs: a few heavy items make static
+		// splitting fall apart, stealing evens it out
+		JobCounter counter;
+		t_start = std::chrono::high_resolution_clock::now();
+		std::function<void(size_t, size_t)> split = [&](size_t begin, size_t end)
+		{
+			if (end - begin > 64)
+			{
+				size_t middle = (begin + end) / 2;
+				jobs.run([&split, begin, middle] { split(begin, middle); }, &counter);
+				jobs.run([&split, middle, end] { split(middle, end); }, &counter);
+				return;
+			}
+			for (size_t i = begin; i < end; i++)
+				out[i] = spin(i % 97 == 0 ? work * 20 : work, float(i));
+		};
+		jobs.run([&split] { split(0, items); }, &counter);
+		jobs.wait(counter);
+		double skewed = secondsSince(t_start);
+
+		// Tiny jobs show the per-job overhead
+		const size_t tinyJobs = 100000;
+		std::atomic<uint32_t> sum(0);
+		JobCounter tiny;
+		t_start = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < tinyJobs; i++)
+			jobs.run([&sum] { sum++; }, &tiny);
+		jobs.wait(tiny);
+		double overhead = secondsSince(t_start);
+
+		printf("%2u threads: parallel-for %.1f ms (%.1fx), skewed spawn tree %.1f ms, %.2f us per empty job\n",
+			threads, uniform * 1e3, serial / uniform, skewed * 1e3, overhead / tinyJobs * 1e6);
+		if (threads == cores)
+		{
+			jobs.printStats();
+			break;
+		}
+	}
+}
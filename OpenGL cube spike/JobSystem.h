@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of jobs still to finish. Jobs queued after a counter only start
+// once it reaches zero, which is how dependencies between stages are expressed.
+class JobCounter
+{
+public:
+	JobCounter() : pending(0) {}
+	bool done() const { return pending.load() == 0; }
+
+private:
+	friend class JobSystem;
+	struct Continuation
+	{
+		std::function<void()> fn;
+		JobCounter* counter;
+	};
+	std::atomic<uint32_t> pending;
+	std::mutex mutex;
+	std::vector<Continuation> continuations;
+};
+
+struct JobWorkerStats
+{
+	uint64_t jobs = 0;
+	uint64_t steals = 0;		// Jobs taken from another thread's deque
+	double busySeconds = 0.0;
+};
+
+// Work-stealing scheduler. Every worker owns a deque: it pushes and pops
+// its own jobs at the back, idle workers steal the oldest job from the front
+// of someone else's. Jobs queued from other threads go to a shared deque.
+// A thread waiting on a counter runs queued jobs instead of blocking, so
+// jobs may wait on jobs they spawned.
+class JobSystem
+{
+public:
+	// With no workers, jobs only run inside wait() and parallelFor()
+	explicit JobSystem(unsigned workerCount = defaultWorkerCount());
+	// One per core besides the calling thread, and at least one
+	static unsigned defaultWorkerCount();
+	~JobSystem();
+
+	unsigned workerCount() const { return unsigned(workers.size()); }
+
+	// counter is incremented now and decremented when fn returns
+	void run(std::function<void()> fn, JobCounter* counter = nullptr);
+	// Queue fn once dependency reaches zero
+	void runAfter(JobCounter& dependency, std::function<void()> fn, JobCounter* counter = nullptr);
+	// Run queued jobs on the calling thread until counter reaches zero
+	void wait(JobCounter& counter);
+
+	// body(begin, end) over [0, count) in ranges of at most grain items; returns when all are done
+	void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+	// Index 0 is every thread outside the pool, then one entry per worker
+	std::vector<JobWorkerStats> stats() const;
+	void resetStats();
+	void printStats() const;
+
+private:
+	struct Job
+	{
+		std::function<void()> fn;
+		JobCounter* counter;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+		std::atomic<uint64_t> executed;
+		std::atomic<uint64_t> steals;
+		std::atomic<uint64_t> busyNanoseconds;
+		Queue() : executed(0), steals(0), busyNanoseconds(0) {}
+	};
+
+	void push(Job job);
+	bool tryRunOne(unsigned self);
+	void execute(Job& job, unsigned self, bool stolen);
+	void finish(JobCounter* counter);
+	void workerLoop(unsigned index);
+	unsigned currentIndex() const;
+
+	// queues[0] is shared by outside threads, queues[i] belongs to worker i
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+
+	std::atomic<uint32_t> queued;
+	std::atomic<uint32_t> sleeping;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool stopping = false;
+	std::chrono::high_resolution_clock::time_point statsStart;
+};
@@ -0,0 +1,103 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const char* path)
+{
+	close();
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+	HANDLE view = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!view)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+	bytes = static_cast<const unsigned char*>(MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0));
+	if (!bytes)
+	{
+		CloseHandle(view);
+		CloseHandle(handle);
+		return false;
+	}
+	file = handle;
+	mapping = view;
+	length = size_t(fileSize.QuadPart);
+#else
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void* view = mmap(NULL, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);	// The mapping keeps the file referenced
+	if (view == MAP_FAILED)
+		return false;
+	bytes = static_cast<const unsigned char*>(view);
+	length = size_t(info.st_size);
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (!bytes)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(bytes);
+	CloseHandle(mapping);
+	CloseHandle(file);
+	mapping = file = nullptr;
+#else
+	munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+	bytes = nullptr;
+	length = 0;
+}
+
+bool statFile(const char* path, FileStamp& stamp)
+{
+	stamp = FileStamp();
+#ifdef _WIN32
+	// Windows keeps no inode change time, so creation time stands in for it
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data))
+		return false;
+	stamp.size = uint64_t(data.nFileSizeHigh) << 32 | data.nFileSizeLow;
+	stamp.modifiedTime = (uint64_t(data.ftLastWriteTime.dwHighDateTime) << 32 | data.ftLastWriteTime.dwLowDateTime) * 100;
+	stamp.changeTime = (uint64_t(data.ftCreationTime.dwHighDateTime) << 32 | data.ftCreationTime.dwLowDateTime) * 100;
+#else
+	struct stat info;
+	if (stat(path, &info) != 0)
+		return false;
+	stamp.size = uint64_t(info.st_size);
+#ifdef __APPLE__
+	stamp.modifiedTime = uint64_t(info.st_mtimespec.tv_sec) * 1000000000 + uint64_t(info.st_mtimespec.tv_nsec);
+	stamp.changeTime = uint64_t(info.st_ctimespec.tv_sec) * 1000000000 + uint64_t(info.st_ctimespec.tv_nsec);
+#else
+	stamp.modifiedTime = uint64_t(info.st_mtim.tv_sec) * 1000000000 + uint64_t(info.st_mtim.tv_nsec);
+	stamp.changeTime = uint64_t(info.st_ctim.tv_sec) * 1000000000 + uint64_t(info.st_ctim.tv_nsec);
+#endif
+#endif
+	return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile() { close(); }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const char* path);
+	void close();
+
+	const unsigned char* data() const { return bytes; }
+	size_t size() const { return length; }
+	bool isOpen() const { return bytes != nullptr; }
+
+private:
+	const unsigned char* bytes = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
+
+// What a file was when last read, to tell whether it has changed since.
+// Times are in nanoseconds; the change time also moves when a copy or
+// archive tool puts the modification time back.
+struct FileStamp
+{
+	uint64_t size = 0;
+	uint64_t modifiedTime = 0;
+	uint64_t changeTime = 0;
+
+	bool operator==(const FileStamp& other) const
+	{
+		return size == other.size && modifiedTime == other.modifiedTime && changeTime == other.changeTime;
+	}
+	bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+// False if the file can't be found, leaving stamp zeroed
+bool statFile(const char* path, FileStamp& stamp);
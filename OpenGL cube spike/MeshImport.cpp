@@ -0,0 +1,1253 @@
+#include "MeshImport.h"
+#include "Benchmark.h"
+#include "RenderStats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <glm/gtc/matrix_transform.hpp>
+
+static uint64_t alignTo(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void writeSection(FILE* file, uint64_t offset, const void* data, size_t size)
+{
+	static const char zeros[64] = {};
+	long position = ftell(file);
+	while (uint64_t(position) < offset)
+	{
+		size_t padding = size_t(std::min<uint64_t>(offset - position, sizeof(zeros)));
+		fwrite(zeros, 1, padding, file);
+		position += long(padding);
+	}
+	if (size)
+		fwrite(data, 1, size, file);
+}
+
+static bool endsWith(const char* text, const char* suffix)
+{
+	size_t length = strlen(text), suffixLength = strlen(suffix);
+	if (length < suffixLength)
+		return false;
+	for (size_t i = 0; i < suffixLength; i++)
+	{
+		if (tolower(text[length - suffixLength + i]) != suffix[i])
+			return false;
+	}
+	return true;
+}
+
+// Area weighted vertex normals; the cross product's length is twice the triangle's area
+static std::vector<glm::vec3> triangleNormals(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& triangles)
+{
+	std::vector<glm::vec3> normals(positions.size(), glm::vec3(0.0f));
+	for (size_t i = 0; i + 2 < triangles.size(); i += 3)
+	{
+		uint32_t a = triangles[i], b = triangles[i + 1], c = triangles[i + 2];
+		glm::vec3 n = glm::cross(positions[b] - positions[a], positions[c] - positions[a]);
+		normals[a] += n;
+		normals[b] += n;
+		normals[c] += n;
+	}
+	for (glm::vec3& n : normals)
+	{
+		float length = glm::length(n);
+		n = length > 0.0f ? n / length : glm::vec3(0.0f, 0.0f, 1.0f);
+	}
+	return normals;
+}
+
+// OBJ tokenizing. strtod and sscanf dominate naive loaders, so numbers are
+// read by hand; the last digits of long mantissas are dropped.
+
+static const char* skipSpaces(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
+
+static const char* parseFloat(const char* p, const char* end, float& out)
+{
+	static const double powers[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	p = skipSpaces(p, end);
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any = false;
+	for (; p < end && unsigned(*p - '0') < 10; p++, any = true)
+	{
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + unsigned(*p - '0');
+			digits += mantissa != 0;
+		}
+		else
+			exponent++;
+	}
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && unsigned(*p - '0') < 10; p++, any = true)
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + unsigned(*p - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+	if (!any)
+		return nullptr;
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* q = p + 1;
+		bool negativeExponent = false;
+		if (q < end && (*q == '-' || *q == '+'))
+			negativeExponent = *q++ == '-';
+		int value = 0;
+		bool exponentDigits = false;
+		for (; q < end && unsigned(*q - '0') < 10; q++, exponentDigits = true)
+			value = std::min(value * 10 + (*q - '0'), 1000);
+		if (exponentDigits)
+		{
+			exponent += negativeExponent ? -value : value;
+			p = q;
+		}
+	}
+
+	double value = double(mantissa);
+	if (exponent < 0)
+		value = -exponent <= 22 ? value / powers[-exponent] : value * std::pow(10.0, exponent);
+	else if (exponent > 0)
+		value = exponent <= 22 ? value * powers[exponent] : value * std::pow(10.0, exponent);
+	out = float(negative ? -value : value);
+	return p;
+}
+
+static const char* parseInt(const char* p, const char* end, int32_t& out)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	const char* start = p;
+	int64_t value = 0;
+	for (; p < end && unsigned(*p - '0') < 10; p++)
+		value = std::min<int64_t>(value * 10 + (*p - '0'), INT32_MAX);
+	if (p == start)
+		return nullptr;
+	out = int32_t(negative ? -value : value);
+	return p;
+}
+
+// Indices are made 0-based while tokenizing. Negative ones count back from
+// the last element defined before the face, which is only known relative to
+// the chunk until the chunks before it have been counted.
+enum
+{
+	RELATIVE_V = 1,
+	RELATIVE_VT = 2,
+	RELATIVE_VN = 4
+};
+
+struct ObjCorner
+{
+	int32_t v, vt, vn;		// -1 when absent
+	uint32_t relative;		// RELATIVE_* bits for indices still local to the chunk
+};
+
+struct ObjChunk
+{
+	const char* begin;
+	const char* end;
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> texcoords;
+	std::vector<glm::vec3> normals;
+	std::vector<ObjCorner> corners;	// Three per triangle
+	size_t positionBase, texcoordBase, normalBase, cornerBase;
+	const char* failedLine = nullptr;
+};
+
+static const char* parseCornerIndex(const char* p, const char* end, size_t localCount, uint32_t relativeBit,
+	int32_t& index, uint32_t& relative)
+{
+	int32_t value;
+	p = parseInt(p, end, value);
+	if (!p || value == 0)
+		return nullptr;
+	if (value > 0)
+		index = value - 1;
+	else
+	{
+		index = int32_t(localCount) + value;
+		relative |= relativeBit;
+	}
+	return p;
+}
+
+static void parseObjChunk(ObjChunk& chunk)
+{
+	const char* p = chunk.begin;
+	std::vector<ObjCorner> polygon;
+	bool failed = false;
+	while (p < chunk.end && !failed)
+	{
+		const char* eol = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+		if (!eol)
+			eol = chunk.end;
+		p = skipSpaces(p, eol);
+
+		if (eol - p > 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			glm::vec3 v;
+			const char* q = p + 1;
+			for (int i = 0; i < 3 && q; i++)
+				q = parseFloat(q, eol, v[i]);
+			failed = !q;
+			chunk.positions.push_back(v);
+		}
+		else if (eol - p > 3 && p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t'))
+		{
+			// The second coordinate is optional, the third is ignored
+			glm::vec2 t(0.0f);
+			const char* q = parseFloat(p + 2, eol, t.x);
+			if (q && !parseFloat(q, eol, t.y))
+				t.y = 0.0f;
+			failed = !q;
+			chunk.texcoords.push_back(t);
+		}
+		else if (eol - p > 3 && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t'))
+		{
+			glm::vec3 n;
+			const char* q = p + 2;
+			for (int i = 0; i < 3 && q; i++)
+				q = parseFloat(q, eol, n[i]);
+			failed = !q;
+			chunk.normals.push_back(n);
+		}
+		else if (eol - p > 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			// v, v/vt, v//vn or v/vt/vn per corner; polygons become fans
+			polygon.clear();
+			const char* q = p + 1;
+			while (true)
+			{
+				q = skipSpaces(q, eol);
+				if (q == eol || *q == '\r' || *q == '#')
+					break;
+				ObjCorner corner = { -1, -1, -1, 0 };
+				q = parseCornerIndex(q, eol, chunk.positions.size(), RELATIVE_V, corner.v, corner.relative);
+				if (q && q < eol && *q == '/')
+				{
+					q++;
+					if (q < eol && *q != '/')
+						q = parseCornerIndex(q, eol, chunk.texcoords.size(), RELATIVE_VT, corner.vt, corner.relative);
+					if (q && q < eol && *q == '/')
+						q = parseCornerIndex(q + 1, eol, chunk.normals.size(), RELATIVE_VN, corner.vn, corner.relative);
+				}
+				if (!q)
+				{
+					failed = true;
+					break;
+				}
+				polygon.push_back(corner);
+			}
+			for (size_t i = 1; i + 1 < polygon.size(); i++)
+			{
+				chunk.corners.push_back(polygon[0]);
+				chunk.corners.push_back(polygon[i]);
+				chunk.corners.push_back(polygon[i + 1]);
+			}
+		}
+		// Groups, materials, smoothing groups, lines and comments are skipped
+
+		if (failed)
+			chunk.failedLine = p;
+		p = eol + 1;
+	}
+}
+
+static bool resolveIndex(int32_t& index, uint32_t relative, uint32_t bit, size_t base, size_t count, bool optional)
+{
+	if (relative & bit)
+		index += int32_t(base);
+	if (index < 0)
+		return optional && !(relative & bit) && index == -1;
+	return size_t(index) < count;
+}
+
+bool MeshImporter::parseObj(const char* path, MeshData& mesh)
+{
+	MappedFile file;
+	if (!file.open(path))
+	{
+		fprintf(stderr, "%s: could not open\n", path);
+		return false;
+	}
+	counters.sourceBytes = file.size();
+
+	// Chunks end after a newline, so no line is split between two jobs
+	auto t_start = std::chrono::high_resolution_clock::now();
+	const size_t chunkBytes = 1 << 20;
+	const char* text = reinterpret_cast<const char*>(file.data());
+	const char* textEnd = text + file.size();
+	std::vector<ObjChunk> chunks;
+	for (const char* begin = text; begin < textEnd; )
+	{
+		const char* end = begin + std::min<size_t>(chunkBytes, textEnd - begin);
+		const char* eol = end < textEnd ? static_cast<const char*>(memchr(end, '\n', textEnd - end)) : nullptr;
+		end = eol ? eol + 1 : textEnd;
+		chunks.push_back(ObjChunk());
+		chunks.back().begin = begin;
+		chunks.back().end = end;
+		begin = end;
+	}
+	jobs.parallelFor(chunks.size(), 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			parseObjChunk(chunks[i]);
+	});
+
+	size_t positionCount = 0, texcoordCount = 0, normalCount = 0, cornerCount = 0;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		ObjChunk& chunk = chunks[i];
+		if (chunk.failedLine)
+		{
+			size_t line = 1 + std::count(text, chunk.failedLine, '\n');
+			fprintf(stderr, "%s(%zu): malformed line\n", path, line);
+			return false;
+		}
+		chunk.positionBase = positionCount;
+		chunk.texcoordBase = texcoordCount;
+		chunk.normalBase = normalCount;
+		chunk.cornerBase = cornerCount;
+		positionCount += chunk.positions.size();
+		texcoordCount += chunk.texcoords.size();
+		normalCount += chunk.normals.size();
+		cornerCount += chunk.corners.size();
+	}
+	if (!cornerCount || cornerCount > UINT32_MAX)
+	{
+		fprintf(stderr, "%s: %s\n", path, cornerCount ? "too many triangles" : "no faces");
+		return false;
+	}
+
+	// Make the indices global and gather the pieces
+	std::vector<glm::vec3> positions(positionCount), normals(normalCount);
+	std::vector<glm::vec2> texcoords(texcoordCount);
+	std::vector<ObjCorner> corners(cornerCount);
+	std::atomic<bool> badIndex(false);
+	jobs.parallelFor(chunks.size(), 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			ObjChunk& chunk = chunks[i];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionBase);
+			std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), texcoords.begin() + chunk.texcoordBase);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normalBase);
+			for (size_t j = 0; j < chunk.corners.size(); j++)
+			{
+				ObjCorner corner = chunk.corners[j];
+				if (!resolveIndex(corner.v, corner.relative, RELATIVE_V, chunk.positionBase, positionCount, false) ||
+					!resolveIndex(corner.vt, corner.relative, RELATIVE_VT, chunk.texcoordBase, texcoordCount, true) ||
+					!resolveIndex(corner.vn, corner.relative, RELATIVE_VN, chunk.normalBase, normalCount, true))
+					badIndex = true;
+				corners[chunk.cornerBase + j] = corner;
+			}
+			chunk = ObjChunk();
+		}
+	});
+	file.close();
+	counters.parseSeconds = secondsSince(t_start);
+	if (badIndex)
+	{
+		fprintf(stderr, "%s: face index out of range\n", path);
+		return false;
+	}
+
+	// Weld corners with the same position, texcoord and normal through an
+	// open addressing table of vertex index + 1
+	t_start = std::chrono::high_resolution_clock::now();
+	std::vector<ObjCorner> unique;
+	unique.reserve(positionCount + positionCount / 4);
+	std::vector<uint32_t> table;
+	size_t mask = 0;
+	auto hash = [](const ObjCorner& c)
+	{
+		uint32_t h = uint32_t(c.v) * 0x9E3779B1u ^ uint32_t(c.vt) * 0x85EBCA77u ^ uint32_t(c.vn) * 0xC2B2AE3Du;
+		return h ^ (h >> 15);
+	};
+	auto grow = [&]
+	{
+		size_t capacity = 1024;
+		while (capacity < unique.size() * 2 + positionCount)
+			capacity *= 2;
+		table.assign(capacity, 0);
+		mask = capacity - 1;
+		for (size_t i = 0; i < unique.size(); i++)
+		{
+			size_t slot = hash(unique[i]) & mask;
+			while (table[slot])
+				slot = (slot + 1) & mask;
+			table[slot] = uint32_t(i + 1);
+		}
+	};
+	grow();
+
+	mesh = MeshData();
+	mesh.indices.resize(cornerCount);
+	bool missingNormals = false;
+	for (size_t i = 0; i < cornerCount; i++)
+	{
+		const ObjCorner& corner = corners[i];
+		size_t slot = hash(corner) & mask;
+		while (true)
+		{
+			uint32_t entry = table[slot];
+			if (!entry)
+			{
+				unique.push_back(corner);
+				table[slot] = uint32_t(unique.size());
+				mesh.indices[i] = uint32_t(unique.size() - 1);
+				missingNormals |= corner.vn < 0;
+				if (unique.size() * 2 > table.size())
+					grow();
+				break;
+			}
+			const ObjCorner& other = unique[entry - 1];
+			if (other.v == corner.v && other.vt == corner.vt && other.vn == corner.vn)
+			{
+				mesh.indices[i] = entry - 1;
+				break;
+			}
+			slot = (slot + 1) & mask;
+		}
+	}
+
+	// Generated normals are shared by every corner at a position, so texture
+	// seams don't show up as shading seams
+	std::vector<glm::vec3> generated;
+	if (missingNormals)
+	{
+		std::vector<uint32_t> triangles(cornerCount);
+		for (size_t i = 0; i < cornerCount; i++)
+			triangles[i] = uint32_t(corners[i].v);
+		generated = triangleNormals(positions, triangles);
+	}
+
+	// OBJ puts the texture origin at the bottom left
+	mesh.positions.resize(unique.size());
+	mesh.normals.resize(unique.size());
+	mesh.texcoords.resize(unique.size());
+	for (size_t i = 0; i < unique.size(); i++)
+	{
+		const ObjCorner& corner = unique[i];
+		mesh.positions[i] = positions[corner.v];
+		mesh.normals[i] = corner.vn >= 0 ? normals[corner.vn] : generated[corner.v];
+		mesh.texcoords[i] = corner.vt >= 0 ? glm::vec2(texcoords[corner.vt].x, 1.0f - texcoords[corner.vt].y) : glm::vec2(0.0f);
+	}
+	counters.buildSeconds = secondsSince(t_start);
+	return true;
+}
+
+// Just enough JSON for a glTF document, parsed into a tree
+struct GltfJson
+{
+	enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+	Type type = NUL;
+	double value = 0.0;
+	std::string text;
+	std::vector<std::string> keys;	// Member names of objects, parallel to items
+	std::vector<GltfJson> items;
+
+	const GltfJson* get(const char* key) const
+	{
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			if (keys[i] == key)
+				return &items[i];
+		}
+		return nullptr;
+	}
+	const GltfJson* at(double index) const
+	{
+		return type == ARRAY && index >= 0.0 && index < double(items.size()) ? &items[size_t(index)] : nullptr;
+	}
+	double number(const char* key, double fallback) const
+	{
+		const GltfJson* member = get(key);
+		return member && member->type == NUMBER ? member->value : fallback;
+	}
+};
+
+struct GltfJsonParser
+{
+	const char* p;
+	const char* end;
+	bool ok;
+
+	GltfJsonParser(const char* begin, const char* end) : p(begin), end(end), ok(true) {}
+
+	void skip() { while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++; }
+	bool literal(const char* word)
+	{
+		size_t length = strlen(word);
+		if (size_t(end - p) < length || memcmp(p, word, length) != 0)
+			return false;
+		p += length;
+		return true;
+	}
+	std::string string()
+	{
+		std::string value;
+		p++;
+		while (p < end && *p != '"')
+		{
+			if (*p == '\\' && p + 1 < end)
+			{
+				p++;
+				if (*p == 'u')
+				{
+					p = std::min(p + 4, end - 1);
+					value += '?';
+				}
+				else
+					value += *p == 'n' ? '\n' : *p == 't' ? '\t' : *p;
+			}
+			else
+				value += *p;
+			p++;
+		}
+		if (p < end)
+			p++;
+		else
+			ok = false;
+		return value;
+	}
+	void parse(GltfJson& out, int depth)
+	{
+		skip();
+		if (p >= end || depth > 64)
+		{
+			ok = false;
+			return;
+		}
+		if (*p == '{' || *p == '[')
+		{
+			bool object = *p == '{';
+			char close = object ? '}' : ']';
+			out.type = object ? GltfJson::OBJECT : GltfJson::ARRAY;
+			p++;
+			skip();
+			if (p < end && *p == close)
+			{
+				p++;
+				return;
+			}
+			while (ok)
+			{
+				skip();
+				if (object)
+				{
+					if (p >= end || *p != '"')
+					{
+						ok = false;
+						return;
+					}
+					out.keys.push_back(string());
+					skip();
+					if (p >= end || *p++ != ':')
+						ok = false;
+				}
+				out.items.push_back(GltfJson());
+				parse(out.items.back(), depth + 1);
+				skip();
+				if (p < end && *p == ',')
+					p++;
+				else if (p < end && *p == close)
+				{
+					p++;
+					return;
+				}
+				else
+					ok = false;
+			}
+		}
+		else if (*p == '"')
+		{
+			out.type = GltfJson::STRING;
+			out.text = string();
+		}
+		else if (literal("true") || literal("false"))
+		{
+			out.type = GltfJson::BOOLEAN;
+			out.value = p[-1] == 'e' && p[-2] == 'u' ? 1.0 : 0.0;
+		}
+		else if (literal("null"))
+			out.type = GltfJson::NUL;
+		else
+		{
+			char* next;
+			out.type = GltfJson::NUMBER;
+			out.value = strtod(p, &next);
+			if (next == p)
+				ok = false;
+			p = next;
+		}
+	}
+};
+
+const uint32_t GLB_MAGIC = 0x46546C67;		// "glTF"
+const uint32_t GLB_JSON_CHUNK = 0x4E4F534A;
+const uint32_t GLB_BIN_CHUNK = 0x004E4942;
+
+// Reads accessors of the one buffer a .glb carries
+struct GltfBuffers
+{
+	const GltfJson* accessors;
+	const GltfJson* bufferViews;
+	const unsigned char* bin;
+	size_t binSize;
+
+	// A count, stride or byte offset from the JSON; false unless it is a
+	// whole number the buffer could hold, so converting it is defined
+	bool byteCount(const GltfJson* object, const char* key, size_t& out) const
+	{
+		double value = object->number(key, 0.0);
+		if (!(value >= 0.0 && value <= double(binSize)) || value != std::floor(value))
+			return false;
+		out = size_t(value);
+		return true;
+	}
+
+	// Locates an accessor's elements; false if it isn't components wide or doesn't fit the buffer
+	bool locate(double index, int components, const unsigned char*& data, size_t& count, size_t& stride, int& componentType, bool& normalized) const
+	{
+		const GltfJson* accessor = accessors ? accessors->at(index) : nullptr;
+		if (!accessor || accessor->get("sparse"))
+			return false;
+		const GltfJson* view = bufferViews ? bufferViews->at(accessor->number("bufferView", -1.0)) : nullptr;
+		const GltfJson* type = accessor->get("type");
+		if (!view || !type || view->number("buffer", 0.0) != 0.0)
+			return false;
+		static const char* types[] = { "SCALAR", "VEC2", "VEC3", "VEC4" };
+		if (type->text != types[components - 1])
+			return false;
+
+		double typeNumber = accessor->number("componentType", 0.0);
+		componentType = typeNumber >= 0.0 && typeNumber <= 65535.0 ? int(typeNumber) : 0;
+		size_t componentSize;
+		switch (componentType)
+		{
+		case GL_BYTE: case GL_UNSIGNED_BYTE: componentSize = 1; break;
+		case GL_SHORT: case GL_UNSIGNED_SHORT: componentSize = 2; break;
+		case GL_UNSIGNED_INT: case GL_FLOAT: componentSize = 4; break;
+		default: return false;
+		}
+		const GltfJson* normalizedFlag = accessor->get("normalized");
+		normalized = normalizedFlag && normalizedFlag->value != 0.0;
+
+		size_t viewOffset, viewLength, accessorOffset;
+		if (!byteCount(accessor, "count", count) || !byteCount(view, "byteStride", stride) ||
+			!byteCount(view, "byteOffset", viewOffset) || !byteCount(view, "byteLength", viewLength) ||
+			!byteCount(accessor, "byteOffset", accessorOffset))
+			return false;
+		size_t elementSize = components * componentSize;
+		if (!stride)
+			stride = elementSize;
+
+		// Each step compares against the room left, so no sum can wrap
+		if (viewLength > binSize - viewOffset || accessorOffset > viewLength)
+			return false;
+		size_t room = viewLength - accessorOffset;
+		if (count && (elementSize > room || count - 1 > (room - elementSize) / stride))
+			return false;
+		data = bin + viewOffset + accessorOffset;
+		return true;
+	}
+
+	bool readFloats(double index, int components, float* out, size_t expectedCount) const
+	{
+		const unsigned char* data;
+		size_t count, stride;
+		int componentType;
+		bool normalized;
+		if (!locate(index, components, data, count, stride, componentType, normalized) || count != expectedCount)
+			return false;
+		for (size_t i = 0; i < count; i++, data += stride)
+		{
+			for (int c = 0; c < components; c++)
+			{
+				float value;
+				switch (componentType)
+				{
+				case GL_FLOAT: memcpy(&value, data + c * 4, 4); break;
+				case GL_UNSIGNED_BYTE: value = data[c] / (normalized ? 255.0f : 1.0f); break;
+				case GL_BYTE: value = normalized ? std::max(int8_t(data[c]) / 127.0f, -1.0f) : float(int8_t(data[c])); break;
+				case GL_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, data + c * 2, 2); value = v / (normalized ? 65535.0f : 1.0f); break; }
+				case GL_SHORT: { int16_t v; memcpy(&v, data + c * 2, 2); value = normalized ? std::max(v / 32767.0f, -1.0f) : float(v); break; }
+				default: return false;
+				}
+				*out++ = value;
+			}
+		}
+		return true;
+	}
+};
+
+bool MeshImporter::parseGlb(const char* path, MeshData& mesh)
+{
+	MappedFile file;
+	if (!file.open(path))
+	{
+		fprintf(stderr, "%s: could not open\n", path);
+		return false;
+	}
+	counters.sourceBytes = file.size();
+	auto t_start = std::chrono::high_resolution_clock::now();
+
+	// Header, then a JSON chunk and an optional binary chunk, 4-byte aligned
+	const unsigned char* data = file.data();
+	uint32_t words[5] = {};
+	if (file.size() >= sizeof(words))
+		memcpy(words, data, sizeof(words));
+	if (words[0] != GLB_MAGIC || words[1] != 2 || words[2] > file.size() || words[4] != GLB_JSON_CHUNK ||
+		20 + uint64_t(words[3]) > words[2])
+	{
+		fprintf(stderr, "%s: not a glTF 2.0 binary\n", path);
+		return false;
+	}
+	size_t fileLength = words[2];
+	const char* json = reinterpret_cast<const char*>(data + 20);
+	GltfBuffers buffers = {};
+	size_t binChunk = alignTo(20 + words[3], 4);
+	if (binChunk + 8 <= fileLength)
+	{
+		uint32_t chunk[2];
+		memcpy(chunk, data + binChunk, sizeof(chunk));
+		if (chunk[1] == GLB_BIN_CHUNK && binChunk + 8 + chunk[0] <= fileLength)
+		{
+			buffers.bin = data + binChunk + 8;
+			buffers.binSize = chunk[0];
+		}
+	}
+
+	GltfJson root;
+	GltfJsonParser parser(json, json + words[3]);
+	parser.parse(root, 0);
+	const GltfJson* meshes = root.get("meshes");
+	buffers.accessors = root.get("accessors");
+	buffers.bufferViews = root.get("bufferViews");
+	if (!parser.ok || !meshes || meshes->type != GltfJson::ARRAY)
+	{
+		fprintf(stderr, "%s: %s\n", path, parser.ok ? "no meshes" : "malformed JSON");
+		return false;
+	}
+
+	mesh = MeshData();
+	bool missingNormals = false;
+	bool failed = false;
+	for (const GltfJson& item : meshes->items)
+	{
+		const GltfJson* primitives = item.get("primitives");
+		if (!primitives)
+			continue;
+		for (const GltfJson& primitive : primitives->items)
+		{
+			const GltfJson* attributes = primitive.get("attributes");
+			if (primitive.number("mode", 4.0) != 4.0 || !attributes || !attributes->get("POSITION"))
+				continue;	// Only triangle lists
+
+			size_t base = mesh.positions.size();
+			const unsigned char* elements;
+			size_t count, stride;
+			int componentType;
+			bool normalized;
+			if (!buffers.locate(attributes->number("POSITION", -1.0), 3, elements, count, stride, componentType, normalized))
+			{
+				failed = true;
+				break;
+			}
+			mesh.positions.resize(base + count);
+			mesh.normals.resize(base + count, glm::vec3(0.0f));
+			mesh.texcoords.resize(base + count, glm::vec2(0.0f));
+			failed |= !buffers.readFloats(attributes->number("POSITION", -1.0), 3, &mesh.positions[base].x, count);
+			if (attributes->get("NORMAL"))
+				failed |= !buffers.readFloats(attributes->number("NORMAL", -1.0), 3, &mesh.normals[base].x, count);
+			else
+				missingNormals = true;
+			if (attributes->get("TEXCOORD_0"))
+				failed |= !buffers.readFloats(attributes->number("TEXCOORD_0", -1.0), 2, &mesh.texcoords[base].x, count);
+
+			if (primitive.get("indices"))
+			{
+				const unsigned char* indices;
+				size_t indexCount;
+				if (!buffers.locate(primitive.number("indices", -1.0), 1, indices, indexCount, stride, componentType, normalized))
+				{
+					failed = true;
+					break;
+				}
+				for (size_t i = 0; i < indexCount; i++, indices += stride)
+				{
+					uint32_t index = 0;
+					if (componentType == GL_UNSIGNED_BYTE)
+						index = indices[0];
+					else if (componentType == GL_UNSIGNED_SHORT)
+					{
+						uint16_t value;
+						memcpy(&value, indices, 2);
+						index = value;
+					}
+					else if (componentType == GL_UNSIGNED_INT)
+						memcpy(&index, indices, 4);
+					else
+						failed = true;
+					failed |= index >= count;
+					mesh.indices.push_back(uint32_t(base + index));
+				}
+				mesh.indices.resize(mesh.indices.size() - indexCount % 3);
+			}
+			else
+			{
+				for (size_t i = 0; i + count % 3 < count; i++)
+					mesh.indices.push_back(uint32_t(base + i));
+			}
+		}
+		if (failed)
+			break;
+	}
+	counters.parseSeconds = secondsSince(t_start);
+	if (failed || mesh.indices.empty() || mesh.positions.size() > UINT32_MAX)
+	{
+		fprintf(stderr, "%s: %s\n", path, failed ? "bad accessor" : "no triangles");
+		return false;
+	}
+
+	t_start = std::chrono::high_resolution_clock::now();
+	if (missingNormals)
+	{
+		std::vector<glm::vec3> generated = triangleNormals(mesh.positions, mesh.indices);
+		for (size_t i = 0; i < mesh.normals.size(); i++)
+		{
+			if (mesh.normals[i] == glm::vec3(0.0f))
+				mesh.normals[i] = generated[i];
+		}
+	}
+	counters.buildSeconds = secondsSince(t_start);
+	return true;
+}
+
+bool MeshImporter::parse(const char* path, MeshData& mesh)
+{
+	if (endsWith(path, ".glb"))
+		return parseGlb(path, mesh);
+	if (endsWith(path, ".obj"))
+		return parseObj(path, mesh);
+	fprintf(stderr, "%s: only .obj and .glb meshes can be imported\n", path);
+	return false;
+}
+
+static uint32_t packSnorm10(float value)
+{
+	return uint32_t(int32_t(std::round(glm::clamp(value, -1.0f, 1.0f) * 511.0f))) & 0x3FF;
+}
+
+bool MeshImporter::writeCache(const char* path, const MeshData& mesh, const FileStamp& source)
+{
+	auto t_start = std::chrono::high_resolution_clock::now();
+	size_t vertexCount = mesh.positions.size();
+	glm::vec3 lo(INFINITY), hi(-INFINITY);
+	for (const glm::vec3& p : mesh.positions)
+	{
+		lo = glm::min(lo, p);
+		hi = glm::max(hi, p);
+	}
+	glm::vec3 center = (lo + hi) * 0.5f;
+	glm::vec3 scale = 1.0f / glm::max((hi - lo) * 0.5f, glm::vec3(1e-20f));
+
+	std::vector<MeshVertex> vertices(vertexCount);
+	jobs.parallelFor(vertexCount, 16384, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			glm::vec3 p = glm::clamp((mesh.positions[i] - center) * scale, -1.0f, 1.0f) * 32767.0f;
+			glm::vec3 n = mesh.normals[i];
+			MeshVertex& v = vertices[i];
+			v.position[0] = int16_t(std::round(p.x));
+			v.position[1] = int16_t(std::round(p.y));
+			v.position[2] = int16_t(std::round(p.z));
+			v.position[3] = 0;
+			v.normal = packSnorm10(n.x) | packSnorm10(n.y) << 10 | packSnorm10(n.z) << 20;
+			v.texcoord = glm::packHalf2x16(mesh.texcoords[i]);
+		}
+	});
+
+	MeshHeader header = {};
+	header.magic = MESH_MAGIC;
+	header.version = MESH_VERSION;
+	header.vertexCount = uint32_t(vertexCount);
+	header.indexCount = uint32_t(mesh.indices.size());
+	header.indexSize = vertexCount <= 0x10000 ? 2 : 4;
+	for (int i = 0; i < 3; i++)
+	{
+		header.boundsMin[i] = lo[i];
+		header.boundsMax[i] = hi[i];
+	}
+	header.sourceSize = source.size;
+	header.sourceTime = source.modifiedTime;
+	header.sourceChangeTime = source.changeTime;
+	header.verticesOffset = alignTo(sizeof(MeshHeader), 64);
+	header.indicesOffset = alignTo(header.verticesOffset + vertexCount * sizeof(MeshVertex), 64);
+	header.fileSize = header.indicesOffset + mesh.indices.size() * header.indexSize;
+
+	std::vector<uint16_t> shortIndices;
+	if (header.indexSize == 2)
+		shortIndices.assign(mesh.indices.begin(), mesh.indices.end());
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+	fwrite(&header, sizeof(header), 1, file);
+	writeSection(file, header.verticesOffset, vertices.data(), vertices.size() * sizeof(MeshVertex));
+	if (header.indexSize == 2)
+		writeSection(file, header.indicesOffset, shortIndices.data(), shortIndices.size() * 2);
+	else
+		writeSection(file, header.indicesOffset, mesh.indices.data(), mesh.indices.size() * 4);
+	bool ok = ftell(file) == long(header.fileSize);
+	fclose(file);
+	counters.writeSeconds = secondsSince(t_start);
+	return ok;
+}
+
+bool MeshImporter::import(const char* sourcePath, const char* cachePath, MeshFile& mesh)
+{
+	counters = MeshImportStats();
+
+	// Without the source any cache will do, so shipped caches load on their own
+	FileStamp source;
+	bool haveSource = statFile(sourcePath, source);
+	auto t_start = std::chrono::high_resolution_clock::now();
+	if (mesh.open(cachePath) && (!haveSource || mesh.sourceStamp() == source))
+	{
+		counters.loadSeconds = secondsSince(t_start);
+		counters.cached = true;
+		counters.sourceBytes = source.size;
+		counters.vertexCount = mesh.vertexCount();
+		counters.triangleCount = mesh.indexCount() / 3;
+		return true;
+	}
+	mesh.close();
+	if (!haveSource)
+	{
+		fprintf(stderr, "%s: not found\n", sourcePath);
+		return false;
+	}
+
+	MeshData data;
+	if (!parse(sourcePath, data))
+		return false;
+	counters.vertexCount = uint32_t(data.positions.size());
+	counters.triangleCount = uint32_t(data.indices.size() / 3);
+	if (!writeCache(cachePath, data, source))
+	{
+		fprintf(stderr, "%s: could not write the cache\n", cachePath);
+		return false;
+	}
+	t_start = std::chrono::high_resolution_clock::now();
+	bool ok = mesh.open(cachePath);
+	counters.loadSeconds = secondsSince(t_start);
+	return ok;
+}
+
+void MeshImporter::printStats() const
+{
+	if (counters.cached)
+	{
+		printf("Mesh: %u vertices, %u triangles, loaded from cache in %.2f ms\n",
+			counters.vertexCount, counters.triangleCount, counters.loadSeconds * 1e3);
+		return;
+	}
+	double megabytes = counters.sourceBytes / (1024.0 * 1024.0);
+	printf("Mesh: %u vertices, %u triangles, %.1f MB parsed in %.1f ms (%.0f MB/s), built in %.1f ms, "
+		"cache written in %.1f ms, mapped in %.2f ms\n",
+		counters.vertexCount, counters.triangleCount, megabytes, counters.parseSeconds * 1e3,
+		megabytes / std::max(counters.parseSeconds, 1e-9), counters.buildSeconds * 1e3,
+		counters.writeSeconds * 1e3, counters.loadSeconds * 1e3);
+}
+
+// In one pass the compiler can vectorize, as open() reads every index
+template <typename T>
+static uint32_t largestIndex(const unsigned char* data, uint32_t count)
+{
+	const T* indices = reinterpret_cast<const T*>(data);
+	T largest = 0;
+	for (uint32_t i = 0; i < count; i++)
+		largest = std::max(largest, indices[i]);
+	return largest;
+}
+
+bool MeshFile::open(const char* path)
+{
+	close();
+	if (!file.open(path))
+		return false;
+
+	const MeshHeader* h = reinterpret_cast<const MeshHeader*>(file.data());
+	const char* error = nullptr;
+	if (file.size() < sizeof(MeshHeader) || h->magic != MESH_MAGIC)
+		error = "not a mesh file";
+	else if (h->version != MESH_VERSION)
+		error = "unsupported version";
+	else if (h->fileSize != file.size())
+		error = "truncated";
+	else if ((h->indexSize != 2 && h->indexSize != 4) || h->indexCount % 3 ||
+		(h->indexSize == 2 && h->vertexCount > 0x10000))
+		error = "bad index format";
+	else if (h->verticesOffset > h->indicesOffset || h->vertexCount > (h->indicesOffset - h->verticesOffset) / sizeof(MeshVertex) ||
+		h->indicesOffset > h->fileSize || h->indexCount > (h->fileSize - h->indicesOffset) / h->indexSize ||
+		(h->verticesOffset | h->indicesOffset) % 16)
+		error = "bad section table";
+	// The draw reads whatever vertex an index names
+	else if (h->indexCount && (h->indexSize == 2 ?
+		largestIndex<uint16_t>(file.data() + h->indicesOffset, h->indexCount) :
+		largestIndex<uint32_t>(file.data() + h->indicesOffset, h->indexCount)) >= h->vertexCount)
+		error = "index out of range";
+
+	if (error)
+	{
+		fprintf(stderr, "%s: %s\n", path, error);
+		file.close();
+		return false;
+	}
+	header = h;
+	glm::vec3 lo(h->boundsMin[0], h->boundsMin[1], h->boundsMin[2]);
+	glm::vec3 hi(h->boundsMax[0], h->boundsMax[1], h->boundsMax[2]);
+	center = (lo + hi) * 0.5f;
+	halfSize = glm::max((hi - lo) * 0.5f, glm::vec3(1e-20f));
+	return true;
+}
+
+glm::mat4 MeshFile::boundsTransform() const
+{
+	return glm::scale(glm::translate(glm::mat4(), center), halfSize);
+}
+
+glm::mat4 MeshFile::unitCubeTransform() const
+{
+	float largest = std::max(halfSize.x, std::max(halfSize.y, halfSize.z));
+	return glm::scale(glm::mat4(), halfSize * (0.5f / largest));
+}
+
+void MeshFile::upload(GLint positionLocation, GLint texcoordLocation, GLint normalLocation)
+{
+	destroy();
+	glGenBuffers(2, buffers);
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+	glBufferData(GL_ARRAY_BUFFER, header->vertexCount * sizeof(MeshVertex), vertices(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, size_t(header->indexCount) * header->indexSize, indices(), GL_STATIC_DRAW);
+	renderStats.add(RENDER_BUFFER_BYTES, header->vertexCount * sizeof(MeshVertex) + size_t(header->indexCount) * header->indexSize);
+
+	if (positionLocation >= 0)
+	{
+		glVertexAttribPointer(positionLocation, 3, GL_SHORT, GL_TRUE, sizeof(MeshVertex), reinterpret_cast<void*>(offsetof(MeshVertex, position)));
+		glEnableVertexAttribArray(positionLocation);
+	}
+	if (normalLocation >= 0)
+	{
+		glVertexAttribPointer(normalLocation, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(MeshVertex), reinterpret_cast<void*>(offsetof(MeshVertex, normal)));
+		glEnableVertexAttribArray(normalLocation);
+	}
+	if (texcoordLocation >= 0)
+	{
+		glVertexAttribPointer(texcoordLocation, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(MeshVertex), reinterpret_cast<void*>(offsetof(MeshVertex, texcoord)));
+		glEnableVertexAttribArray(texcoordLocation);
+	}
+	drawCount = GLsizei(header->indexCount);
+	indexType = header->indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+void MeshFile::draw() const
+{
+	glDrawElements(GL_TRIANGLES, drawCount, indexType, 0);
+	renderStats.draw(GL_TRIANGLES, drawCount);
+}
+
+void MeshFile::destroy()
+{
+	if (buffers[0])
+		glDeleteBuffers(2, buffers);
+	buffers[0] = buffers[1] = 0;
+	drawCount = 0;
+}
+
+// UV sphere with v/vt/vn on every corner, written the way exporters do
+static bool writeSphereObj(const char* path, int slices, int stacks)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+	fprintf(file, "# Benchmark sphere\no sphere\n");
+	const float pi = 3.14159265f;
+	for (int y = 0; y <= stacks; y++)
+	{
+		for (int x = 0; x <= slices; x++)
+		{
+			float theta = pi * y / stacks, phi = 2.0f * pi * x / slices;
+			float nx = sinf(theta) * cosf(phi), ny = sinf(theta) * sinf(phi), nz = cosf(theta);
+			fprintf(file, "v %.6f %.6f %.6f\nvt %.6f %.6f\nvn %.4f %.4f %.4f\n",
+				nx * 2.5f, ny * 2.5f, nz * 2.5f, float(x) / slices, 1.0f - float(y) / stacks, nx, ny, nz);
+		}
+	}
+	for (int y = 0; y < stacks; y++)
+	{
+		for (int x = 0; x < slices; x++)
+		{
+			int a = y * (slices + 1) + x + 1, b = a + 1, c = a + slices + 2, d = a + slices + 1;
+			fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, d, d, d, c, c, c, b, b, b);
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+// Minimal .glb holding one primitive with float attributes and 32-bit indices
+static bool writeGlb(const char* path, const MeshData& mesh)
+{
+	size_t count = mesh.positions.size();
+	size_t positionBytes = count * 12, normalBytes = count * 12, texcoordBytes = count * 8;
+	size_t indexBytes = mesh.indices.size() * 4;
+	glm::vec3 lo(INFINITY), hi(-INFINITY);
+	for (const glm::vec3& p : mesh.positions)
+	{
+		lo = glm::min(lo, p);
+		hi = glm::max(hi, p);
+	}
+
+	char json[2048];
+	int length = snprintf(json, sizeof(json),
+		"{\"asset\":{\"version\":\"2.0\"},\"buffers\":[{\"byteLength\":%zu}],"
+		"\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,\"byteLength\":%zu},{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu},"
+		"{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu},{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu}],"
+		"\"accessors\":[{\"bufferView\":0,\"componentType\":5126,\"count\":%zu,\"type\":\"VEC3\",\"min\":[%g,%g,%g],\"max\":[%g,%g,%g]},"
+		"{\"bufferView\":1,\"componentType\":5126,\"count\":%zu,\"type\":\"VEC3\"},"
+		"{\"bufferView\":2,\"componentType\":5126,\"count\":%zu,\"type\":\"VEC2\"},"
+		"{\"bufferView\":3,\"componentType\":5125,\"count\":%zu,\"type\":\"SCALAR\"}],"
+		"\"meshes\":[{\"name\":\"sphere\",\"primitives\":[{\"attributes\":{\"POSITION\":0,\"NORMAL\":1,\"TEXCOORD_0\":2},\"indices\":3}]}]}",
+		positionBytes + normalBytes + texcoordBytes + indexBytes,
+		positionBytes, positionBytes, normalBytes, positionBytes + normalBytes, texcoordBytes,
+		positionBytes + normalBytes + texcoordBytes, indexBytes,
+		count, lo.x, lo.y, lo.z, hi.x, hi.y, hi.z, count, count, mesh.indices.size());
+	std::string text(json, length);
+	while (text.size() % 4)
+		text += ' ';
+
+	uint32_t binBytes = uint32_t(positionBytes + normalBytes + texcoordBytes + indexBytes);
+	uint32_t header[5] = { GLB_MAGIC, 2, uint32_t(12 + 8 + text.size() + 8 + binBytes), uint32_t(text.size()), GLB_JSON_CHUNK };
+	uint32_t binHeader[2] = { binBytes, GLB_BIN_CHUNK };
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+	fwrite(header, sizeof(header), 1, file);
+	fwrite(text.data(), 1, text.size(), file);
+	fwrite(binHeader, sizeof(binHeader), 1, file);
+	fwrite(mesh.positions.data(), 1, positionBytes, file);
+	fwrite(mesh.normals.data(), 1, normalBytes, file);
+	fwrite(mesh.texcoords.data(), 1, texcoordBytes, file);
+	fwrite(mesh.indices.data(), 1, indexBytes, file);
+	bool ok = ftell(file) == long(header[2]);
+	fclose(file);
+	return ok;
+}
+
+void benchmarkMeshImport()
+{
+	const char* objPath = "bench_mesh.obj";
+	const char* glbPath = "bench_mesh.glb";
+	const char* cachePath = "bench_mesh.obj.mesh";
+	if (!writeSphereObj(objPath, 1024, 512))
+	{
+		printf("Could not write the benchmark mesh\n");
+		return;
+	}
+
+	// Tokenizing scales with threads, welding is serial
+	unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+	MeshData data;
+	for (unsigned threads = 1; ; threads = std::min(threads * 2, cores))
+	{
+		JobSystem jobs(threads - 1);
+		MeshImporter importer(jobs);
+		bool ok = importer.parseObj(objPath, data);
+		const MeshImportStats& s = importer.stats();
+		printf("OBJ, %2u threads: %s, %.1f MB tokenized in %.1f ms (%.0f MB/s), welded in %.1f ms\n",
+			threads, ok ? "ok" : "FAILED", s.sourceBytes / (1024.0 * 1024.0), s.parseSeconds * 1e3,
+			s.sourceBytes / (1024.0 * 1024.0) / s.parseSeconds, s.buildSeconds * 1e3);
+		if (!ok)
+			return;
+		if (threads == cores)
+			break;
+	}
+	printf("%zu vertices, %zu triangles after welding\n", data.positions.size(), data.indices.size() / 3);
+
+	JobSystem jobs;
+	MeshImporter importer(jobs);
+	if (writeGlb(glbPath, data))
+	{
+		MeshData fromGlb;
+		bool ok = importer.parseGlb(glbPath, fromGlb) && fromGlb.indices == data.indices;
+		const MeshImportStats& s = importer.stats();
+		printf("GLB: %s, %.1f MB parsed in %.1f ms (%.0f MB/s)\n", ok ? "ok" : "FAILED",
+			s.sourceBytes / (1024.0 * 1024.0), s.parseSeconds * 1e3, s.sourceBytes / (1024.0 * 1024.0) / s.parseSeconds);
+	}
+
+	// Cold import writes the cache, the warm one only maps it
+	remove(cachePath);
+	MeshFile mesh;
+	auto t_start = std::chrono::high_resolution_clock::now();
+	bool coldOk = importer.import(objPath, cachePath, mesh);
+	double coldSeconds = secondsSince(t_start);
+	importer.printStats();
+	mesh.close();
+
+	t_start = std::chrono::high_resolution_clock::now();
+	bool warmOk = importer.import(objPath, cachePath, mesh) && importer.stats().cached;
+	double warmSeconds = secondsSince(t_start);
+	// Touch every page glBufferData would read
+	double checksum = 0.0;
+	t_start = std::chrono::high_resolution_clock::now();
+	if (warmOk)
+	{
+		for (uint32_t i = 0; i < mesh.vertexCount(); i += 256)
+			checksum += mesh.vertices()[i].position[0];
+		const unsigned char* indices = static_cast<const unsigned char*>(mesh.indices());
+		for (size_t i = 0; i < size_t(mesh.indexCount()) * mesh.indexSize(); i += 4096)
+			checksum += indices[i];
+	}
+	double touchSeconds = secondsSince(t_start);
+	printf("Cold import %s in %.1f ms, warm %s: lookup and map %.3f ms, first touch %.1f ms of %.1f MB (checksum %.0f), %.0fx faster\n",
+		coldOk ? "ok" : "FAILED", coldSeconds * 1e3, warmOk ? "ok" : "FAILED", warmSeconds * 1e3, touchSeconds * 1e3,
+		mesh.isOpen() ? mesh.byteSize() / (1024.0 * 1024.0) : 0.0, checksum, coldSeconds / (warmSeconds + touchSeconds));
+
+	mesh.close();
+	remove(objPath);
+	remove(glbPath);
+	remove(cachePath);
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "MappedFile.h"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// Cached mesh layout, version 2. Every section starts on a 64-byte boundary
+// so both can be handed to glBufferData straight from the mapping.
+//
+//   MeshHeader
+//   MeshVertex[vertexCount]
+//   uint16_t or uint32_t[indexCount]	triangle list
+
+const uint32_t MESH_MAGIC = 0x3148534D;	// "MSH1"
+const uint32_t MESH_VERSION = 2;
+
+struct MeshHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t indexSize;			// 2 or 4 bytes
+	uint32_t padding;
+	float boundsMin[3];
+	float boundsMax[3];
+	uint64_t sourceSize;		// FileStamp of the file the cache was built from
+	uint64_t sourceTime;
+	uint64_t sourceChangeTime;
+	uint64_t verticesOffset;
+	uint64_t indicesOffset;
+	uint64_t fileSize;
+};
+
+// Positions are snorm16 relative to the bounds, normals 2_10_10_10 snorm,
+// texcoords half floats with the origin at the top left like glTF
+struct MeshVertex
+{
+	int16_t position[4];
+	uint32_t normal;
+	uint32_t texcoord;
+};
+
+static_assert(sizeof(MeshHeader) == 96, "MeshHeader layout is part of the file format");
+static_assert(sizeof(MeshVertex) == 16, "MeshVertex layout is part of the file format");
+
+// Imported mesh in ordinary containers, before quantization
+struct MeshData
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> texcoords;
+	std::vector<uint32_t> indices;
+};
+
+// Memory-mapped cached mesh. open() only validates the header and section bounds.
+class MeshFile
+{
+public:
+	~MeshFile() { destroy(); }
+
+	bool open(const char* path);
+	void close() { file.close(); header = nullptr; }
+	bool isOpen() const { return header != nullptr; }
+
+	uint32_t vertexCount() const { return header->vertexCount; }
+	uint32_t indexCount() const { return header->indexCount; }
+	uint32_t indexSize() const { return header->indexSize; }
+	FileStamp sourceStamp() const
+	{
+		FileStamp stamp;
+		stamp.size = header->sourceSize;
+		stamp.modifiedTime = header->sourceTime;
+		stamp.changeTime = header->sourceChangeTime;
+		return stamp;
+	}
+	const MeshVertex* vertices() const { return reinterpret_cast<const MeshVertex*>(file.data() + header->verticesOffset); }
+	const void* indices() const { return file.data() + header->indicesOffset; }
+	size_t byteSize() const { return file.size(); }
+
+	// Undoes the position quantization, placing the mesh where the source had it
+	glm::mat4 boundsTransform() const;
+	// Centers the mesh and scales its largest side to 1, the size of the demo cube
+	glm::mat4 unitCubeTransform() const;
+
+	// Copies both sections from the mapping into new buffers and points the
+	// attributes of the bound VAO at them; the mapping may be closed afterwards.
+	// A negative location leaves that attribute alone.
+	void upload(GLint positionLocation, GLint texcoordLocation, GLint normalLocation = -1);
+	void draw() const;
+	void destroy();
+
+private:
+	MappedFile file;
+	const MeshHeader* header = nullptr;
+	glm::vec3 center;
+	glm::vec3 halfSize;
+	GLuint buffers[2] = {};
+	GLsizei drawCount = 0;
+	GLenum indexType = GL_UNSIGNED_INT;
+};
+
+struct MeshImportStats
+{
+	bool cached = false;			// Loaded from an up to date cache
+	uint64_t sourceBytes = 0;
+	uint32_t vertexCount = 0;
+	uint32_t triangleCount = 0;
+	double parseSeconds = 0.0;		// Tokenizing the source, on the job system for OBJ
+	double buildSeconds = 0.0;		// Resolving indices, welding corners and generating normals
+	double writeSeconds = 0.0;		// Quantizing and writing the cache
+	double loadSeconds = 0.0;		// Mapping and validating the cache
+};
+
+// Imports Wavefront OBJ and binary glTF (.glb) meshes. OBJ files are split
+// at line boundaries and the pieces tokenized by jobs; corners sharing
+// position, texcoord and normal are welded into one vertex. Every primitive
+// of every glTF mesh is merged, without node transforms. Missing normals
+// are generated from the triangles.
+class MeshImporter
+{
+public:
+	explicit MeshImporter(JobSystem& jobs) : jobs(jobs) {}
+
+	// Opens cachePath if it was built from sourcePath as it is now, otherwise
+	// imports sourcePath and rewrites the cache first
+	bool import(const char* sourcePath, const char* cachePath, MeshFile& mesh);
+
+	// Picks the parser from the extension
+	bool parse(const char* path, MeshData& mesh);
+	bool parseObj(const char* path, MeshData& mesh);
+	bool parseGlb(const char* path, MeshData& mesh);
+	bool writeCache(const char* path, const MeshData& mesh, const FileStamp& source);
+
+	const MeshImportStats& stats() const { return counters; }
+	void printStats() const;
+
+private:
+	JobSystem& jobs;
+	MeshImportStats counters;
+};
@@ -0,0 +1,435 @@
+#include "OcclusionCulling.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <glm/gtc/matrix_transform.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define OCCLUSION_SIMD 1
+#endif
+
+// Triangles per transform task and boxes per test task
+const unsigned TRIANGLES_PER_TASK = 256;
+const unsigned BOXES_PER_TASK = 512;
+
+OcclusionBox transformBox(const glm::mat4& model, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+	glm::vec3 worldCenter = glm::vec3(model * glm::vec4(center, 1.0f));
+	glm::vec3 worldExtent;
+	for (int row = 0; row < 3; row++)
+		worldExtent[row] = std::abs(model[0][row]) * extent.x + std::abs(model[1][row]) * extent.y + std::abs(model[2][row]) * extent.z;
+	OcclusionBox box = { worldCenter - worldExtent, worldCenter + worldExtent };
+	return box;
+}
+
+OcclusionCuller::OcclusionCuller(JobSystem& jobs, int width, int height)
+	: jobs(jobs)
+{
+	// Rows are rasterized 4 pixels at a time
+	width = (std::max(width, 4) + 3) & ~3;
+	height = std::max(height, 1);
+	while (true)
+	{
+		Level level;
+		level.width = width;
+		level.height = height;
+		level.nearest.assign(size_t(width) * height, 1.0f);
+		level.farthest.assign(size_t(width) * height, 1.0f);
+		levels.push_back(std::move(level));
+		if (width == 1 && height == 1)
+			break;
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+}
+
+void OcclusionCuller::parallelFor(unsigned taskCount, const std::function<void(unsigned)>& task)
+{
+	jobs.parallelFor(taskCount, 1, [&task](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			task(unsigned(i));
+	});
+}
+
+void OcclusionCuller::beginFrame(const glm::mat4& viewProj)
+{
+	this->viewProj = viewProj;
+	occluders.clear();
+	frame = OcclusionStats();
+	frames++;
+}
+
+void OcclusionCuller::addOccluder(const float* positions, size_t stride, uint32_t vertexCount, const glm::mat4& model)
+{
+	Occluder occluder;
+	occluder.positions = positions;
+	occluder.stride = stride;
+	occluder.firstTriangle = frame.occluderTriangles;
+	occluder.triangleCount = vertexCount / 3;
+	occluder.modelViewProj = viewProj * model;
+	occluders.push_back(occluder);
+	frame.occluders++;
+	frame.occluderTriangles += occluder.triangleCount;
+}
+
+void OcclusionCuller::transformTriangles(unsigned task)
+{
+	const int width = levels[0].width, height = levels[0].height;
+	uint32_t first = task * TRIANGLES_PER_TASK;
+	uint32_t last = std::min<uint32_t>(first + TRIANGLES_PER_TASK, uint32_t(triangles.size()));
+
+	// Occluder owning the first triangle of this task
+	size_t o = std::upper_bound(occluders.begin(), occluders.end(), first, [](uint32_t index, const Occluder& occluder)
+	{
+		return index < occluder.firstTriangle;
+	}) - occluders.begin() - 1;
+
+	for (uint32_t t = first; t < last; t++)
+	{
+		while (t >= occluders[o].firstTriangle + occluders[o].triangleCount)
+			o++;
+		const Occluder& occluder = occluders[o];
+		Triangle& tri = triangles[t];
+		tri.minY = 0;
+		tri.maxY = -1;
+
+		float x[3], y[3], z[3];
+		bool clipped = false;
+		for (int k = 0; k < 3; k++)
+		{
+			const float* p = occluder.positions + ((t - occluder.firstTriangle) * 3 + k) * occluder.stride;
+			glm::vec4 clip = occluder.modelViewProj * glm::vec4(p[0], p[1], p[2], 1.0f);
+			// Triangles reaching the near plane are dropped, which only loses occlusion
+			if (clip.w < 1e-5f || clip.z < -clip.w)
+			{
+				clipped = true;
+				break;
+			}
+			float invW = 1.0f / clip.w;
+			x[k] = (clip.x * invW * 0.5f + 0.5f) * width;
+			y[k] = (clip.y * invW * 0.5f + 0.5f) * height;
+			z[k] = clip.z * invW;
+		}
+		if (clipped)
+			continue;
+
+		// Either winding is accepted, so closed meshes need no consistent order
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+		if (std::abs(area) < 1e-6f)
+			continue;
+		if (area < 0.0f)
+		{
+			std::swap(x[1], x[2]);
+			std::swap(y[1], y[2]);
+			std::swap(z[1], z[2]);
+			area = -area;
+		}
+
+		tri.minX = std::max(0, int(std::floor(std::min(x[0], std::min(x[1], x[2])))));
+		tri.maxX = std::min(width - 1, int(std::ceil(std::max(x[0], std::max(x[1], x[2])))));
+		int minY = std::max(0, int(std::floor(std::min(y[0], std::min(y[1], y[2])))));
+		int maxY = std::min(height - 1, int(std::ceil(std::max(y[0], std::max(y[1], y[2])))));
+		if (tri.minX > tri.maxX || minY > maxY)
+			continue;
+
+		for (int e = 0; e < 3; e++)
+		{
+			int n = (e + 1) % 3;
+			tri.a[e] = y[e] - y[n];
+			tri.b[e] = x[n] - x[e];
+			tri.c[e] = -tri.a[e] * x[e] - tri.b[e] * y[e];
+		}
+		tri.zx = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+		tri.zy = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+		tri.zc = z[0] - tri.zx * x[0] - tri.zy * y[0];
+		tri.minY = minY;
+		tri.maxY = maxY;
+	}
+}
+
+void OcclusionCuller::rasterizeBand(unsigned band, bool simd)
+{
+	Level& target = levels[0];
+	const int y0 = int(band) * bandHeight;
+	const int y1 = std::min(y0 + bandHeight, target.height);
+	std::fill(target.farthest.begin() + size_t(y0) * target.width, target.farthest.begin() + size_t(y1) * target.width, 1.0f);
+
+	for (const Triangle& tri : triangles)
+	{
+		if (tri.maxY < y0 || tri.minY >= y1)
+			continue;
+		int rowBegin = std::max(tri.minY, y0), rowEnd = std::min(tri.maxY + 1, y1);
+		int xBegin = tri.minX & ~3;
+
+		for (int y = rowBegin; y < rowEnd; y++)
+		{
+			float* row = target.farthest.data() + size_t(y) * target.width;
+			float py = y + 0.5f;
+#ifdef OCCLUSION_SIMD
+			if (simd)
+			{
+				const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+				__m128 a0 = _mm_set1_ps(tri.a[0]), a1 = _mm_set1_ps(tri.a[1]), a2 = _mm_set1_ps(tri.a[2]);
+				__m128 zx = _mm_set1_ps(tri.zx);
+				__m128 r0 = _mm_set1_ps(tri.b[0] * py + tri.c[0]);
+				__m128 r1 = _mm_set1_ps(tri.b[1] * py + tri.c[1]);
+				__m128 r2 = _mm_set1_ps(tri.b[2] * py + tri.c[2]);
+				__m128 rz = _mm_set1_ps(tri.zy * py + tri.zc);
+				__m128 zero = _mm_setzero_ps();
+				for (int x = xBegin; x <= tri.maxX; x += 4)
+				{
+					__m128 px = _mm_add_ps(_mm_set1_ps(float(x)), lane);
+					__m128 inside = _mm_and_ps(
+						_mm_and_ps(_mm_cmpgt_ps(_mm_add_ps(_mm_mul_ps(a0, px), r0), zero),
+							_mm_cmpgt_ps(_mm_add_ps(_mm_mul_ps(a1, px), r1), zero)),
+						_mm_cmpgt_ps(_mm_add_ps(_mm_mul_ps(a2, px), r2), zero));
+					if (!_mm_movemask_ps(inside))
+						continue;
+					__m128 old = _mm_loadu_ps(row + x);
+					__m128 z = _mm_min_ps(old, _mm_add_ps(_mm_mul_ps(zx, px), rz));
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, old)));
+				}
+				continue;
+			}
+#endif
+			for (int x = xBegin; x <= tri.maxX; x++)
+			{
+				float px = x + 0.5f;
+				if (tri.a[0] * px + tri.b[0] * py + tri.c[0] > 0.0f &&
+					tri.a[1] * px + tri.b[1] * py + tri.c[1] > 0.0f &&
+					tri.a[2] * px + tri.b[2] * py + tri.c[2] > 0.0f)
+					row[x] = std::min(row[x], tri.zx * px + tri.zy * py + tri.zc);
+			}
+		}
+	}
+}
+
+void OcclusionCuller::buildHierarchy()
+{
+	levels[0].nearest = levels[0].farthest;
+	for (size_t l = 1; l < levels.size(); l++)
+	{
+		const Level& fine = levels[l - 1];
+		Level& coarse = levels[l];
+		for (int y = 0; y < coarse.height; y++)
+		{
+			int fy0 = y * 2, fy1 = std::min(y * 2 + 1, fine.height - 1);
+			for (int x = 0; x < coarse.width; x++)
+			{
+				int fx0 = x * 2, fx1 = std::min(x * 2 + 1, fine.width - 1);
+				size_t i00 = size_t(fy0) * fine.width + fx0, i01 = size_t(fy0) * fine.width + fx1;
+				size_t i10 = size_t(fy1) * fine.width + fx0, i11 = size_t(fy1) * fine.width + fx1;
+				size_t c = size_t(y) * coarse.width + x;
+				coarse.nearest[c] = std::min(std::min(fine.nearest[i00], fine.nearest[i01]), std::min(fine.nearest[i10], fine.nearest[i11]));
+				coarse.farthest[c] = std::max(std::max(fine.farthest[i00], fine.farthest[i01]), std::max(fine.farthest[i10], fine.farthest[i11]));
+			}
+		}
+	}
+}
+
+void OcclusionCuller::rasterize(bool simd)
+{
+	auto t_start = std::chrono::high_resolution_clock::now();
+
+	triangles.resize(frame.occluderTriangles);
+	unsigned transformTasks = unsigned((triangles.size() + TRIANGLES_PER_TASK - 1) / TRIANGLES_PER_TASK);
+	parallelFor(transformTasks, [this](unsigned task) { transformTriangles(task); });
+
+	uint32_t accepted = 0;
+	for (const Triangle& tri : triangles)
+		accepted += tri.maxY >= tri.minY;
+	frame.rasterizedTriangles = accepted;
+
+	// Bands own disjoint rows, so no two workers touch the same pixel
+	unsigned bands = unsigned((levels[0].height + bandHeight - 1) / bandHeight);
+	parallelFor(bands, [this, simd](unsigned band) { rasterizeBand(band, simd); });
+	buildHierarchy();
+
+	frame.rasterSeconds = secondsSince(t_start);
+	totalRasterSeconds += frame.rasterSeconds;
+}
+
+bool OcclusionCuller::testLevel(int level, int x0, int y0, int x1, int y1, float boxNear, float boxFar, bool& decided) const
+{
+	const Level& l = levels[level];
+	x0 >>= level; y0 >>= level; x1 >>= level; y1 >>= level;
+	bool visible = false;
+	for (int y = y0; y <= y1; y++)
+	{
+		for (int x = x0; x <= x1; x++)
+		{
+			size_t i = size_t(y) * l.width + x;
+			// Entirely in front of every occluder here
+			if (boxFar < l.nearest[i])
+			{
+				decided = true;
+				return true;
+			}
+			if (boxNear <= l.farthest[i])
+				visible = true;
+		}
+	}
+	decided = !visible;
+	return visible;
+}
+
+bool OcclusionCuller::isVisible(const OcclusionBox& box) const
+{
+	const Level& base = levels[0];
+	float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+	float boxNear = INFINITY, boxFar = -INFINITY;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		glm::vec4 p((corner & 1) ? box.max.x : box.min.x, (corner & 2) ? box.max.y : box.min.y, (corner & 4) ? box.max.z : box.min.z, 1.0f);
+		glm::vec4 clip = viewProj * p;
+		// Boxes crossing the near plane are never occluded
+		if (clip.w < 1e-5f || clip.z < -clip.w)
+			return true;
+		float invW = 1.0f / clip.w;
+		minX = std::min(minX, clip.x * invW);
+		maxX = std::max(maxX, clip.x * invW);
+		minY = std::min(minY, clip.y * invW);
+		maxY = std::max(maxY, clip.y * invW);
+		boxNear = std::min(boxNear, clip.z * invW);
+		boxFar = std::max(boxFar, clip.z * invW);
+	}
+
+	// Off screen boxes are left to frustum culling
+	float sx0 = (minX * 0.5f + 0.5f) * base.width, sx1 = (maxX * 0.5f + 0.5f) * base.width;
+	float sy0 = (minY * 0.5f + 0.5f) * base.height, sy1 = (maxY * 0.5f + 0.5f) * base.height;
+	if (sx1 < 0.0f || sy1 < 0.0f || sx0 >= base.width || sy0 >= base.height)
+		return true;
+	int x0 = std::max(0, int(sx0)), x1 = std::min(base.width - 1, int(sx1));
+	int y0 = std::max(0, int(sy0)), y1 = std::min(base.height - 1, int(sy1));
+
+	// Fine level covering the box with at most 4x4 texels, tried after a coarser pass
+	int extent = std::max(x1 - x0, y1 - y0);
+	int fine = 0;
+	while ((extent >> fine) > 3 && fine + 1 < int(levels.size()))
+		fine++;
+	int coarse = std::min(fine + 2, int(levels.size()) - 1);
+
+	bool decided = false;
+	bool visible = testLevel(coarse, x0, y0, x1, y1, boxNear, boxFar, decided);
+	if (decided || coarse == fine)
+		return visible;
+	return testLevel(fine, x0, y0, x1, y1, boxNear, boxFar, decided);
+}
+
+void OcclusionCuller::cullBoxes(const OcclusionBox* boxes, size_t count, uint8_t* visible)
+{
+	auto t_start = std::chrono::high_resolution_clock::now();
+
+	std::atomic<uint32_t> occluded(0);
+	unsigned tasks = unsigned((count + BOXES_PER_TASK - 1) / BOXES_PER_TASK);
+	parallelFor(tasks, [&](unsigned task)
+	{
+		size_t first = size_t(task) * BOXES_PER_TASK;
+		size_t last = std::min(first + BOXES_PER_TASK, count);
+		uint32_t hidden = 0;
+		for (size_t i = first; i < last; i++)
+		{
+			visible[i] = isVisible(boxes[i]) ? 1 : 0;
+			hidden += visible[i] == 0;
+		}
+		occluded += hidden;
+	});
+
+	double seconds = secondsSince(t_start);
+	frame.objectsTested += uint32_t(count);
+	frame.objectsOccluded += occluded;
+	frame.testSeconds += seconds;
+	totalTested += count;
+	totalOccluded += occluded;
+	totalTestSeconds += seconds;
+}
+
+void OcclusionCuller::printStats() const
+{
+	if (!frames)
+		return;
+	printf("Occlusion: %llu frames on %zu threads, %.1f%% of %.0f tested objects occluded per frame, raster %.2f ms + test %.2f ms per frame\n",
+		(unsigned long long)frames, size_t(jobs.workerCount()) + 1,
+		totalTested ? 100.0 * totalOccluded / totalTested : 0.0, double(totalTested) / frames,
+		totalRasterSeconds * 1e3 / frames, totalTestSeconds * 1e3 / frames);
+}
+
+// Unit cube as a triangle list
+static void cubeTriangles(std::vector<float>& positions)
+{
+	static const int faces[6][4] = {
+		{ 0, 2, 3, 1 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 }, { 2, 6, 7, 3 }, { 0, 4, 6, 2 }, { 1, 3, 7, 5 }
+	};
+	for (const int* face : faces)
+	{
+		const int corners[6] = { face[0], face[1], face[2], face[2], face[3], face[0] };
+		for (int corner : corners)
+		{
+			positions.push_back((corner & 1) ? 0.5f : -0.5f);
+			positions.push_back((corner & 2) ? 0.5f : -0.5f);
+			positions.push_back((corner & 4) ? 0.5f : -0.5f);
+		}
+	}
+}
+
+void benchmarkOcclusionCulling()
+{
+	// A city-like grid: large buildings close to the camera hide small props behind them
+	std::vector<float> cube;
+	cubeTriangles(cube);
+	glm::mat4 viewProj = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 1.0f, 500.0f) *
+		glm::lookAt(glm::vec3(0.0f, -20.0f, 2.0f), glm::vec3(0.0f, 100.0f, 2.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+
+	std::vector<glm::mat4> buildings;
+	for (int row = 0; row < 4; row++)
+		for (int column = -6; column <= 6; column++)
+			buildings.push_back(glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(column * 8.0f, row * 12.0f, 6.0f)), glm::vec3(6.0f, 6.0f, 12.0f)));
+
+	const size_t objectCount = 200000;
+	std::vector<OcclusionBox> boxes(objectCount);
+	srand(7);
+	for (OcclusionBox& box : boxes)
+	{
+		glm::vec3 center((rand() % 2000) * 0.1f - 100.0f, (rand() % 2000) * 0.2f - 10.0f, (rand() % 100) * 0.05f);
+		box.min = center - glm::vec3(0.3f);
+		box.max = center + glm::vec3(0.3f);
+	}
+	std::vector<uint8_t> visible(objectCount);
+
+	std::vector<unsigned> threadCounts(1, 1);
+	if (std::thread::hardware_concurrency() > 1)
+		threadCounts.push_back(std::thread::hardware_concurrency());
+	for (unsigned threads : threadCounts)
+	{
+		JobSystem jobs(threads - 1);
+		OcclusionCuller culler(jobs);
+		for (int simd = 1; simd >= 0; simd--)
+		{
+			const int frames = 20;
+			double raster = 0.0, test = 0.0;
+			for (int f = 0; f < frames; f++)
+			{
+				culler.beginFrame(viewProj);
+				for (const glm::mat4& model : buildings)
+					culler.addOccluder(cube.data(), 3, uint32_t(cube.size() / 3), model);
+				culler.rasterize(simd != 0);
+				culler.cullBoxes(boxes.data(), boxes.size(), visible.data());
+				raster += culler.stats().rasterSeconds;
+				test += culler.stats().testSeconds;
+			}
+			const OcclusionStats& stats = culler.stats();
+			printf("%u thread%s, %s: %u occluder triangles, raster %.3f ms, test %.2f ms (%.1f Mboxes/s), %u of %u occluded\n",
+				threads, threads > 1 ? "s" : " ", simd ? "SIMD  " : "scalar", stats.rasterizedTriangles,
+				raster * 1e3 / frames, test * 1e3 / frames, objectCount * frames / test * 1e-6,
+				stats.objectsOccluded, stats.objectsTested);
+		}
+	}
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "JobSystem.h"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// World-space axis aligned box
+struct OcclusionBox
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+// Bounds of a local box after transforming it by model
+OcclusionBox transformBox(const glm::mat4& model, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+struct OcclusionStats
+{
+	uint32_t occluders = 0;
+	uint32_t occluderTriangles = 0;
+	uint32_t rasterizedTriangles = 0;	// After near-plane and degenerate rejection
+	uint32_t objectsTested = 0;
+	uint32_t objectsOccluded = 0;
+	double rasterSeconds = 0.0;			// Transform, rasterization and hierarchy
+	double testSeconds = 0.0;
+};
+
+// Software occlusion culling. Occluder triangles are rasterized into a small
+// depth buffer, 4 pixels at a time, and reduced into a min/max hierarchy.
+// Boxes whose nearest point lies behind the farthest occluder depth over
+// their whole screen footprint are reported as occluded.
+// Depth is NDC z in [-1, 1]; the buffer is cleared to the far plane.
+class OcclusionCuller
+{
+public:
+	// Transform, raster and test tasks run on jobs
+	explicit OcclusionCuller(JobSystem& jobs, int width = 256, int height = 192);
+
+	// Start a frame with the proj * view the scene is drawn with
+	void beginFrame(const glm::mat4& viewProj);
+	// Triangle list, stride in floats between positions. The positions
+	// must stay alive until rasterize() returns.
+	void addOccluder(const float* positions, size_t stride, uint32_t vertexCount, const glm::mat4& model);
+	// simd = false runs the scalar reference path
+	void rasterize(bool simd = true);
+
+	// visible[i] is set to 0 for occluded boxes and 1 otherwise
+	void cullBoxes(const OcclusionBox* boxes, size_t count, uint8_t* visible);
+	bool isVisible(const OcclusionBox& box) const;
+
+	int width() const { return levels[0].width; }
+	int height() const { return levels[0].height; }
+	// Farthest occluder depth per pixel of hierarchy level 0
+	const float* depth() const { return levels[0].farthest.data(); }
+
+	const OcclusionStats& stats() const { return frame; }
+	void printStats() const;
+
+private:
+	struct Occluder
+	{
+		const float* positions;
+		size_t stride;
+		uint32_t firstTriangle;
+		uint32_t triangleCount;
+		glm::mat4 modelViewProj;
+	};
+
+	// Set up screen-space triangle: edge functions a * x + b * y + c are
+	// positive inside, depth is the plane zx * x + zy * y + zc
+	struct Triangle
+	{
+		float a[3], b[3], c[3];
+		float zx, zy, zc;
+		int minX, maxX;
+		int minY, maxY;		// Pixels covered, maxY < minY when rejected
+	};
+
+	struct Level
+	{
+		int width, height;
+		std::vector<float> nearest;
+		std::vector<float> farthest;
+	};
+
+	void transformTriangles(unsigned task);
+	void rasterizeBand(unsigned band, bool simd);
+	void buildHierarchy();
+	bool testLevel(int level, int x0, int y0, int x1, int y1, float boxNear, float boxFar, bool& decided) const;
+
+	// One call per task index, the calling thread takes part
+	void parallelFor(unsigned taskCount, const std::function<void(unsigned)>& task);
+
+	glm::mat4 viewProj;
+	std::vector<Occluder> occluders;
+	std::vector<Triangle> triangles;
+	std::vector<Level> levels;
+	int bandHeight = 8;
+
+	JobSystem& jobs;
+
+	OcclusionStats frame;
+	uint64_t frames = 0;
+	uint64_t totalTested = 0, totalOccluded = 0;
+	double totalRasterSeconds = 0.0, totalTestSeconds = 0.0;
+};
@@ -0,0 +1,138 @@
+#include "Reflection.h"
+#include "RenderStats.h"
+
+#include <algorithm>
+#include <cstring>
+#include <glm/gtc/matrix_inverse.hpp>
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static float sign(float value)
+{
+	return value > 0.0f ? 1.0f : value < 0.0f ? -1.0f : 0.0f;
+}
+
+// Replace the near plane of a perspective projection with an arbitrary
+// view-space clip plane (Lengyel, "Oblique View Frustum Depth Projection
+// and Clipping"). The camera must lie on the negative side of the plane.
+static glm::mat4 obliqueProjection(glm::mat4 proj, const glm::vec4& clipPlane)
+{
+	glm::vec4 q;
+	q.x = (sign(clipPlane.x) + proj[2][0]) / proj[0][0];
+	q.y = (sign(clipPlane.y) + proj[2][1]) / proj[1][1];
+	q.z = -1.0f;
+	q.w = (1.0f + proj[2][2]) / proj[3][2];
+
+	glm::vec4 c = clipPlane * (2.0f / glm::dot(clipPlane, q));
+	proj[0][2] = c.x;
+	proj[1][2] = c.y;
+	proj[2][2] = c.z + 1.0f;
+	proj[3][2] = c.w;
+	return proj;
+}
+
+PlanarReflection::PlanarReflection(int windowWidth, int windowHeight, int downscale)
+	: windowWidth(windowWidth), windowHeight(windowHeight)
+{
+	downscale = std::max(1, downscale);
+	targetWidth = std::max(1, windowWidth / downscale);
+	targetHeight = std::max(1, windowHeight / downscale);
+
+	glGenTextures(1, &colorTexture);
+	glBindTexture(GL_TEXTURE_2D, colorTexture);
+	renderStats.add(RENDER_TEXTURE_BINDS);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, targetWidth, targetHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, targetWidth, targetHeight);
+
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	setPlane(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
+}
+
+PlanarReflection::~PlanarReflection()
+{
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteRenderbuffers(1, &depthBuffer);
+	glDeleteTextures(1, &colorTexture);
+}
+
+void PlanarReflection::setPlane(const glm::vec4& newPlane)
+{
+	glm::vec3 n = glm::vec3(newPlane);
+	float length = glm::length(n);
+	plane = newPlane / length;
+	n = glm::vec3(plane);
+
+	// Householder reflection about the plane
+	mirrorMatrix = glm::mat4();
+	for (int c = 0; c < 3; c++)
+		for (int r = 0; r < 3; r++)
+			mirrorMatrix[c][r] -= 2.0f * n[r] * n[c];
+	for (int r = 0; r < 3; r++)
+		mirrorMatrix[3][r] = -2.0f * plane.w * n[r];
+
+	valid = false;
+}
+
+bool PlanarReflection::needsUpdate(const glm::mat4& view, const glm::mat4& proj, uint64_t contentHash)
+{
+	bool stale = !valid || contentHash != cachedContent ||
+		memcmp(&view, &cachedView, sizeof(view)) != 0 ||
+		memcmp(&proj, &cachedProj, sizeof(proj)) != 0;
+	if (!stale)
+	{
+		reuses++;
+		return false;
+	}
+
+	valid = true;
+	cachedView = view;
+	cachedProj = proj;
+	cachedContent = contentHash;
+	return true;
+}
+
+void PlanarReflection::begin(const glm::mat4& view, const glm::mat4& proj, glm::mat4& reflectedView, glm::mat4& obliqueProj)
+{
+	reflectedView = view * mirrorMatrix;
+
+	// Keep what lies behind the mirror once mirrored, in camera space
+	glm::vec4 clipPlane = glm::inverseTranspose(view) * -plane;
+	obliqueProj = obliqueProjection(proj, clipPlane);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, targetWidth, targetHeight);
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// Mirroring flips the winding of every triangle
+	glFrontFace(GL_CW);
+	renders++;
+}
+
+void PlanarReflection::end()
+{
+	glFrontFace(GL_CCW);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, windowWidth, windowHeight);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+
+// FNV-1a, used to detect changes in reflected content (e.g. model matrices)
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL);
+
+// Planar mirror rendered into a reduced-resolution texture instead of
+// redrawing the scene at full resolution through a stencil mask.
+// The texture is only re-rendered when the camera or the reflected content
+// changes; otherwise the previous image is sampled again. A reflected object
+// that moves every frame, like the spinning cube, re-renders every frame.
+class PlanarReflection
+{
+public:
+	// downscale 2 renders the mirror image at half the window resolution
+	PlanarReflection(int windowWidth, int windowHeight, int downscale = 2);
+	~PlanarReflection();
+
+	// Mirror plane (n, d) with dot(n, p) + d = 0; geometry on the side n points to is reflected
+	void setPlane(const glm::vec4& plane);
+	const glm::mat4& mirror() const { return mirrorMatrix; }
+
+	// True if the cached image does not match this camera and content
+	bool needsUpdate(const glm::mat4& view, const glm::mat4& proj, uint64_t contentHash);
+
+	// Bind the reflection target and compute the mirrored camera. The near
+	// plane of obliqueProj is the mirror plane, so geometry behind it is clipped.
+	void begin(const glm::mat4& view, const glm::mat4& proj, glm::mat4& reflectedView, glm::mat4& obliqueProj);
+	// Restore the default framebuffer and window viewport
+	void end();
+
+	GLuint texture() const { return colorTexture; }
+	int width() const { return targetWidth; }
+	int height() const { return targetHeight; }
+
+	uint64_t renderCount() const { return renders; }
+	uint64_t reuseCount() const { return reuses; }
+
+private:
+	int windowWidth, windowHeight;
+	int targetWidth, targetHeight;
+	GLuint framebuffer = 0, colorTexture = 0, depthBuffer = 0;
+
+	glm::vec4 plane;
+	glm::mat4 mirrorMatrix;
+
+	bool valid = false;
+	glm::mat4 cachedView, cachedProj;
+	uint64_t cachedContent = 0;
+	uint64_t renders = 0, reuses = 0;
+};
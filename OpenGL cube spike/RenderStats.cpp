@@ -0,0 +1,152 @@
+#include "RenderStats.h"
+
+#include <algorithm>
+#include <cstdio>
+
+RenderStats renderStats;
+
+static int histogramBucket(uint64_t value)
+{
+	int bucket = 0;
+	while (value && bucket < RENDER_HISTOGRAM_BUCKETS - 1)
+	{
+		value >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+RenderStats::RenderStats(size_t historySize)
+	: historySize(std::max<size_t>(historySize, 1))
+{
+	history.reserve(this->historySize);
+}
+
+void RenderStats::draw(GLenum mode, GLsizei vertexCount, GLsizei instanceCount)
+{
+	uint64_t primitives;
+	switch (mode)
+	{
+	case GL_TRIANGLES: primitives = vertexCount / 3; break;
+	case GL_TRIANGLE_STRIP: case GL_TRIANGLE_FAN: primitives = std::max(vertexCount - 2, 0); break;
+	case GL_LINES: primitives = vertexCount / 2; break;
+	case GL_LINE_STRIP: primitives = std::max(vertexCount - 1, 0); break;
+	default: primitives = vertexCount; break;
+	}
+	current[RENDER_DRAW_CALLS]++;
+	current[RENDER_PRIMITIVES] += primitives * std::max(instanceCount, 0);
+}
+
+void RenderStats::endFrame()
+{
+	if (history.size() < historySize)
+		history.push_back(current);
+	else
+	{
+		Frame& oldest = history[historyNext];
+		for (int i = 0; i < RENDER_COUNTER_COUNT; i++)
+			sums[i] -= oldest[i];
+		oldest = current;
+	}
+	historyNext = (historyNext + 1) % historySize;
+
+	for (int i = 0; i < RENDER_COUNTER_COUNT; i++)
+	{
+		sums[i] += current[i];
+		histograms[i][histogramBucket(current[i])]++;
+	}
+	current.fill(0);
+	frames++;
+}
+
+void RenderStats::reset()
+{
+	current.fill(0);
+	sums.fill(0);
+	history.clear();
+	historyNext = 0;
+	frames = 0;
+	std::fill(&histograms[0][0], &histograms[0][0] + RENDER_COUNTER_COUNT * RENDER_HISTOGRAM_BUCKETS, uint64_t(0));
+}
+
+uint64_t RenderStats::last(RenderCounter counter) const
+{
+	if (history.empty())
+		return 0;
+	return history[(historyNext + historySize - 1) % historySize][counter];
+}
+
+double RenderStats::average(RenderCounter counter) const
+{
+	return history.empty() ? 0.0 : double(sums[counter]) / history.size();
+}
+
+uint64_t RenderStats::peak(RenderCounter counter) const
+{
+	uint64_t value = 0;
+	for (const Frame& frame : history)
+		value = std::max(value, frame[counter]);
+	return value;
+}
+
+uint64_t RenderStats::percentile(RenderCounter counter, double fraction) const
+{
+	uint64_t wanted = uint64_t(fraction * frames + 0.5), seen = 0;
+	for (int bucket = 0; bucket < RENDER_HISTOGRAM_BUCKETS; bucket++)
+	{
+		seen += histograms[counter][bucket];
+		if (seen >= wanted && seen)
+			return bucket == RENDER_HISTOGRAM_BUCKETS - 1 ? UINT64_MAX : (uint64_t(1) << bucket) - 1;
+	}
+	return 0;
+}
+
+const char* RenderStats::name(RenderCounter counter)
+{
+	static const char* names[RENDER_COUNTER_COUNT] = {
+		"draw_calls", "primitives", "uniform_bytes", "buffer_bytes", "texture_uploads",
+		"texture_bytes", "program_binds", "texture_binds", "depth_state", "stencil_state"
+	};
+	return names[counter];
+}
+
+bool RenderStats::writeCsv(const char* path) const
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+		return false;
+	fprintf(file, "frame");
+	for (int i = 0; i < RENDER_COUNTER_COUNT; i++)
+		fprintf(file, ",%s", name(RenderCounter(i)));
+	fprintf(file, "\n");
+
+	size_t count = history.size();
+	size_t oldest = count < historySize ? 0 : historyNext;
+	for (size_t row = 0; row < count; row++)
+	{
+		const Frame& frame = history[(oldest + row) % historySize];
+		fprintf(file, "%llu", (unsigned long long)(frames - count + row));
+		for (int i = 0; i < RENDER_COUNTER_COUNT; i++)
+			fprintf(file, ",%llu", (unsigned long long)frame[i]);
+		fprintf(file, "\n");
+	}
+	bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+void RenderStats::printStats() const
+{
+	if (!frames)
+		return;
+	// Percentiles come from the all-time histogram, as the top of the bucket they fall in
+	printf("Render: %llu frames; average and worst of the last %zu, median and 95%% of all\n",
+		(unsigned long long)frames, history.size());
+	for (int i = 0; i < RENDER_COUNTER_COUNT; i++)
+	{
+		RenderCounter counter = RenderCounter(i);
+		printf("  %-16s %12.1f %12llu %12llu %12llu\n", name(counter), average(counter),
+			(unsigned long long)peak(counter), (unsigned long long)percentile(counter, 0.5),
+			(unsigned long long)percentile(counter, 0.95));
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum RenderCounter
+{
+	RENDER_DRAW_CALLS,
+	RENDER_PRIMITIVES,			// Triangles, lines or points, times instances
+	RENDER_UNIFORM_BYTES,
+	RENDER_BUFFER_BYTES,		// Buffer data uploaded, allocations without data don't count
+	RENDER_TEXTURE_UPLOADS,		// Texture levels specified with data
+	RENDER_TEXTURE_BYTES,
+	RENDER_PROGRAM_BINDS,
+	RENDER_TEXTURE_BINDS,
+	RENDER_DEPTH_STATE,			// Depth test, mask and function changes
+	RENDER_STENCIL_STATE,		// Stencil test, function, operation and mask changes
+	RENDER_COUNTER_COUNT
+};
+
+// Bucket 0 counts frames with a value of 0, bucket i values in [2^(i-1), 2^i)
+const int RENDER_HISTOGRAM_BUCKETS = 34;
+
+// Per-frame counters of the work submitted to GL. Code issuing GL calls
+// reports them with add() and draw(); endFrame() closes the frame, keeping
+// a window of recent frames for averages and CSV dumps and a log2 histogram
+// of every frame since the last reset. Only used from the render thread.
+class RenderStats
+{
+public:
+	explicit RenderStats(size_t historySize = 300);
+
+	void add(RenderCounter counter, uint64_t amount = 1) { current[counter] += amount; }
+	void draw(GLenum mode, GLsizei vertexCount, GLsizei instanceCount = 1);
+	void endFrame();
+	void reset();
+
+	uint64_t frameCount() const { return frames; }
+	// The last finished frame
+	uint64_t last(RenderCounter counter) const;
+	// Over the frames still in the window
+	double average(RenderCounter counter) const;
+	uint64_t peak(RenderCounter counter) const;
+	// Upper bound of the histogram bucket holding the given fraction of frames
+	uint64_t percentile(RenderCounter counter, double fraction) const;
+	const uint64_t* histogram(RenderCounter counter) const { return histograms[counter]; }
+
+	static const char* name(RenderCounter counter);
+
+	// One row per frame in the window, oldest first
+	bool writeCsv(const char* path) const;
+	void printStats() const;
+
+private:
+	typedef std::array<uint64_t, RENDER_COUNTER_COUNT> Frame;
+
+	Frame current = {};
+	std::vector<Frame> history;		// Ring of the last historySize frames
+	size_t historySize;
+	size_t historyNext = 0;
+	Frame sums = {};				// Of the frames in history
+	uint64_t frames = 0;
+	uint64_t histograms[RENDER_COUNTER_COUNT][RENDER_HISTOGRAM_BUCKETS] = {};
+};
+
+// Statistics of the one GL context, fed by every module that draws or uploads
+extern RenderStats renderStats;
@@ -0,0 +1,535 @@
+#include "SceneFile.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <glm/gtc/matrix_transform.hpp>
+
+static uint64_t alignTo(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+struct InstanceBounds
+{
+	glm::vec3 min, max, centroid;
+};
+
+static uint32_t buildNode(std::vector<SceneNode>& nodes, std::vector<uint32_t>& order,
+	const std::vector<InstanceBounds>& bounds, uint32_t begin, uint32_t end, uint32_t leafSize)
+{
+	uint32_t index = uint32_t(nodes.size());
+	nodes.push_back(SceneNode());
+
+	glm::vec3 lo(INFINITY), hi(-INFINITY), centroidLo(INFINITY), centroidHi(-INFINITY);
+	for (uint32_t i = begin; i < end; i++)
+	{
+		const InstanceBounds& b = bounds[order[i]];
+		lo = glm::min(lo, b.min);
+		hi = glm::max(hi, b.max);
+		centroidLo = glm::min(centroidLo, b.centroid);
+		centroidHi = glm::max(centroidHi, b.centroid);
+	}
+
+	SceneNode node = {};
+	memcpy(node.boundsMin, &lo[0], sizeof(node.boundsMin));
+	memcpy(node.boundsMax, &hi[0], sizeof(node.boundsMax));
+	node.firstInstance = begin;
+	node.instanceCount = end - begin;
+
+	if (end - begin > leafSize)
+	{
+		// Median split along the widest centroid axis
+		glm::vec3 extent = centroidHi - centroidLo;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		uint32_t middle = begin + (end - begin) / 2;
+		std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+			[&bounds, axis](uint32_t a, uint32_t b) { return bounds[a].centroid[axis] < bounds[b].centroid[axis]; });
+
+		buildNode(nodes, order, bounds, begin, middle, leafSize);
+		node.rightChild = buildNode(nodes, order, bounds, middle, end, leafSize);
+	}
+	nodes[index] = node;
+	return index;
+}
+
+void buildSceneNodes(SceneData& scene, uint32_t leafSize)
+{
+	size_t count = scene.instances.size();
+	std::vector<InstanceBounds> bounds(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const SceneMesh& mesh = scene.meshes[scene.instances[i].mesh];
+		glm::vec3 localMin = glm::vec3(mesh.boundsMin[0], mesh.boundsMin[1], mesh.boundsMin[2]);
+		glm::vec3 localMax = glm::vec3(mesh.boundsMax[0], mesh.boundsMax[1], mesh.boundsMax[2]);
+		glm::vec3 center = (localMin + localMax) * 0.5f;
+		glm::vec3 half = (localMax - localMin) * 0.5f;
+
+		// Transformed box, using the absolute rotation/scale to bound the corners
+		const glm::mat4& m = scene.transforms[i];
+		glm::vec3 worldCenter = glm::vec3(m * glm::vec4(center, 1.0f));
+		glm::vec3 worldHalf;
+		for (int r = 0; r < 3; r++)
+			worldHalf[r] = std::fabs(m[0][r]) * half.x + std::fabs(m[1][r]) * half.y + std::fabs(m[2][r]) * half.z;
+		bounds[i].min = worldCenter - worldHalf;
+		bounds[i].max = worldCenter + worldHalf;
+		bounds[i].centroid = worldCenter;
+	}
+
+	std::vector<uint32_t> order(count);
+	for (size_t i = 0; i < count; i++)
+		order[i] = uint32_t(i);
+
+	scene.nodes.clear();
+	if (count)
+		buildNode(scene.nodes, order, bounds, 0, uint32_t(count), std::max(1u, leafSize));
+
+	// Store instances in hierarchy order so every node is one contiguous range
+	std::vector<glm::mat4> transforms(count);
+	std::vector<SceneInstance> instances(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		transforms[i] = scene.transforms[order[i]];
+		instances[i] = scene.instances[order[i]];
+	}
+	scene.transforms.swap(transforms);
+	scene.instances.swap(instances);
+}
+
+static void writeSection(FILE* file, uint64_t offset, const void* data, size_t size)
+{
+	static const char zeros[64] = {};
+	long position = ftell(file);
+	while (uint64_t(position) < offset)
+	{
+		size_t padding = size_t(std::min<uint64_t>(offset - position, sizeof(zeros)));
+		fwrite(zeros, 1, padding, file);
+		position += long(padding);
+	}
+	if (size)
+		fwrite(data, 1, size, file);
+}
+
+bool writeScene(const char* path, SceneData& scene)
+{
+	if (scene.nodes.empty() && !scene.instances.empty())
+		buildSceneNodes(scene);
+
+	SceneHeader header = {};
+	header.magic = SCENE_MAGIC;
+	header.version = SCENE_VERSION;
+	header.meshCount = uint32_t(scene.meshes.size());
+	header.materialCount = uint32_t(scene.materials.size());
+	header.instanceCount = uint32_t(scene.instances.size());
+	header.nodeCount = uint32_t(scene.nodes.size());
+	header.meshesOffset = alignTo(sizeof(SceneHeader), 64);
+	header.materialsOffset = alignTo(header.meshesOffset + scene.meshes.size() * sizeof(SceneMesh), 64);
+	header.transformsOffset = alignTo(header.materialsOffset + scene.materials.size() * sizeof(SceneMaterial), 64);
+	header.instancesOffset = alignTo(header.transformsOffset + scene.transforms.size() * sizeof(glm::mat4), 64);
+	header.nodesOffset = alignTo(header.instancesOffset + scene.instances.size() * sizeof(SceneInstance), 64);
+	header.fileSize = header.nodesOffset + scene.nodes.size() * sizeof(SceneNode);
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+	fwrite(&header, sizeof(header), 1, file);
+	writeSection(file, header.meshesOffset, scene.meshes.data(), scene.meshes.size() * sizeof(SceneMesh));
+	writeSection(file, header.materialsOffset, scene.materials.data(), scene.materials.size() * sizeof(SceneMaterial));
+	writeSection(file, header.transformsOffset, scene.transforms.data(), scene.transforms.size() * sizeof(glm::mat4));
+	writeSection(file, header.instancesOffset, scene.instances.data(), scene.instances.size() * sizeof(SceneInstance));
+	writeSection(file, header.nodesOffset, scene.nodes.data(), scene.nodes.size() * sizeof(SceneNode));
+	bool ok = ftell(file) == long(header.fileSize);
+	fclose(file);
+	return ok;
+}
+
+// Whether count items at offset lie inside the file, without the sum wrapping
+static bool sectionFits(uint64_t offset, uint64_t count, uint64_t itemSize, uint64_t fileSize)
+{
+	return offset <= fileSize && count <= (fileSize - offset) / itemSize;
+}
+
+// Every index into another section in range, and the hierarchy walking
+// forward, so the arrays can be trusted without further checks
+static const char* checkIndices(const SceneHeader* h, const unsigned char* data)
+{
+	const SceneInstance* instances = reinterpret_cast<const SceneInstance*>(data + h->instancesOffset);
+	for (uint32_t i = 0; i < h->instanceCount; i++)
+	{
+		if (instances[i].mesh >= h->meshCount)
+			return "instance mesh out of range";
+		if (instances[i].material >= h->materialCount)
+			return "instance material out of range";
+	}
+	const SceneNode* nodes = reinterpret_cast<const SceneNode*>(data + h->nodesOffset);
+	for (uint32_t i = 0; i < h->nodeCount; i++)
+	{
+		const SceneNode& node = nodes[i];
+		if (uint64_t(node.firstInstance) + node.instanceCount > h->instanceCount)
+			return "node instances out of range";
+		if (node.rightChild && (node.rightChild <= i + 1 || node.rightChild >= h->nodeCount))
+			return "node child out of range";
+	}
+	return nullptr;
+}
+
+bool SceneFile::open(const char* path)
+{
+	close();
+	if (!file.open(path))
+		return false;
+
+	const SceneHeader* h = reinterpret_cast<const SceneHeader*>(file.data());
+	const char* error = nullptr;
+	if (file.size() < sizeof(SceneHeader) || h->magic != SCENE_MAGIC)
+		error = "not a scene file";
+	else if (h->version != SCENE_VERSION)
+		error = "unsupported version";
+	else if (h->fileSize != file.size())
+		error = "truncated";
+	else if (!sectionFits(h->meshesOffset, h->meshCount, sizeof(SceneMesh), h->fileSize) ||
+		!sectionFits(h->materialsOffset, h->materialCount, sizeof(SceneMaterial), h->fileSize) ||
+		!sectionFits(h->transformsOffset, h->instanceCount, sizeof(glm::mat4), h->fileSize) ||
+		!sectionFits(h->instancesOffset, h->instanceCount, sizeof(SceneInstance), h->fileSize) ||
+		!sectionFits(h->nodesOffset, h->nodeCount, sizeof(SceneNode), h->fileSize) ||
+		(h->meshesOffset | h->materialsOffset | h->transformsOffset | h->instancesOffset | h->nodesOffset) % 16)
+		error = "bad section table";
+	else
+		error = checkIndices(h, file.data());
+
+	if (error)
+	{
+		fprintf(stderr, "%s: %s\n", path, error);
+		file.close();
+		return false;
+	}
+	header = h;
+	return true;
+}
+
+void cullSceneNodes(const SceneNode* nodes, uint32_t nodeCount, const glm::mat4& viewProj, std::vector<SceneRange>& visible)
+{
+	visible.clear();
+	if (!nodeCount)
+		return;
+
+	// Frustum planes from the combined matrix (Gribb & Hartmann)
+	glm::vec4 planes[6];
+	glm::vec4 row[4];
+	for (int r = 0; r < 4; r++)
+		row[r] = glm::vec4(viewProj[0][r], viewProj[1][r], viewProj[2][r], viewProj[3][r]);
+	for (int i = 0; i < 3; i++)
+	{
+		planes[i * 2] = row[3] + row[i];
+		planes[i * 2 + 1] = row[3] - row[i];
+	}
+
+	auto emit = [&visible](uint32_t first, uint32_t count)
+	{
+		if (!visible.empty() && visible.back().first + visible.back().count == first)
+			visible.back().count += count;
+		else
+			visible.push_back({ first, count });
+	};
+
+	uint32_t stack[64];
+	int depth = 0;
+	stack[depth++] = 0;
+	while (depth)
+	{
+		const SceneNode& node = nodes[stack[--depth]];
+		bool inside = true, outside = false;
+		for (const glm::vec4& p : planes)
+		{
+			// Corner furthest along the plane normal, and the one opposite it
+			float furthest = p.w, nearest = p.w;
+			for (int a = 0; a < 3; a++)
+			{
+				furthest += p[a] * (p[a] > 0.0f ? node.boundsMax[a] : node.boundsMin[a]);
+				nearest += p[a] * (p[a] > 0.0f ? node.boundsMin[a] : node.boundsMax[a]);
+			}
+			if (furthest < 0.0f)
+			{
+				outside = true;
+				break;
+			}
+			if (nearest < 0.0f)
+				inside = false;
+		}
+
+		if (outside)
+			continue;
+		if (inside || !node.rightChild || depth + 2 > 64)
+		{
+			emit(node.firstInstance, node.instanceCount);
+			continue;
+		}
+		// Right pushed first so ranges come out in ascending order
+		stack[depth++] = node.rightChild;
+		stack[depth++] = uint32_t(&node - nodes) + 1;
+	}
+}
+
+void makeDemoScene(SceneData& scene, uint32_t instanceCount)
+{
+	scene = SceneData();
+
+	SceneMesh cube = {};
+	strcpy(cube.name, "cube");
+	cube.firstVertex = 0;
+	cube.vertexCount = 36;
+	for (int a = 0; a < 3; a++)
+	{
+		cube.boundsMin[a] = -0.5f;
+		cube.boundsMax[a] = 0.5f;
+	}
+	scene.meshes.push_back(cube);
+
+	const char* materialNames[] = { "kitten", "puppy", "mixed" };
+	for (int i = 0; i < 3; i++)
+	{
+		SceneMaterial material = {};
+		strcpy(material.name, materialNames[i]);
+		for (int c = 0; c < 4; c++)
+			material.tint[c] = 1.0f;
+		scene.materials.push_back(material);
+	}
+
+	uint32_t side = uint32_t(std::ceil(std::sqrt(double(instanceCount))));
+	scene.transforms.resize(instanceCount);
+	scene.instances.resize(instanceCount);
+	srand(42);
+	for (uint32_t i = 0; i < instanceCount; i++)
+	{
+		float x = float(i % side) * 2.0f - side;
+		float y = float(i / side) * 2.0f - side;
+		float angle = (rand() % 360) * 0.0174533f;
+		float scale = 0.5f + (rand() % 100) * 0.005f;
+		glm::mat4 m = glm::mat4(
+			glm::vec4(std::cos(angle) * scale, std::sin(angle) * scale, 0.0f, 0.0f),
+			glm::vec4(-std::sin(angle) * scale, std::cos(angle) * scale, 0.0f, 0.0f),
+			glm::vec4(0.0f, 0.0f, scale, 0.0f),
+			glm::vec4(x, y, scale * 0.5f - 0.5f, 1.0f));
+		scene.transforms[i] = m;
+		scene.instances[i].mesh = 0;
+		scene.instances[i].material = i % 3;
+	}
+}
+
+bool writeSceneJson(const char* path, const SceneData& scene)
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+		return false;
+
+	fprintf(file, "{\n\"meshes\": [\n");
+	for (size_t i = 0; i < scene.meshes.size(); i++)
+	{
+		const SceneMesh& m = scene.meshes[i];
+		fprintf(file, "{\"name\": \"%s\", \"firstVertex\": %u, \"vertexCount\": %u, \"min\": [%.9g, %.9g, %.9g], \"max\": [%.9g, %.9g, %.9g]}%s\n",
+			m.name, m.firstVertex, m.vertexCount, m.boundsMin[0], m.boundsMin[1], m.boundsMin[2],
+			m.boundsMax[0], m.boundsMax[1], m.boundsMax[2], i + 1 < scene.meshes.size() ? "," : "");
+	}
+	fprintf(file, "],\n\"materials\": [\n");
+	for (size_t i = 0; i < scene.materials.size(); i++)
+	{
+		const SceneMaterial& m = scene.materials[i];
+		fprintf(file, "{\"name\": \"%s\", \"tint\": [%.9g, %.9g, %.9g, %.9g]}%s\n",
+			m.name, m.tint[0], m.tint[1], m.tint[2], m.tint[3], i + 1 < scene.materials.size() ? "," : "");
+	}
+	fprintf(file, "],\n\"instances\": [\n");
+	for (size_t i = 0; i < scene.instances.size(); i++)
+	{
+		const float* t = &scene.transforms[i][0][0];
+		fprintf(file, "{\"mesh\": %u, \"material\": %u, \"transform\": [", scene.instances[i].mesh, scene.instances[i].material);
+		for (int k = 0; k < 16; k++)
+			fprintf(file, k < 15 ? "%.9g, " : "%.9g", t[k]);
+		fprintf(file, "]}%s\n", i + 1 < scene.instances.size() ? "," : "");
+	}
+	fprintf(file, "]\n}\n");
+	fclose(file);
+	return true;
+}
+
+// Just enough JSON for the layout writeSceneJson produces
+struct JsonReader
+{
+	const char* p;
+	const char* end;
+	bool ok;
+
+	JsonReader(const char* begin, const char* end) : p(begin), end(end), ok(true) {}
+
+	void skip() { while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++; }
+	bool peek(char c) { skip(); return p < end && *p == c; }
+	void expect(char c) { skip(); if (p < end && *p == c) p++; else ok = false; }
+	std::string string()
+	{
+		expect('"');
+		const char* start = p;
+		while (p < end && *p != '"')
+			p++;
+		std::string value(start, p);
+		expect('"');
+		return value;
+	}
+	double number()
+	{
+		skip();
+		char* next;
+		double value = strtod(p, &next);
+		if (next == p)
+			ok = false;
+		p = next;
+		return value;
+	}
+	void numbers(float* out, int count)
+	{
+		expect('[');
+		for (int i = 0; i < count; i++)
+		{
+			if (i)
+				expect(',');
+			out[i] = float(number());
+		}
+		expect(']');
+	}
+};
+
+bool loadSceneJson(const char* path, SceneData& scene)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return false;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	std::vector<char> text(size + 1);
+	size_t read = fread(text.data(), 1, size, file);
+	fclose(file);
+	text[read] = '\0';
+
+	scene = SceneData();
+	JsonReader json(text.data(), text.data() + read);
+	json.expect('{');
+	while (json.ok && !json.peek('}'))
+	{
+		std::string section = json.string();
+		json.expect(':');
+		json.expect('[');
+		while (json.ok && !json.peek(']'))
+		{
+			json.expect('{');
+			SceneMesh mesh = {};
+			SceneMaterial material = {};
+			SceneInstance instance = {};
+			glm::mat4 transform;
+			while (json.ok && !json.peek('}'))
+			{
+				std::string key = json.string();
+				json.expect(':');
+				if (key == "name")
+				{
+					std::string name = json.string();
+					strncpy(section == "meshes" ? mesh.name : material.name, name.c_str(), sizeof(mesh.name) - 1);
+				}
+				else if (key == "firstVertex") mesh.firstVertex = uint32_t(json.number());
+				else if (key == "vertexCount") mesh.vertexCount = uint32_t(json.number());
+				else if (key == "min") json.numbers(mesh.boundsMin, 3);
+				else if (key == "max") json.numbers(mesh.boundsMax, 3);
+				else if (key == "tint") json.numbers(material.tint, 4);
+				else if (key == "mesh") instance.mesh = uint32_t(json.number());
+				else if (key == "material") instance.material = uint32_t(json.number());
+				else if (key == "transform") json.numbers(&transform[0][0], 16);
+				else json.ok = false;
+				if (json.peek(','))
+					json.expect(',');
+			}
+			json.expect('}');
+			if (section == "meshes")
+				scene.meshes.push_back(mesh);
+			else if (section == "materials")
+				scene.materials.push_back(material);
+			else
+			{
+				scene.instances.push_back(instance);
+				scene.transforms.push_back(transform);
+			}
+			if (json.peek(','))
+				json.expect(',');
+		}
+		json.expect(']');
+		if (json.peek(','))
+			json.expect(',');
+	}
+	json.expect('}');
+	return json.ok;
+}
+
+void benchmarkSceneLoad()
+{
+	const char* binaryPath = "bench_scene.scn";
+	const char* jsonPath = "bench_scene.json";
+	const uint32_t instanceCount = 1000000;
+
+	SceneData scene;
+	makeDemoScene(scene, instanceCount);
+	auto t_start = std::chrono::high_resolution_clock::now();
+	buildSceneNodes(scene);
+	double buildSeconds = secondsSince(t_start);
+	if (!writeScene(binaryPath, scene) || !writeSceneJson(jsonPath, scene))
+	{
+		printf("Could not write the benchmark scenes\n");
+		return;
+	}
+
+	// Text: read, parse every number, then rebuild the hierarchy
+	SceneData parsed;
+	t_start = std::chrono::high_resolution_clock::now();
+	bool parsedOk = loadSceneJson(jsonPath, parsed);
+	double parseSeconds = secondsSince(t_start);
+	t_start = std::chrono::high_resolution_clock::now();
+	buildSceneNodes(parsed);
+	double rebuildSeconds = secondsSince(t_start);
+
+	// Binary: map and validate, then touch every page the renderer would read
+	SceneFile file;
+	t_start = std::chrono::high_resolution_clock::now();
+	bool mappedOk = file.open(binaryPath);
+	double mapSeconds = secondsSince(t_start);
+	double checksum = 0.0;
+	t_start = std::chrono::high_resolution_clock::now();
+	if (mappedOk)
+	{
+		const glm::mat4* transforms = file.transforms();
+		for (uint32_t i = 0; i < file.instanceCount(); i += 64)
+			checksum += transforms[i][3][0];
+		const SceneNode* nodes = file.nodes();
+		for (uint32_t i = 0; i < file.nodeCount(); i += 64)
+			checksum += nodes[i].boundsMin[0];
+	}
+	double touchSeconds = secondsSince(t_start);
+
+	std::vector<SceneRange> visible;
+	glm::mat4 viewProj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 1.0f, 500.0f) *
+		glm::lookAt(glm::vec3(0.0f, -300.0f, 150.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	t_start = std::chrono::high_resolution_clock::now();
+	if (mappedOk)
+		cullSceneNodes(file.nodes(), file.nodeCount(), viewProj, visible);
+	double cullSeconds = secondsSince(t_start);
+
+	printf("%u instances, hierarchy built in %.1f ms\n", instanceCount, buildSeconds * 1e3);
+	printf("JSON:   %s, parse %.1f ms + hierarchy %.1f ms = %.1f ms\n",
+		parsedOk ? "ok" : "FAILED", parseSeconds * 1e3, rebuildSeconds * 1e3, (parseSeconds + rebuildSeconds) * 1e3);
+	printf("Binary: %s, map %.3f ms, first touch %.1f ms (checksum %.0f), %.0fx faster than JSON\n",
+		mappedOk ? "ok" : "FAILED", mapSeconds * 1e3, touchSeconds * 1e3, checksum,
+		(parseSeconds + rebuildSeconds) / (mapSeconds + touchSeconds));
+	printf("Cull straight from the mapping: %zu visible ranges in %.2f ms\n", visible.size(), cullSeconds * 1e3);
+
+	file.close();
+	remove(binaryPath);
+	remove(jsonPath);
+}
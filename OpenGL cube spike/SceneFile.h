@@ -0,0 +1,136 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary scene layout, version 1. Little endian; every section starts on a
+// 64-byte boundary so the mapping can be handed to glBufferData and the
+// culling code as-is.
+//
+//   SceneHeader
+//   SceneMesh[meshCount]
+//   SceneMaterial[materialCount]
+//   glm::mat4[instanceCount]		world transforms, column major, BVH order
+//   SceneInstance[instanceCount]	mesh and material indices, BVH order
+//   SceneNode[nodeCount]			AABB hierarchy, depth first
+
+const uint32_t SCENE_MAGIC = 0x314E4353;	// "SCN1"
+const uint32_t SCENE_VERSION = 1;
+
+struct SceneHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t meshCount;
+	uint32_t materialCount;
+	uint32_t instanceCount;
+	uint32_t nodeCount;
+	uint64_t meshesOffset;
+	uint64_t materialsOffset;
+	uint64_t transformsOffset;
+	uint64_t instancesOffset;
+	uint64_t nodesOffset;
+	uint64_t fileSize;
+};
+
+struct SceneMesh
+{
+	char name[48];			// Mesh asset reference
+	uint32_t firstVertex;
+	uint32_t vertexCount;
+	float boundsMin[3];
+	float boundsMax[3];
+};
+
+struct SceneMaterial
+{
+	char name[48];			// Material asset reference
+	float tint[4];
+};
+
+struct SceneInstance
+{
+	uint32_t mesh;
+	uint32_t material;
+};
+
+// Every node covers instances [firstInstance, firstInstance + instanceCount).
+// The left child directly follows its parent; rightChild is 0 for leaves.
+struct SceneNode
+{
+	float boundsMin[3];
+	uint32_t firstInstance;
+	float boundsMax[3];
+	uint32_t instanceCount;
+	uint32_t rightChild;
+	uint32_t padding[3];
+};
+
+static_assert(sizeof(SceneHeader) == 72, "SceneHeader layout is part of the file format");
+static_assert(sizeof(SceneMesh) == 80, "SceneMesh layout is part of the file format");
+static_assert(sizeof(SceneMaterial) == 64, "SceneMaterial layout is part of the file format");
+static_assert(sizeof(SceneNode) == 48, "SceneNode layout is part of the file format");
+static_assert(sizeof(glm::mat4) == 64, "Transforms are stored as raw glm::mat4");
+
+// Scene in ordinary containers, used when writing or converting
+struct SceneData
+{
+	std::vector<SceneMesh> meshes;
+	std::vector<SceneMaterial> materials;
+	std::vector<glm::mat4> transforms;
+	std::vector<SceneInstance> instances;
+	std::vector<SceneNode> nodes;
+};
+
+// Build the AABB hierarchy, reordering transforms and instances to match
+void buildSceneNodes(SceneData& scene, uint32_t leafSize = 16);
+bool writeScene(const char* path, SceneData& scene);
+
+// Text equivalent, kept for tools and for comparing load times
+bool writeSceneJson(const char* path, const SceneData& scene);
+bool loadSceneJson(const char* path, SceneData& scene);
+
+// Cubes scattered on a grid, all referencing mesh 0
+void makeDemoScene(SceneData& scene, uint32_t instanceCount);
+
+// Memory-mapped binary scene. open() validates the header, the section
+// bounds and the indices between sections; the arrays are used straight
+// from the mapping.
+class SceneFile
+{
+public:
+	bool open(const char* path);
+	void close() { file.close(); header = nullptr; }
+	bool isOpen() const { return header != nullptr; }
+
+	uint32_t meshCount() const { return header->meshCount; }
+	uint32_t materialCount() const { return header->materialCount; }
+	uint32_t instanceCount() const { return header->instanceCount; }
+	uint32_t nodeCount() const { return header->nodeCount; }
+
+	const SceneMesh* meshes() const { return section<SceneMesh>(header->meshesOffset); }
+	const SceneMaterial* materials() const { return section<SceneMaterial>(header->materialsOffset); }
+	const glm::mat4* transforms() const { return section<glm::mat4>(header->transformsOffset); }
+	const SceneInstance* instances() const { return section<SceneInstance>(header->instancesOffset); }
+	const SceneNode* nodes() const { return section<SceneNode>(header->nodesOffset); }
+
+private:
+	template <typename T>
+	const T* section(uint64_t offset) const { return reinterpret_cast<const T*>(file.data() + offset); }
+
+	MappedFile file;
+	const SceneHeader* header = nullptr;
+};
+
+struct SceneRange
+{
+	uint32_t first;
+	uint32_t count;
+};
+
+// Frustum cull the hierarchy; visible instances come back as merged ranges
+void cullSceneNodes(const SceneNode* nodes, uint32_t nodeCount, const glm::mat4& viewProj, std::vector<SceneRange>& visible);
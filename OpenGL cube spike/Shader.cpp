@@ -0,0 +1,69 @@
+#include "Shader.h"
+
+#include <cstdio>
+#include <vector>
+
+static GLuint compileShader(GLenum type, const GLchar* source)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+
+	GLint status;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status != GL_TRUE)
+	{
+		GLint length = 0;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+		std::vector<char> log(length + 1);
+		glGetShaderInfoLog(shader, length, NULL, log.data());
+		fprintf(stderr, "Shader compile failed:\n%s\n", log.data());
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+GLuint createProgram(const GLchar* vertexSource, const GLchar* fragmentSource)
+{
+	return createProgram(vertexSource, fragmentSource, NULL, 0);
+}
+
+GLuint createProgram(const GLchar* vertexSource, const GLchar* fragmentSource,
+	const char* const* attributes, int attributeCount)
+{
+	GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+	GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+	if (!vertexShader || !fragmentShader)
+	{
+		glDeleteShader(vertexShader);
+		glDeleteShader(fragmentShader);
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vertexShader);
+	glAttachShader(program, fragmentShader);
+	glBindFragDataLocation(program, 0, "outColor");
+	for (int i = 0; i < attributeCount; i++)
+		glBindAttribLocation(program, i, attributes[i]);
+	glLinkProgram(program);
+
+	// The program keeps the compiled stages alive
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+
+	GLint status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE)
+	{
+		GLint length = 0;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+		std::vector<char> log(length + 1);
+		glGetProgramInfoLog(program, length, NULL, log.data());
+		fprintf(stderr, "Program link failed:\n%s\n", log.data());
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
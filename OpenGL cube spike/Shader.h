@@ -0,0 +1,13 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// Compile a vertex/fragment pair and link them into a program.
+// The fragment output is bound to "outColor" like the main cube program.
+// Returns 0 if compilation or linking failed (the info log is printed).
+GLuint createProgram(const GLchar* vertexSource, const GLchar* fragmentSource);
+
+// Same, binding attributes[i] to location i before linking so programs
+// sharing a vertex layout can share VAOs
+GLuint createProgram(const GLchar* vertexSource, const GLchar* fragmentSource,
+	const char* const* attributes, int attributeCount);
@@ -0,0 +1,118 @@
+#include "ShaderVariants.h"
+#include "RenderStats.h"
+#include "Shader.h"
+
+#include <cstdio>
+#include <glm/gtc/type_ptr.hpp>
+
+static const char* featureDefines[SHADER_FEATURE_COUNT] = {
+	"#define TINT\n",
+	"#define DUAL_TEXTURE\n",
+	"#define LIGHTING\n",
+	"#define INSTANCING\n"
+};
+
+static const char* attributeNames[] = { "position", "color", "texcoord", "instanceModel" };
+
+ShaderVariants::ShaderVariants(const GLchar* vertexSource, const GLchar* fragmentSource)
+	: vertexSource(vertexSource), fragmentSource(fragmentSource)
+{
+}
+
+ShaderVariants::~ShaderVariants()
+{
+	for (auto& entry : variants)
+		glDeleteProgram(entry.second.program);
+}
+
+void ShaderVariants::setFeatureSource(unsigned feature, const GLchar* fragmentPrelude)
+{
+	for (int bit = 0; bit < SHADER_FEATURE_COUNT; bit++)
+		if (feature == (1u << bit))
+			featureSources[bit] = fragmentPrelude;
+}
+
+void ShaderVariants::bindSampler(const char* name, GLint unit)
+{
+	samplers.push_back(std::make_pair(std::string(name), unit));
+}
+
+unsigned ShaderVariants::select(const glm::vec3& tint, bool dualTexture, bool lit, bool instanced)
+{
+	unsigned features = 0;
+	if (tint != glm::vec3(1.0f))
+		features |= SHADER_TINT;
+	if (dualTexture)
+		features |= SHADER_DUAL_TEXTURE;
+	if (lit)
+		features |= SHADER_LIGHTING;
+	if (instanced)
+		features |= SHADER_INSTANCING;
+	return features;
+}
+
+void ShaderVariants::setCamera(const glm::mat4& newView, const glm::mat4& newProj)
+{
+	view = newView;
+	proj = newProj;
+	cameraVersion++;
+}
+
+ShaderVariant& ShaderVariants::compile(unsigned features)
+{
+	std::string header = "#version 150 core\n";
+	std::string prelude;
+	for (int bit = 0; bit < SHADER_FEATURE_COUNT; bit++)
+	{
+		if (features & (1u << bit))
+		{
+			header += featureDefines[bit];
+			prelude += featureSources[bit];
+		}
+	}
+	std::string vertex = header + vertexSource;
+	std::string fragment = header + prelude + fragmentSource;
+
+	ShaderVariant& variant = variants[features];
+	variant.features = features;
+	variant.program = createProgram(vertex.c_str(), fragment.c_str(), attributeNames, 4);
+	if (!variant.program)
+		fprintf(stderr, "Shader variant 0x%x failed to build\n", features);
+
+	variant.uniModel = glGetUniformLocation(variant.program, "model");
+	variant.uniView = glGetUniformLocation(variant.program, "view");
+	variant.uniProj = glGetUniformLocation(variant.program, "proj");
+	variant.uniColor = glGetUniformLocation(variant.program, "overrideColor");
+
+	// Binding it to set the samplers is a switch like any other
+	glUseProgram(variant.program);
+	current = variant.program;
+	switches++;
+	for (auto& sampler : samplers)
+		glUniform1i(glGetUniformLocation(variant.program, sampler.first.c_str()), sampler.second);
+	renderStats.add(RENDER_PROGRAM_BINDS);
+	renderStats.add(RENDER_UNIFORM_BYTES, samplers.size() * sizeof(GLint));
+	return variant;
+}
+
+const ShaderVariant& ShaderVariants::use(unsigned features)
+{
+	auto it = variants.find(features);
+	ShaderVariant& variant = it != variants.end() ? it->second : compile(features);
+
+	if (variant.program != current)
+	{
+		glUseProgram(variant.program);
+		current = variant.program;
+		switches++;
+		renderStats.add(RENDER_PROGRAM_BINDS);
+	}
+	if (variant.cameraVersion != cameraVersion)
+	{
+		glUniformMatrix4fv(variant.uniView, 1, GL_FALSE, glm::value_ptr(view));
+		glUniformMatrix4fv(variant.uniProj, 1, GL_FALSE, glm::value_ptr(proj));
+		renderStats.add(RENDER_UNIFORM_BYTES, 2 * sizeof(glm::mat4));
+		variant.cameraVersion = cameraVersion;
+	}
+	return variant;
+}
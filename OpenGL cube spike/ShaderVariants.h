@@ -0,0 +1,77 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Features a draw can ask for. Each one becomes a #define in the
+// specialized program, so disabled features cost no ALU or texture fetches.
+enum ShaderFeature
+{
+	SHADER_TINT = 1,			// overrideColor multiply
+	SHADER_DUAL_TEXTURE = 2,	// mix of texKitten and texPuppy
+	SHADER_LIGHTING = 4,		// clustered point lights
+	SHADER_INSTANCING = 8,		// per-instance model matrix attribute
+	SHADER_FEATURE_COUNT = 4
+};
+
+// Fixed attribute locations shared by every variant, so one VAO serves them all
+enum ShaderAttribute
+{
+	ATTRIB_POSITION = 0,
+	ATTRIB_COLOR = 1,
+	ATTRIB_TEXCOORD = 2,
+	ATTRIB_INSTANCE_MODEL = 3	// mat4, uses locations 3-6
+};
+
+struct ShaderVariant
+{
+	unsigned features = 0;
+	GLuint program = 0;
+	GLint uniModel = -1, uniView = -1, uniProj = -1, uniColor = -1;
+	uint64_t cameraVersion = 0;
+};
+
+// Lazily compiled, feature-specialized programs built from one source pair.
+// Sources have no #version line; it is prepended along with the #defines.
+class ShaderVariants
+{
+public:
+	ShaderVariants(const GLchar* vertexSource, const GLchar* fragmentSource);
+	~ShaderVariants();
+
+	// Extra fragment code inserted ahead of the body when feature is enabled
+	void setFeatureSource(unsigned feature, const GLchar* fragmentPrelude);
+	// Sampler units applied to each variant as it is created
+	void bindSampler(const char* name, GLint unit);
+
+	// Cheapest feature set for a draw: a white tint is left out entirely
+	static unsigned select(const glm::vec3& tint, bool dualTexture, bool lit, bool instanced);
+
+	// Camera uniforms are uploaded to a variant the next time it is used
+	void setCamera(const glm::mat4& view, const glm::mat4& proj);
+
+	// Make the variant current, compiling it on first use
+	const ShaderVariant& use(unsigned features);
+	// Call after binding a program outside this class
+	void programChanged() { current = 0; }
+
+	size_t compiledCount() const { return variants.size(); }
+	uint64_t programSwitches() const { return switches; }
+
+private:
+	ShaderVariant& compile(unsigned features);
+
+	std::string vertexSource, fragmentSource;
+	std::string featureSources[SHADER_FEATURE_COUNT];
+	std::vector<std::pair<std::string, GLint>> samplers;
+	std::map<unsigned, ShaderVariant> variants;
+
+	glm::mat4 view, proj;
+	uint64_t cameraVersion = 1;
+	GLuint current = 0;
+	uint64_t switches = 0;
+};
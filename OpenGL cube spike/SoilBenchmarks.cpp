@@ -0,0 +1,745 @@
+#include "Benchmark.h"
+#include "ImageBatch.h"
+#include "Reflection.h"
+#include "VirtualTexture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <SOIL/SOIL.h>
+#include <SOIL/image_helper.h>
+
+// SOIL's own benchmarks, from decoding to prepared textures and saved
+// images, all without a GL context
+
+// Parallel SOIL decodes of every sample format must match serial decodes
+// byte for byte, and a failing decode must see its own failure reason
+// even while other threads succeed. The last thread count oversubscribes
+// the cores so decodes are preempted midway.
+void benchmarkImageDecoding()
+{
+	std::vector<std::string> paths = sampleImagePaths();
+
+	// Serial reference
+	std::vector<uint64_t> hashes;
+	std::vector<size_t> sizes;
+	for (const std::string& path : paths)
+	{
+		int width, height, channels;
+		unsigned char* image = SOIL_load_image(path.c_str(), &width, &height, &channels, SOIL_LOAD_RGBA);
+		if (!image)
+		{
+			printf("Could not load %s, run from the project directory\n", path.c_str());
+			return;
+		}
+		sizes.push_back(size_t(width) * height * 4);
+		hashes.push_back(hashBytes(image, sizes.back()));
+		SOIL_free_image_data(image);
+	}
+
+	// A PNG cut short in its image data
+	std::vector<unsigned char> truncated;
+	if (FILE* file = fopen(paths[0].c_str(), "rb"))
+	{
+		fseek(file, 0, SEEK_END);
+		truncated.resize(size_t(ftell(file)) / 2);
+		fseek(file, 0, SEEK_SET);
+		truncated.resize(fread(truncated.data(), 1, truncated.size(), file));
+		fclose(file);
+	}
+	int width, height, channels;
+	if (truncated.empty() || SOIL_load_image_from_memory(truncated.data(), int(truncated.size()), &width, &height, &channels, SOIL_LOAD_RGBA))
+	{
+		printf("Could not make a failing decode\n");
+		return;
+	}
+	const std::string failure = SOIL_last_result();
+
+	std::vector<unsigned> threadCounts(1, 1);
+	unsigned cores = std::thread::hardware_concurrency();
+	if (cores > 1)
+		threadCounts.push_back(cores);
+	threadCounts.push_back(std::max(cores * 2, 4u));
+
+	const size_t decodes = paths.size() * 24;
+	double serialSeconds = 0.0;
+	for (unsigned threads : threadCounts)
+	{
+		JobSystem jobs(threads - 1);
+		std::atomic<int> mismatches(0), wrongFailures(0);
+		std::atomic<uint64_t> bytes(0);
+		auto t_start = std::chrono::high_resolution_clock::now();
+		jobs.parallelFor(decodes, 1, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				size_t file = i % paths.size();
+				int width, height, channels;
+				unsigned char* image = SOIL_load_image(paths[file].c_str(), &width, &height, &channels, SOIL_LOAD_RGBA);
+				if (!image || size_t(width) * height * 4 != sizes[file] || hashBytes(image, sizes[file]) != hashes[file])
+					mismatches++;
+				bytes += sizes[file];
+				SOIL_free_image_data(image);
+
+				// Legacy calls report through thread-local state, context calls through the context
+				if (i % 3)
+					continue;
+				if (SOIL_load_image_from_memory(truncated.data(), int(truncated.size()), &width, &height, &channels, SOIL_LOAD_RGBA)
+					|| failure != SOIL_last_result())
+					wrongFailures++;
+				SOIL_context context;
+				SOIL_init_context(&context);
+				if (SOIL_load_image_from_memory_ctx(&context, truncated.data(), int(truncated.size()), &width, &height, &channels, SOIL_LOAD_RGBA)
+					|| failure != context.result_string)
+					wrongFailures++;
+			}
+		});
+		double seconds = secondsSince(t_start);
+		if (threads == 1)
+			serialSeconds = seconds;
+		printf("%2u threads: %zu decodes in %.1f ms, %.1f MB/s decoded, %.2fx, %d mismatched, %d wrong failure reasons\n",
+			threads, decodes, seconds * 1e3, bytes / seconds / 1e6, serialSeconds / seconds, int(mismatches), int(wrongFailures));
+	}
+	printf("Failure reason: %s\n", failure.c_str());
+}
+
+void benchmarkTexturePrepare()
+{
+	std::vector<std::string> paths = sampleTexturePaths();
+	const int copies = 4;
+	JobSystem jobs;
+	std::vector<ImageRequest> requests;
+	for (int copy = 0; copy < copies; copy++)
+		for (const std::string& path : paths)
+			requests.emplace_back(path, SOIL_LOAD_RGBA);
+	ImageBatch batch(jobs, requests);
+	batch.wait();
+	if (batch.stats().failed)
+	{
+		printf("Could not load the images, run from the project directory\n");
+		return;
+	}
+
+	// A typical desktop GL 3 implementation, no context needed
+	SOIL_capabilities capabilities;
+	capabilities.max_texture_size = 16384;
+	capabilities.NPOT = 1;
+	capabilities.texture_rectangle = 1;
+	capabilities.DXT = 1;
+
+	struct FlagSet { const char* name; unsigned flags; };
+	const FlagSet flagSets[] = {
+		{ "copy", 0 },
+		{ "invert + premultiply", SOIL_FLAG_INVERT_Y | SOIL_FLAG_MULTIPLY_ALPHA },
+		{ "mipmaps", SOIL_FLAG_MIPMAPS },
+		{ "mipmaps + DXT", SOIL_FLAG_MIPMAPS | SOIL_FLAG_COMPRESS_TO_DXT },
+	};
+	std::vector<SOIL_prepared_texture> prepared(requests.size());
+	std::vector<uint64_t> serialHashes(requests.size());
+	for (const FlagSet& set : flagSets)
+	{
+		double seconds[2] = {};
+		uint64_t bytes = 0;
+		int levels = 0, mismatched = 0;
+		for (int parallel = 0; parallel < 2; parallel++)
+		{
+			auto t_start = std::chrono::high_resolution_clock::now();
+			auto prepare = [&](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; i++)
+				{
+					const DecodedImage& image = batch.get(i);
+					SOIL_prepare_texture(image.pixels, image.width, image.height, image.channels,
+						set.flags, &capabilities, &prepared[i]);
+				}
+			};
+			if (parallel)
+				jobs.parallelFor(requests.size(), 1, prepare);
+			else
+				prepare(0, requests.size());
+			seconds[parallel] = secondsSince(t_start);
+
+			for (size_t i = 0; i < requests.size(); i++)
+			{
+				// Jobs must produce exactly what this thread did
+				uint64_t hash = hashBytes(&prepared[i].level_count, sizeof(int)), size = 0;
+				for (int l = 0; l < prepared[i].level_count; l++)
+				{
+					hash = hashBytes(prepared[i].levels[l].data, prepared[i].levels[l].size, hash);
+					size += prepared[i].levels[l].size;
+				}
+				if (parallel)
+					mismatched += hash != serialHashes[i];
+				else
+				{
+					serialHashes[i] = hash;
+					bytes += size;
+					levels += prepared[i].level_count;
+				}
+				SOIL_free_prepared_texture(&prepared[i]);
+			}
+		}
+		printf("%-22s %2zu textures, %3d levels, %6.2f MB out: %7.1f ms, %7.1f ms on %u threads (%.2fx), %d mismatched\n",
+			set.name, requests.size(), levels, bytes / 1e6, seconds[0] * 1e3, seconds[1] * 1e3, jobs.workerCount() + 1,
+			seconds[0] / seconds[1], mismatched);
+	}
+}
+
+// What SOIL did before copy_and_transform_image: copy, then a full pass per flag
+static void transformInPasses(const unsigned char* image, int width, int height, int channels, unsigned char* out, unsigned transforms)
+{
+	size_t row = size_t(width) * channels, size = row * height;
+	memcpy(out, image, size);
+	if (transforms & IMAGE_TRANSFORM_INVERT_Y)
+		for (int y = 0; y * 2 < height; y++)
+			std::swap_ranges(out + y * row, out + (y + 1) * row, out + (height - 1 - y) * row);
+	if (transforms & IMAGE_TRANSFORM_NTSC_SAFE_RGB)
+	{
+		unsigned char lut[256];
+		for (int i = 0; i < 256; i++)
+			lut[i] = (unsigned char)((235.499f - 15.501f) * i / 255.0f + 15.501f);
+		int colors = channels - (1 - (channels & 1));
+		for (size_t i = 0; i < size; i += channels)
+			for (int c = 0; c < colors; c++)
+				out[i + c] = lut[out[i + c]];
+	}
+	if ((transforms & IMAGE_TRANSFORM_MULTIPLY_ALPHA) && channels == 4)
+		for (size_t i = 0; i < size; i += 4)
+			for (int c = 0; c < 3; c++)
+				out[i + c] = (out[i + c] * out[i + 3] + 128) >> 8;
+	if ((transforms & IMAGE_TRANSFORM_RGB_TO_YCoCg) && channels >= 3)
+	{
+		auto clamp_byte = [](int x) { return (unsigned char)std::min(std::max(x, 0), 255); };
+		for (size_t i = 0; i < size; i += channels)
+		{
+			int r = out[i], g = (out[i + 1] + 1) >> 1, b = out[i + 2], tmp = (2 + r + b) >> 2;
+			unsigned char co = clamp_byte(128 + ((r - b + 1) >> 1)), cg = clamp_byte(128 + g - tmp), y = clamp_byte(g + tmp);
+			if (channels == 3)
+			{
+				out[i] = co; out[i + 1] = y; out[i + 2] = cg;
+			}
+			else
+			{
+				unsigned char a = out[i + 3];
+				out[i] = co; out[i + 1] = cg; out[i + 2] = a; out[i + 3] = y;
+			}
+		}
+	}
+}
+
+void benchmarkTextureTransforms()
+{
+	struct Size { const char* name; int width, height; };
+	const Size sizes[] = { { "4K", 3840, 2160 }, { "8K", 7680, 4320 } };
+	struct Transforms { const char* name; unsigned transforms; };
+	const Transforms sets[] = {
+		{ "invert", IMAGE_TRANSFORM_INVERT_Y },
+		{ "invert + premultiply", IMAGE_TRANSFORM_INVERT_Y | IMAGE_TRANSFORM_MULTIPLY_ALPHA },
+		{ "all four", IMAGE_TRANSFORM_INVERT_Y | IMAGE_TRANSFORM_NTSC_SAFE_RGB | IMAGE_TRANSFORM_MULTIPLY_ALPHA | IMAGE_TRANSFORM_RGB_TO_YCoCg },
+	};
+	for (const Size& size : sizes)
+	{
+		for (int channels = 3; channels <= 4; channels++)
+		{
+			std::vector<unsigned char> image(size_t(size.width) * size.height * channels), passes(image.size()), fused(image.size());
+			uint32_t seed = 1;
+			for (unsigned char& byte : image)
+			{
+				seed = seed * 1664525u + 1013904223u;
+				byte = (unsigned char)(seed >> 24);
+			}
+			for (const Transforms& set : sets)
+			{
+				// Best of a few runs, after a warm-up that faults the pages in
+				double seconds[2] = { 1e9, 1e9 };
+				for (int run = 0; run < 4; run++)
+				{
+					auto t_start = std::chrono::high_resolution_clock::now();
+					transformInPasses(image.data(), size.width, size.height, channels, passes.data(), set.transforms);
+					seconds[0] = std::min(seconds[0], run ? secondsSince(t_start) : 1e9);
+					t_start = std::chrono::high_resolution_clock::now();
+					copy_and_transform_image(image.data(), size.width, size.height, channels, fused.data(), set.transforms);
+					seconds[1] = std::min(seconds[1], run ? secondsSince(t_start) : 1e9);
+				}
+				printf("%s %s %-22s passes %7.2f ms, fused %7.2f ms (%5.2f GB/s), %.2fx, %s\n", size.name,
+					channels == 3 ? "RGB " : "RGBA", set.name, seconds[0] * 1e3, seconds[1] * 1e3, image.size() / seconds[1] / 1e9,
+					seconds[0] / seconds[1], passes == fused ? "identical" : "MISMATCH");
+			}
+		}
+	}
+}
+
+// What SOIL did before the pyramid: a buffer per level, each averaged from level 0
+static void mipmapsFromLevel0(const unsigned char* image, int width, int height, int channels,
+	std::vector<std::vector<unsigned char>>& levels)
+{
+	levels.assign(1, std::vector<unsigned char>(image, image + size_t(width) * height * channels));
+	for (int level = 1; (1 << level) <= width || (1 << level) <= height; level++)
+	{
+		levels.emplace_back(size_t(std::max(width >> level, 1)) * std::max(height >> level, 1) * channels);
+		mipmap_image(image, width, height, channels, levels.back().data(), 1 << level, 1 << level);
+	}
+}
+
+static double psnr(double squaredError, size_t count)
+{
+	return squaredError > 0.0 ? 10.0 * log10(255.0 * 255.0 * count / squaredError) : 99.0;
+}
+
+void benchmarkMipPyramid()
+{
+	const int size = 2048;
+	const char* filterNames[] = { "box", "Kaiser", "Lanczos" };
+
+	// Throughput on noise, best of a few runs after a warm-up
+	for (int channels = 1; channels <= 4; channels++)
+	{
+		std::vector<unsigned char> image(size_t(size) * size * channels);
+		uint32_t seed = channels;
+		for (unsigned char& byte : image)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			byte = (unsigned char)(seed >> 24);
+		}
+		int levelCount = mip_pyramid_levels(size, size);
+		std::vector<unsigned char> pyramid(mip_pyramid_offset(size, size, channels, levelCount));
+		std::vector<std::vector<unsigned char>> levels;
+		double oldSeconds = 1e9;
+		for (int run = 0; run < 3; run++)
+		{
+			auto t_start = std::chrono::high_resolution_clock::now();
+			mipmapsFromLevel0(image.data(), size, size, channels, levels);
+			oldSeconds = std::min(oldSeconds, run ? secondsSince(t_start) : 1e9);
+		}
+
+		// The box pyramid is exactly mipmap_image applied level by level, and
+		// within rounding of averaging each level from level 0
+		std::vector<unsigned char> halved(image);
+		bool exact = true;
+		int worst = 0;
+		build_mip_pyramid(image.data(), size, size, channels, pyramid.data(), levelCount, MIP_FILTER_BOX, 0);
+		for (int level = 1; level < levelCount; level++)
+		{
+			int width = std::max(size >> (level - 1), 1), height = width;
+			std::vector<unsigned char> next(size_t(std::max(width / 2, 1)) * std::max(height / 2, 1) * channels);
+			mipmap_image(halved.data(), width, height, channels, next.data(), 2, 2);
+			halved.swap(next);
+			const unsigned char* built = pyramid.data() + mip_pyramid_offset(size, size, channels, level);
+			exact &= memcmp(built, halved.data(), halved.size()) == 0;
+			for (size_t i = 0; i < halved.size(); i++)
+				worst = std::max(worst, std::abs(built[i] - levels[level][i]));
+		}
+
+		for (int filter = MIP_FILTER_BOX; filter <= MIP_FILTER_LANCZOS; filter++)
+		{
+			for (int linear = 0; linear <= 1; linear++)
+			{
+				if (channels < 3 && (filter != MIP_FILTER_BOX || linear))
+					continue;
+				double seconds = 1e9;
+				for (int run = 0; run < 3; run++)
+				{
+					auto t_start = std::chrono::high_resolution_clock::now();
+					build_mip_pyramid(image.data(), size, size, channels, pyramid.data(), levelCount, filter, linear);
+					seconds = std::min(seconds, run ? secondsSince(t_start) : 1e9);
+				}
+				printf("%d channel %-7s %-12s level 0 averages %7.2f ms, pyramid %7.2f ms, %5.2fx", channels,
+					filterNames[filter], linear ? "linear light" : "", oldSeconds * 1e3, seconds * 1e3, oldSeconds / seconds);
+				if (filter == MIP_FILTER_BOX && !linear)
+					printf(", %s 2x2 passes, within %d of level 0 averages", exact ? "same as" : "MISMATCH with", worst);
+				printf("\n");
+			}
+		}
+	}
+
+	// Quality: cosines either side of each level's Nyquist limit. An ideal
+	// filter keeps the ones below it and removes the rest, anything else is
+	// blur or aliasing. PSNR against that, away from the edges.
+	struct Wave { double frequency, angle, phase; };
+	const Wave waves[] = { { 0.02, 0.3, 0.1 }, { 0.045, 1.2, 1.7 }, { 0.09, 2.1, 0.4 }, { 0.18, 0.7, 2.9 }, { 0.35, 1.9, 1.3 } };
+	auto pattern = [&](double x, double y, double nyquist)
+	{
+		double value = 128.0;
+		for (const Wave& wave : waves)
+			if (wave.frequency < nyquist)
+				value += 24.0 * cos(2.0 * 3.14159265358979 * wave.frequency * (x * cos(wave.angle) + y * sin(wave.angle)) + wave.phase);
+		return value;
+	};
+	const int patternSize = 1024, quality = 5;
+	std::vector<unsigned char> image(size_t(patternSize) * patternSize);
+	for (int y = 0; y < patternSize; y++)
+		for (int x = 0; x < patternSize; x++)
+			image[size_t(y) * patternSize + x] = (unsigned char)(pattern(x + 0.5, y + 0.5, 1.0) + 0.5);
+	auto levelPsnr = [&](const unsigned char* pixels, int level)
+	{
+		int width = patternSize >> level, scale = 1 << level;
+		double error = 0.0;
+		size_t count = 0;
+		for (int y = 4; y < width - 4; y++)
+			for (int x = 4; x < width - 4; x++, count++)
+			{
+				double d = pixels[size_t(y) * width + x] - pattern((x + 0.5) * scale, (y + 0.5) * scale, 0.5 / scale);
+				error += d * d;
+			}
+		return psnr(error, count);
+	};
+	std::vector<std::vector<unsigned char>> levels;
+	mipmapsFromLevel0(image.data(), patternSize, patternSize, 1, levels);
+	printf("PSNR against an ideal low pass, levels 1 to %d:\n  level 0 averages", quality - 1);
+	for (int level = 1; level < quality; level++)
+		printf(" %6.2f dB", levelPsnr(levels[level].data(), level));
+	printf("\n");
+	std::vector<unsigned char> pyramid(mip_pyramid_offset(patternSize, patternSize, 1, quality));
+	for (int filter = MIP_FILTER_BOX; filter <= MIP_FILTER_LANCZOS; filter++)
+	{
+		build_mip_pyramid(image.data(), patternSize, patternSize, 1, pyramid.data(), quality, filter, 0);
+		printf("  %-16s", filterNames[filter]);
+		for (int level = 1; level < quality; level++)
+			printf(" %6.2f dB", levelPsnr(pyramid.data() + mip_pyramid_offset(patternSize, patternSize, 1, level), level));
+		printf("\n");
+	}
+
+	// Odd sides: a ramp must stay where it is, while halving with 2x2
+	// blocks drops the last texel of odd rows and shifts what is left
+	{
+		const int width = 67, height = 35;
+		std::vector<unsigned char> ramp(size_t(width) * height);
+		for (int y = 0; y < height; y++)
+			for (int x = 0; x < width; x++)
+				ramp[size_t(y) * width + x] = (unsigned char)(255.0 * (x + 0.5) / width + 0.5);
+		int levelCount = mip_pyramid_levels(width, height);
+		std::vector<unsigned char> odd(mip_pyramid_offset(width, height, 1, levelCount));
+		// Worst error against the ramp over the levels at least 16 wide, away
+		// from the edges the wide filters repeat
+		auto rampError = [](const unsigned char* pixels, int w, int h)
+		{
+			double worst = 0.0;
+			for (int x = std::max(w / 8, 4); x < w - std::max(w / 8, 4); x++)
+				worst = std::max(worst, std::abs(pixels[size_t(h / 2) * w + x] - 255.0 * (x + 0.5) / w));
+			return worst;
+		};
+		double worst = 0.0;
+		std::vector<unsigned char> halved(ramp);
+		for (int w = width, h = height; w / 2 >= 16; w /= 2, h /= 2)
+		{
+			std::vector<unsigned char> next(size_t(w / 2) * (h / 2));
+			mipmap_image(halved.data(), w, h, 1, next.data(), 2, 2);
+			halved.swap(next);
+			worst = std::max(worst, rampError(halved.data(), w / 2, h / 2));
+		}
+		printf("67x35 ramp, worst error of levels 16 or more wide: 2x2 passes %.2f", worst);
+		for (int filter = MIP_FILTER_BOX; filter <= MIP_FILTER_LANCZOS; filter++)
+		{
+			build_mip_pyramid(ramp.data(), width, height, 1, odd.data(), levelCount, filter, 0);
+			worst = 0.0;
+			for (int level = 1, w = width / 2, h = height / 2; w >= 16; level++, w /= 2, h /= 2)
+				worst = std::max(worst, rampError(odd.data() + mip_pyramid_offset(width, height, 1, level), w, h));
+			printf(", %s %.2f", filterNames[filter], worst);
+		}
+		printf("\n");
+	}
+
+	// Linear light: one texel black and white stripes look 50% bright, which
+	// is 188 in sRGB, but averaging the bytes makes 128
+	{
+		const int width = 256;
+		std::vector<unsigned char> stripes(size_t(width) * width * 3);
+		for (size_t i = 0; i < stripes.size(); i++)
+			stripes[i] = (i / 3) % 2 ? 255 : 0;
+		std::vector<unsigned char> built(mip_pyramid_offset(width, width, 3, 4));
+		for (int linear = 0; linear <= 1; linear++)
+		{
+			build_mip_pyramid(stripes.data(), width, width, 3, built.data(), 4, MIP_FILTER_BOX, linear);
+			printf("stripes, %-12s levels 1 to 3 average", linear ? "linear light" : "sRGB bytes");
+			for (int level = 1; level < 4; level++)
+			{
+				int offset = mip_pyramid_offset(width, width, 3, level), count = (width >> level) * (width >> level) * 3;
+				double sum = 0.0;
+				for (int i = 0; i < count; i++)
+					sum += built[offset + i];
+				printf(" %6.1f", sum / count);
+			}
+			printf("\n");
+		}
+	}
+}
+
+void benchmarkDXTThreads()
+{
+	// A detailed map with a soft alpha ramp, like the textures the demo uses
+	const int size = 2048;
+	std::vector<unsigned char> rgb(size_t(size) * size * 3), rgba(size_t(size) * size * 4);
+	virtualDemoSource(0, 0, size, size, rgb.data());
+	for (size_t i = 0; i < size_t(size) * size; i++)
+	{
+		memcpy(&rgba[i * 4], &rgb[i * 3], 3);
+		rgba[i * 4 + 3] = (unsigned char)(i % size * 255 / (size - 1));
+	}
+
+	SOIL_capabilities capabilities;
+	capabilities.max_texture_size = 16384;
+	capabilities.NPOT = 1;
+	capabilities.texture_rectangle = 1;
+	capabilities.DXT = 1;
+
+	const int threadCounts[] = { 1, 2, 4, 8, 16, 32, 64 };
+	for (int channels = 3; channels <= 4; channels++)
+	{
+		const unsigned char* pixels = channels == 3 ? rgb.data() : rgba.data();
+		// Best of a few runs, hashing every compressed level
+		auto prepare = [&](double& seconds)
+		{
+			uint64_t hash = 0;
+			seconds = 1e9;
+			for (int run = 0; run < 3; run++)
+			{
+				SOIL_prepared_texture texture;
+				auto t_start = std::chrono::high_resolution_clock::now();
+				SOIL_prepare_texture(pixels, size, size, channels, SOIL_FLAG_MIPMAPS | SOIL_FLAG_COMPRESS_TO_DXT, &capabilities, &texture);
+				seconds = std::min(seconds, secondsSince(t_start));
+				hash = hashBytes(&texture.level_count, sizeof(int));
+				for (int l = 0; l < texture.level_count; l++)
+					hash = hashBytes(texture.levels[l].data, texture.levels[l].size, hash * 31 + texture.levels[l].compressed);
+				SOIL_free_prepared_texture(&texture);
+			}
+			return hash;
+		};
+		double serialSeconds;
+		uint64_t serialHash = prepare(serialSeconds);
+		printf("%dx%d %s mipmaps + %s: serial %7.1f ms\n", size, size, channels == 3 ? "RGB" : "RGBA",
+			channels == 3 ? "DXT1" : "DXT5", serialSeconds * 1e3);
+		for (int threads : threadCounts)
+		{
+			JobSystem jobs(threads - 1);
+			SOILJobScope scope(jobs);
+			double seconds;
+			uint64_t hash = prepare(seconds);
+			printf("  %2d threads %7.1f ms, %5.2fx, %s\n", threads, seconds * 1e3, serialSeconds / seconds,
+				hash == serialHash ? "identical" : "MISMATCH");
+		}
+	}
+	printf("(%u hardware threads)\n", std::thread::hardware_concurrency());
+}
+
+void benchmarkDecodeArena()
+{
+	std::vector<std::string> paths = sampleImagePaths();
+	std::vector<std::vector<unsigned char>> files;
+	if (!readSampleImages(paths, files))
+		return;
+	// Streaming uploads one format, so every image comes out RGBA
+	const int rounds = 20;
+
+	// What each decode allocates from the heap today
+	printf("%-56s %13s  %-28s  %s\n", "", "", "heap", "arena, decoded in place");
+	size_t arenaSize = 0, pixelsSize = 0;
+	std::vector<uint64_t> hashes;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		SOIL_context context;
+		SOIL_init_context(&context);
+		int width, height, channels;
+		unsigned char* pixels = SOIL_load_image_from_memory_ctx(&context, files[i].data(), int(files[i].size()),
+			&width, &height, &channels, SOIL_LOAD_RGBA);
+		if (!pixels)
+		{
+			printf("%s: %s\n", paths[i].c_str(), context.result_string);
+			return;
+		}
+		size_t size = size_t(width) * height * 4;
+		hashes.push_back(hashBytes(pixels, size));
+		SOIL_free_image_data(pixels);
+		// A bump arena keeps what was freed until reset; 16 bytes of alignment per allocation
+		arenaSize = std::max(arenaSize, context.allocated_bytes + 16 * context.allocations);
+		pixelsSize = std::max(pixelsSize, size);
+		printf("%-56s %5d x %-5d  %2u allocations, peak %6.2f MB", paths[i].c_str(), width, height,
+			context.allocations, context.peak_bytes / 1e6);
+
+		std::vector<unsigned char> into(size);
+		SOIL_load_image_from_memory_into_ctx(&context, files[i].data(), int(files[i].size()),
+			&width, &height, &channels, SOIL_LOAD_RGBA, into.data(), size);
+		printf("  %2u allocations, peak %6.2f MB\n", context.allocations, context.peak_bytes / 1e6);
+	}
+
+	// Steady state: the same images over and over, the way a streamer cycles through tiles
+	for (int mode = 0; mode < 3; mode++)
+	{
+		static const char* modes[] = { "heap", "arena", "arena + into" };
+		DecodeArena arena(arenaSize);
+		std::vector<unsigned char> into(pixelsSize);
+		SOIL_context context;
+		SOIL_init_context(&context);
+		if (mode)
+			arena.attach(context);
+		int mismatched = 0;
+		unsigned allocations = 0;
+		uint64_t bytes = 0;
+		auto t_start = std::chrono::high_resolution_clock::now();
+		for (int round = 0; round < rounds; round++)
+		{
+			for (size_t i = 0; i < files.size(); i++)
+			{
+				int width = 0, height = 0, channels;
+				unsigned char* pixels = into.data();
+				if (mode == 2)
+				{
+					if (!SOIL_load_image_from_memory_into_ctx(&context, files[i].data(), int(files[i].size()),
+							&width, &height, &channels, SOIL_LOAD_RGBA, pixels, into.size()))
+						pixels = nullptr;
+				}
+				else
+					pixels = SOIL_load_image_from_memory_ctx(&context, files[i].data(), int(files[i].size()),
+						&width, &height, &channels, SOIL_LOAD_RGBA);
+				size_t size = size_t(width) * height * 4;
+				allocations += context.allocations;
+				bytes += size;
+				if (round == 0)
+					mismatched += !pixels || hashBytes(pixels, size) != hashes[i];
+				if (mode == 0)
+					SOIL_free_image_data(pixels);
+				arena.reset();
+			}
+		}
+		double seconds = secondsSince(t_start);
+		printf("%-13s %4zu decodes %7.1f ms, %6.1f MB/s, %5.1f %s allocations per decode, %s",
+			modes[mode], files.size() * rounds, seconds * 1e3, bytes / seconds / 1e6,
+			double(allocations) / (files.size() * rounds), mode ? "arena" : "heap", mismatched ? "MISMATCH" : "identical");
+		if (mode)
+			printf(", arena %.2f MB, high water %.2f MB", arena.capacity() / 1e6, arena.highWater() / 1e6);
+		printf("\n");
+	}
+}
+
+void benchmarkPNGSave()
+{
+	std::vector<std::string> paths = sampleImagePaths();
+	std::vector<std::vector<unsigned char>> files;
+	if (!readSampleImages(paths, files))
+		return;
+	struct Image { std::vector<unsigned char> pixels; int width, height, channels; };
+	std::vector<Image> samples;
+	uint64_t rawBytes = 0;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		Image image;
+		unsigned char* pixels = SOIL_load_image_from_memory(files[i].data(), int(files[i].size()),
+			&image.width, &image.height, &image.channels, SOIL_LOAD_AUTO);
+		if (!pixels)
+			continue;
+		image.pixels.assign(pixels, pixels + size_t(image.width) * image.height * image.channels);
+		SOIL_free_image_data(pixels);
+		rawBytes += image.pixels.size();
+		samples.push_back(std::move(image));
+	}
+	// A frame sized capture of the demo map, worth splitting over threads
+	Image frame;
+	frame.width = 1920;
+	frame.height = 1080;
+	frame.channels = 3;
+	frame.pixels.resize(size_t(frame.width) * frame.height * 3);
+	virtualDemoSource(0, 0, frame.width, frame.height, frame.pixels.data());
+
+	const char* path = "bench_png_save.tmp";
+	auto fileSize = [](const char* name)
+	{
+		FILE* file = fopen(name, "rb");
+		if (!file)
+			return 0L;
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file);
+		fclose(file);
+		return size;
+	};
+
+	// Every sample through SOIL_save_image as TGA, then PNG at each level
+	printf("%zu sample images, %.2f MB of pixels\n", samples.size(), rawBytes / 1e6);
+	double seconds = 1e9;
+	uint64_t tgaBytes = 0;
+	for (int run = 0; run < 3; run++)
+	{
+		tgaBytes = 0;
+		auto t_start = std::chrono::high_resolution_clock::now();
+		for (const Image& image : samples)
+		{
+			SOIL_save_image(path, SOIL_SAVE_TYPE_TGA, image.width, image.height, image.channels, image.pixels.data());
+			tgaBytes += fileSize(path);
+		}
+		seconds = std::min(seconds, secondsSince(t_start));
+	}
+	printf("  TGA          %7.1f ms %7.1f MB/s  %6.2f MB  ratio %5.2f\n",
+		seconds * 1e3, rawBytes / seconds / 1e6, tgaBytes / 1e6, double(rawBytes) / tgaBytes);
+	static const char* levels[] = { "fastest", "fast", "default", "best" };
+	for (int level = SOIL_PNG_FASTEST; level <= SOIL_PNG_BEST; level++)
+	{
+		uint64_t pngBytes = 0;
+		int mismatched = 0;
+		seconds = 1e9;
+		for (int run = 0; run < 3; run++)
+		{
+			pngBytes = 0;
+			auto t_start = std::chrono::high_resolution_clock::now();
+			for (const Image& image : samples)
+			{
+				SOIL_save_image_PNG(path, image.width, image.height, image.channels, image.pixels.data(), level);
+				pngBytes += fileSize(path);
+			}
+			seconds = std::min(seconds, secondsSince(t_start));
+		}
+		// Lossless, so SOIL must read back every pixel
+		for (const Image& image : samples)
+		{
+			int size, width, height, channels;
+			unsigned char* png = SOIL_save_image_PNG_to_memory(image.width, image.height, image.channels,
+				image.pixels.data(), level, &size);
+			unsigned char* back = png ? SOIL_load_image_from_memory(png, size, &width, &height, &channels, SOIL_LOAD_AUTO) : nullptr;
+			mismatched += !back || width != image.width || height != image.height || channels != image.channels ||
+				memcmp(back, image.pixels.data(), image.pixels.size()) != 0;
+			SOIL_free_image_data(back);
+			SOIL_free_image_data(png);
+		}
+		printf("  PNG %-8s %7.1f ms %7.1f MB/s  %6.2f MB  ratio %5.2f, %4.1f%% of TGA, %s\n",
+			levels[level], seconds * 1e3, rawBytes / seconds / 1e6, pngBytes / 1e6, double(rawBytes) / pngBytes,
+			100.0 * pngBytes / tgaBytes, mismatched ? "MISMATCH" : "lossless");
+	}
+	remove(path);
+
+	// The capture in memory, serial and with the chunks on the job system
+	printf("%dx%d RGB frame, %.2f MB\n", frame.width, frame.height, frame.pixels.size() / 1e6);
+	std::vector<unsigned> threadCounts(1, 1);
+	if (std::thread::hardware_concurrency() > 1)
+		threadCounts.push_back(std::thread::hardware_concurrency());
+	for (int level = SOIL_PNG_FASTEST; level <= SOIL_PNG_BEST; level++)
+	{
+		uint64_t serialHash = 0;
+		double serialSeconds = 0.0;
+		for (unsigned threads : threadCounts)
+		{
+			JobSystem jobs(threads - 1);
+			std::unique_ptr<SOILJobScope> scope(threads > 1 ? new SOILJobScope(jobs) : nullptr);
+			int size = 0;
+			uint64_t hash = 0;
+			seconds = 1e9;
+			for (int run = 0; run < 3; run++)
+			{
+				auto t_start = std::chrono::high_resolution_clock::now();
+				unsigned char* png = SOIL_save_image_PNG_to_memory(frame.width, frame.height, 3, frame.pixels.data(), level, &size);
+				seconds = std::min(seconds, secondsSince(t_start));
+				hash = hashBytes(png, size);
+				SOIL_free_image_data(png);
+			}
+			if (threads == 1)
+			{
+				serialHash = hash;
+				serialSeconds = seconds;
+			}
+			printf("  PNG %-8s %2u thread%s %7.1f ms %7.1f MB/s  ratio %5.2f  %5.2fx, %s\n", levels[level], threads,
+				threads > 1 ? "s" : " ", seconds * 1e3, frame.pixels.size() / seconds / 1e6, double(frame.pixels.size()) / size,
+				serialSeconds / seconds, hash == serialHash ? "identical" : "MISMATCH");
+		}
+	}
+}
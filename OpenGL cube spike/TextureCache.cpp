@@ -0,0 +1,610 @@
+#include "TextureCache.h"
+#include "Benchmark.h"
+#include "Reflection.h"
+#include "RenderStats.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+const uint32_t TEXTURE_INDEX_MAGIC = 0x31494354;	// "TCI1"
+
+struct TextureIndexHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t clock;
+	uint64_t entryCount;
+};
+
+static uint64_t alignTo(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void writeSection(FILE* file, uint64_t offset, const void* data, size_t size)
+{
+	static const char zeros[64] = {};
+	long position = ftell(file);
+	while (uint64_t(position) < offset)
+	{
+		size_t padding = size_t(std::min<uint64_t>(offset - position, sizeof(zeros)));
+		fwrite(zeros, 1, padding, file);
+		position += long(padding);
+	}
+	if (size)
+		fwrite(data, 1, size, file);
+}
+
+static void makeDirectory(const char* path)
+{
+#ifdef _WIN32
+	_mkdir(path);
+#else
+	mkdir(path, 0755);
+#endif
+}
+
+static void removeDirectory(const char* path)
+{
+#ifdef _WIN32
+	_rmdir(path);
+#else
+	rmdir(path);
+#endif
+}
+
+// Keys of the entry files in the directory, read back from their names
+static std::vector<uint64_t> listEntryKeys(const std::string& directory)
+{
+	std::vector<uint64_t> keys;
+	auto add = [&](const char* name)
+	{
+		if (strlen(name) != 20 || strcmp(name + 16, ".tex") != 0)
+			return;
+		for (int i = 0; i < 16; i++)
+			if (!isdigit(static_cast<unsigned char>(name[i])) && (name[i] < 'a' || name[i] > 'f'))
+				return;
+		keys.push_back(strtoull(name, nullptr, 16));
+	};
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE handle = FindFirstFileA((directory + "/*.tex").c_str(), &data);
+	if (handle == INVALID_HANDLE_VALUE)
+		return keys;
+	do
+		add(data.cFileName);
+	while (FindNextFileA(handle, &data));
+	FindClose(handle);
+#else
+	DIR* dir = opendir(directory.c_str());
+	if (!dir)
+		return keys;
+	while (dirent* entry = readdir(dir))
+		add(entry->d_name);
+	closedir(dir);
+#endif
+	return keys;
+}
+
+static uint64_t rotl(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t read64(const unsigned char* p)
+{
+	uint64_t value;
+	memcpy(&value, p, 8);
+	return value;
+}
+
+static uint32_t read32(const unsigned char* p)
+{
+	uint32_t value;
+	memcpy(&value, p, 4);
+	return value;
+}
+
+// xxHash64. Every load hashes its whole source, which FNV-1a's byte at a
+// time would make slower than mapping the cached entry.
+static uint64_t contentHash(const void* data, size_t size, uint64_t seed)
+{
+	const uint64_t P1 = 11400714785074694791ULL, P2 = 14029467366897019727ULL, P3 = 1609587929392839161ULL;
+	const uint64_t P4 = 9650029242287828579ULL, P5 = 2870177450012600261ULL;
+	auto round = [=](uint64_t acc, uint64_t input) { return rotl(acc + input * P2, 31) * P1; };
+	auto merge = [=](uint64_t acc, uint64_t lane) { return (acc ^ round(0, lane)) * P1 + P4; };
+
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	const unsigned char* end = p + size;
+	uint64_t hash;
+	if (size >= 32)
+	{
+		uint64_t lanes[4] = { seed + P1 + P2, seed + P2, seed, seed - P1 };
+		for (; p + 32 <= end; p += 32)
+			for (int i = 0; i < 4; i++)
+				lanes[i] = round(lanes[i], read64(p + i * 8));
+		hash = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+		for (int i = 0; i < 4; i++)
+			hash = merge(hash, lanes[i]);
+	}
+	else
+		hash = seed + P5;
+	hash += size;
+	for (; p + 8 <= end; p += 8)
+		hash = rotl(hash ^ round(0, read64(p)), 27) * P1 + P4;
+	if (p + 4 <= end)
+	{
+		hash = rotl(hash ^ (read32(p) * P1), 23) * P2 + P3;
+		p += 4;
+	}
+	for (; p < end; p++)
+		hash = rotl(hash ^ (*p * P5), 11) * P1;
+	hash ^= hash >> 33;
+	hash *= P2;
+	hash ^= hash >> 29;
+	hash *= P3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+bool CachedTexture::open(const char* path, uint64_t key)
+{
+	close();
+	if (!file.open(path))
+		return false;
+
+	const TextureCacheHeader* h = reinterpret_cast<const TextureCacheHeader*>(file.data());
+	const char* error = nullptr;
+	if (file.size() < sizeof(TextureCacheHeader) || h->magic != TEXTURE_CACHE_MAGIC)
+		error = "not a cached texture";
+	else if (h->version != TEXTURE_CACHE_VERSION)
+		error = "unsupported version";
+	else if (h->key != key)
+		error = "cached for another source";
+	else if (h->fileSize != file.size())
+		error = "truncated";
+	else if (h->levelCount == 0 || h->levelCount > SOIL_MAX_TEXTURE_LEVELS ||
+		sizeof(TextureCacheHeader) + uint64_t(h->levelCount) * sizeof(TextureCacheLevel) > h->fileSize)
+		error = "bad level table";
+
+	// Every level has to lie inside the file before anything is handed to GL
+	const TextureCacheLevel* levels = reinterpret_cast<const TextureCacheLevel*>(h + 1);
+	for (uint32_t i = 0; !error && i < h->levelCount; i++)
+		if (levels[i].offset > h->fileSize || levels[i].size > h->fileSize - levels[i].offset || levels[i].size > uint64_t(INT32_MAX) ||
+			levels[i].width <= 0 || levels[i].height <= 0)
+			error = "bad level offset";
+
+	if (error)
+	{
+		fprintf(stderr, "%s: %s\n", path, error);
+		file.close();
+		return false;
+	}
+	texture.texture_type = h->textureType;
+	texture.texture_target = h->textureTarget;
+	texture.flags = h->flags;
+	texture.internal_format = h->internalFormat;
+	texture.format = h->format;
+	texture.channels = int(h->channels);
+	texture.level_count = int(h->levelCount);
+	for (uint32_t i = 0; i < h->levelCount; i++)
+	{
+		SOIL_texture_level& level = texture.levels[i];
+		level.width = levels[i].width;
+		level.height = levels[i].height;
+		level.size = int(levels[i].size);
+		level.compressed = int(levels[i].compressed);
+		// SOIL only reads through it
+		level.data = const_cast<unsigned char*>(file.data() + levels[i].offset);
+	}
+	return true;
+}
+
+unsigned CachedTexture::upload(unsigned reuseTextureID) const
+{
+	unsigned id = SOIL_upload_prepared_texture(&texture, reuseTextureID);
+	if (id)
+	{
+		for (int i = 0; i < texture.level_count; i++)
+		{
+			renderStats.add(RENDER_TEXTURE_UPLOADS);
+			renderStats.add(RENDER_TEXTURE_BYTES, texture.levels[i].size);
+		}
+	}
+	return id;
+}
+
+TextureCache::TextureCache(std::string directory, uint64_t maxBytes)
+	: directory(std::move(directory)), maxBytes(maxBytes)
+{
+	makeDirectory(this->directory.c_str());
+
+	// A missing or damaged index only loses the order entries were used in
+	if (FILE* file = fopen((this->directory + "/index.bin").c_str(), "rb"))
+	{
+		TextureIndexHeader header;
+		if (fread(&header, sizeof(header), 1, file) == 1 && header.magic == TEXTURE_INDEX_MAGIC &&
+			header.version == TEXTURE_CACHE_VERSION && header.entryCount < (1u << 24))
+		{
+			entries.resize(size_t(header.entryCount));
+			if (fread(entries.data(), sizeof(Entry), entries.size(), file) == entries.size())
+				clock = header.clock;
+			else
+				entries.clear();
+		}
+		fclose(file);
+	}
+	std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.key < b.key; });
+
+	// The files are what takes the space. Ones the index lost, to a crash
+	// before flush() or a damaged index, count as least recently used so
+	// they go first; entries whose files are gone are dropped.
+	std::vector<Entry> found;
+	for (uint64_t key : listEntryKeys(this->directory))
+	{
+		FileStamp stamp;
+		if (!statFile(entryPath(key).c_str(), stamp))
+			continue;
+		Entry entry = { key, stamp.size, 0 };
+		auto known = std::lower_bound(entries.begin(), entries.end(), key, [](const Entry& e, uint64_t k) { return e.key < k; });
+		if (known != entries.end() && known->key == key)
+		{
+			entry.lastUsed = known->lastUsed;
+			dirty = dirty || entry.bytes != known->bytes;
+		}
+		else
+			dirty = true;
+		found.push_back(entry);
+	}
+	dirty = dirty || found.size() != entries.size();
+	entries.swap(found);
+	for (const Entry& entry : entries)
+		counters.bytes += entry.bytes;
+	counters.entries = entries.size();
+	evict();
+}
+
+std::string TextureCache::entryPath(uint64_t key) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016" PRIx64 ".tex", key);
+	return directory + name;
+}
+
+TextureCache::Entry* TextureCache::find(uint64_t key)
+{
+	for (Entry& entry : entries)
+		if (entry.key == key)
+			return &entry;
+	return nullptr;
+}
+
+bool TextureCache::forget(size_t index)
+{
+	// Windows can't delete a file that is still mapped; it stays counted
+	// and is tried again by the next eviction
+	if (::remove(entryPath(entries[index].key).c_str()) != 0 && errno != ENOENT)
+		return false;
+	counters.bytes -= entries[index].bytes;
+	entries.erase(entries.begin() + index);
+	counters.entries = entries.size();
+	dirty = true;
+	return true;
+}
+
+void TextureCache::evict()
+{
+	if (counters.bytes <= maxBytes)
+		return;
+	// Oldest first. The entry just written is the newest, so it always stays.
+	std::vector<Entry> byAge = entries;
+	std::sort(byAge.begin(), byAge.end(), [](const Entry& a, const Entry& b) { return a.lastUsed < b.lastUsed; });
+	for (size_t i = 0; i + 1 < byAge.size() && counters.bytes > maxBytes; i++)
+		if (forget(size_t(find(byAge[i].key) - entries.data())))
+			counters.evictions++;
+}
+
+bool TextureCache::write(const char* path, uint64_t key, const SOIL_prepared_texture& texture)
+{
+	TextureCacheHeader header = {};
+	header.magic = TEXTURE_CACHE_MAGIC;
+	header.version = TEXTURE_CACHE_VERSION;
+	header.key = key;
+	header.textureType = texture.texture_type;
+	header.textureTarget = texture.texture_target;
+	header.flags = texture.flags;
+	header.internalFormat = texture.internal_format;
+	header.format = texture.format;
+	header.channels = uint32_t(texture.channels);
+	header.levelCount = uint32_t(texture.level_count);
+
+	std::vector<TextureCacheLevel> levels(texture.level_count);
+	uint64_t offset = sizeof(TextureCacheHeader) + levels.size() * sizeof(TextureCacheLevel);
+	for (int i = 0; i < texture.level_count; i++)
+	{
+		const SOIL_texture_level& level = texture.levels[i];
+		levels[i].width = level.width;
+		levels[i].height = level.height;
+		levels[i].compressed = uint32_t(level.compressed);
+		levels[i].padding = 0;
+		levels[i].offset = alignTo(offset, 64);
+		levels[i].size = uint64_t(level.size);
+		offset = levels[i].offset + levels[i].size;
+	}
+	header.fileSize = offset;
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(levels.data(), sizeof(TextureCacheLevel), levels.size(), file);
+	for (int i = 0; i < texture.level_count; i++)
+		writeSection(file, levels[i].offset, texture.levels[i].data, size_t(levels[i].size));
+	bool ok = ftell(file) == long(header.fileSize);
+	ok = fclose(file) == 0 && ok;
+	return ok;
+}
+
+bool TextureCache::prepare(const char* path, int forceChannels, unsigned flags,
+	const SOIL_capabilities& capabilities, CachedTexture& texture)
+{
+	texture.close();
+	auto t_start = std::chrono::high_resolution_clock::now();
+	MappedFile source;
+	if (!source.open(path))
+	{
+		fprintf(stderr, "%s: not found\n", path);
+		counters.failures++;
+		return false;
+	}
+	// Whatever changes SOIL_prepare_texture's output is part of the key
+	struct
+	{
+		int32_t forceChannels;
+		uint32_t flags;
+		SOIL_capabilities capabilities;
+		uint32_t version;
+	} settings = { forceChannels, flags, capabilities, TEXTURE_CACHE_VERSION };
+	uint64_t key = contentHash(source.data(), source.size(), contentHash(&settings, sizeof(settings), 0));
+	counters.hashSeconds += secondsSince(t_start);
+
+	std::string cachePath = entryPath(key);
+	if (Entry* entry = find(key))
+	{
+		t_start = std::chrono::high_resolution_clock::now();
+		bool opened = texture.open(cachePath.c_str(), key);
+		counters.mapSeconds += secondsSince(t_start);
+		if (opened)
+		{
+			entry->lastUsed = ++clock;
+			dirty = true;
+			counters.hits++;
+			return true;
+		}
+		// Deleted or damaged behind the cache's back
+		if (!forget(size_t(entry - entries.data())))
+		{
+			counters.failures++;
+			return false;
+		}
+	}
+	counters.misses++;
+
+	t_start = std::chrono::high_resolution_clock::now();
+	SOIL_context context;
+	SOIL_init_context(&context);
+	int width, height, channels;
+	unsigned char* pixels = SOIL_load_image_from_memory_ctx(&context, source.data(), int(source.size()),
+		&width, &height, &channels, forceChannels);
+	SOIL_prepared_texture prepared;
+	bool ok = pixels && SOIL_prepare_texture(pixels, width, height, forceChannels ? forceChannels : channels,
+		flags, &capabilities, &prepared);
+	SOIL_free_image_data(pixels);
+	counters.processSeconds += secondsSince(t_start);
+	if (!ok)
+	{
+		fprintf(stderr, "%s: %s\n", path, pixels ? SOIL_last_result() : context.result_string);
+		counters.failures++;
+		return false;
+	}
+
+	t_start = std::chrono::high_resolution_clock::now();
+	bool written = write(cachePath.c_str(), key, prepared);
+	SOIL_free_prepared_texture(&prepared);
+	counters.writeSeconds += secondsSince(t_start);
+	if (!written)
+	{
+		fprintf(stderr, "%s: could not write the cache\n", cachePath.c_str());
+		::remove(cachePath.c_str());
+		counters.failures++;
+		return false;
+	}
+	struct stat info;
+	Entry entry = { key, stat(cachePath.c_str(), &info) == 0 ? uint64_t(info.st_size) : 0, ++clock };
+	entries.push_back(entry);
+	counters.bytes += entry.bytes;
+	counters.entries = entries.size();
+	dirty = true;
+	evict();
+
+	// Hits and misses hand out the same mapping
+	t_start = std::chrono::high_resolution_clock::now();
+	ok = texture.open(cachePath.c_str(), key);
+	counters.mapSeconds += secondsSince(t_start);
+	return ok;
+}
+
+unsigned TextureCache::loadTexture(const char* path, int forceChannels, unsigned reuseTextureID, unsigned flags)
+{
+	// Direct DDS loads are uploaded as they are, with nothing to cache
+	if (flags & SOIL_FLAG_DDS_LOAD_DIRECT)
+		return SOIL_load_OGL_texture(path, forceChannels, reuseTextureID, flags);
+
+	SOIL_capabilities capabilities;
+	SOIL_query_capabilities(&capabilities);
+	CachedTexture texture;
+	if (!prepare(path, forceChannels, flags, capabilities, texture))
+		return SOIL_load_OGL_texture(path, forceChannels, reuseTextureID, flags);
+	return texture.upload(reuseTextureID);
+}
+
+bool TextureCache::flush()
+{
+	if (!dirty)
+		return true;
+	FILE* file = fopen((directory + "/index.bin").c_str(), "wb");
+	if (!file)
+		return false;
+	TextureIndexHeader header = { TEXTURE_INDEX_MAGIC, TEXTURE_CACHE_VERSION, clock, entries.size() };
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(entries.data(), sizeof(Entry), entries.size(), file);
+	bool ok = ftell(file) == long(sizeof(header) + entries.size() * sizeof(Entry));
+	ok = fclose(file) == 0 && ok;
+	dirty = !ok;
+	return ok;
+}
+
+void TextureCache::clear()
+{
+	for (size_t i = entries.size(); i-- > 0;)
+		forget(i);
+	if (entries.empty())
+		clock = 0;
+}
+
+void TextureCache::printStats() const
+{
+	const TextureCacheStats& s = counters;
+	printf("Texture cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " failed, %" PRIu64 " evicted, "
+		"%zu entries, %.2f of %.2f MB; hashing %.1f ms, processing %.1f ms, writing %.1f ms, mapping %.2f ms\n",
+		s.hits, s.misses, s.failures, s.evictions, s.entries, s.bytes / 1e6, maxBytes / 1e6,
+		s.hashSeconds * 1e3, s.processSeconds * 1e3, s.writeSeconds * 1e3, s.mapSeconds * 1e3);
+}
+
+// Level bytes of a prepared texture, to compare cached and uncached results
+static uint64_t preparedHash(const SOIL_prepared_texture& texture)
+{
+	uint64_t hash = hashBytes(&texture.level_count, sizeof(int));
+	hash = hashBytes(&texture.internal_format, sizeof(unsigned), hash);
+	for (int i = 0; i < texture.level_count; i++)
+		hash = hashBytes(texture.levels[i].data, size_t(texture.levels[i].size), hash * 31 + texture.levels[i].compressed);
+	return hash;
+}
+
+void benchmarkTextureCache()
+{
+	std::vector<std::string> paths = sampleTexturePaths();
+	const size_t count = paths.size();
+	// The eviction pattern below takes four
+	if (count < 4)
+	{
+		printf("Need four sample textures, have %zu\n", count);
+		return;
+	}
+	const char* directory = "bench_texture_cache";
+
+	// A typical desktop GL 3 implementation, no context needed
+	SOIL_capabilities capabilities;
+	capabilities.max_texture_size = 16384;
+	capabilities.NPOT = 1;
+	capabilities.texture_rectangle = 1;
+	capabilities.DXT = 1;
+
+	struct FlagSet { const char* name; unsigned flags; };
+	const FlagSet flagSets[] = {
+		{ "invert + mipmaps", SOIL_FLAG_INVERT_Y | SOIL_FLAG_MIPMAPS },
+		{ "invert + mipmaps + DXT", SOIL_FLAG_INVERT_Y | SOIL_FLAG_MIPMAPS | SOIL_FLAG_COMPRESS_TO_DXT },
+	};
+	for (const FlagSet& set : flagSets)
+	{
+		// What SOIL_load_OGL_texture does on the CPU at every launch
+		std::vector<uint64_t> hashes;
+		auto t_start = std::chrono::high_resolution_clock::now();
+		for (const std::string& path : paths)
+		{
+			int width, height, channels;
+			unsigned char* pixels = SOIL_load_image(path.c_str(), &width, &height, &channels, SOIL_LOAD_RGBA);
+			SOIL_prepared_texture prepared;
+			if (!pixels || !SOIL_prepare_texture(pixels, width, height, 4, set.flags, &capabilities, &prepared))
+			{
+				printf("Could not load %s, run from the project directory\n", path.c_str());
+				SOIL_free_image_data(pixels);
+				return;
+			}
+			hashes.push_back(preparedHash(prepared));
+			SOIL_free_prepared_texture(&prepared);
+			SOIL_free_image_data(pixels);
+		}
+		double uncachedSeconds = secondsSince(t_start);
+
+		// The first launch fills the cache, the next one only maps it
+		double seconds[2];
+		int mismatched = 0;
+		uint64_t hits = 0, bytes = 0;
+		{
+			TextureCache cache(directory, 1ull << 30);
+			cache.clear();
+		}
+		for (int launch = 0; launch < 2; launch++)
+		{
+			TextureCache cache(directory, 1ull << 30);
+			std::vector<CachedTexture> textures(count);
+			t_start = std::chrono::high_resolution_clock::now();
+			for (size_t i = 0; i < count; i++)
+				mismatched += !cache.prepare(paths[i].c_str(), SOIL_LOAD_RGBA, set.flags, capabilities, textures[i]);
+			seconds[launch] = secondsSince(t_start);
+			for (size_t i = 0; i < count; i++)
+				mismatched += textures[i].isOpen() && preparedHash(textures[i].prepared()) != hashes[i];
+			hits = cache.stats().hits;
+			bytes = cache.stats().bytes;
+		}
+		printf("%-24s %zu textures: uncached %7.1f ms, first launch %7.1f ms, cached %6.2f ms (%.0fx), "
+			"%" PRIu64 " hits, %.2f MB on disk, %s\n",
+			set.name, count, uncachedSeconds * 1e3, seconds[0] * 1e3, seconds[1] * 1e3, uncachedSeconds / seconds[1],
+			hits, bytes / 1e6, mismatched ? "MISMATCH" : "identical");
+	}
+
+	// Two hot textures and two that take turns, in room for three: the cold
+	// ones evict each other while the hot ones keep hitting
+	const unsigned flags = flagSets[0].flags;
+	std::vector<uint64_t> sizes(count);
+	{
+		TextureCache cache(directory, 1ull << 30);
+		cache.clear();
+		for (size_t i = 0; i < count; i++)
+		{
+			CachedTexture texture;
+			cache.prepare(paths[i].c_str(), SOIL_LOAD_RGBA, flags, capabilities, texture);
+			sizes[i] = texture.byteSize();
+		}
+	}
+	TextureCache cache(directory, sizes[0] + sizes[1] + std::max(sizes[2], sizes[3]));
+	cache.clear();
+	for (int round = 0; round < 8; round++)
+	{
+		CachedTexture texture;
+		cache.prepare(paths[0].c_str(), SOIL_LOAD_RGBA, flags, capabilities, texture);
+		cache.prepare(paths[1].c_str(), SOIL_LOAD_RGBA, flags, capabilities, texture);
+		cache.prepare(paths[2 + round % 2].c_str(), SOIL_LOAD_RGBA, flags, capabilities, texture);
+	}
+	cache.printStats();
+	cache.clear();
+	cache.flush();
+	remove((std::string(directory) + "/index.bin").c_str());
+	removeDirectory(directory);
+}
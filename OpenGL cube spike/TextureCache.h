@@ -0,0 +1,138 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <SOIL/SOIL.h>
+
+// Cached texture layout, version 1: everything SOIL_prepare_texture made
+// from one source image. Every level starts on a 64-byte boundary so it can
+// be handed to glTexImage2D / glCompressedTexImage2D straight from the mapping.
+//
+//   TextureCacheHeader
+//   TextureCacheLevel[levelCount]
+//   levels
+
+const uint32_t TEXTURE_CACHE_MAGIC = 0x31584554;	// "TEX1"
+const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+struct TextureCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;				// Repeated from the file name, to catch renamed files
+	uint32_t textureType;		// The SOIL_prepared_texture fields
+	uint32_t textureTarget;
+	uint32_t flags;
+	uint32_t internalFormat;
+	uint32_t format;
+	uint32_t channels;
+	uint32_t levelCount;
+	uint32_t padding;
+	uint64_t fileSize;
+};
+
+struct TextureCacheLevel
+{
+	int32_t width;
+	int32_t height;
+	uint32_t compressed;
+	uint32_t padding;
+	uint64_t offset;
+	uint64_t size;
+};
+
+static_assert(sizeof(TextureCacheHeader) == 56, "TextureCacheHeader layout is part of the file format");
+static_assert(sizeof(TextureCacheLevel) == 32, "TextureCacheLevel layout is part of the file format");
+
+// A processed texture mapped from the cache. The prepared texture points
+// into the mapping, so it is only valid while this stays open, and must not
+// be given to SOIL_free_prepared_texture.
+class CachedTexture
+{
+public:
+	bool isOpen() const { return file.isOpen(); }
+	void close() { file.close(); texture = SOIL_prepared_texture(); }
+
+	const SOIL_prepared_texture& prepared() const { return texture; }
+	size_t byteSize() const { return file.size(); }
+
+	// SOIL_upload_prepared_texture, on the OpenGL thread
+	unsigned upload(unsigned reuseTextureID = 0) const;
+
+private:
+	friend class TextureCache;
+	bool open(const char* path, uint64_t key);
+
+	MappedFile file;
+	SOIL_prepared_texture texture = SOIL_prepared_texture();
+};
+
+struct TextureCacheStats
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;			// Processed and written
+	uint64_t failures = 0;			// Sources that could not be loaded or processed
+	uint64_t evictions = 0;
+	uint64_t bytes = 0;				// Of the entries on disk
+	size_t entries = 0;
+	double hashSeconds = 0.0;		// Reading and hashing sources
+	double processSeconds = 0.0;	// Decoding and preparing on misses
+	double writeSeconds = 0.0;
+	double mapSeconds = 0.0;		// Mapping and validating entries
+};
+
+// Persistent cache of SOIL's processed textures: every level in its final
+// format, so a hit skips decoding, flipping, resizing, MIPmapping and DXT
+// compression. Entries are keyed by a hash of the source bytes, the SOIL
+// flags, the forced channels and the capabilities the texture was prepared
+// for, and live in one file each. Past maxBytes the least recently used
+// entries are deleted. Not thread safe.
+class TextureCache
+{
+public:
+	// Creates the directory if needed; its index of entries is read here,
+	// checked against the files in it, and written back by flush() and the
+	// destructor
+	TextureCache(std::string directory, uint64_t maxBytes);
+	~TextureCache() { flush(); }
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// Maps the entry for the source, processing it and writing the entry
+	// first on a miss. Fails if the source can't be loaded or processed.
+	bool prepare(const char* path, int forceChannels, unsigned flags,
+		const SOIL_capabilities& capabilities, CachedTexture& texture);
+	// SOIL_load_OGL_texture through the cache, for the current context
+	unsigned loadTexture(const char* path, int forceChannels, unsigned reuseTextureID, unsigned flags);
+
+	bool flush();
+	// Deletes every entry that isn't mapped
+	void clear();
+
+	const TextureCacheStats& stats() const { return counters; }
+	void printStats() const;
+
+private:
+	struct Entry
+	{
+		uint64_t key;
+		uint64_t bytes;
+		uint64_t lastUsed;		// The clock when it was last hit or written
+	};
+
+	std::string entryPath(uint64_t key) const;
+	Entry* find(uint64_t key);
+	bool forget(size_t index);		// Deletes the entry's file too; false if it couldn't be
+	bool write(const char* path, uint64_t key, const SOIL_prepared_texture& texture);
+	void evict();
+
+	std::string directory;
+	uint64_t maxBytes;
+	uint64_t clock = 0;
+	std::vector<Entry> entries;
+	bool dirty = false;
+	TextureCacheStats counters;
+};
@@ -0,0 +1,332 @@
+#include "TextureResidency.h"
+#include "Benchmark.h"
+#include "RenderStats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// Levels this size and smaller are always resident
+const uint32_t TAIL_SIZE = 64;
+
+TextureResidency::TextureResidency(const AssetPack& pack, JobSystem& jobs, size_t budgetBytes,
+	size_t uploadBytesPerFrame, bool uploads)
+	: pack(pack), jobs(jobs), uploads(uploads), uploadBytesPerFrame(uploadBytesPerFrame)
+{
+	counters.budgetBytes = budgetBytes;
+	created = std::chrono::high_resolution_clock::now();
+}
+
+TextureResidency::~TextureResidency()
+{
+	// Prefetch jobs point at our textures
+	jobs.wait(prefetching);
+	for (auto& t : textures)
+		if (t->texture)
+			glDeleteTextures(1, &t->texture);
+}
+
+ResidentTextureId TextureResidency::add(const char* name)
+{
+	const PackEntry* entry = pack.find(name);
+	if (!entry || entry->type != PACK_TEXTURE || !entry->levelCount)
+		return NO_RESIDENT_TEXTURE;
+
+	std::unique_ptr<Texture> t(new Texture);
+	t->entry = entry;
+	t->levels = pack.levels(*entry);
+	t->texture = 0;
+	t->tailLevel = entry->levelCount - 1;
+	while (t->tailLevel > 0 && std::max(t->levels[t->tailLevel - 1].width, t->levels[t->tailLevel - 1].height) <= TAIL_SIZE)
+		t->tailLevel--;
+	t->resident = t->tailLevel;
+	t->wanted = t->tailLevel;
+	t->frameWanted = t->tailLevel;
+	t->lastUsed = frame;
+	t->streaming = NOT_STREAMING;
+
+	for (uint32_t level = t->tailLevel; level < entry->levelCount; level++)
+		counters.residentBytes += size_t(t->levels[level].size);
+	counters.peakBytes = std::max(counters.peakBytes, counters.residentBytes);
+
+	if (uploads)
+	{
+		GLint bound = 0;
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+		glGenTextures(1, &t->texture);
+		glBindTexture(GL_TEXTURE_2D, t->texture);
+		renderStats.add(RENDER_TEXTURE_BINDS, 2);
+		for (uint32_t level = t->tailLevel; level < entry->levelCount; level++)
+			pack.uploadLevel(*entry, level);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, t->tailLevel);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry->levelCount - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, bound);
+	}
+
+	textures.push_back(std::move(t));
+	return ResidentTextureId(textures.size() - 1);
+}
+
+void TextureResidency::markUsed(ResidentTextureId id, float screenPixels)
+{
+	// One texel per pixel: each level halves the size
+	Texture& t = *textures[id];
+	float size = float(std::max(t.levels[0].width, t.levels[0].height));
+	float level = screenPixels > 0.0f ? std::floor(std::log2(size / screenPixels)) : float(t.tailLevel);
+	uint32_t wanted = uint32_t(std::min(std::max(level, 0.0f), float(t.tailLevel)));
+	t.frameWanted = std::min(t.frameWanted, wanted);
+	t.lastUsed = frame + 1;
+}
+
+void TextureResidency::update()
+{
+	auto t_start = std::chrono::high_resolution_clock::now();
+	frame++;
+	counters.updates++;
+
+	GLint bound = 0;
+	if (uploads)
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+
+	// Upload prefetched levels, at least one per frame however large
+	size_t uploaded = 0;
+	for (auto& t : textures)
+	{
+		if (t->streaming == NOT_STREAMING || !t->prefetched.load())
+			continue;
+		size_t size = size_t(t->levels[t->streaming].size);
+		if (uploaded && uploaded + size > uploadBytesPerFrame)
+			continue;
+		uploaded += size;
+		finishStreaming(*t);
+	}
+
+	// Unused textures need nothing beyond their tail
+	for (auto& t : textures)
+	{
+		t->wanted = t->lastUsed == frame ? t->frameWanted : t->tailLevel;
+		t->frameWanted = t->tailLevel;
+	}
+
+	// A lowered budget takes levels away even from textures that still want them
+	while (counters.residentBytes + pendingBytes > counters.budgetBytes && evictOne(nullptr, false))
+		;
+
+	// Furthest from their wanted level first, then most recently used
+	candidates.clear();
+	for (auto& t : textures)
+		if (t->wanted < t->resident && t->streaming == NOT_STREAMING)
+			candidates.push_back(t.get());
+	std::sort(candidates.begin(), candidates.end(), [](const Texture* a, const Texture* b)
+	{
+		uint32_t deficitA = a->resident - a->wanted, deficitB = b->resident - b->wanted;
+		if (deficitA != deficitB)
+			return deficitA > deficitB;
+		return a->lastUsed > b->lastUsed;
+	});
+	for (Texture* t : candidates)
+	{
+		size_t size = size_t(t->levels[t->resident - 1].size);
+		while (counters.residentBytes + pendingBytes + size > counters.budgetBytes && evictOne(t, true))
+			;
+		if (counters.residentBytes + pendingBytes + size > counters.budgetBytes)
+		{
+			counters.starvedRequests++;
+			continue;
+		}
+		startStreaming(*t);
+	}
+
+	if (uploads)
+	{
+		glBindTexture(GL_TEXTURE_2D, bound);
+		renderStats.add(RENDER_TEXTURE_BINDS);
+	}
+	counters.uploadSeconds += secondsSince(t_start);
+}
+
+void TextureResidency::startStreaming(Texture& t)
+{
+	t.streaming = t.resident - 1;
+	t.prefetched = false;
+	pendingBytes += size_t(t.levels[t.streaming].size);
+
+	// Touch a byte per page so the upload reads from memory, not disk
+	const unsigned char* bytes = pack.data(t.levels[t.streaming].offset);
+	size_t size = size_t(t.levels[t.streaming].size);
+	Texture* texture = &t;
+	jobs.run([bytes, size, texture]
+	{
+		unsigned sum = 0;
+		for (size_t i = 0; i < size; i += 4096)
+			sum += bytes[i];
+		volatile unsigned sink = sum;
+		(void)sink;
+		texture->prefetched = true;
+	}, &prefetching);
+}
+
+void TextureResidency::finishStreaming(Texture& t)
+{
+	uint32_t level = t.streaming;
+	size_t size = size_t(t.levels[level].size);
+	if (uploads)
+	{
+		glBindTexture(GL_TEXTURE_2D, t.texture);
+		renderStats.add(RENDER_TEXTURE_BINDS);
+		pack.uploadLevel(*t.entry, level);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+	}
+	t.resident = level;
+	t.streaming = NOT_STREAMING;
+	pendingBytes -= size;
+	counters.residentBytes += size;
+	counters.peakBytes = std::max(counters.peakBytes, counters.residentBytes);
+	counters.levelsStreamed++;
+	counters.bytesStreamed += size;
+}
+
+bool TextureResidency::evictOne(const Texture* keep, bool surplusOnly)
+{
+	Texture* victim = nullptr;
+	for (auto& t : textures)
+	{
+		// Levels are dropped finest first, and never while the next one is on its way
+		if (t.get() == keep || t->resident >= t->tailLevel || t->streaming != NOT_STREAMING)
+			continue;
+		if (surplusOnly && t->resident >= t->wanted)
+			continue;
+		if (!victim || t->lastUsed < victim->lastUsed ||
+			(t->lastUsed == victim->lastUsed && t->resident < victim->resident))
+			victim = t.get();
+	}
+	if (!victim)
+		return false;
+	evict(*victim);
+	return true;
+}
+
+void TextureResidency::evict(Texture& t)
+{
+	uint32_t level = t.resident;
+	if (uploads)
+	{
+		// Redefining the level as empty releases its storage
+		glBindTexture(GL_TEXTURE_2D, t.texture);
+		renderStats.add(RENDER_TEXTURE_BINDS);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+		if (t.entry->format)
+			glTexImage2D(GL_TEXTURE_2D, level, t.entry->internalFormat, 0, 0, 0, t.entry->format, GL_UNSIGNED_BYTE, nullptr);
+		else
+			glCompressedTexImage2D(GL_TEXTURE_2D, level, t.entry->internalFormat, 0, 0, 0, 0, nullptr);
+	}
+	t.resident = level + 1;
+	counters.residentBytes -= size_t(t.levels[level].size);
+	counters.levelsEvicted++;
+}
+
+void TextureResidency::printStats() const
+{
+	double seconds = secondsSince(created);
+	printf("Residency: %zu textures, %.2f of %.2f MB resident (peak %.2f), %llu levels streamed (%.2f MB, %.2f MB/s), %llu evicted, %llu starved requests, %.3f ms per update\n",
+		textures.size(), counters.residentBytes / 1048576.0, counters.budgetBytes / 1048576.0, counters.peakBytes / 1048576.0,
+		(unsigned long long)counters.levelsStreamed, counters.bytesStreamed / 1048576.0,
+		seconds > 0.0 ? counters.bytesStreamed / 1048576.0 / seconds : 0.0,
+		(unsigned long long)counters.levelsEvicted, (unsigned long long)counters.starvedRequests,
+		counters.updates ? counters.uploadSeconds * 1e3 / counters.updates : 0.0);
+}
+
+void benchmarkTextureResidency()
+{
+	// 32 textures baked from the two samples, their full chains 4x the budget
+	const char* packPath = "bench_residency.pak";
+	const char* sources[] = { "Textures/sample.png", "Textures/sample2.png" };
+	const int textureCount = 32;
+	JobSystem jobs;
+	{
+		AssetPackBuilder builder(&jobs);
+		for (int i = 0; i < textureCount; i++)
+		{
+			char name[32];
+			sprintf(name, "texture%02d", i);
+			builder.addTexture(name, sources[i % 2], 3, false);
+		}
+		if (!builder.write(packPath))
+		{
+			printf("Could not bake the benchmark pack, run from the project directory\n");
+			return;
+		}
+	}
+	AssetPack pack;
+	if (!pack.open(packPath))
+	{
+		printf("Could not open the benchmark pack\n");
+		return;
+	}
+
+	size_t fullBytes = 0;
+	for (int i = 0; i < textureCount; i++)
+	{
+		char name[32];
+		sprintf(name, "texture%02d", i);
+		const PackEntry* entry = pack.find(name);
+		const PackLevel* levels = pack.levels(*entry);
+		for (uint32_t level = 0; level < entry->levelCount; level++)
+			fullBytes += size_t(levels[level].size);
+	}
+
+	// Prefetch jobs read the mapping, so the residency goes before the pack
+	std::unique_ptr<TextureResidency> residency(new TextureResidency(pack, jobs, fullBytes / 4, 1 << 20, false));
+	for (int i = 0; i < textureCount; i++)
+	{
+		char name[32];
+		sprintf(name, "texture%02d", i);
+		residency->add(name);
+	}
+
+	// A camera sweeping along a row of textured objects: each is on screen
+	// for a while, growing as it comes closer
+	const int frames = 600;
+	uint64_t satisfied = 0, used = 0;
+	auto t_start = std::chrono::high_resolution_clock::now();
+	for (int f = 0; f < frames; f++)
+	{
+		float cameraX = float(f) / frames * textureCount;
+		for (int i = 0; i < textureCount; i++)
+		{
+			float distance = std::abs(i - cameraX);
+			if (distance > 4.0f)
+				continue;
+			residency->markUsed(ResidentTextureId(i), 1024.0f / (1.0f + distance * distance));
+		}
+		residency->update();
+		// Frames are long enough for the disk to keep up
+		residency->flush();
+		for (int i = 0; i < textureCount; i++)
+		{
+			if (std::abs(i - cameraX) > 4.0f)
+				continue;
+			used++;
+			satisfied += residency->residentLevel(ResidentTextureId(i)) <= residency->wantedLevel(ResidentTextureId(i));
+		}
+	}
+	double seconds = secondsSince(t_start);
+	printf("%d textures, %.1f MB with full chains, budget %.1f MB, %d frames in %.1f ms (%.3f ms per update)\n",
+		textureCount, fullBytes / 1048576.0, fullBytes / 4 / 1048576.0, frames, seconds * 1e3, seconds * 1e3 / frames);
+	printf("Visible textures at their wanted level: %.1f%% of %llu\n", 100.0 * satisfied / std::max<uint64_t>(used, 1),
+		(unsigned long long)used);
+	residency->printStats();
+
+	// Halving the budget evicts down to it straight away
+	residency->setBudget(fullBytes / 8);
+	residency->update();
+	printf("Budget halved: %.2f MB resident after one update\n", residency->stats().residentBytes / 1048576.0);
+	residency.reset();
+	pack.close();
+	remove(packPath);
+}
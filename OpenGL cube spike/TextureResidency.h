@@ -0,0 +1,100 @@
+#pragma once
+
+#include "AssetPack.h"
+#include "JobSystem.h"
+
+#include <GL/glew.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+typedef uint32_t ResidentTextureId;
+const ResidentTextureId NO_RESIDENT_TEXTURE = 0xFFFFFFFF;
+
+struct ResidencyStats
+{
+	size_t budgetBytes = 0;
+	size_t residentBytes = 0;
+	size_t peakBytes = 0;
+	uint64_t levelsStreamed = 0;
+	uint64_t levelsEvicted = 0;
+	uint64_t bytesStreamed = 0;
+	uint64_t starvedRequests = 0;	// A finer level was wanted but nothing could make room
+	uint64_t updates = 0;
+	double uploadSeconds = 0.0;		// GL uploads and evictions on the calling thread
+};
+
+// Streams mip levels of asset pack textures under a byte budget. Every
+// texture keeps its mip tail (levels of 64x64 and smaller) resident, with
+// GL_TEXTURE_BASE_LEVEL at its finest resident level. markUsed() reports how
+// large a texture appears on screen; update() streams the next finer level
+// of the textures furthest from what they need, coarse to fine, making room
+// by evicting levels that are no longer needed, least recently used first.
+// Levels still wanted are only evicted when the budget shrinks.
+// A level's pages are faulted in from the mapping by a job before it is
+// uploaded, so disk reads don't stall the render thread.
+class TextureResidency
+{
+public:
+	// uploads = false keeps the bookkeeping and prefetching but makes no GL calls
+	TextureResidency(const AssetPack& pack, JobSystem& jobs, size_t budgetBytes,
+		size_t uploadBytesPerFrame = 4 << 20, bool uploads = true);
+	~TextureResidency();
+
+	// Creates the texture with its mip tail resident
+	ResidentTextureId add(const char* name);
+	GLuint texture(ResidentTextureId id) const { return textures[id]->texture; }
+
+	// The texture covers about screenPixels pixels along its larger axis this frame
+	void markUsed(ResidentTextureId id, float screenPixels);
+	void update();
+	// Wait for the levels being prefetched, so the next update() uploads them
+	void flush() { jobs.wait(prefetching); }
+
+	uint32_t residentLevel(ResidentTextureId id) const { return textures[id]->resident; }
+	uint32_t wantedLevel(ResidentTextureId id) const { return textures[id]->wanted; }
+	size_t textureCount() const { return textures.size(); }
+
+	void setBudget(size_t bytes) { counters.budgetBytes = bytes; }
+	const ResidencyStats& stats() const { return counters; }
+	void printStats() const;
+
+private:
+	static const uint32_t NOT_STREAMING = 0xFFFFFFFF;
+
+	struct Texture
+	{
+		const PackEntry* entry;
+		const PackLevel* levels;
+		GLuint texture;
+		uint32_t tailLevel;			// Finest level of the mip tail
+		uint32_t resident;			// Finest resident level
+		uint32_t wanted;			// Finest level needed by the last update
+		uint32_t frameWanted;		// Finest level asked for since the last update
+		uint64_t lastUsed;			// Update it was last used in
+		uint32_t streaming;			// Level being prefetched
+		std::atomic<bool> prefetched;
+		Texture() : prefetched(false) {}
+	};
+
+	void startStreaming(Texture& t);
+	void finishStreaming(Texture& t);
+	// Drop the finest level of the least recently used texture that has one to spare
+	bool evictOne(const Texture* keep, bool surplusOnly);
+	void evict(Texture& t);
+
+	const AssetPack& pack;
+	JobSystem& jobs;
+	bool uploads;
+	size_t uploadBytesPerFrame;
+	std::vector<std::unique_ptr<Texture>> textures;
+	std::vector<Texture*> candidates;
+	size_t pendingBytes = 0;		// Levels being prefetched, already counted against the budget
+	JobCounter prefetching;
+	uint64_t frame = 0;
+
+	ResidencyStats counters;
+	std::chrono::high_resolution_clock::time_point created;
+};
@@ -0,0 +1,355 @@
+#include "TransformHierarchy.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define TRANSFORM_SIMD 1
+#endif
+
+static const glm::mat4 identity(1.0f);
+
+TransformId TransformHierarchy::create(TransformId parent)
+{
+	TransformId id = TransformId(slotOf.size());
+	uint32_t slot = uint32_t(idOf.size());
+	slotOf.push_back(slot);
+	idOf.push_back(id);
+
+	tx.push_back(0.0f); ty.push_back(0.0f); tz.push_back(0.0f);
+	qx.push_back(0.0f); qy.push_back(0.0f); qz.push_back(0.0f); qw.push_back(1.0f);
+	sx.push_back(1.0f); sy.push_back(1.0f); sz.push_back(1.0f);
+	uint32_t parentIndex = parent == NO_TRANSFORM ? NO_TRANSFORM : slotOf[parent];
+	parentSlot.push_back(parentIndex);
+	depth.push_back(parent == NO_TRANSFORM ? 0 : depth[parentIndex] + 1);
+	localDirty.push_back(1);
+	changedIn.push_back(0);
+	worlds.push_back(identity);
+
+	structureChanged = true;
+	anyDirty = true;
+	return id;
+}
+
+void TransformHierarchy::setTranslation(TransformId id, const glm::vec3& translation)
+{
+	uint32_t slot = slotOf[id];
+	tx[slot] = translation.x;
+	ty[slot] = translation.y;
+	tz[slot] = translation.z;
+	localDirty[slot] = 1;
+	anyDirty = true;
+}
+
+void TransformHierarchy::setRotation(TransformId id, const glm::quat& rotation)
+{
+	uint32_t slot = slotOf[id];
+	qx[slot] = rotation.x;
+	qy[slot] = rotation.y;
+	qz[slot] = rotation.z;
+	qw[slot] = rotation.w;
+	localDirty[slot] = 1;
+	anyDirty = true;
+}
+
+void TransformHierarchy::setScale(TransformId id, const glm::vec3& scale)
+{
+	uint32_t slot = slotOf[id];
+	sx[slot] = scale.x;
+	sy[slot] = scale.y;
+	sz[slot] = scale.z;
+	localDirty[slot] = 1;
+	anyDirty = true;
+}
+
+template <typename T>
+static void permute(std::vector<T>& values, const std::vector<uint32_t>& newSlot)
+{
+	std::vector<T> sorted(values.size());
+	for (size_t i = 0; i < values.size(); i++)
+		sorted[newSlot[i]] = values[i];
+	values.swap(sorted);
+}
+
+void TransformHierarchy::reorder()
+{
+	uint32_t maxDepth = 0;
+	for (uint32_t d : depth)
+		maxDepth = std::max(maxDepth, d);
+	levelStart.assign(maxDepth + 2, 0);
+	for (uint32_t d : depth)
+		levelStart[d + 1]++;
+	for (size_t d = 1; d < levelStart.size(); d++)
+		levelStart[d] += levelStart[d - 1];
+
+	// Creation order is usually breadth first already
+	if (std::is_sorted(depth.begin(), depth.end()))
+		return;
+
+	// Stable counting sort by depth keeps siblings next to each other
+	std::vector<uint32_t> newSlot(depth.size());
+	std::vector<uint32_t> cursor(levelStart.begin(), levelStart.end() - 1);
+	for (size_t i = 0; i < depth.size(); i++)
+		newSlot[i] = cursor[depth[i]]++;
+
+	permute(tx, newSlot); permute(ty, newSlot); permute(tz, newSlot);
+	permute(qx, newSlot); permute(qy, newSlot); permute(qz, newSlot); permute(qw, newSlot);
+	permute(sx, newSlot); permute(sy, newSlot); permute(sz, newSlot);
+	permute(depth, newSlot);
+	permute(localDirty, newSlot);
+	permute(changedIn, newSlot);
+	permute(worlds, newSlot);
+	permute(idOf, newSlot);
+	permute(parentSlot, newSlot);
+	for (uint32_t& parent : parentSlot)
+		if (parent != NO_TRANSFORM)
+			parent = newSlot[parent];
+	for (uint32_t slot = 0; slot < idOf.size(); slot++)
+		slotOf[idOf[slot]] = slot;
+	counters.reorders++;
+}
+
+void TransformHierarchy::update(bool simd)
+{
+	auto t_start = std::chrono::high_resolution_clock::now();
+	if (structureChanged)
+	{
+		reorder();
+		structureChanged = false;
+	}
+
+	recomputed = 0;
+	if (anyDirty)
+	{
+		// Stamping with the update number saves clearing a flag per node
+		uint32_t stamp = uint32_t(counters.updates + 1);
+		for (size_t level = 0; level + 1 < levelStart.size(); level++)
+		{
+			// Parents live in earlier levels, so their flags are final here
+			batch.clear();
+			for (uint32_t slot = levelStart[level]; slot < levelStart[level + 1]; slot++)
+			{
+				uint32_t parent = parentSlot[slot];
+				if (localDirty[slot] || (parent != NO_TRANSFORM && changedIn[parent] == stamp))
+					batch.push_back(slot);
+			}
+#ifdef TRANSFORM_SIMD
+			if (simd)
+				computeSimd(batch.data(), batch.size());
+			else
+#endif
+				computeScalar(batch.data(), batch.size());
+			for (uint32_t slot : batch)
+			{
+				changedIn[slot] = stamp;
+				localDirty[slot] = 0;
+			}
+			recomputed += batch.size();
+		}
+		anyDirty = false;
+	}
+
+	counters.updates++;
+	counters.nodesRecomputed += recomputed;
+	counters.updateSeconds += secondsSince(t_start);
+}
+
+void TransformHierarchy::computeScalar(const uint32_t* slots, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t s = slots[i];
+		glm::mat3 rotation = glm::mat3_cast(glm::quat(qw[s], qx[s], qy[s], qz[s]));
+		glm::mat4 local(
+			glm::vec4(rotation[0] * sx[s], 0.0f),
+			glm::vec4(rotation[1] * sy[s], 0.0f),
+			glm::vec4(rotation[2] * sz[s], 0.0f),
+			glm::vec4(tx[s], ty[s], tz[s], 1.0f));
+		worlds[s] = parentSlot[s] == NO_TRANSFORM ? local : worlds[parentSlot[s]] * local;
+	}
+}
+
+#ifdef TRANSFORM_SIMD
+void TransformHierarchy::computeSimd(const uint32_t* slots, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const uint32_t s0 = slots[i], s1 = slots[i + 1], s2 = slots[i + 2], s3 = slots[i + 3];
+		// Whole dirty subtrees give runs of consecutive slots, loaded straight from the arrays
+		const bool contiguous = s3 == s0 + 3;
+#define GATHER(array) (contiguous ? _mm_loadu_ps(&array[s0]) : _mm_setr_ps(array[s0], array[s1], array[s2], array[s3]))
+		__m128 x = GATHER(qx), y = GATHER(qy), z = GATHER(qz), w = GATHER(qw);
+		__m128 scaleX = GATHER(sx), scaleY = GATHER(sy), scaleZ = GATHER(sz);
+		__m128 translateX = GATHER(tx), translateY = GATHER(ty), translateZ = GATHER(tz);
+#undef GATHER
+
+		// Rotation from the unit quaternion, each column scaled. Everything below
+		// is spelled out so the batch stays in registers without loop unrolling.
+		const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+		__m128 l00 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), scaleX);
+		__m128 l01 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), scaleX);
+		__m128 l02 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), scaleX);
+		__m128 l10 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), scaleY);
+		__m128 l11 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), scaleY);
+		__m128 l12 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), scaleY);
+		__m128 l20 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), scaleZ);
+		__m128 l21 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), scaleZ);
+		__m128 l22 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), scaleZ);
+
+		// Parent matrices with pCR holding column C, row R of the four lanes.
+		// Siblings are stored next to each other, so often one parent covers the batch.
+		const float* parents[4];
+		for (int lane = 0; lane < 4; lane++)
+		{
+			uint32_t parent = parentSlot[slots[i + lane]];
+			parents[lane] = &(parent == NO_TRANSFORM ? identity : worlds[parent])[0][0];
+		}
+		__m128 p00, p01, p02, p10, p11, p12, p20, p21, p22, p30, p31, p32, unused;
+		if (parents[0] == parents[1] && parents[0] == parents[2] && parents[0] == parents[3])
+		{
+			const float* p = parents[0];
+			p00 = _mm_set1_ps(p[0]); p01 = _mm_set1_ps(p[1]); p02 = _mm_set1_ps(p[2]);
+			p10 = _mm_set1_ps(p[4]); p11 = _mm_set1_ps(p[5]); p12 = _mm_set1_ps(p[6]);
+			p20 = _mm_set1_ps(p[8]); p21 = _mm_set1_ps(p[9]); p22 = _mm_set1_ps(p[10]);
+			p30 = _mm_set1_ps(p[12]); p31 = _mm_set1_ps(p[13]); p32 = _mm_set1_ps(p[14]);
+		}
+		else
+		{
+#define LOAD_COLUMN(c, r0, r1, r2) \
+			r0 = _mm_loadu_ps(parents[0] + c * 4); r1 = _mm_loadu_ps(parents[1] + c * 4); \
+			r2 = _mm_loadu_ps(parents[2] + c * 4); unused = _mm_loadu_ps(parents[3] + c * 4); \
+			_MM_TRANSPOSE4_PS(r0, r1, r2, unused);
+			LOAD_COLUMN(0, p00, p01, p02)
+			LOAD_COLUMN(1, p10, p11, p12)
+			LOAD_COLUMN(2, p20, p21, p22)
+			LOAD_COLUMN(3, p30, p31, p32)
+#undef LOAD_COLUMN
+		}
+
+		// world = parent * local. Both are affine, so only the top three rows are
+		// computed and the bottom row is (0, 0, 0, 1).
+		float* outputs[4] = { &worlds[s0][0][0], &worlds[s1][0][0], &worlds[s2][0][0], &worlds[s3][0][0] };
+		const __m128 zero = _mm_setzero_ps();
+#define ROW(r, a, b, c) _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0##r, a), _mm_mul_ps(p1##r, b)), _mm_mul_ps(p2##r, c))
+#define STORE_COLUMN(c, r0, r1, r2, r3) \
+		{ \
+			__m128 v0 = r0, v1 = r1, v2 = r2, v3 = r3; \
+			_MM_TRANSPOSE4_PS(v0, v1, v2, v3); \
+			_mm_storeu_ps(outputs[0] + c * 4, v0); _mm_storeu_ps(outputs[1] + c * 4, v1); \
+			_mm_storeu_ps(outputs[2] + c * 4, v2); _mm_storeu_ps(outputs[3] + c * 4, v3); \
+		}
+		STORE_COLUMN(0, ROW(0, l00, l01, l02), ROW(1, l00, l01, l02), ROW(2, l00, l01, l02), zero)
+		STORE_COLUMN(1, ROW(0, l10, l11, l12), ROW(1, l10, l11, l12), ROW(2, l10, l11, l12), zero)
+		STORE_COLUMN(2, ROW(0, l20, l21, l22), ROW(1, l20, l21, l22), ROW(2, l20, l21, l22), zero)
+		STORE_COLUMN(3, _mm_add_ps(ROW(0, translateX, translateY, translateZ), p30),
+			_mm_add_ps(ROW(1, translateX, translateY, translateZ), p31),
+			_mm_add_ps(ROW(2, translateX, translateY, translateZ), p32), one)
+#undef STORE_COLUMN
+#undef ROW
+	}
+	computeScalar(slots + i, count - i);
+}
+#else
+void TransformHierarchy::computeSimd(const uint32_t* slots, size_t count)
+{
+	computeScalar(slots, count);
+}
+#endif
+
+void TransformHierarchy::printStats() const
+{
+	if (!counters.updates)
+		return;
+	printf("Transforms: %zu nodes, %llu updates, %.1f nodes recomputed per update, %.3f ms per update\n",
+		size(), (unsigned long long)counters.updates, double(counters.nodesRecomputed) / counters.updates,
+		counters.updateSeconds * 1e3 / counters.updates);
+}
+
+void benchmarkTransformHierarchy()
+{
+	// 1M nodes in a 4-ary tree, created depth first so the first update has to sort them
+	const uint32_t nodeCount = 1 << 20;
+	TransformHierarchy hierarchy;
+	std::vector<TransformId> ids;
+	ids.reserve(nodeCount);
+	std::vector<uint32_t> stack(1, 0);
+	std::vector<TransformId> parents(nodeCount, NO_TRANSFORM);
+	ids.resize(nodeCount);
+	uint32_t created = 0;
+	while (!stack.empty() && created < nodeCount)
+	{
+		uint32_t heapIndex = stack.back();
+		stack.pop_back();
+		if (heapIndex >= nodeCount)
+			continue;
+		ids[heapIndex] = hierarchy.create(heapIndex ? ids[(heapIndex - 1) / 4] : NO_TRANSFORM);
+		created++;
+		for (uint32_t child = 4; child >= 1; child--)
+			stack.push_back(heapIndex * 4 + child);
+	}
+
+	srand(3);
+	for (uint32_t i = 0; i < nodeCount; i++)
+	{
+		hierarchy.setTranslation(ids[i], glm::vec3(rand() % 100 * 0.01f, rand() % 100 * 0.01f, rand() % 100 * 0.01f));
+		hierarchy.setRotation(ids[i], glm::angleAxis(rand() % 360 * 0.0174533f, glm::normalize(glm::vec3(1.0f, 2.0f, 3.0f))));
+		hierarchy.setScale(ids[i], glm::vec3(0.999f));
+	}
+	auto t_start = std::chrono::high_resolution_clock::now();
+	hierarchy.update();
+	printf("%u nodes, first update with breadth-first sort: %.1f ms\n", nodeCount, secondsSince(t_start) * 1e3);
+
+	// Scalar reference for the comparison below
+	std::vector<glm::mat4> reference(nodeCount);
+	hierarchy.setRotation(ids[0], glm::angleAxis(0.5f, glm::vec3(0.0f, 0.0f, 1.0f)));
+	hierarchy.update(false);
+	for (uint32_t i = 0; i < nodeCount; i++)
+		reference[i] = hierarchy.world(ids[i]);
+
+	const int frames = 20;
+	for (int simd = 0; simd < 2; simd++)
+	{
+		t_start = std::chrono::high_resolution_clock::now();
+		for (int f = 0; f < frames; f++)
+		{
+			hierarchy.setRotation(ids[0], glm::angleAxis(0.5f, glm::vec3(0.0f, 0.0f, 1.0f)));
+			hierarchy.update(simd != 0);
+		}
+		printf("Root moved, %s: %zu nodes recomputed in %.2f ms\n", simd ? "SIMD  " : "scalar",
+			hierarchy.lastRecomputed(), secondsSince(t_start) * 1e3 / frames);
+	}
+
+	float maxError = 0.0f;
+	for (uint32_t i = 0; i < nodeCount; i += 7)
+		for (int c = 0; c < 4; c++)
+			for (int r = 0; r < 4; r++)
+				maxError = std::max(maxError, std::abs(hierarchy.world(ids[i])[c][r] - reference[i][c][r]));
+	printf("Largest SIMD vs scalar difference: %g\n", maxError);
+
+	// A few animated leaves and small subtrees, the common case
+	const uint32_t moving = nodeCount / 100;
+	for (int simd = 0; simd < 2; simd++)
+	{
+		t_start = std::chrono::high_resolution_clock::now();
+		for (int f = 0; f < frames; f++)
+		{
+			for (uint32_t i = 0; i < moving; i++)
+				hierarchy.setTranslation(ids[nodeCount / 3 + (i * 97) % (nodeCount - nodeCount / 3)], glm::vec3(f * 0.01f));
+			hierarchy.update(simd != 0);
+		}
+		printf("1%% of nodes moved, %s: %zu nodes recomputed in %.2f ms\n", simd ? "SIMD  " : "scalar",
+			hierarchy.lastRecomputed(), secondsSince(t_start) * 1e3 / frames);
+	}
+
+	t_start = std::chrono::high_resolution_clock::now();
+	for (int f = 0; f < frames; f++)
+		hierarchy.update();
+	printf("Nothing moved: %.4f ms\n", secondsSince(t_start) * 1e3 / frames);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <cstdint>
+#include <vector>
+
+typedef uint32_t TransformId;
+const TransformId NO_TRANSFORM = 0xFFFFFFFF;
+
+struct TransformStats
+{
+	uint64_t updates = 0;
+	uint64_t nodesRecomputed = 0;
+	uint64_t reorders = 0;
+	double updateSeconds = 0.0;
+};
+
+// Scene graph transforms. Local translation, rotation and scale are kept
+// structure-of-arrays, with nodes stored breadth first so every depth is one
+// contiguous range. update() walks the depths in order and recomputes world
+// matrices only for nodes whose local transform changed or whose parent was
+// recomputed, four nodes per SSE batch.
+// Parents are fixed at creation and must be created before their children.
+class TransformHierarchy
+{
+public:
+	TransformId create(TransformId parent = NO_TRANSFORM);
+	size_t size() const { return slotOf.size(); }
+
+	void setTranslation(TransformId id, const glm::vec3& translation);
+	void setRotation(TransformId id, const glm::quat& rotation);
+	void setScale(TransformId id, const glm::vec3& scale);
+
+	// simd = false runs the scalar reference path
+	void update(bool simd = true);
+
+	// Valid after update()
+	const glm::mat4& world(TransformId id) const { return worlds[slotOf[id]]; }
+
+	const TransformStats& stats() const { return counters; }
+	size_t lastRecomputed() const { return recomputed; }
+	void printStats() const;
+
+private:
+	void reorder();
+	void computeScalar(const uint32_t* slots, size_t count);
+	void computeSimd(const uint32_t* slots, size_t count);
+
+	// Indexed by slot, breadth first after update()
+	std::vector<float> tx, ty, tz;
+	std::vector<float> qx, qy, qz, qw;
+	std::vector<float> sx, sy, sz;
+	std::vector<uint32_t> parentSlot;		// NO_TRANSFORM for roots
+	std::vector<uint32_t> depth;
+	std::vector<uint8_t> localDirty;
+	std::vector<uint32_t> changedIn;			// Update that last recomputed the world
+	std::vector<glm::mat4> worlds;
+
+	std::vector<uint32_t> slotOf;			// By id
+	std::vector<TransformId> idOf;			// By slot
+	std::vector<uint32_t> levelStart;		// Slot ranges per depth
+	std::vector<uint32_t> batch;
+	bool structureChanged = false;
+	bool anyDirty = false;
+
+	size_t recomputed = 0;
+	TransformStats counters;
+};
@@ -0,0 +1,929 @@
+#include "VirtualTexture.h"
+#include "Benchmark.h"
+#include "RenderStats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <glm/glm.hpp>
+extern "C"
+{
+#include <SOIL/image_DXT.h>
+}
+
+const GLchar* virtualTextureSource =
+"uniform sampler2D virtualAtlas;"
+"uniform sampler2D virtualIndirection;"
+"uniform vec2 virtualSize;"
+"uniform float virtualLevels;"
+"uniform float virtualLodBias;"
+"uniform vec3 virtualPage;"
+"uniform float virtualAtlasSize;"
+"float virtualLevel(vec2 uv) {"
+"	vec2 dx = dFdx(uv * virtualSize), dy = dFdy(uv * virtualSize);"
+"	return clamp(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + virtualLodBias), 0.0, virtualLevels - 1.0);"
+"}"
+"vec4 sampleVirtual(vec2 uv) {"
+"	float wanted = virtualLevel(uv);"
+"	uv = fract(uv);"
+"	vec3 entry = floor(textureLod(virtualIndirection, uv, wanted).xyz * 255.0 + 0.5);"
+"	vec2 pages = vec2(textureSize(virtualIndirection, int(entry.z)));"
+"	vec2 texel = entry.xy * virtualPage.z + virtualPage.y + fract(uv * pages) * virtualPage.x;"
+"	return textureLod(virtualAtlas, texel / virtualAtlasSize, 0.0);"
+"}"
+"vec4 virtualFeedback(vec2 uv) {"
+"	float level = virtualLevel(uv);"
+"	uvec2 page = uvec2(fract(uv) * vec2(textureSize(virtualIndirection, int(level))));"
+"	return vec4(uvec4(page & 255u, (page.x >> 8) | (page.y >> 8) << 4, uint(level))) / 255.0;"
+"}";
+
+static uint64_t alignTo(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void writeSection(FILE* file, uint64_t offset, const void* data, size_t size)
+{
+	static const char zeros[64] = {};
+	long position = ftell(file);
+	while (uint64_t(position) < offset)
+	{
+		size_t padding = size_t(std::min<uint64_t>(offset - position, sizeof(zeros)));
+		fwrite(zeros, 1, padding, file);
+		position += long(padding);
+	}
+	if (size)
+		fwrite(data, 1, size, file);
+}
+
+static bool seekTo(FILE* file, uint64_t offset)
+{
+#ifdef _WIN32
+	return _fseeki64(file, int64_t(offset), SEEK_SET) == 0;
+#else
+	return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+static bool isPowerOfTwo(uint32_t value)
+{
+	return value && !(value & (value - 1));
+}
+
+// Page counts halve per level until both reach one; a side already down to
+// a single page stops shrinking, so every level is whole pages
+static void levelLayout(uint32_t width, uint32_t height, uint32_t pageSize, std::vector<VirtualLevel>& levels)
+{
+	uint32_t pagesX = width / pageSize, pagesY = height / pageSize, firstPage = 0;
+	for (;;)
+	{
+		VirtualLevel level = {};
+		level.width = pagesX * pageSize;
+		level.height = pagesY * pageSize;
+		level.pagesX = pagesX;
+		level.pagesY = pagesY;
+		level.firstPage = firstPage;
+		levels.push_back(level);
+		firstPage += pagesX * pagesY;
+		if (pagesX == 1 && pagesY == 1)
+			break;
+		pagesX = std::max(pagesX / 2, 1u);
+		pagesY = std::max(pagesY / 2, 1u);
+	}
+}
+
+// Padded level 0 page from the source, clamping at the image edges
+static void sourcePage(const VirtualTextureSource& source, uint32_t width, uint32_t height, uint32_t pageSize,
+	uint32_t border, uint32_t px, uint32_t py, std::vector<unsigned char>& rect, unsigned char* out)
+{
+	uint32_t padded = pageSize + 2 * border;
+	int x0 = int(px * pageSize) - int(border), y0 = int(py * pageSize) - int(border);
+	int left = std::max(x0, 0), top = std::max(y0, 0);
+	int right = std::min(x0 + int(padded), int(width)), bottom = std::min(y0 + int(padded), int(height));
+	int rectWidth = right - left;
+	rect.resize(size_t(rectWidth) * (bottom - top) * 3);
+	source(left, top, rectWidth, bottom - top, rect.data());
+
+	for (uint32_t j = 0; j < padded; j++)
+	{
+		int sy = std::min(std::max(y0 + int(j), top), bottom - 1) - top;
+		for (uint32_t i = 0; i < padded; i++)
+		{
+			int sx = std::min(std::max(x0 + int(i), left), right - 1) - left;
+			memcpy(out + (j * padded + i) * 3, &rect[(size_t(sy) * rectWidth + sx) * 3], 3);
+		}
+	}
+}
+
+bool buildVirtualTexture(const char* path, uint32_t width, uint32_t height, const VirtualTextureSource& source,
+	JobSystem& jobs, uint32_t pageSize, uint32_t border)
+{
+	if (!isPowerOfTwo(pageSize) || border * 2 > pageSize || width % pageSize || height % pageSize ||
+		!isPowerOfTwo(width / pageSize) || !isPowerOfTwo(height / pageSize) ||
+		width / pageSize > 4096 || height / pageSize > 4096)
+	{
+		fprintf(stderr, "%s: the size must be the page size times a power of two, at most 4096 pages\n", path);
+		return false;
+	}
+
+	std::vector<VirtualLevel> levels;
+	levelLayout(width, height, pageSize, levels);
+	uint32_t padded = pageSize + 2 * border;
+
+	VirtualTextureHeader header = {};
+	header.magic = VIRTUAL_MAGIC;
+	header.version = VIRTUAL_VERSION;
+	header.width = width;
+	header.height = height;
+	header.pageSize = pageSize;
+	header.border = border;
+	header.levelCount = uint32_t(levels.size());
+	header.pageCount = levels.back().firstPage + 1;
+	header.levelsOffset = alignTo(sizeof(header), 64);
+	header.pagesOffset = alignTo(header.levelsOffset + levels.size() * sizeof(VirtualLevel), 64);
+	header.pageStride = alignTo(uint64_t(padded) * padded * 3, 64);
+	header.fileSize = header.pagesOffset + header.pageCount * header.pageStride;
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+	writeSection(file, 0, &header, sizeof(header));
+	writeSection(file, header.levelsOffset, levels.data(), levels.size() * sizeof(VirtualLevel));
+	writeSection(file, header.pagesOffset, nullptr, 0);
+
+	// Pages go out a row at a time, each padded to the stride
+	size_t stride = size_t(header.pageStride);
+	std::vector<unsigned char> row(levels[0].pagesX * stride);
+	for (uint32_t py = 0; py < levels[0].pagesY; py++)
+	{
+		jobs.parallelFor(levels[0].pagesX, 1, [&](size_t begin, size_t end)
+		{
+			std::vector<unsigned char> rect;
+			for (size_t px = begin; px < end; px++)
+				sourcePage(source, width, height, pageSize, border, uint32_t(px), py, rect, &row[px * stride]);
+		});
+		fwrite(row.data(), 1, levels[0].pagesX * stride, file);
+	}
+
+	// Each coarser level is filtered from the one just written. Its page
+	// row y, borders included, reads at most the finer rows 2y - 1 to 2y + 2.
+	bool ok = true;
+	for (uint32_t level = 1; level < header.levelCount && ok; level++)
+	{
+		fflush(file);
+		FILE* reader = fopen(path, "rb");
+		if (!reader)
+		{
+			ok = false;
+			break;
+		}
+		const VirtualLevel& fine = levels[level - 1];
+		const VirtualLevel& coarse = levels[level];
+		uint32_t fx = fine.pagesX / coarse.pagesX, fy = fine.pagesY / coarse.pagesY;
+		std::vector<std::vector<unsigned char>> fineRows(fine.pagesY);
+
+		for (uint32_t qy = 0; qy < coarse.pagesY && ok; qy++)
+		{
+			uint32_t firstRow = qy ? qy * fy - 1 : 0, lastRow = std::min(qy * fy + fy, fine.pagesY - 1);
+			for (uint32_t r = 0; r < firstRow; r++)
+				std::vector<unsigned char>().swap(fineRows[r]);
+			for (uint32_t r = firstRow; r <= lastRow && ok; r++)
+			{
+				if (!fineRows[r].empty())
+					continue;
+				fineRows[r].resize(fine.pagesX * stride);
+				ok = seekTo(reader, header.pagesOffset + uint64_t(fine.firstPage + r * fine.pagesX) * stride) &&
+					fread(fineRows[r].data(), 1, fineRows[r].size(), reader) == fineRows[r].size();
+			}
+			if (!ok)
+				break;
+
+			jobs.parallelFor(coarse.pagesX, 1, [&](size_t begin, size_t end)
+			{
+				for (size_t qx = begin; qx < end; qx++)
+				{
+					unsigned char* out = &row[qx * stride];
+					for (uint32_t j = 0; j < padded; j++)
+					{
+						int ay = std::min(std::max(int(qy * pageSize + j) - int(border), 0), int(coarse.height) - 1);
+						for (uint32_t i = 0; i < padded; i++)
+						{
+							int ax = std::min(std::max(int(qx * pageSize + i) - int(border), 0), int(coarse.width) - 1);
+							unsigned sum[3] = {};
+							for (uint32_t b = 0; b < fy; b++)
+								for (uint32_t a = 0; a < fx; a++)
+								{
+									uint32_t sx = ax * fx + a, sy = ay * fy + b;
+									const unsigned char* texel = &fineRows[sy / pageSize][(sx / pageSize) * stride +
+										((sy % pageSize + border) * padded + sx % pageSize + border) * 3];
+									sum[0] += texel[0];
+									sum[1] += texel[1];
+									sum[2] += texel[2];
+								}
+							unsigned count = fx * fy;
+							for (int c = 0; c < 3; c++)
+								out[(j * padded + i) * 3 + c] = (unsigned char)((sum[c] + count / 2) / count);
+						}
+					}
+				}
+			});
+			fwrite(row.data(), 1, coarse.pagesX * stride, file);
+		}
+		fclose(reader);
+	}
+
+	ok = ok && !ferror(file);
+	fclose(file);
+	if (!ok)
+	{
+		fprintf(stderr, "%s: could not write the virtual texture\n", path);
+		remove(path);
+	}
+	return ok;
+}
+
+static uint32_t hashTexel(uint32_t x, uint32_t y)
+{
+	uint32_t h = x * 0x8DA6B343u ^ y * 0xD8163841u;
+	h ^= h >> 15;
+	h *= 0x2C1B3C6Du;
+	h ^= h >> 12;
+	return h;
+}
+
+void virtualDemoSource(uint32_t x, uint32_t y, uint32_t width, uint32_t height, unsigned char* rgb)
+{
+	// Coloured 512 texel fields with a road grid, a 64 texel tile grid and
+	// per-texel grain, so every level has something to show
+	for (uint32_t j = 0; j < height; j++)
+		for (uint32_t i = 0; i < width; i++)
+		{
+			uint32_t tx = x + i, ty = y + j;
+			uint32_t field = hashTexel(tx >> 9, ty >> 9);
+			int color[3] = { 64 + int(field & 127), 64 + int(field >> 7 & 127), 48 + int(field >> 14 & 63) };
+			int grain = int(hashTexel(tx, ty) & 31) - 16;
+			int shade = ((tx & 63) < 2 || (ty & 63) < 2) ? -40 : ((tx + ty) >> 4 & 1) * 12;
+			bool road = (tx & 511) < 12 || (ty & 511) < 12;
+			for (int c = 0; c < 3; c++)
+			{
+				int value = road ? 200 + grain / 2 : color[c] + shade + grain;
+				rgb[(size_t(j) * width + i) * 3 + c] = (unsigned char)std::min(std::max(value, 0), 255);
+			}
+		}
+}
+
+VirtualTexture::VirtualTexture(JobSystem& jobs, int atlasPages, size_t cacheBytes, bool compress, bool gl)
+	: jobs(jobs), atlasPages(std::min(std::max(atlasPages, 2), 255)), cacheBudget(cacheBytes), compress(compress), gl(gl),
+	loadNanoseconds(0)
+{
+}
+
+VirtualTexture::~VirtualTexture()
+{
+	// Load jobs read the mapping and fill our ready list
+	jobs.wait(loading);
+	if (!gl)
+		return;
+	for (int i = 0; i < 2; i++)
+		if (feedbackFences[i])
+			glDeleteSync(feedbackFences[i]);
+	if (feedbackFramebuffer)
+	{
+		glDeleteBuffers(2, feedbackBuffers);
+		glDeleteFramebuffers(1, &feedbackFramebuffer);
+		glDeleteRenderbuffers(1, &feedbackDepth);
+		glDeleteTextures(1, &feedbackColor);
+	}
+	glDeleteTextures(1, &atlas);
+	glDeleteTextures(1, &indirectionTexture);
+}
+
+bool VirtualTexture::open(const char* path)
+{
+	if (header || !file.open(path))
+		return false;
+
+	const VirtualTextureHeader* h = reinterpret_cast<const VirtualTextureHeader*>(file.data());
+	const char* error = nullptr;
+	if (file.size() < sizeof(VirtualTextureHeader) || h->magic != VIRTUAL_MAGIC)
+		error = "not a virtual texture";
+	else if (h->version != VIRTUAL_VERSION)
+		error = "unsupported version";
+	else if (h->fileSize != file.size())
+		error = "truncated";
+	// Pages no larger than a GL texture keep the stride arithmetic in range, and
+	// the section checks divide the room left rather than wrap a sum
+	else if (!isPowerOfTwo(h->pageSize) || h->pageSize > 16384 || uint64_t(h->border) * 2 > h->pageSize ||
+		!h->levelCount || h->levelCount > 16 ||
+		h->pageStride < (uint64_t(h->pageSize) + 2 * h->border) * (uint64_t(h->pageSize) + 2 * h->border) * 3 ||
+		h->levelsOffset > h->pagesOffset || h->levelCount * sizeof(VirtualLevel) > h->pagesOffset - h->levelsOffset ||
+		h->pagesOffset > h->fileSize || h->pageCount > (h->fileSize - h->pagesOffset) / h->pageStride)
+		error = "bad layout";
+	else
+	{
+		// The level table has to be the one levelLayout() makes for this size
+		std::vector<VirtualLevel> expected;
+		if (h->width % h->pageSize || h->height % h->pageSize ||
+			!isPowerOfTwo(h->width / h->pageSize) || !isPowerOfTwo(h->height / h->pageSize) ||
+			h->width / h->pageSize > 4096 || h->height / h->pageSize > 4096)
+			error = "bad size";
+		else
+		{
+			levelLayout(h->width, h->height, h->pageSize, expected);
+			if (expected.size() != h->levelCount || expected.back().firstPage + 1 != h->pageCount ||
+				memcmp(expected.data(), file.data() + h->levelsOffset, expected.size() * sizeof(VirtualLevel)) != 0)
+				error = "bad level table";
+		}
+	}
+
+	if (error)
+	{
+		fprintf(stderr, "%s: %s\n", path, error);
+		file.close();
+		return false;
+	}
+	header = h;
+	levels = reinterpret_cast<const VirtualLevel*>(file.data() + h->levelsOffset);
+	paddedSize = h->pageSize + 2 * h->border;
+	// DXT1 works on 4x4 blocks
+	compress = compress && paddedSize % 4 == 0;
+	atlasPageBytes = compress ? size_t(paddedSize / 4) * (paddedSize / 4) * 8 : size_t(paddedSize) * paddedSize * 3;
+	slots.assign(size_t(atlasPages) * atlasPages, Slot());
+
+	size_t indirectionSize = 0;
+	for (uint32_t level = 0; level < h->levelCount; level++)
+	{
+		indirectionOffsets.push_back(indirectionSize);
+		indirectionSize += size_t(levels[level].pagesX) * levels[level].pagesY * 4;
+	}
+	indirection.assign(indirectionSize, 0);
+	uploadedIndirection.assign(indirectionSize, 0);
+	counters.atlasBytes = slots.size() * atlasPageBytes;
+	counters.indirectionBytes = indirectionSize;
+
+	if (gl)
+	{
+		GLsizei atlasSize = atlasPages * paddedSize;
+		glGenTextures(1, &atlas);
+		glBindTexture(GL_TEXTURE_2D, atlas);
+		glTexImage2D(GL_TEXTURE_2D, 0, compress ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB8, atlasSize, atlasSize, 0,
+			GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+		// One texel per page, mip levels matching the page levels
+		glGenTextures(1, &indirectionTexture);
+		glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+		renderStats.add(RENDER_TEXTURE_BINDS, 2);
+		for (uint32_t level = 0; level < h->levelCount; level++)
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, levels[level].pagesX, levels[level].pagesY, 0,
+				GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, h->levelCount - 1);
+	}
+	opened = std::chrono::high_resolution_clock::now();
+
+	// The coarsest levels, up to an eighth of the atlas, stay resident
+	uint32_t pinnedPages = 0;
+	for (int level = int(h->levelCount) - 1; level >= 0; level--)
+	{
+		uint32_t pages = levels[level].pagesX * levels[level].pagesY;
+		if (level < int(h->levelCount) - 1 && pinnedPages + pages > slots.size() / 8)
+			break;
+		pinnedPages += pages;
+		for (uint32_t y = 0; y < levels[level].pagesY; y++)
+			for (uint32_t x = 0; x < levels[level].pagesX; x++)
+			{
+				std::vector<unsigned char> data;
+				uint32_t key = pageKey(level, x, y);
+				transcode(key, data);
+				upload(key, data);
+				slots[resident[key]].pinned = true;
+			}
+	}
+	refreshIndirection();
+	return true;
+}
+
+const unsigned char* VirtualTexture::pageData(uint32_t key) const
+{
+	const VirtualLevel& level = levels[key >> 28];
+	uint32_t page = level.firstPage + (key >> 14 & 0x3FFF) * level.pagesX + (key & 0x3FFF);
+	return file.data() + header->pagesOffset + page * header->pageStride;
+}
+
+void VirtualTexture::transcode(uint32_t key, std::vector<unsigned char>& out) const
+{
+	// Reading the page faults it in from the mapping
+	const unsigned char* rgb = pageData(key);
+	if (!compress)
+	{
+		out.assign(rgb, rgb + atlasPageBytes);
+		return;
+	}
+	int size = 0;
+	unsigned char* dxt = convert_image_to_DXT1(rgb, paddedSize, paddedSize, 3, &size);
+	out.assign(dxt, dxt + size);
+	free(dxt);
+}
+
+void VirtualTexture::cache(uint32_t key, std::vector<unsigned char>& data)
+{
+	if (cached.count(key))
+		return;
+	lru.push_front(key);
+	CachedPage& page = cached[key];
+	page.data.swap(data);
+	page.lru = lru.begin();
+	page.uploaded = false;
+	counters.cacheBytes += page.data.size();
+	counters.peakCacheBytes = std::max(counters.peakCacheBytes, counters.cacheBytes);
+
+	// Least recently used first, never the page just added
+	while (counters.cacheBytes > cacheBudget && lru.size() > 1)
+	{
+		auto victim = cached.find(lru.back());
+		counters.cacheBytes -= victim->second.data.size();
+		cached.erase(victim);
+		lru.pop_back();
+	}
+}
+
+bool VirtualTexture::upload(uint32_t key, const std::vector<unsigned char>& data)
+{
+	// A free slot, or the one unused longest; pages used this frame stay
+	uint32_t best = NO_PAGE;
+	for (uint32_t i = 0; i < slots.size(); i++)
+	{
+		const Slot& slot = slots[i];
+		if (slot.page == NO_PAGE)
+		{
+			best = i;
+			break;
+		}
+		if (slot.pinned || slot.lastUsed >= frame)
+			continue;
+		if (best == NO_PAGE || slot.lastUsed < slots[best].lastUsed)
+			best = i;
+	}
+	if (best == NO_PAGE)
+		return false;
+
+	Slot& slot = slots[best];
+	if (slot.page != NO_PAGE)
+	{
+		resident.erase(slot.page);
+		counters.pagesEvicted++;
+	}
+	slot.page = key;
+	slot.lastUsed = frame;
+	resident[key] = best;
+
+	if (gl)
+	{
+		GLint x = GLint(best % atlasPages * paddedSize), y = GLint(best / atlasPages * paddedSize);
+		glBindTexture(GL_TEXTURE_2D, atlas);
+		renderStats.add(RENDER_TEXTURE_BINDS);
+		if (compress)
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, paddedSize, paddedSize, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+				GLsizei(data.size()), data.data());
+		else
+			glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, paddedSize, paddedSize, GL_RGB, GL_UNSIGNED_BYTE, data.data());
+		renderStats.add(RENDER_TEXTURE_UPLOADS);
+		renderStats.add(RENDER_TEXTURE_BYTES, data.size());
+	}
+	counters.pagesUploaded++;
+	counters.uploadBytes += data.size();
+	indirectionDirty = true;
+	return true;
+}
+
+void VirtualTexture::refreshIndirection()
+{
+	// Coarse to fine: a page that isn't resident points where its parent does
+	int top = int(header->levelCount) - 1;
+	for (int level = top; level >= 0; level--)
+	{
+		const VirtualLevel& l = levels[level];
+		unsigned char* texels = &indirection[indirectionOffsets[level]];
+		for (uint32_t y = 0; y < l.pagesY; y++)
+			for (uint32_t x = 0; x < l.pagesX; x++)
+			{
+				unsigned char* entry = texels + (size_t(y) * l.pagesX + x) * 4;
+				auto found = resident.find(pageKey(level, x, y));
+				if (found != resident.end())
+				{
+					entry[0] = (unsigned char)(found->second % atlasPages);
+					entry[1] = (unsigned char)(found->second / atlasPages);
+					entry[2] = (unsigned char)level;
+					entry[3] = 255;
+				}
+				else if (level < top)
+				{
+					const VirtualLevel& parent = levels[level + 1];
+					uint32_t px = x >> (l.pagesX > parent.pagesX), py = y >> (l.pagesY > parent.pagesY);
+					memcpy(entry, &indirection[indirectionOffsets[level + 1] + (size_t(py) * parent.pagesX + px) * 4], 4);
+				}
+			}
+	}
+
+	// Only the levels that changed go to the GPU
+	bool bound = false;
+	for (uint32_t level = 0; level < header->levelCount; level++)
+	{
+		size_t offset = indirectionOffsets[level], size = size_t(levels[level].pagesX) * levels[level].pagesY * 4;
+		if (memcmp(&indirection[offset], &uploadedIndirection[offset], size) == 0)
+			continue;
+		memcpy(&uploadedIndirection[offset], &indirection[offset], size);
+		counters.uploadBytes += size;
+		if (!gl)
+			continue;
+		if (!bound)
+		{
+			glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+			renderStats.add(RENDER_TEXTURE_BINDS);
+			bound = true;
+		}
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, levels[level].pagesX, levels[level].pagesY, GL_RGBA, GL_UNSIGNED_BYTE,
+			&indirection[offset]);
+		renderStats.add(RENDER_TEXTURE_UPLOADS);
+		renderStats.add(RENDER_TEXTURE_BYTES, size);
+	}
+	indirectionDirty = false;
+}
+
+void VirtualTexture::addFeedback(const unsigned char* rgba, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		const unsigned char* texel = rgba + i * 4;
+		if (texel[3] == 255)
+			continue;
+		request(texel[3], texel[0] | (texel[2] & 15) << 8, texel[1] | (texel[2] >> 4) << 8);
+	}
+}
+
+void VirtualTexture::request(uint32_t level, uint32_t x, uint32_t y)
+{
+	if (!header || level >= header->levelCount || x >= levels[level].pagesX || y >= levels[level].pagesY)
+		return;
+	// Neighbouring feedback texels mostly name the same page
+	uint32_t key = pageKey(level, x, y);
+	if (requested.empty() || requested.back() != key)
+		requested.push_back(key);
+}
+
+void VirtualTexture::update(int pagesPerUpdate)
+{
+	if (!header)
+		return;
+	auto t_start = std::chrono::high_resolution_clock::now();
+	frame++;
+	counters.updates++;
+
+	// Finished loads join the CPU cache
+	std::vector<std::pair<uint32_t, std::vector<unsigned char>>> finished;
+	{
+		std::lock_guard<std::mutex> lock(readyMutex);
+		finished.swap(ready);
+	}
+	for (auto& page : finished)
+	{
+		inFlight.erase(page.first);
+		cache(page.first, page.second);
+	}
+	counters.loadSeconds = loadNanoseconds.load() * 1e-9;
+
+	std::sort(requested.begin(), requested.end());
+	requested.erase(std::unique(requested.begin(), requested.end()), requested.end());
+	for (uint32_t key : requested)
+	{
+		counters.requests++;
+		if (resident.count(key))
+			counters.atlasHits++;
+		else
+		{
+			auto page = cached.find(key);
+			if (page != cached.end() && page->second.uploaded)
+				counters.cacheHits++;
+		}
+	}
+
+	// The ancestors of a page are wanted too, they stand in while it loads.
+	// Keys sort by level, so descending order handles coarse pages first.
+	size_t direct = requested.size();
+	for (size_t i = 0; i < direct; i++)
+	{
+		uint32_t key = requested[i], level = key >> 28, x = key & 0x3FFF, y = key >> 14 & 0x3FFF;
+		for (; level + 1 < header->levelCount; level++)
+		{
+			x >>= levels[level].pagesX > levels[level + 1].pagesX;
+			y >>= levels[level].pagesY > levels[level + 1].pagesY;
+			requested.push_back(pageKey(level + 1, x, y));
+		}
+	}
+	std::sort(requested.begin(), requested.end(), [](uint32_t a, uint32_t b) { return a > b; });
+	requested.erase(std::unique(requested.begin(), requested.end()), requested.end());
+
+	std::vector<uint32_t> missing;
+	for (uint32_t key : requested)
+	{
+		auto slot = resident.find(key);
+		if (slot != resident.end())
+		{
+			slots[slot->second].lastUsed = frame;
+			continue;
+		}
+		if (cached.count(key))
+		{
+			missing.push_back(key);
+			continue;
+		}
+		if (!inFlight.insert(key).second)
+			continue;
+		counters.loads++;
+		jobs.run([this, key]
+		{
+			auto t_load = std::chrono::high_resolution_clock::now();
+			std::vector<unsigned char> data;
+			transcode(key, data);
+			loadNanoseconds += uint64_t(secondsSince(t_load) * 1e9);
+			std::lock_guard<std::mutex> lock(readyMutex);
+			ready.emplace_back(key, std::move(data));
+		}, &loading);
+	}
+	requested.clear();
+
+	for (size_t i = 0; i < missing.size() && int(i) < pagesPerUpdate; i++)
+	{
+		CachedPage& page = cached[missing[i]];
+		if (!upload(missing[i], page.data))
+		{
+			counters.starved += std::min<size_t>(missing.size(), pagesPerUpdate) - i;
+			break;
+		}
+		page.uploaded = true;
+		lru.splice(lru.begin(), lru, page.lru);
+	}
+	if (indirectionDirty)
+		refreshIndirection();
+	counters.uploadSeconds += secondsSince(t_start);
+}
+
+void VirtualTexture::beginFeedback(int windowWidth, int windowHeight)
+{
+	int width = std::max(windowWidth / FEEDBACK_SCALE, 1), height = std::max(windowHeight / FEEDBACK_SCALE, 1);
+	if (width != feedbackWidth || height != feedbackHeight)
+	{
+		// Readbacks still pending are the old size
+		for (int i = 0; i < 2; i++)
+			if (feedbackFences[i])
+			{
+				glDeleteSync(feedbackFences[i]);
+				feedbackFences[i] = 0;
+			}
+		if (!feedbackFramebuffer)
+		{
+			glGenTextures(1, &feedbackColor);
+			glGenRenderbuffers(1, &feedbackDepth);
+			glGenFramebuffers(1, &feedbackFramebuffer);
+			glGenBuffers(2, feedbackBuffers);
+		}
+		glBindTexture(GL_TEXTURE_2D, feedbackColor);
+		renderStats.add(RENDER_TEXTURE_BINDS);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedbackColor, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+
+		for (int i = 0; i < 2; i++)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, nullptr, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		feedbackWidth = width;
+		feedbackHeight = height;
+	}
+
+	glGetIntegerv(GL_VIEWPORT, savedViewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+	glViewport(0, 0, width, height);
+	// Alpha 255 marks texels that saw no virtual texture
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void VirtualTexture::endFeedback()
+{
+	// The older buffer is two frames old by now, the newer one is read if it happens to be ready
+	int index = feedbackNext;
+	readFeedback(index, true);
+	readFeedback(index ^ 1, false);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[index]);
+	glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	feedbackFences[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	feedbackNext = index ^ 1;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+}
+
+void VirtualTexture::readFeedback(int index, bool wait)
+{
+	if (!feedbackFences[index])
+		return;
+	GLenum state = glClientWaitSync(feedbackFences[index], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	while (wait && state == GL_TIMEOUT_EXPIRED)
+		state = glClientWaitSync(feedbackFences[index], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);	// 1 ms
+	if (state == GL_TIMEOUT_EXPIRED)
+		return;
+	glDeleteSync(feedbackFences[index]);
+	feedbackFences[index] = 0;
+
+	size_t count = size_t(feedbackWidth) * feedbackHeight;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[index]);
+	const unsigned char* texels = static_cast<const unsigned char*>(
+		glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, count * 4, GL_MAP_READ_BIT));
+	if (texels)
+	{
+		addFeedback(texels, count);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void VirtualTexture::bind(GLuint program, GLint firstUnit, bool feedback)
+{
+	glActiveTexture(GL_TEXTURE0 + firstUnit);
+	glBindTexture(GL_TEXTURE_2D, atlas);
+	glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+	glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+	glActiveTexture(GL_TEXTURE0);
+	renderStats.add(RENDER_TEXTURE_BINDS, 2);
+
+	glUniform1i(glGetUniformLocation(program, "virtualAtlas"), firstUnit);
+	glUniform1i(glGetUniformLocation(program, "virtualIndirection"), firstUnit + 1);
+	glUniform2f(glGetUniformLocation(program, "virtualSize"), float(header->width), float(header->height));
+	glUniform1f(glGetUniformLocation(program, "virtualLevels"), float(header->levelCount));
+	// Feedback derivatives are FEEDBACK_SCALE times those of the window
+	glUniform1f(glGetUniformLocation(program, "virtualLodBias"), feedback ? -std::log2(float(FEEDBACK_SCALE)) : 0.0f);
+	glUniform3f(glGetUniformLocation(program, "virtualPage"), float(header->pageSize), float(header->border), float(paddedSize));
+	glUniform1f(glGetUniformLocation(program, "virtualAtlasSize"), float(atlasPages * paddedSize));
+	renderStats.add(RENDER_UNIFORM_BYTES, 2 * sizeof(GLint) + 8 * sizeof(float));
+}
+
+bool VirtualTexture::isResident(uint32_t level, uint32_t x, uint32_t y) const
+{
+	return resident.count(pageKey(level, x, y)) != 0;
+}
+
+void VirtualTexture::printStats() const
+{
+	if (!header)
+		return;
+	double seconds = secondsSince(opened);
+	printf("Virtual texture: %ux%u, %u levels of %u texel pages (+%u border), %llu page requests, %.1f%% in the atlas, %llu back from the CPU cache\n",
+		header->width, header->height, header->levelCount, header->pageSize, header->border,
+		(unsigned long long)counters.requests, counters.requests ? 100.0 * counters.atlasHits / counters.requests : 0.0,
+		(unsigned long long)counters.cacheHits);
+	printf("  %llu pages loaded (%.3f ms each on a job), %llu uploaded (%.2f MB, %.2f MB/s), %llu evicted, %llu starved, %.3f ms per update\n",
+		(unsigned long long)counters.loads, counters.loads ? counters.loadSeconds * 1e3 / counters.loads : 0.0,
+		(unsigned long long)counters.pagesUploaded, counters.uploadBytes / 1048576.0,
+		seconds > 0.0 ? counters.uploadBytes / 1048576.0 / seconds : 0.0,
+		(unsigned long long)counters.pagesEvicted, (unsigned long long)counters.starved,
+		counters.updates ? counters.uploadSeconds * 1e3 / counters.updates : 0.0);
+	printf("  memory: atlas %.2f MB (%zu %s pages), indirection %.1f KB, CPU cache %.2f MB (peak %.2f, budget %.2f), file %.1f MB mapped\n",
+		counters.atlasBytes / 1048576.0, slots.size(), compress ? "DXT1" : "RGB", counters.indirectionBytes / 1024.0,
+		counters.cacheBytes / 1048576.0, counters.peakCacheBytes / 1048576.0, cacheBudget / 1048576.0,
+		file.size() / 1048576.0);
+}
+
+// Feedback a 1280x720 view of the texture on the ground would render, at
+// the feedback resolution: the ray through each texel hits the plane, and
+// the hits of the neighbouring texels give the derivatives
+static void planeFeedback(const glm::vec3& eye, float yaw, float pitch, float worldSize, const VirtualTexture& texture,
+	int width, int height, std::vector<unsigned char>& feedback)
+{
+	const float tanHalfFov = std::tan(glm::radians(30.0f)), aspect = float(width) / height, farDistance = 400.0f;
+	glm::vec3 forward(std::cos(pitch) * std::sin(yaw), std::sin(pitch), std::cos(pitch) * std::cos(yaw));
+	glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+	glm::vec3 up = glm::cross(right, forward);
+
+	// Texture coordinates at the texel corners, negative where the ray misses
+	std::vector<glm::vec2> hits(size_t(width + 1) * (height + 1));
+	for (int j = 0; j <= height; j++)
+		for (int i = 0; i <= width; i++)
+		{
+			float sx = (2.0f * i / width - 1.0f) * tanHalfFov * aspect, sy = (1.0f - 2.0f * j / height) * tanHalfFov;
+			glm::vec3 ray = forward + right * sx + up * sy;
+			float t = ray.y < 0.0f ? -eye.y / ray.y : -1.0f;
+			hits[j * (width + 1) + i] = t > 0.0f && t * glm::length(ray) < farDistance ?
+				glm::vec2(eye.x + ray.x * t, eye.z + ray.z * t) / worldSize : glm::vec2(-1.0f);
+		}
+
+	uint32_t levels = texture.levelCount();
+	float pageSize = float(texture.pageSize());
+	feedback.assign(size_t(width) * height * 4, 255);
+	for (int j = 0; j < height; j++)
+		for (int i = 0; i < width; i++)
+		{
+			glm::vec2 uv = hits[j * (width + 1) + i], right = hits[j * (width + 1) + i + 1], below = hits[(j + 1) * (width + 1) + i];
+			if (uv.x < 0.0f && uv.y < 0.0f)
+				continue;
+			// Per window pixel, as the shader sees it
+			glm::vec2 scale = glm::vec2(float(texture.width()), float(texture.height())) / float(VirtualTexture::FEEDBACK_SCALE);
+			glm::vec2 dx = (right - uv) * scale, dy = (below - uv) * scale;
+			float footprint = std::max(glm::dot(dx, dx), glm::dot(dy, dy));
+			if (right.x < 0.0f || below.x < 0.0f)
+				footprint = 1e30f;
+			int level = int(std::floor(0.5f * std::log2(std::max(footprint, 1.0f))));
+			level = std::min(std::max(level, 0), int(levels) - 1);
+
+			glm::vec2 wrapped = uv - glm::floor(uv);
+			uint32_t px = std::min(uint32_t(wrapped.x * float(texture.width() >> level) / pageSize), 4095u);
+			uint32_t py = std::min(uint32_t(wrapped.y * float(texture.height() >> level) / pageSize), 4095u);
+			unsigned char* texel = &feedback[(size_t(j) * width + i) * 4];
+			texel[0] = (unsigned char)(px & 255);
+			texel[1] = (unsigned char)(py & 255);
+			texel[2] = (unsigned char)(px >> 8 | (py >> 8) << 4);
+			texel[3] = (unsigned char)level;
+		}
+}
+
+void benchmarkVirtualTexture()
+{
+	const char* path = "bench_virtual.vtx";
+	const uint32_t size = 8192;
+	JobSystem jobs;
+	auto t_start = std::chrono::high_resolution_clock::now();
+	if (!buildVirtualTexture(path, size, size, virtualDemoSource, jobs))
+	{
+		printf("Could not build the benchmark virtual texture\n");
+		return;
+	}
+	double buildSeconds = secondsSince(t_start);
+
+	// Load jobs read the mapping, so the texture goes before the file
+	std::unique_ptr<VirtualTexture> texture(new VirtualTexture(jobs, 32, 32 << 20, true, false));
+	if (!texture->open(path))
+	{
+		printf("Could not open the benchmark virtual texture\n");
+		return;
+	}
+	printf("Built %ux%u in %.1f ms: %.1f MB of pages at %.1f MB/s, %d worker threads\n", size, size, buildSeconds * 1e3,
+		texture->fileBytes() / 1048576.0, texture->fileBytes() / 1048576.0 / buildSeconds, int(jobs.workerCount()));
+
+	// Low flight over a 256 unit ground plane, turning and climbing, with the
+	// texture repeating beyond it; 32 level 0 texels per unit
+	const int frames = 600, feedbackWidth = 1280 / VirtualTexture::FEEDBACK_SCALE, feedbackHeight = 720 / VirtualTexture::FEEDBACK_SCALE;
+	const float worldSize = 256.0f;
+	std::vector<unsigned char> feedback;
+	double feedbackSeconds = 0.0;
+	VirtualTextureStats half;
+	t_start = std::chrono::high_resolution_clock::now();
+	for (int f = 0; f < frames; f++)
+	{
+		float t = float(f) / frames;
+		float yaw = 6.2831853f * t;
+		glm::vec3 eye(128.0f + 60.0f * std::sin(yaw), 4.0f + 20.0f * t * t, 128.0f - 60.0f * std::cos(yaw));
+		auto t_feedback = std::chrono::high_resolution_clock::now();
+		planeFeedback(eye, yaw + 1.5707963f, -0.35f, worldSize, *texture, feedbackWidth, feedbackHeight, feedback);
+		feedbackSeconds += secondsSince(t_feedback);
+
+		texture->addFeedback(feedback.data(), feedback.size() / 4);
+		texture->update();
+		// Frames are long enough for the loads to finish
+		texture->flush();
+		if (f == frames / 2 - 1)
+			half = texture->stats();
+	}
+	double seconds = secondsSince(t_start) - feedbackSeconds;
+
+	const VirtualTextureStats& stats = texture->stats();
+	uint64_t requests = stats.requests - half.requests, hits = stats.atlasHits - half.atlasHits;
+	printf("%d frames of %dx%d feedback in %.1f ms (%.3f ms per frame, feedback generation excluded)\n",
+		frames, feedbackWidth, feedbackHeight, seconds * 1e3, seconds * 1e3 / frames);
+	printf("Second half: %.1f%% of %llu requested pages already in the atlas, %llu loads, %llu from the CPU cache\n",
+		requests ? 100.0 * hits / requests : 0.0, (unsigned long long)requests, (unsigned long long)(stats.loads - half.loads),
+		(unsigned long long)(stats.cacheHits - half.cacheHits));
+	texture->printStats();
+	texture.reset();
+	remove(path);
+}
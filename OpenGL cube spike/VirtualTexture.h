@@ -0,0 +1,208 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "MappedFile.h"
+
+#include <GL/glew.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Tiled virtual texture layout, version 1. The image and its mips are cut
+// into pages of pageSize texels plus a border of texels copied from the
+// neighbours, so bilinear filtering never reads across pages in the atlas.
+//
+//   VirtualTextureHeader
+//   VirtualLevel[levelCount]		finest first
+//   pages						RGB, (pageSize + 2 * border)^2 texels each,
+//								level by level, rows of pages top to bottom
+
+const uint32_t VIRTUAL_MAGIC = 0x31585456;	// "VTX1"
+const uint32_t VIRTUAL_VERSION = 1;
+
+struct VirtualTextureHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;				// Level 0 texels, pageSize times a power of two
+	uint32_t height;
+	uint32_t pageSize;
+	uint32_t border;
+	uint32_t levelCount;		// Down to a single page
+	uint32_t pageCount;
+	uint64_t levelsOffset;
+	uint64_t pagesOffset;
+	uint64_t pageStride;		// Bytes between pages, 64-byte aligned
+	uint64_t fileSize;
+};
+
+struct VirtualLevel
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t pagesX;
+	uint32_t pagesY;
+	uint32_t firstPage;
+	uint32_t padding;
+};
+
+static_assert(sizeof(VirtualTextureHeader) == 64, "VirtualTextureHeader layout is part of the file format");
+static_assert(sizeof(VirtualLevel) == 24, "VirtualLevel layout is part of the file format");
+
+// Fills a width x height rectangle of level 0 RGB texels at (x, y), always
+// inside the image. Called from jobs, so sources must be thread safe.
+typedef std::function<void(uint32_t x, uint32_t y, uint32_t width, uint32_t height, unsigned char* rgb)> VirtualTextureSource;
+
+// Offline side: pages level 0 from the source with jobs, then box filters
+// every coarser level from the pages of the level below, read back from
+// the file a few page rows at a time, so images far larger than memory work
+bool buildVirtualTexture(const char* path, uint32_t width, uint32_t height, const VirtualTextureSource& source,
+	JobSystem& jobs, uint32_t pageSize = 128, uint32_t border = 4);
+
+// Procedural map used by the demo and the benchmark, detailed at every level
+void virtualDemoSource(uint32_t x, uint32_t y, uint32_t width, uint32_t height, unsigned char* rgb);
+
+// GLSL providing vec4 sampleVirtual(vec2 uv) and vec4 virtualFeedback(vec2 uv)
+// for the texture bound by VirtualTexture::bind(). Paste it after the #version line.
+extern const GLchar* virtualTextureSource;
+
+struct VirtualTextureStats
+{
+	uint64_t updates = 0;
+	uint64_t requests = 0;			// Distinct pages asked for by feedback, summed over updates
+	uint64_t atlasHits = 0;			// Already in the atlas
+	uint64_t cacheHits = 0;			// Evicted from the atlas, still in the CPU page cache
+	uint64_t loads = 0;				// Read from the file and transcoded by a job
+	uint64_t pagesUploaded = 0;
+	uint64_t pagesEvicted = 0;
+	uint64_t starved = 0;			// Ready pages left for later, the atlas had no slot to spare
+	uint64_t uploadBytes = 0;		// Pages and indirection
+	double loadSeconds = 0.0;		// Summed over jobs
+	double uploadSeconds = 0.0;		// update() on the calling thread
+	size_t atlasBytes = 0;
+	size_t indirectionBytes = 0;
+	size_t cacheBytes = 0;
+	size_t peakCacheBytes = 0;
+};
+
+// Streams the pages a view needs into a physical page atlas. Feedback
+// (rendered by a shader or passed in directly) names the pages wanted;
+// pages are read from the mapped file and transcoded on the job system,
+// kept in an LRU CPU cache and uploaded into the least recently used atlas
+// slots. An indirection texture, one texel per page and one mip per level,
+// points every page at the finest resident page covering it; the coarsest
+// levels stay resident so there is always something to sample.
+class VirtualTexture
+{
+public:
+	// compress stores the atlas as DXT1. gl = false keeps all the bookkeeping without GL calls.
+	VirtualTexture(JobSystem& jobs, int atlasPages = 32, size_t cacheBytes = 64 << 20, bool compress = true, bool gl = true);
+	~VirtualTexture();
+
+	bool open(const char* path);
+	bool isOpen() const { return header != nullptr; }
+	uint32_t width() const { return header->width; }
+	uint32_t height() const { return header->height; }
+	uint32_t levelCount() const { return header->levelCount; }
+	uint32_t pageSize() const { return header->pageSize; }
+	size_t fileBytes() const { return file.size(); }
+
+	// Feedback texels as written by virtualFeedback(); alpha 255 means no page
+	void addFeedback(const unsigned char* rgba, size_t count);
+	void request(uint32_t level, uint32_t x, uint32_t y);
+
+	// Handles this frame's requests, uploads up to pagesPerUpdate ready pages
+	// and refreshes the indirection texture
+	void update(int pagesPerUpdate = 16);
+	// Wait for the loads in flight, so the next update() can upload them
+	void flush() { jobs.wait(loading); }
+
+	// Render the view with virtualFeedback() between these, into a target
+	// FEEDBACK_SCALE times smaller than the window. The result is read back
+	// asynchronously and fed to a later update().
+	static const int FEEDBACK_SCALE = 8;
+	void beginFeedback(int windowWidth, int windowHeight);
+	void endFeedback();
+
+	// Binds the atlas and indirection textures to two units and sets the
+	// uniforms of program; feedback programs pick levels for the full window
+	void bind(GLuint program, GLint firstUnit, bool feedback = false);
+
+	bool isResident(uint32_t level, uint32_t x, uint32_t y) const;
+	const VirtualTextureStats& stats() const { return counters; }
+	void printStats() const;
+
+private:
+	static const uint32_t NO_PAGE = 0xFFFFFFFF;
+
+	struct Slot
+	{
+		uint32_t page = NO_PAGE;	// Key of the page it holds
+		uint64_t lastUsed = 0;
+		bool pinned = false;
+	};
+
+	struct CachedPage
+	{
+		std::vector<unsigned char> data;	// Atlas format
+		std::list<uint32_t>::iterator lru;
+		bool uploaded;						// At least once, so a request for it is a cache hit
+	};
+
+	static uint32_t pageKey(uint32_t level, uint32_t x, uint32_t y) { return level << 28 | y << 14 | x; }
+	const unsigned char* pageData(uint32_t key) const;
+	void transcode(uint32_t key, std::vector<unsigned char>& out) const;
+	void cache(uint32_t key, std::vector<unsigned char>& data);
+	bool upload(uint32_t key, const std::vector<unsigned char>& data);
+	void refreshIndirection();
+	void readFeedback(int index, bool wait);
+
+	JobSystem& jobs;
+	int atlasPages;
+	size_t cacheBudget;
+	bool compress;
+	bool gl;
+
+	MappedFile file;
+	const VirtualTextureHeader* header = nullptr;
+	const VirtualLevel* levels = nullptr;
+	uint32_t paddedSize = 0;
+	size_t atlasPageBytes = 0;
+
+	std::vector<Slot> slots;
+	std::unordered_map<uint32_t, uint32_t> resident;	// Page key to slot
+	std::vector<uint32_t> requested;					// This frame's page keys
+	uint64_t frame = 0;
+
+	// Transcoded pages, most recently used at the front
+	std::unordered_map<uint32_t, CachedPage> cached;
+	std::list<uint32_t> lru;
+
+	// Loads in flight and their results
+	JobCounter loading;
+	std::unordered_set<uint32_t> inFlight;
+	std::mutex readyMutex;
+	std::vector<std::pair<uint32_t, std::vector<unsigned char>>> ready;
+	std::atomic<uint64_t> loadNanoseconds;
+
+	// Indirection texels, levels back to back, and what was uploaded last
+	std::vector<unsigned char> indirection, uploadedIndirection;
+	std::vector<size_t> indirectionOffsets;
+	bool indirectionDirty = true;
+
+	GLuint atlas = 0, indirectionTexture = 0;
+	GLuint feedbackFramebuffer = 0, feedbackColor = 0, feedbackDepth = 0;
+	GLuint feedbackBuffers[2] = {};
+	GLsync feedbackFences[2] = {};
+	int feedbackWidth = 0, feedbackHeight = 0, feedbackNext = 0;
+	GLint savedViewport[4] = {};
+
+	VirtualTextureStats counters;
+	std::chrono::high_resolution_clock::time_point opened;
+};
@@ -0,0 +1,525 @@
+#include "Voxel.h"
+#include "Benchmark.h"
+#include "RenderStats.h"
+#include "Shader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <glm/gtc/type_ptr.hpp>
+
+// Shader sources
+static const GLchar* voxelVertexSource =
+"#version 150 core\n"
+"in uint packedVertex;"
+"out vec3 Color;"
+"out vec2 Texcoord;"
+"uniform mat4 view;"
+"uniform mat4 proj;"
+"uniform vec3 chunkOrigin;"
+"const float faceShade[6] = float[6](0.8, 0.8, 0.7, 0.7, 1.0, 0.5);"
+"void main() {"
+"	vec3 position = vec3(packedVertex & 63u, (packedVertex >> 6) & 63u, (packedVertex >> 12) & 63u);"
+"	uint face = (packedVertex >> 18) & 7u;"
+"	uint block = (packedVertex >> 21) & 255u;"
+"	uint axis = face >> 1;"
+"	Texcoord = axis == 0u ? position.yz : axis == 1u ? position.xz : position.xy;"
+"	vec3 blockColor = vec3(float((block * 97u) & 255u), float((block * 57u) & 255u), float((block * 23u) & 255u)) / 255.0;"
+"	Color = mix(vec3(1.0), blockColor, 0.6) * faceShade[face];"
+"	gl_Position = proj * view * vec4(chunkOrigin + position, 1.0);"
+"}";
+static const GLchar* voxelFragmentSource =
+"#version 150 core\n"
+"in vec3 Color;"
+"in vec2 Texcoord;"
+"out vec4 outColor;"
+"uniform sampler2D tex;"
+// Merged quads span several blocks and the texture clamps, so repeat it
+// here; the gradients of the unwrapped coordinates keep the seams unmipped
+"void main() {"
+"	outColor = vec4(Color, 1.0) * textureGrad(tex, fract(Texcoord), dFdx(Texcoord), dFdy(Texcoord));"
+"}";
+
+void greedyMesh(const PaddedChunk& chunk, std::vector<uint32_t>& vertices, VoxelMeshStats& stats)
+{
+	// Signed face mask for one slice: +block for a face pointing along +d,
+	// -block for a face pointing along -d, 0 for no face
+	int mask[CHUNK_SIZE * CHUNK_SIZE];
+
+	for (int z = 0; z < CHUNK_SIZE; z++)
+		for (int y = 0; y < CHUNK_SIZE; y++)
+			for (int x = 0; x < CHUNK_SIZE; x++)
+				if (chunk.at(x, y, z))
+					stats.solidVoxels++;
+
+	for (int d = 0; d < 3; d++)
+	{
+		int u = (d + 1) % 3;
+		int v = (d + 2) % 3;
+		int p[3];
+		int q[3] = { 0, 0, 0 };
+		q[d] = 1;
+
+		// Plane s lies between cells s - 1 and s along d
+		for (int s = 0; s <= CHUNK_SIZE; s++)
+		{
+			for (int j = 0; j < CHUNK_SIZE; j++)
+			{
+				for (int i = 0; i < CHUNK_SIZE; i++)
+				{
+					p[d] = s; p[u] = i; p[v] = j;
+					BlockId b = chunk.at(p[0], p[1], p[2]);
+					BlockId a = chunk.at(p[0] - q[0], p[1] - q[1], p[2] - q[2]);
+
+					int face = 0;
+					if (a && !b && s > 0)
+						face = a;
+					else if (b && !a && s < CHUNK_SIZE)
+						face = -b;
+					mask[i + j * CHUNK_SIZE] = face;
+					if (face)
+						stats.visibleFaces++;
+				}
+			}
+
+			// Merge equal faces into rectangles, widest first
+			for (int j = 0; j < CHUNK_SIZE; j++)
+			{
+				for (int i = 0; i < CHUNK_SIZE; )
+				{
+					int face = mask[i + j * CHUNK_SIZE];
+					if (!face)
+					{
+						i++;
+						continue;
+					}
+
+					int w = 1;
+					while (i + w < CHUNK_SIZE && mask[i + w + j * CHUNK_SIZE] == face)
+						w++;
+
+					int h = 1;
+					for (; j + h < CHUNK_SIZE; h++)
+					{
+						int k = 0;
+						while (k < w && mask[i + k + (j + h) * CHUNK_SIZE] == face)
+							k++;
+						if (k < w)
+							break;
+					}
+
+					for (int l = 0; l < h; l++)
+						std::fill_n(&mask[i + (j + l) * CHUNK_SIZE], w, 0);
+
+					int c[4][3];
+					for (int n = 0; n < 4; n++)
+					{
+						c[n][d] = s;
+						c[n][u] = i;
+						c[n][v] = j;
+					}
+					c[1][u] += w;
+					c[2][u] += w; c[2][v] += h;
+					c[3][v] += h;
+
+					// u x v points along +d, so this order is counter-clockwise seen from +d
+					BlockId block = BlockId(face > 0 ? face : -face);
+					int faceIndex = d * 2 + (face > 0 ? 0 : 1);
+					static const int frontOrder[4] = { 0, 1, 2, 3 };
+					static const int backOrder[4] = { 0, 3, 2, 1 };
+					const int* order = face > 0 ? frontOrder : backOrder;
+					for (int n = 0; n < 4; n++)
+					{
+						const int* corner = c[order[n]];
+						vertices.push_back(packVoxelVertex(corner[0], corner[1], corner[2], faceIndex, block));
+					}
+					stats.quads++;
+					i += w;
+				}
+			}
+		}
+	}
+}
+
+BlockId terrainBlock(int x, int y, int z)
+{
+	float height = 24.0f + 10.0f * std::sin(x * 0.07f) * std::cos(y * 0.05f) + 4.0f * std::sin((x + y) * 0.19f);
+	if (z < 0 || z > height)
+		return 0;
+	if (z + 1 > height)
+		return 3;	// Grass
+	if (z + 4 > height)
+		return 2;	// Dirt
+	return 1;		// Stone
+}
+
+static int floorDiv(int a, int b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+VoxelWorld::VoxelWorld(JobSystem& jobs)
+	: jobs(jobs)
+{
+}
+
+VoxelWorld::~VoxelWorld()
+{
+	// Jobs still meshing hold a pointer to us
+	jobs.wait(meshing);
+
+	for (auto& entry : chunks)
+	{
+		glDeleteBuffers(1, &entry.second->vbo);
+		glDeleteVertexArrays(1, &entry.second->vao);
+	}
+	glDeleteBuffers(1, &ebo);
+	glDeleteProgram(program);
+}
+
+int64_t VoxelWorld::chunkKey(int cx, int cy, int cz)
+{
+	// 21 bits per axis
+	const int64_t mask = (1 << 21) - 1;
+	return (int64_t(cx) & mask) | (int64_t(cy) & mask) << 21 | (int64_t(cz) & mask) << 42;
+}
+
+VoxelWorld::Chunk* VoxelWorld::findChunk(int cx, int cy, int cz) const
+{
+	auto it = chunks.find(chunkKey(cx, cy, cz));
+	return it == chunks.end() ? nullptr : it->second.get();
+}
+
+VoxelWorld::Chunk& VoxelWorld::getOrCreateChunk(int cx, int cy, int cz)
+{
+	std::unique_ptr<Chunk>& chunk = chunks[chunkKey(cx, cy, cz)];
+	if (!chunk)
+	{
+		chunk.reset(new Chunk);
+		chunk->coord = glm::ivec3(cx, cy, cz);
+	}
+	return *chunk;
+}
+
+BlockId VoxelWorld::getBlock(int x, int y, int z) const
+{
+	int cx = floorDiv(x, CHUNK_SIZE), cy = floorDiv(y, CHUNK_SIZE), cz = floorDiv(z, CHUNK_SIZE);
+	const Chunk* chunk = findChunk(cx, cy, cz);
+	if (!chunk)
+		return 0;
+	int lx = x - cx * CHUNK_SIZE, ly = y - cy * CHUNK_SIZE, lz = z - cz * CHUNK_SIZE;
+	return chunk->blocks[lx + ly * CHUNK_SIZE + lz * CHUNK_SIZE * CHUNK_SIZE];
+}
+
+void VoxelWorld::setBlock(int x, int y, int z, BlockId block)
+{
+	int cx = floorDiv(x, CHUNK_SIZE), cy = floorDiv(y, CHUNK_SIZE), cz = floorDiv(z, CHUNK_SIZE);
+	Chunk* chunk = findChunk(cx, cy, cz);
+	if (!chunk)
+	{
+		if (!block)
+			return;
+		chunk = &getOrCreateChunk(cx, cy, cz);
+	}
+
+	int lx = x - cx * CHUNK_SIZE, ly = y - cy * CHUNK_SIZE, lz = z - cz * CHUNK_SIZE;
+	BlockId& current = chunk->blocks[lx + ly * CHUNK_SIZE + lz * CHUNK_SIZE * CHUNK_SIZE];
+	if (current == block)
+		return;
+	current = block;
+	markDirty(cx, cy, cz);
+
+	// Border blocks change which faces the neighbour shows
+	if (lx == 0) markDirty(cx - 1, cy, cz);
+	if (lx == CHUNK_SIZE - 1) markDirty(cx + 1, cy, cz);
+	if (ly == 0) markDirty(cx, cy - 1, cz);
+	if (ly == CHUNK_SIZE - 1) markDirty(cx, cy + 1, cz);
+	if (lz == 0) markDirty(cx, cy, cz - 1);
+	if (lz == CHUNK_SIZE - 1) markDirty(cx, cy, cz + 1);
+}
+
+void VoxelWorld::markDirty(int cx, int cy, int cz)
+{
+	Chunk* chunk = findChunk(cx, cy, cz);
+	if (!chunk)
+		return;
+	chunk->version++;
+	dirty.insert(chunkKey(cx, cy, cz));
+}
+
+void VoxelWorld::generateTerrain(int chunksX, int chunksY, int chunksZ)
+{
+	for (int cz = 0; cz < chunksZ; cz++)
+		for (int cy = 0; cy < chunksY; cy++)
+			for (int cx = 0; cx < chunksX; cx++)
+			{
+				Chunk& chunk = getOrCreateChunk(cx, cy, cz);
+				BlockId* block = chunk.blocks;
+				for (int z = 0; z < CHUNK_SIZE; z++)
+					for (int y = 0; y < CHUNK_SIZE; y++)
+						for (int x = 0; x < CHUNK_SIZE; x++)
+							*block++ = terrainBlock(cx * CHUNK_SIZE + x, cy * CHUNK_SIZE + y, cz * CHUNK_SIZE + z);
+				chunk.version++;
+				dirty.insert(chunkKey(cx, cy, cz));
+			}
+}
+
+void VoxelWorld::snapshot(const Chunk& chunk, PaddedChunk& padded) const
+{
+	// Look the 3x3x3 neighbourhood up once instead of per border cell
+	const Chunk* neighbours[27];
+	for (int dz = -1; dz <= 1; dz++)
+		for (int dy = -1; dy <= 1; dy++)
+			for (int dx = -1; dx <= 1; dx++)
+				neighbours[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 9] = findChunk(chunk.coord.x + dx, chunk.coord.y + dy, chunk.coord.z + dz);
+
+	for (int z = -1; z <= CHUNK_SIZE; z++)
+	{
+		int dz = z < 0 ? -1 : z >= CHUNK_SIZE ? 1 : 0;
+		int lz = z - dz * CHUNK_SIZE;
+		for (int y = -1; y <= CHUNK_SIZE; y++)
+		{
+			int dy = y < 0 ? -1 : y >= CHUNK_SIZE ? 1 : 0;
+			int ly = y - dy * CHUNK_SIZE;
+			for (int x = -1; x <= CHUNK_SIZE; x++)
+			{
+				int dx = x < 0 ? -1 : x >= CHUNK_SIZE ? 1 : 0;
+				int lx = x - dx * CHUNK_SIZE;
+				const Chunk* source = neighbours[(dx + 1) + (dy + 1) * 3 + (dz + 1) * 9];
+				padded.at(x, y, z) = source ? source->blocks[lx + ly * CHUNK_SIZE + lz * CHUNK_SIZE * CHUNK_SIZE] : 0;
+			}
+		}
+	}
+}
+
+void VoxelWorld::mesh(const MeshJob& job)
+{
+	static thread_local std::vector<uint32_t> vertices;
+	auto t_start = std::chrono::high_resolution_clock::now();
+	MeshResult result;
+	result.key = job.key;
+	result.version = job.version;
+	vertices.clear();
+	greedyMesh(job.padded, vertices, result.stats);
+	result.vertices.assign(vertices.begin(), vertices.end());
+	result.seconds = secondsSince(t_start);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	results.push_back(std::move(result));
+	pendingJobs--;
+}
+
+void VoxelWorld::update()
+{
+	if (!program)
+	{
+		program = createProgram(voxelVertexSource, voxelFragmentSource);
+		uniView = glGetUniformLocation(program, "view");
+		uniProj = glGetUniformLocation(program, "proj");
+		uniOrigin = glGetUniformLocation(program, "chunkOrigin");
+		packedAttrib = glGetAttribLocation(program, "packedVertex");
+		glGenBuffers(1, &ebo);
+	}
+
+	// Upload finished meshes
+	std::vector<MeshResult> finished;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		finished.swap(results);
+	}
+	for (const MeshResult& result : finished)
+	{
+		chunksMeshed++;
+		meshSeconds += result.seconds;
+
+		auto it = chunks.find(result.key);
+		if (it == chunks.end())
+			continue;
+		Chunk& chunk = *it->second;
+		chunk.inFlight = false;
+		if (result.version > chunk.meshedVersion)
+			upload(chunk, result);
+	}
+
+	// Snapshot dirty chunks for meshing jobs. Chunks still being meshed stay
+	// dirty and are picked up again once their current job lands.
+	for (auto it = dirty.begin(); it != dirty.end(); )
+	{
+		Chunk& chunk = *chunks[*it];
+		if (chunk.inFlight)
+		{
+			++it;
+			continue;
+		}
+		std::shared_ptr<MeshJob> job(new MeshJob);
+		job->key = *it;
+		job->version = chunk.version;
+		snapshot(chunk, job->padded);
+		chunk.inFlight = true;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pendingJobs++;
+		}
+		jobs.run([this, job] { mesh(*job); }, &meshing);
+		it = dirty.erase(it);
+	}
+}
+
+void VoxelWorld::reserveIndices(uint32_t quads)
+{
+	if (quads <= eboQuads)
+		return;
+	eboQuads = std::max(quads, eboQuads * 2);
+
+	std::vector<GLuint> indices(eboQuads * 6);
+	for (uint32_t q = 0; q < eboQuads; q++)
+	{
+		GLuint base = q * 4;
+		GLuint* index = &indices[q * 6];
+		index[0] = base; index[1] = base + 1; index[2] = base + 2;
+		index[3] = base + 2; index[4] = base + 3; index[5] = base;
+	}
+	// Every chunk VAO references this buffer, so respecify it in place
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	renderStats.add(RENDER_BUFFER_BYTES, indices.size() * sizeof(GLuint));
+}
+
+void VoxelWorld::upload(Chunk& chunk, const MeshResult& result)
+{
+	if (!chunk.vao)
+	{
+		glGenVertexArrays(1, &chunk.vao);
+		glGenBuffers(1, &chunk.vbo);
+	}
+	glBindVertexArray(chunk.vao);
+	reserveIndices(result.stats.quads);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+
+	glBindBuffer(GL_ARRAY_BUFFER, chunk.vbo);
+	glBufferData(GL_ARRAY_BUFFER, result.vertices.size() * sizeof(uint32_t), result.vertices.data(), GL_STATIC_DRAW);
+	renderStats.add(RENDER_BUFFER_BYTES, result.vertices.size() * sizeof(uint32_t));
+	glVertexAttribIPointer(packedAttrib, 1, GL_UNSIGNED_INT, sizeof(uint32_t), 0);
+	glEnableVertexAttribArray(packedAttrib);
+
+	chunk.indexCount = GLsizei(result.stats.quads * 6);
+	chunk.mesh = result.stats;
+	chunk.meshedVersion = result.version;
+}
+
+void VoxelWorld::draw(const glm::mat4& view, const glm::mat4& proj)
+{
+	if (!program)
+		return;
+
+	glUseProgram(program);
+	glUniformMatrix4fv(uniView, 1, GL_FALSE, glm::value_ptr(view));
+	glUniformMatrix4fv(uniProj, 1, GL_FALSE, glm::value_ptr(proj));
+	glUniform1i(glGetUniformLocation(program, "tex"), 0);
+	renderStats.add(RENDER_PROGRAM_BINDS);
+	renderStats.add(RENDER_UNIFORM_BYTES, 2 * sizeof(glm::mat4) + sizeof(GLint));
+
+	for (auto& entry : chunks)
+	{
+		const Chunk& chunk = *entry.second;
+		if (!chunk.indexCount)
+			continue;
+		glm::vec3 origin = glm::vec3(chunk.coord * CHUNK_SIZE);
+		glUniform3fv(uniOrigin, 1, glm::value_ptr(origin));
+		glBindVertexArray(chunk.vao);
+		glDrawElements(GL_TRIANGLES, chunk.indexCount, GL_UNSIGNED_INT, 0);
+		renderStats.add(RENDER_UNIFORM_BYTES, sizeof(glm::vec3));
+		renderStats.draw(GL_TRIANGLES, chunk.indexCount);
+	}
+}
+
+VoxelStats VoxelWorld::stats() const
+{
+	VoxelStats stats;
+	stats.chunksMeshed = chunksMeshed;
+	stats.meshSeconds = meshSeconds;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.pendingJobs = pendingJobs;
+	}
+	for (auto& entry : chunks)
+	{
+		const Chunk& chunk = *entry.second;
+		if (!chunk.meshedVersion)
+			continue;
+		stats.residentChunks++;
+		stats.naiveTriangles += uint64_t(chunk.mesh.solidVoxels) * 12;
+		stats.culledTriangles += uint64_t(chunk.mesh.visibleFaces) * 2;
+		stats.greedyTriangles += uint64_t(chunk.mesh.quads) * 2;
+		stats.vertexBytes += uint64_t(chunk.mesh.quads) * 4 * sizeof(uint32_t);
+	}
+	return stats;
+}
+
+void VoxelWorld::printStats() const
+{
+	VoxelStats s = stats();
+	double voxelsPerSecond = s.meshSeconds > 0.0 ? s.chunksMeshed * double(CHUNK_VOLUME) / s.meshSeconds : 0.0;
+	printf("Voxels: %zu chunks resident, %llu meshed (%.1f Mvoxels/s per worker), %zu pending\n",
+		s.residentChunks, (unsigned long long)s.chunksMeshed, voxelsPerSecond / 1e6, s.pendingJobs);
+	printf("Voxels: triangles naive %llu, culled %llu, greedy %llu (%.1fx fewer than naive), %.2f MB vertices\n",
+		(unsigned long long)s.naiveTriangles, (unsigned long long)s.culledTriangles, (unsigned long long)s.greedyTriangles,
+		s.greedyTriangles ? double(s.naiveTriangles) / s.greedyTriangles : 0.0, s.vertexBytes / (1024.0 * 1024.0));
+}
+
+void benchmarkVoxelMeshing()
+{
+	const int chunksX = 8, chunksY = 8, chunksZ = 2;
+	const int count = chunksX * chunksY * chunksZ;
+
+	std::vector<PaddedChunk> padded(count);
+	for (int c = 0; c < count; c++)
+	{
+		int cx = c % chunksX, cy = (c / chunksX) % chunksY, cz = c / (chunksX * chunksY);
+		for (int z = -1; z <= CHUNK_SIZE; z++)
+			for (int y = -1; y <= CHUNK_SIZE; y++)
+				for (int x = -1; x <= CHUNK_SIZE; x++)
+					padded[c].at(x, y, z) = terrainBlock(cx * CHUNK_SIZE + x, cy * CHUNK_SIZE + y, cz * CHUNK_SIZE + z);
+	}
+
+	// Single thread
+	VoxelMeshStats total;
+	std::vector<uint32_t> vertices;
+	auto t_start = std::chrono::high_resolution_clock::now();
+	for (int c = 0; c < count; c++)
+	{
+		vertices.clear();
+		greedyMesh(padded[c], vertices, total);
+	}
+	double seconds = secondsSince(t_start);
+	printf("1 thread:  %d chunks in %.1f ms, %.0f chunks/s, %.1f Mvoxels/s\n",
+		count, seconds * 1e3, count / seconds, count * double(CHUNK_VOLUME) / seconds / 1e6);
+
+	// All cores, one job per chunk
+	JobSystem jobs;
+	unsigned threadCount = jobs.workerCount() + 1;
+	t_start = std::chrono::high_resolution_clock::now();
+	jobs.parallelFor(count, 1, [&padded](size_t begin, size_t end)
+	{
+		std::vector<uint32_t> local;
+		VoxelMeshStats unused;
+		for (size_t c = begin; c < end; c++)
+		{
+			local.clear();
+			greedyMesh(padded[c], local, unused);
+		}
+	});
+	double parallelSeconds = secondsSince(t_start);
+	printf("%u threads: %d chunks in %.1f ms, %.0f chunks/s (%.1fx)\n",
+		threadCount, count, parallelSeconds * 1e3, count / parallelSeconds, seconds / parallelSeconds);
+
+	uint64_t naive = uint64_t(total.solidVoxels) * 12;
+	uint64_t culled = uint64_t(total.visibleFaces) * 2;
+	uint64_t greedy = uint64_t(total.quads) * 2;
+	printf("Triangles: naive %llu, culled %llu (%.1fx), greedy %llu (%.1fx)\n",
+		(unsigned long long)naive, (unsigned long long)culled, double(naive) / culled,
+		(unsigned long long)greedy, double(naive) / greedy);
+	printf("Vertex data: naive %.1f MB (36 x 32 B per voxel), greedy %.2f MB (4 x 4 B per quad)\n",
+		naive * 3 * 32 / (1024.0 * 1024.0), total.quads * 16 / (1024.0 * 1024.0));
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "JobSystem.h"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+const int CHUNK_SIZE = 32;
+const int CHUNK_VOLUME = CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE;
+const int PADDED_SIZE = CHUNK_SIZE + 2;
+
+// 0 is air, everything else is a solid block type
+typedef uint8_t BlockId;
+
+// Faces in packed vertices: +X, -X, +Y, -Y, +Z, -Z
+enum VoxelFace { FACE_POS_X, FACE_NEG_X, FACE_POS_Y, FACE_NEG_Y, FACE_POS_Z, FACE_NEG_Z };
+
+// One 32-bit vertex: bits 0-5 x, 6-11 y, 12-17 z (0..32 inside the chunk),
+// 18-20 face, 21-28 block type. Texture coordinates are derived in the shader
+// from the position on the face plane, so merged quads tile their texture.
+inline uint32_t packVoxelVertex(int x, int y, int z, int face, BlockId block)
+{
+	return uint32_t(x) | uint32_t(y) << 6 | uint32_t(z) << 12 | uint32_t(face) << 18 | uint32_t(block) << 21;
+}
+
+// Chunk blocks plus one layer of each neighbour, so faces on chunk borders
+// can be culled without touching other chunks while meshing.
+struct PaddedChunk
+{
+	BlockId blocks[PADDED_SIZE * PADDED_SIZE * PADDED_SIZE];
+
+	// x, y, z in -1..CHUNK_SIZE
+	BlockId& at(int x, int y, int z) { return blocks[(x + 1) + (y + 1) * PADDED_SIZE + (z + 1) * PADDED_SIZE * PADDED_SIZE]; }
+	BlockId at(int x, int y, int z) const { return blocks[(x + 1) + (y + 1) * PADDED_SIZE + (z + 1) * PADDED_SIZE * PADDED_SIZE]; }
+};
+
+struct VoxelMeshStats
+{
+	uint32_t solidVoxels = 0;
+	uint32_t visibleFaces = 0;	// Faces left after hidden-face removal
+	uint32_t quads = 0;			// Quads left after greedy merging
+};
+
+// Hidden-face removal and greedy quad merging. Appends 4 packed vertices per quad.
+void greedyMesh(const PaddedChunk& chunk, std::vector<uint32_t>& vertices, VoxelMeshStats& stats);
+
+// Block type for the demo terrain at world block coordinates (Z is up)
+BlockId terrainBlock(int x, int y, int z);
+
+struct VoxelStats
+{
+	uint64_t chunksMeshed = 0;
+	double meshSeconds = 0.0;		// Summed over all workers
+	size_t pendingJobs = 0;			// Queued or running
+	size_t residentChunks = 0;
+	uint64_t naiveTriangles = 0;	// 12 per solid voxel, one cube each
+	uint64_t culledTriangles = 0;	// After hidden-face removal
+	uint64_t greedyTriangles = 0;	// What is actually drawn
+	uint64_t vertexBytes = 0;
+};
+
+// Chunked block world. Edits mark chunks dirty; update() hands snapshots of
+// dirty chunks to meshing jobs and uploads finished meshes.
+// All GL work happens in update() and draw() on the thread owning the context.
+class VoxelWorld
+{
+public:
+	explicit VoxelWorld(JobSystem& jobs);
+	~VoxelWorld();
+
+	BlockId getBlock(int x, int y, int z) const;
+	void setBlock(int x, int y, int z, BlockId block);
+
+	// Fill chunks [0, chunks) with terrainBlock()
+	void generateTerrain(int chunksX, int chunksY, int chunksZ);
+
+	void update();
+	void draw(const glm::mat4& view, const glm::mat4& proj);
+
+	VoxelStats stats() const;
+	void printStats() const;
+
+private:
+	struct Chunk
+	{
+		BlockId blocks[CHUNK_VOLUME] = {};
+		uint32_t version = 1;
+		uint32_t meshedVersion = 0;
+		bool inFlight = false;
+		glm::ivec3 coord;
+		GLuint vao = 0, vbo = 0;
+		GLsizei indexCount = 0;
+		VoxelMeshStats mesh;
+	};
+
+	struct MeshJob
+	{
+		int64_t key;
+		uint32_t version;
+		PaddedChunk padded;
+	};
+
+	struct MeshResult
+	{
+		int64_t key;
+		uint32_t version;
+		std::vector<uint32_t> vertices;
+		VoxelMeshStats stats;
+		double seconds;
+	};
+
+	static int64_t chunkKey(int cx, int cy, int cz);
+	Chunk* findChunk(int cx, int cy, int cz) const;
+	Chunk& getOrCreateChunk(int cx, int cy, int cz);
+	void markDirty(int cx, int cy, int cz);
+	void snapshot(const Chunk& chunk, PaddedChunk& padded) const;
+	void upload(Chunk& chunk, const MeshResult& result);
+	void reserveIndices(uint32_t quads);
+	void mesh(const MeshJob& job);
+
+	std::unordered_map<int64_t, std::unique_ptr<Chunk>> chunks;
+	std::unordered_set<int64_t> dirty;
+
+	JobSystem& jobs;
+	JobCounter meshing;
+	mutable std::mutex mutex;
+	std::vector<MeshResult> results;
+	size_t pendingJobs = 0;
+
+	GLuint program = 0;
+	GLuint ebo = 0;
+	uint32_t eboQuads = 0;
+	GLint uniView = -1, uniProj = -1, uniOrigin = -1;
+	GLint packedAttrib = -1;
+
+	uint64_t chunksMeshed = 0;
+	double meshSeconds = 0.0;
+};
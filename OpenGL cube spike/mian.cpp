@@ -3,43 +3,224 @@
 #include <GL/glew.h>
 #include <SDL/SDL.h>
 #include <SDL/SDL_opengl.h>
+#include <algorithm>
 #include <forward_list>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
 #include <SOIL/SOIL.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-
-// Shader sources
+#include "AssetPack.h"
+#include "Benchmark.h"
+#include "ClusteredLighting.h"
+#include "FrameCapture.h"
+#include "FramePacing.h"
+#include "ImageBatch.h"
+#include "JobSystem.h"
+#include "MeshImport.h"
+#include "OcclusionCulling.h"
+#include "Reflection.h"
+#include "RenderStats.h"
+#include "SceneFile.h"
+#include "Shader.h"
+#include "ShaderVariants.h"
+#include "TextureResidency.h"
+#include "TransformHierarchy.h"
+#include "VirtualTexture.h"
+#include "Voxel.h"
+
+// Shader sources, specialized per draw by ShaderVariants
 const GLchar* vertexSource =
-"#version 150 core\n"
 "in vec3 position;"
 "in vec3 color;"
 "in vec2 texcoord;"
 "out vec3 Color;"
 "out vec2 Texcoord;"
+"\n#ifdef INSTANCING\n"
+"in mat4 instanceModel;"
+"\n#define model instanceModel\n"
+"\n#else\n"
 "uniform mat4 model;"
+"\n#endif\n"
 "uniform mat4 view;"
 "uniform mat4 proj;"
+"\n#ifdef TINT\n"
 "uniform vec3 overrideColor;"
+"\n#endif\n"
+"\n#ifdef LIGHTING\n"
+"out vec3 ViewPosition;"
+"\n#endif\n"
 "void main() {"
+"\n#ifdef TINT\n"
 "	Color = overrideColor * color;"
+"\n#else\n"
+"	Color = color;"
+"\n#endif\n"
 "	Texcoord = texcoord;"
-"	gl_Position = proj * view * model * vec4(position, 1.0);"
+"	vec4 viewPosition = view * model * vec4(position, 1.0);"
+"\n#ifdef LIGHTING\n"
+"	ViewPosition = viewPosition.xyz;"
+"\n#endif\n"
+"	gl_Position = proj * viewPosition;"
 "}";
 const GLchar* fragmentSource =
-"#version 150 core\n"
 "in vec3 Color;"
 "in vec2 Texcoord;"
 "out vec4 outColor;"
+"\n#ifdef DUAL_TEXTURE\n"
 "uniform sampler2D texKitten;"
 "uniform sampler2D texPuppy;"
+"\n#endif\n"
+"\n#ifdef LIGHTING\n"
+"in vec3 ViewPosition;"
+"\n#endif\n"
+"void main() {"
+"	vec3 albedo = Color;"
+"\n#ifdef DUAL_TEXTURE\n"
+"	albedo *= mix(texture(texKitten, Texcoord), texture(texPuppy, Texcoord), 0.5).rgb;"
+"\n#endif\n"
+"\n#ifdef LIGHTING\n"
+"	vec3 normal = normalize(cross(dFdx(ViewPosition), dFdy(ViewPosition)));"
+"	albedo = albedo * 0.2 + clusteredLighting(ViewPosition, normal, albedo);"
+"\n#endif\n"
+"	outColor = vec4(albedo, 1.0);"
+"}";
+
+// Floor sampling the cached planar reflection in screen space
+const GLchar* floorVertexSource =
+"#version 150 core\n"
+"in vec3 position;"
+"uniform mat4 view;"
+"uniform mat4 proj;"
+"void main() {"
+"	gl_Position = proj * view * vec4(position, 1.0);"
+"}";
+const GLchar* floorFragmentSource =
+"#version 150 core\n"
+"out vec4 outColor;"
+"uniform sampler2D reflection;"
+"uniform vec2 viewportSize;"
+"uniform vec3 tint;"
+"void main() {"
+"	outColor = vec4(tint * texture(reflection, gl_FragCoord.xy / viewportSize).rgb, 1.0);"
+"}";
+
+// Ground plane paged from a virtual texture; virtualTextureSource goes after the version line
+const GLchar* groundVertexSource =
+"#version 150 core\n"
+"in vec2 position;"
+"out vec2 Texcoord;"
+"uniform mat4 viewProj;"
+"void main() {"
+"	Texcoord = position / 256.0;"
+"	gl_Position = viewProj * vec4(position, 0.0, 1.0);"
+"}";
+const GLchar* groundFragmentSource =
+"in vec2 Texcoord;"
+"out vec4 outColor;"
 "void main() {"
-"	outColor = vec4(Color, 1.0) * mix(texture(texKitten, Texcoord), texture(texPuppy, Texcoord), 0.5);"
+"\n#ifdef FEEDBACK\n"
+"	outColor = virtualFeedback(Texcoord);"
+"\n#else\n"
+"	outColor = sampleVirtual(Texcoord);"
+"\n#endif\n"
 "}";
 
+// Bake the demo's textures and cube shaders into a pack
+static bool buildAssetPack(const char* path, bool compress, JobSystem& jobs)
+{
+	AssetPackBuilder builder(&jobs);
+	if (!builder.addTexture("Textures/sample.png", "Textures/sample.png", 3, compress) ||
+		!builder.addTexture("Textures/sample2.png", "Textures/sample2.png", 3, compress))
+		return false;
+	builder.addShader("cube.vert", vertexSource);
+	builder.addShader("cube.frag", fragmentSource);
+	return builder.write(path);
+}
+
 int main(int argc, char *argv[])
 {
+	auto t_launch = std::chrono::high_resolution_clock::now();
+	if (runBenchmarks(argc, argv))
+		return 0;
+
+	bool voxelMode = false;
+	bool planarReflection = false;
+	int lightCount = 0;
+	const char* scenePath = nullptr;
+	const char* packPath = nullptr;
+	bool compressPack = false;
+	bool occlusionCulling = false;
+	const char* recordPath = nullptr;
+	int recordFps = 60;
+	size_t textureBudget = 0;
+	const char* meshPath = nullptr;
+	int framesInFlight = 2;
+	const char* statsCsvPath = nullptr;
+	const char* virtualTexturePath = nullptr;
+	bool pauseAnimation = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--voxels") == 0)
+			voxelMode = true;
+		else if (strcmp(argv[i], "--planar-reflection") == 0)
+			planarReflection = true;
+		else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+			lightCount = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+			scenePath = argv[++i];
+		else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc)
+			packPath = argv[++i];
+		else if (strcmp(argv[i], "--pack-dxt") == 0)
+			compressPack = true;
+		else if (strcmp(argv[i], "--occlusion") == 0)
+			occlusionCulling = true;
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			recordPath = argv[++i];
+		else if (strcmp(argv[i], "--record-fps") == 0 && i + 1 < argc)
+			recordFps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+			textureBudget = size_t(atoi(argv[++i])) * 1024;
+		else if (strcmp(argv[i], "--mesh") == 0 && i + 1 < argc)
+			meshPath = argv[++i];
+		else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+			framesInFlight = std::max(atoi(argv[++i]), 0);
+		else if (strcmp(argv[i], "--stats-csv") == 0 && i + 1 < argc)
+			statsCsvPath = argv[++i];
+		else if (strcmp(argv[i], "--virtual-texture") == 0 && i + 1 < argc)
+			virtualTexturePath = argv[++i];
+		else if (strcmp(argv[i], "--pause-animation") == 0)
+			pauseAnimation = true;
+	}
+
+	// Shared by asset loading, meshing and the per-frame CPU stages
+	JobSystem jobs;
+	SOILJobScope soilJobs(jobs);
+
+	// Built on first use; delete the file to re-bake after changing the assets
+	AssetPack pack;
+	if (packPath && !pack.open(packPath))
+	{
+		if (buildAssetPack(packPath, compressPack, jobs))
+			pack.open(packPath);
+		if (!pack.isOpen())
+			fprintf(stderr, "Could not build asset pack %s, loading loose files\n", packPath);
+	}
+
+	// Loose textures decode as a batch on the job system while the window and context come up
+	const char* texturePaths[2] = { "Textures/sample.png", "Textures/sample2.png" };
+	std::vector<ImageRequest> textureRequests = { { texturePaths[0], SOIL_LOAD_RGB }, { texturePaths[1], SOIL_LOAD_RGB } };
+	std::unique_ptr<ImageBatch> looseImages;
+	if (!pack.isOpen())
+		looseImages.reset(new ImageBatch(jobs, textureRequests));
+
 	auto t_start = std::chrono::high_resolution_clock::now();
 	
 	SDL_Init(SDL_INIT_EVERYTHING);
@@ -57,6 +238,7 @@ int main(int argc, char *argv[])
 
 	// Initalize OpenGL
 	glEnable(GL_DEPTH_TEST);
+	renderStats.add(RENDER_DEPTH_STATE);
 
 	SDL_Event windowEvent;
 
@@ -124,6 +306,7 @@ int main(int argc, char *argv[])
 
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	renderStats.add(RENDER_BUFFER_BYTES, sizeof(vertices));
 
 	// Create an Element Arrya
 	/*GLuint ebo;
@@ -137,85 +320,344 @@ int main(int argc, char *argv[])
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_STATIC_DRAW);*/
 
-	// Create and compile the vertex shader
-	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertexShader, 1, &vertexSource, NULL);
-	glCompileShader(vertexShader);
-	
-	// Create and compile the fragment shader
-	GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
-	glCompileShader(fragmentShader);
-
-	// Link the vertex and fragment shader into a shader program
-	GLuint shaderProgram = glCreateProgram();
-	glAttachShader(shaderProgram, vertexShader);
-	glAttachShader(shaderProgram, fragmentShader);
-	glBindFragDataLocation(shaderProgram, 0, "outColor");
-	glLinkProgram(shaderProgram);
-	glUseProgram(shaderProgram);
+	// Programs are specialized per draw and compiled on first use
+	const char* cubeVertexSource = pack.isOpen() ? pack.shaderSource("cube.vert") : nullptr;
+	const char* cubeFragmentSource = pack.isOpen() ? pack.shaderSource("cube.frag") : nullptr;
+	std::unique_ptr<ShaderVariants> shaders(new ShaderVariants(
+		cubeVertexSource ? cubeVertexSource : vertexSource,
+		cubeFragmentSource ? cubeFragmentSource : fragmentSource));
+	shaders->setFeatureSource(SHADER_LIGHTING, clusteredLightingSource);
+	shaders->bindSampler("texKitten", 0);
+	shaders->bindSampler("texPuppy", 1);
 	
 	// Specify the layout of the vertex data
-	GLint posAttrib = glGetAttribLocation(shaderProgram, "position");
-	glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), 0);
-	glEnableVertexAttribArray(posAttrib);
+	glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), 0);
+	glEnableVertexAttribArray(ATTRIB_POSITION);
 
-	GLint colorAttrib = glGetAttribLocation(shaderProgram, "color");
-	glVertexAttribPointer(colorAttrib, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), reinterpret_cast<void*>(3 * sizeof(float)));
-	glEnableVertexAttribArray(colorAttrib);
+	glVertexAttribPointer(ATTRIB_COLOR, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), reinterpret_cast<void*>(3 * sizeof(float)));
+	glEnableVertexAttribArray(ATTRIB_COLOR);
 	
-	GLint texAttrib = glGetAttribLocation(shaderProgram, "texcoord");
-	glVertexAttribPointer(texAttrib, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), reinterpret_cast<void*>(6 * sizeof(float)));
-	glEnableVertexAttribArray(texAttrib);
+	glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), reinterpret_cast<void*>(6 * sizeof(float)));
+	glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+
+	// With --mesh <file.obj|file.glb> the model replaces the cube. It is imported
+	// once into <file>.mesh, which later runs map straight into the buffers.
+	MeshFile importedMesh;
+	GLuint meshVao = 0;
+	glm::mat4 meshFit;
+	if (meshPath)
+	{
+		MeshImporter importer(jobs);
+		std::string cachePath = std::string(meshPath) + ".mesh";
+		if (importer.import(meshPath, cachePath.c_str(), importedMesh))
+		{
+			importer.printStats();
+			glGenVertexArrays(1, &meshVao);
+			glBindVertexArray(meshVao);
+			importedMesh.upload(ATTRIB_POSITION, ATTRIB_TEXCOORD);
+			meshFit = importedMesh.unitCubeTransform();
+			importedMesh.close();
+			glBindVertexArray(vao);
+			glBindBuffer(GL_ARRAY_BUFFER, vbo);
+			glVertexAttrib3f(ATTRIB_COLOR, 1.0f, 1.0f, 1.0f);	// The mesh has no vertex colors
+		}
+		else
+			fprintf(stderr, "Could not import %s, drawing the cube\n", meshPath);
+	}
+	auto drawCube = [&]
+	{
+		if (!meshVao)
+		{
+			glDrawArrays(GL_TRIANGLES, 0, 36);
+			renderStats.draw(GL_TRIANGLES, 36);
+			return;
+		}
+		glBindVertexArray(meshVao);
+		importedMesh.draw();
+		glBindVertexArray(vao);
+	};
+
+	// With --texture-budget <KB> the pack's textures stream their mips in as the cube needs them
+	std::unique_ptr<TextureResidency> residency;
+	ResidentTextureId residentTextures[2] = { NO_RESIDENT_TEXTURE, NO_RESIDENT_TEXTURE };
+	if (pack.isOpen() && textureBudget)
+	{
+		residency.reset(new TextureResidency(pack, jobs, textureBudget));
+		for (int i = 0; i < 2; i++)
+			residentTextures[i] = residency->add(texturePaths[i]);
+	}
 
 	// Load textures	
 	GLuint textures[2];
-	int width, height;
-	unsigned char*  image;
 	glGenTextures(2, textures);
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, textures[0]);
+	bool streamed = residentTextures[0] != NO_RESIDENT_TEXTURE;
+	glBindTexture(GL_TEXTURE_2D, streamed ? residency->texture(residentTextures[0]) : textures[0]);
+	renderStats.add(RENDER_TEXTURE_BINDS);
 
-	image = SOIL_load_image("Textures/sample.png", &width, &height, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	SOIL_free_image_data(image);
-	glUniform1i(glGetUniformLocation(shaderProgram, "texKitten"), 0);
+	bool packed = streamed || pack.uploadTexture(texturePaths[0]);
+	if (!packed)
+	{
+		if (!looseImages)
+			looseImages.reset(new ImageBatch(jobs, textureRequests));
+		const DecodedImage& image = looseImages->get(0);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.pixels);
+		renderStats.add(RENDER_TEXTURE_UPLOADS);
+		renderStats.add(RENDER_TEXTURE_BYTES, image.bytes());
+	}
 	
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, packed ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
 	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, textures[1]);
+	streamed = residentTextures[1] != NO_RESIDENT_TEXTURE;
+	glBindTexture(GL_TEXTURE_2D, streamed ? residency->texture(residentTextures[1]) : textures[1]);
+	renderStats.add(RENDER_TEXTURE_BINDS);
 	
-	image = SOIL_load_image("Textures/sample2.png", &width, &height, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	SOIL_free_image_data(image);
-	glUniform1i(glGetUniformLocation(shaderProgram, "texPuppy"), 1);
+	packed = streamed || pack.uploadTexture(texturePaths[1]);
+	if (!packed)
+	{
+		if (!looseImages)
+			looseImages.reset(new ImageBatch(jobs, textureRequests));
+		const DecodedImage& image = looseImages->get(1);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.pixels);
+		renderStats.add(RENDER_TEXTURE_UPLOADS);
+		renderStats.add(RENDER_TEXTURE_BYTES, image.bytes());
+	}
+	// Both uploaded, the decoded pixels can go
+	looseImages.reset();
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, packed ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-	GLuint uniModel = glGetUniformLocation(shaderProgram, "model");
-
 	glm::mat4 view = glm::lookAt(
 		glm::vec3(2.5f, 2.5f, 2.5f),
 		glm::vec3(0.0f, 0.0f, 0.0f),
 		glm::vec3(0.0f, 0.0f, 1.0f)
 		);
-	GLint uniView = glGetUniformLocation(shaderProgram, "view");
-	glUniformMatrix4fv(uniView, 1, GL_FALSE, glm::value_ptr(view));
-
 	glm::mat4 proj = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 1.0f, 10.0f);
-	GLint uniProj = glGetUniformLocation(shaderProgram, "proj");
-	glUniformMatrix4fv(uniProj, 1, GL_FALSE, glm::value_ptr(proj));
+	shaders->setCamera(view, proj);
+
+	// Cheapest variants for the three kinds of draw in the scene
+	unsigned cubeFeatures = ShaderVariants::select(glm::vec3(1.0f), true, lightCount > 0, false);
+	unsigned mirroredFeatures = ShaderVariants::select(glm::vec3(0.5f), true, lightCount > 0, false);
+	unsigned floorFeatures = ShaderVariants::select(glm::vec3(1.0f), false, false, false);	// Black, texturing can't show
+
+	// Half resolution reflection texture, used instead of the stencil mirror with --planar-reflection
+	std::unique_ptr<PlanarReflection> reflection;
+	GLuint floorProgram = 0, floorVao = 0;
+	if (planarReflection)
+	{
+		reflection.reset(new PlanarReflection(800, 600, 2));
+		reflection->setPlane(glm::vec4(0.0f, 0.0f, 1.0f, 0.5f));	// The floor at z = -0.5
+
+		floorProgram = createProgram(floorVertexSource, floorFragmentSource);
+		glUseProgram(floorProgram);
+		glUniformMatrix4fv(glGetUniformLocation(floorProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+		glUniformMatrix4fv(glGetUniformLocation(floorProgram, "proj"), 1, GL_FALSE, glm::value_ptr(proj));
+		glUniform1i(glGetUniformLocation(floorProgram, "reflection"), 2);
+		glUniform2f(glGetUniformLocation(floorProgram, "viewportSize"), 800.0f, 600.0f);
+		glUniform3f(glGetUniformLocation(floorProgram, "tint"), 0.5f, 0.5f, 0.5f);
+		renderStats.add(RENDER_PROGRAM_BINDS);
+		renderStats.add(RENDER_UNIFORM_BYTES, 2 * sizeof(glm::mat4) + sizeof(GLint) + 5 * sizeof(float));
+
+		// Attribute locations differ between programs, so the floor gets its own VAO
+		glGenVertexArrays(1, &floorVao);
+		glBindVertexArray(floorVao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		GLint floorPosAttrib = glGetAttribLocation(floorProgram, "position");
+		glVertexAttribPointer(floorPosAttrib, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), 0);
+		glEnableVertexAttribArray(floorPosAttrib);
+		glBindVertexArray(vao);
+
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, reflection->texture());
+		renderStats.add(RENDER_TEXTURE_BINDS);
+	}
+
+	// Point lights orbiting the cube, binned into clusters every frame
+	std::unique_ptr<ClusteredLighting> clusters(new ClusteredLighting);
+	std::vector<PointLight> lights(lightCount);
+	for (int i = 0; i < lightCount; i++)
+	{
+		lights[i].radius = 0.5f + 0.5f * (rand() / float(RAND_MAX));
+		lights[i].color = glm::vec3(rand() / float(RAND_MAX), rand() / float(RAND_MAX), rand() / float(RAND_MAX));
+		lights[i].intensity = 4.0f / (1.0f + lightCount / 64.0f);
+	}
+
+	// Instanced scene mapped from a binary file with --scene, drawn instead of the cube scene
+	SceneFile scene;
+	GLuint sceneVao = 0, sceneInstances = 0;
+	glm::vec3 sceneCenter;
+	float sceneRadius = 1.0f;
+	std::vector<SceneRange> sceneVisible;
+	// With --occlusion the nearest instances are rasterized as occluders every frame
+	std::unique_ptr<OcclusionCuller> occlusion;
+	std::vector<uint32_t> occluderOrder;
+	std::vector<OcclusionBox> occlusionBoxes;
+	std::vector<uint8_t> occlusionVisible;
+	std::vector<SceneRange> unoccluded;
+	if (occlusionCulling)
+		occlusion.reset(new OcclusionCuller(jobs));
+	if (scenePath)
+	{
+		if (!scene.open(scenePath))
+		{
+			printf("Writing a demo scene to %s\n", scenePath);
+			SceneData demo;
+			makeDemoScene(demo, 100000);
+			if (writeScene(scenePath, demo))
+				scene.open(scenePath);
+		}
+		if (scene.isOpen() && (!scene.nodeCount() || !scene.meshCount()))
+			scene.close();	// Nothing to draw
+		else if (scene.isOpen() &&
+			uint64_t(scene.meshes()[0].firstVertex) + scene.meshes()[0].vertexCount > sizeof(vertices) / (8 * sizeof(GLfloat)))
+		{
+			// Every instance is drawn with mesh 0, out of the cube's vertices
+			fprintf(stderr, "%s: mesh 0 is not in the vertex buffer\n", scenePath);
+			scene.close();
+		}
+	}
+	if (scene.isOpen())
+	{
+		glGenVertexArrays(1, &sceneVao);
+		glBindVertexArray(sceneVao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), 0);
+		glEnableVertexAttribArray(ATTRIB_POSITION);
+		glVertexAttribPointer(ATTRIB_COLOR, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), reinterpret_cast<void*>(3 * sizeof(float)));
+		glEnableVertexAttribArray(ATTRIB_COLOR);
+		glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), reinterpret_cast<void*>(6 * sizeof(float)));
+		glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+
+		// Transforms go from the mapping to the GPU without an intermediate copy
+		glGenBuffers(1, &sceneInstances);
+		glBindBuffer(GL_ARRAY_BUFFER, sceneInstances);
+		glBufferData(GL_ARRAY_BUFFER, scene.instanceCount() * sizeof(glm::mat4), scene.transforms(), GL_STATIC_DRAW);
+		renderStats.add(RENDER_BUFFER_BYTES, scene.instanceCount() * sizeof(glm::mat4));
+		for (int column = 0; column < 4; column++)
+		{
+			glEnableVertexAttribArray(ATTRIB_INSTANCE_MODEL + column);
+			glVertexAttribDivisor(ATTRIB_INSTANCE_MODEL + column, 1);
+		}
+		glBindVertexArray(vao);
+
+		const SceneNode& root = scene.nodes()[0];
+		glm::vec3 lo = glm::vec3(root.boundsMin[0], root.boundsMin[1], root.boundsMin[2]);
+		glm::vec3 hi = glm::vec3(root.boundsMax[0], root.boundsMax[1], root.boundsMax[2]);
+		sceneCenter = (lo + hi) * 0.5f;
+		sceneRadius = glm::length(hi - lo) * 0.5f;
+		printf("Scene: %u instances, %u nodes\n", scene.instanceCount(), scene.nodeCount());
+	}
 
-	GLint uniColor = glGetUniformLocation(shaderProgram, "overrideColor");
+	// Block world drawn instead of the cube scene with --voxels
+	std::unique_ptr<VoxelWorld> voxels;
+	glm::mat4 voxelView = glm::lookAt(
+		glm::vec3(-40.0f, -40.0f, 90.0f),
+		glm::vec3(128.0f, 128.0f, 20.0f),
+		glm::vec3(0.0f, 0.0f, 1.0f)
+		);
+	glm::mat4 voxelProj = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 1.0f, 1000.0f);
+	if (voxelMode)
+	{
+		voxels.reset(new VoxelWorld(jobs));
+		voxels->generateTerrain(8, 8, 2);
+	}
+
+	// With --virtual-texture <file.vtx> a flight over a textured ground plane
+	// replaces the cube scene; a missing file is built from the demo map first
+	std::unique_ptr<VirtualTexture> virtualTexture;
+	GLuint groundProgram = 0, groundFeedbackProgram = 0, groundVao = 0, groundVbo = 0;
+	GLint groundViewProj = -1, groundFeedbackViewProj = -1;
+	if (virtualTexturePath)
+	{
+		FILE* existing = fopen(virtualTexturePath, "rb");
+		if (existing)
+			fclose(existing);
+		else
+		{
+			auto t_build = std::chrono::high_resolution_clock::now();
+			if (buildVirtualTexture(virtualTexturePath, 16384, 16384, virtualDemoSource, jobs))
+				printf("Built %s in %.1f s\n", virtualTexturePath, secondsSince(t_build));
+		}
+		virtualTexture.reset(new VirtualTexture(jobs));
+		if (!virtualTexture->open(virtualTexturePath))
+			virtualTexture.reset();
+	}
+	if (virtualTexture)
+	{
+		std::string fragment = std::string("#version 150 core\n") + virtualTextureSource + groundFragmentSource;
+		std::string feedbackFragment = std::string("#version 150 core\n#define FEEDBACK\n") + virtualTextureSource + groundFragmentSource;
+		const char* groundAttributes[] = { "position" };
+		groundProgram = createProgram(groundVertexSource, fragment.c_str(), groundAttributes, 1);
+		groundFeedbackProgram = createProgram(groundVertexSource, feedbackFragment.c_str(), groundAttributes, 1);
+		groundViewProj = glGetUniformLocation(groundProgram, "viewProj");
+		groundFeedbackViewProj = glGetUniformLocation(groundFeedbackProgram, "viewProj");
+
+		// Five texture repeats either way; the texture covers 256 units
+		const float extent = 1280.0f;
+		float ground[] = { -extent, -extent, extent, -extent, -extent, extent, extent, extent };
+		glGenBuffers(1, &groundVbo);
+		glBindBuffer(GL_ARRAY_BUFFER, groundVbo);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(ground), ground, GL_STATIC_DRAW);
+		renderStats.add(RENDER_BUFFER_BYTES, sizeof(ground));
+		glGenVertexArrays(1, &groundVao);
+		glBindVertexArray(groundVao);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+		glEnableVertexAttribArray(0);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	}
 
+	// The floor and the mirrored cube follow the spinning cube
+	TransformHierarchy transforms;
+	TransformId cubeNode = transforms.create();
+	TransformId floorNode = transforms.create(cubeNode);
+	TransformId mirrorNode = transforms.create(cubeNode);
+	transforms.setTranslation(mirrorNode, glm::vec3(0.0f, 0.0f, -1.0f));
+	transforms.setScale(mirrorNode, glm::vec3(1.0f, 1.0f, -1.0f));
+
+	// Frames are read back through a PBO ring; F12 saves a screenshot
+	std::unique_ptr<FrameCapture> capture(new FrameCapture(800, 600));
+	int screenshotCount = 0;
+	if (recordPath && !capture->startRecording(recordPath, recordFps))
+		fprintf(stderr, "Could not record to %s\n", recordPath);
+
+	// With --frames-in-flight <n> the CPU runs at most n frames ahead of the GPU,
+	// 0 leaves it to the driver. The title shows where the frame time goes.
+	std::unique_ptr<FramePacer> pacer(new FramePacer(unsigned(framesInFlight)));
+	uint64_t titleFrame = 0;
+
+	// Time to first frame covers startup, asset loading and the first shader compiles
+	bool firstFrame = true;
+	auto present = [&]()
+	{
+		capture->capture();
+		SDL_GL_SwapWindow(window);
+		pacer->endFrame();
+		renderStats.endFrame();
+		if (pacer->framesFinished() >= titleFrame + 60)
+		{
+			FrameTiming timing = pacer->average();
+			char title[128];
+			snprintf(title, sizeof(title), "OpenGL - CPU %.2f ms, wait %.2f ms, GPU %.2f ms, latency %.1f ms",
+				timing.cpuSeconds * 1e3, timing.waitSeconds * 1e3, timing.gpuSeconds * 1e3, timing.latencySeconds * 1e3);
+			SDL_SetWindowTitle(window, title);
+			titleFrame = pacer->framesFinished();
+		}
+		if (!firstFrame)
+			return;
+		glFinish();
+		printf("First frame after %.1f ms (%s)\n", secondsSince(t_launch) * 1e3,
+			pack.isOpen() ? "asset pack" : "loose files");
+		firstFrame = false;
+	};
 
 	while (true)
 	{
@@ -226,19 +668,219 @@ int main(int argc, char *argv[])
 			if (windowEvent.type == SDL_KEYUP &&
 				windowEvent.key.keysym.sym == SDLK_ESCAPE) 
 				break;
+			if (windowEvent.type == SDL_KEYUP &&
+				windowEvent.key.keysym.sym == SDLK_F12)
+			{
+				char name[32];
+				snprintf(name, sizeof(name), "screenshot_%03d.png", screenshotCount++);
+				capture->screenshot(name);
+			}
+			// Dig a crater to exercise incremental remeshing
+			if (voxels && windowEvent.type == SDL_KEYUP &&
+				windowEvent.key.keysym.sym == SDLK_SPACE)
+			{
+				int cx = rand() % 256, cy = rand() % 256, cz = 20;
+				for (int z = -6; z <= 6; z++)
+					for (int y = -6; y <= 6; y++)
+						for (int x = -6; x <= 6; x++)
+							if (x * x + y * y + z * z <= 36)
+								voxels->setBlock(cx + x, cy + y, cz + z, 0);
+			}
 		}
+		pacer->beginFrame();
 		glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+		if (voxels)
+		{
+			voxels->update();
+			voxels->draw(voxelView, voxelProj);
+			present();
+			continue;
+		}
+
 		// Calculate transformation
 		auto t_now = std::chrono::high_resolution_clock::now();
-		float time = std::chrono::duration_cast<std::chrono::duration<float>>(t_now - t_start).count();
+		// --pause-animation holds every path at its first frame, so cached work
+		// like the planar reflection can be measured against a still scene
+		float time = pauseAnimation ? 0.0f : std::chrono::duration_cast<std::chrono::duration<float>>(t_now - t_start).count();
+
+		if (virtualTexture)
+		{
+			// Circling low over the plane, the feedback pass names the pages this view needs
+			float yaw = time * 0.1f;
+			glm::vec3 eye(60.0f * std::cos(yaw), 60.0f * std::sin(yaw), 6.0f + 4.0f * std::sin(time * 0.37f));
+			glm::vec3 ahead(-std::sin(yaw), std::cos(yaw), -0.35f);
+			glm::mat4 viewProj = glm::perspective(glm::radians(60.0f), 800.0f / 600.0f, 0.1f, 1000.0f) *
+				glm::lookAt(eye, eye + ahead, glm::vec3(0.0f, 0.0f, 1.0f));
+
+			glBindVertexArray(groundVao);
+			virtualTexture->beginFeedback(800, 600);
+			glUseProgram(groundFeedbackProgram);
+			glUniformMatrix4fv(groundFeedbackViewProj, 1, GL_FALSE, glm::value_ptr(viewProj));
+			virtualTexture->bind(groundFeedbackProgram, 3, true);
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+			renderStats.draw(GL_TRIANGLE_STRIP, 4);
+			virtualTexture->endFeedback();
+			virtualTexture->update();
+
+			glUseProgram(groundProgram);
+			glUniformMatrix4fv(groundViewProj, 1, GL_FALSE, glm::value_ptr(viewProj));
+			virtualTexture->bind(groundProgram, 3);
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+			renderStats.draw(GL_TRIANGLE_STRIP, 4);
+			shaders->programChanged();
+			glBindVertexArray(vao);
+			renderStats.add(RENDER_PROGRAM_BINDS, 2);
+			renderStats.add(RENDER_UNIFORM_BYTES, 2 * sizeof(glm::mat4));
+
+			present();
+			continue;
+		}
+
+		if (residency)
+		{
+			// A cube face is about one unit across at the camera's distance from the origin
+			float cubePixels = proj[1][1] * 300.0f / glm::length(glm::vec3(view[3]));
+			for (ResidentTextureId id : residentTextures)
+				if (id != NO_RESIDENT_TEXTURE)
+					residency->markUsed(id, cubePixels);
+			residency->update();
+		}
+
+		if (scene.isOpen())
+		{
+			// Orbit above the scene, culling the hierarchy straight from the mapping
+			glm::vec3 eye = sceneCenter + glm::vec3(cos(time * 0.1f), sin(time * 0.1f), 0.5f) * sceneRadius * 0.6f;
+			glm::mat4 sceneView = glm::lookAt(eye, sceneCenter, glm::vec3(0.0f, 0.0f, 1.0f));
+			glm::mat4 sceneProj = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 1.0f, sceneRadius * 2.0f);
+			cullSceneNodes(scene.nodes(), scene.nodeCount(), sceneProj * sceneView, sceneVisible);
+
+			// The spike only has the cube mesh, so every instance draws mesh 0
+			const SceneMesh& mesh = scene.meshes()[0];
+			if (occlusion)
+			{
+				const glm::mat4* transforms = scene.transforms();
+				occluderOrder.clear();
+				for (const SceneRange& range : sceneVisible)
+					for (uint32_t i = range.first; i < range.first + range.count; i++)
+						occluderOrder.push_back(i);
+
+				occlusionBoxes.resize(occluderOrder.size());
+				occlusionVisible.resize(occluderOrder.size());
+				glm::vec3 boundsMin(mesh.boundsMin[0], mesh.boundsMin[1], mesh.boundsMin[2]);
+				glm::vec3 boundsMax(mesh.boundsMax[0], mesh.boundsMax[1], mesh.boundsMax[2]);
+				jobs.parallelFor(occluderOrder.size(), 4096, [&](size_t begin, size_t end)
+				{
+					for (size_t i = begin; i < end; i++)
+						occlusionBoxes[i] = transformBox(transforms[occluderOrder[i]], boundsMin, boundsMax);
+				});
+
+				size_t occluderCount = std::min<size_t>(occluderOrder.size(), 64);
+				std::partial_sort(occluderOrder.begin(), occluderOrder.begin() + occluderCount, occluderOrder.end(),
+					[&](uint32_t a, uint32_t b)
+				{
+					glm::vec3 da = glm::vec3(transforms[a][3]) - eye, db = glm::vec3(transforms[b][3]) - eye;
+					return glm::dot(da, da) < glm::dot(db, db);
+				});
+				occlusion->beginFrame(sceneProj * sceneView);
+				for (size_t i = 0; i < occluderCount; i++)
+					occlusion->addOccluder(vertices + mesh.firstVertex * 8, 8, mesh.vertexCount, transforms[occluderOrder[i]]);
+				occlusion->rasterize();
+				occlusion->cullBoxes(occlusionBoxes.data(), occlusionBoxes.size(), occlusionVisible.data());
+
+				// Split the frustum ranges around occluded instances
+				unoccluded.clear();
+				size_t box = 0;
+				for (const SceneRange& range : sceneVisible)
+				{
+					for (uint32_t i = range.first; i < range.first + range.count; i++)
+					{
+						if (!occlusionVisible[box++])
+							continue;
+						if (!unoccluded.empty() && unoccluded.back().first + unoccluded.back().count == i)
+							unoccluded.back().count++;
+						else
+						{
+							SceneRange single = { i, 1 };
+							unoccluded.push_back(single);
+						}
+					}
+				}
+				sceneVisible.swap(unoccluded);
+			}
+
+			shaders->setCamera(sceneView, sceneProj);
+			shaders->use(ShaderVariants::select(glm::vec3(1.0f), true, false, true));
+			glBindVertexArray(sceneVao);
+			glBindBuffer(GL_ARRAY_BUFFER, sceneInstances);
+			for (const SceneRange& range : sceneVisible)
+			{
+				// No base instance in GL 3.2, so point the matrix columns at the range instead
+				for (int column = 0; column < 4; column++)
+				{
+					size_t offset = range.first * sizeof(glm::mat4) + column * sizeof(glm::vec4);
+					glVertexAttribPointer(ATTRIB_INSTANCE_MODEL + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), reinterpret_cast<void*>(offset));
+				}
+				glDrawArraysInstanced(GL_TRIANGLES, mesh.firstVertex, mesh.vertexCount, range.count);
+				renderStats.draw(GL_TRIANGLES, mesh.vertexCount, range.count);
+			}
+			glBindVertexArray(vao);
+
+			present();
+			continue;
+		}
+
+		if (lightCount)
+		{
+			for (int i = 0; i < lightCount; i++)
+			{
+				float angle = time * (0.3f + 0.001f * i) + i * 2.399f;
+				float radius = 0.8f + 0.6f * (i % 7) / 7.0f;
+				lights[i].position = glm::vec3(radius * cos(angle), radius * sin(angle), 0.8f * sin(angle * 1.7f + i));
+			}
+			clusters->buildClusters(proj, 800, 600);
+			clusters->binLights(lights, view);
+			clusters->upload();
+		}
 
 		// Draw cube
-		glm::mat4 model;
-		model = glm::rotate(model, time * glm::radians(90.0f),	glm::vec3(0.0f, 0.0f, 1.0f));
-		glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(model));
-		glDrawArrays(GL_TRIANGLES, 0, 36);
+		const ShaderVariant* shader = &shaders->use(cubeFeatures);
+		if (lightCount)
+			clusters->bind(shader->program, 3);
+		transforms.setRotation(cubeNode, glm::angleAxis(time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
+		transforms.update();
+		glm::mat4 model = transforms.world(cubeNode) * meshFit;
+		glUniformMatrix4fv(shader->uniModel, 1, GL_FALSE, glm::value_ptr(model));
+		renderStats.add(RENDER_UNIFORM_BYTES, sizeof(glm::mat4));
+		drawCube();
+
+		if (reflection)
+		{
+			// Re-render the mirror image only if the cube or the camera moved
+			if (reflection->needsUpdate(view, proj, hashBytes(&model, sizeof(model))))
+			{
+				glm::mat4 reflectedView, obliqueProj;
+				reflection->begin(view, proj, reflectedView, obliqueProj);
+				shaders->setCamera(reflectedView, obliqueProj);
+				shaders->use(cubeFeatures);
+				drawCube();
+				shaders->setCamera(view, proj);
+				reflection->end();
+			}
+
+			// Draw the floor with the reflection
+			glUseProgram(floorProgram);
+			shaders->programChanged();
+			glBindVertexArray(floorVao);
+			glDrawArrays(GL_TRIANGLES, 36, 6);
+			renderStats.add(RENDER_PROGRAM_BINDS);
+			renderStats.draw(GL_TRIANGLES, 6);
+			glBindVertexArray(vao);
+
+			present();
+			continue;
+		}
 
 		glEnable(GL_STENCIL_TEST);
 
@@ -249,30 +891,93 @@ int main(int argc, char *argv[])
 		glStencilMask(0xFF);				// Write to stencil buffer
 		glDepthMask(GL_FALSE);				// Don't write to depth buffer
 		glClear(GL_STENCIL_BUFFER_BIT);		// Clear stencil buffer (0 by default)
+		renderStats.add(RENDER_STENCIL_STATE, 4);
+		renderStats.add(RENDER_DEPTH_STATE);
 		
+		shader = &shaders->use(floorFeatures);
+		glUniformMatrix4fv(shader->uniModel, 1, GL_FALSE, glm::value_ptr(transforms.world(floorNode)));
 		glDrawArrays(GL_TRIANGLES, 36, 6);
+		renderStats.add(RENDER_UNIFORM_BYTES, sizeof(glm::mat4));
+		renderStats.draw(GL_TRIANGLES, 6);
 		
 		// Draw reflection
 		glStencilFunc(GL_EQUAL, 1, 0xFF);	// Pass test if stencil value is 1
 		glStencilMask(0x00);				// Don't write anything to stencil buffer
 		glDepthMask(GL_TRUE);				// Write to depth buffer
-
-		model = glm::scale(glm::translate(model, glm::vec3(0.0f, 0.0f, -1.0f)), glm::vec3(1.0f, 1.0f, -1.0f));
-		glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(model));
-		
-		glUniform3f(uniColor, 0.5f, 0.5f, 0.5f);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-		glUniform3f(uniColor, 1.0f, 1.0f, 1.0f);
+		renderStats.add(RENDER_STENCIL_STATE, 2);
+		renderStats.add(RENDER_DEPTH_STATE);
+
+		shader = &shaders->use(mirroredFeatures);
+		if (lightCount)
+			clusters->bind(shader->program, 3);
+		glUniformMatrix4fv(shader->uniModel, 1, GL_FALSE, glm::value_ptr(transforms.world(mirrorNode) * meshFit));
+		glUniform3f(shader->uniColor, 0.5f, 0.5f, 0.5f);
+		renderStats.add(RENDER_UNIFORM_BYTES, sizeof(glm::mat4) + 3 * sizeof(float));
+		drawCube();
 		
 		glDisable(GL_STENCIL_TEST);
+		renderStats.add(RENDER_STENCIL_STATE);
 		
-		SDL_GL_SwapWindow(window);
+		present();
+	}
+	printf("Shaders: %zu variants compiled, %llu program switches\n",
+		shaders->compiledCount(), (unsigned long long)shaders->programSwitches());
+	if (voxels)
+	{
+		voxels->printStats();
+		voxels.reset();
+	}
+	if (virtualTexture)
+	{
+		virtualTexture->printStats();
+		virtualTexture.reset();
+		glDeleteVertexArrays(1, &groundVao);
+		glDeleteBuffers(1, &groundVbo);
+		glDeleteProgram(groundProgram);
+		glDeleteProgram(groundFeedbackProgram);
+	}
+	if (reflection)
+	{
+		printf("Reflection: %llu renders, %llu frames reused\n",
+			(unsigned long long)reflection->renderCount(), (unsigned long long)reflection->reuseCount());
+		reflection.reset();
+		glDeleteVertexArrays(1, &floorVao);
+		glDeleteProgram(floorProgram);
 	}
+
+	if (occlusion)
+		occlusion->printStats();
+	transforms.printStats();
+	jobs.printStats();
+	capture->stopRecording();
+	capture->printStats();
+	capture.reset();
+	pacer->printStats();
+	pacer.reset();
+	renderStats.printStats();
+	if (statsCsvPath && !renderStats.writeCsv(statsCsvPath))
+		fprintf(stderr, "Could not write %s\n", statsCsvPath);
+	if (scene.isOpen())
+	{
+		glDeleteBuffers(1, &sceneInstances);
+		glDeleteVertexArrays(1, &sceneVao);
+		scene.close();
+	}
+	clusters.reset();
+	shaders.reset();
 	glDeleteTextures(2, textures);
+	if (residency)
+	{
+		residency->printStats();
+		residency.reset();
+	}
 
-	glDeleteProgram(shaderProgram);
-	glDeleteShader(fragmentShader);
-	glDeleteShader(vertexShader);
+
+	if (meshVao)
+	{
+		importedMesh.destroy();
+		glDeleteVertexArrays(1, &meshVao);
+	}
 
 	//glDeleteBuffers(1, &ebo);
 	glDeleteBuffers(1, &vbo);
@@ -34,12 +34,17 @@
 #include "stb_image_aug.h"
 #include "image_helper.h"
 #include "image_DXT.h"
+#include "image_PNG.h"
 
 #include <stdlib.h>
 #include <string.h>
 
-/*	error reporting	*/
-char *result_string_pointer = "SOIL initialized";
+/*	error reporting, per thread so decoding may run on several at once	*/
+static STBI_THREAD_LOCAL const char *result_string_pointer = "SOIL initialized";
+
+/*	the application's threads, for compressing to DXT	*/
+static SOIL_parallel_for parallel_for_function = NULL;
+static void *parallel_for_context = NULL;
 
 /*	for loading cube maps	*/
 enum{
@@ -977,29 +982,184 @@ void check_for_GL_errors( const char *calling_location )
 }
 #endif
 
-unsigned int
-	SOIL_internal_create_OGL_texture
+void
+	SOIL_query_capabilities
+	(
+		SOIL_capabilities *capabilities
+	)
+{
+	glGetIntegerv( GL_MAX_TEXTURE_SIZE, &capabilities->max_texture_size );
+	capabilities->NPOT = (query_NPOT_capability() == SOIL_CAPABILITY_PRESENT);
+	capabilities->texture_rectangle = (query_tex_rectangle_capability() == SOIL_CAPABILITY_PRESENT);
+	capabilities->DXT = (query_DXT_capability() == SOIL_CAPABILITY_PRESENT);
+}
+
+/*	blocks compressed by a task: worth handing to a thread, yet small
+	enough to keep them all busy on one large level	*/
+#define SOIL_DXT_BLOCKS_PER_TASK 4096
+
+typedef struct
+{
+	int level;
+	int first_row, rows;		/*	of 4x4 blocks	*/
+} SOIL_DXT_task;
+
+typedef struct
+{
+	const SOIL_prepared_texture *texture;
+	int DXT5;
+	unsigned char *compressed[SOIL_MAX_TEXTURE_LEVELS];
+	SOIL_DXT_task *tasks;
+} SOIL_DXT_job;
+
+static void
+	compress_DXT_tasks
+	(
+		void *data,
+		int begin, int end
+	)
+{
+	SOIL_DXT_job *job = (SOIL_DXT_job*)data;
+	int i;
+	for( i = begin; i < end; ++i )
+	{
+		const SOIL_DXT_task *task = &job->tasks[i];
+		const SOIL_texture_level *level = &job->texture->levels[task->level];
+		convert_block_rows_to_DXT( level->data, level->width, level->height,
+			job->texture->channels, job->DXT5,
+			task->first_row, task->rows, job->compressed[task->level] );
+	}
+}
+
+/*	Compresses every level at once: the whole chain is cut into tasks of
+	block rows, small levels being a task each, and run with the
+	application's parallel_for.  Each task writes its own bytes, so the
+	result is what compressing level by level makes.	*/
+static void
+	compress_texture_levels
+	(
+		SOIL_prepared_texture *texture,
+		int owned
+	)
+{
+	SOIL_DXT_job job;
+	int i, j, task_count = 0;
+	memset( &job, 0, sizeof(SOIL_DXT_job) );
+	job.texture = texture;
+	/*	1 or 3 channels = DXT1, 2 or 4 channels = DXT5	*/
+	job.DXT5 = ((texture->channels & 1) == 0);
+	for( i = 0; i < texture->level_count; ++i )
+	{
+		const SOIL_texture_level *level = &texture->levels[i];
+		int blocks = (level->width + 3) / 4;
+		int rows_per_task = (blocks < SOIL_DXT_BLOCKS_PER_TASK) ? SOIL_DXT_BLOCKS_PER_TASK / blocks : 1;
+		task_count += ((level->height + 3) / 4 + rows_per_task - 1) / rows_per_task;
+	}
+	job.tasks = (SOIL_DXT_task*)malloc( task_count * sizeof(SOIL_DXT_task) );
+	if( NULL == job.tasks )
+	{
+		/*	the OpenGL driver compresses the pixels	*/
+		return;
+	}
+	task_count = 0;
+	for( i = 0; i < texture->level_count; ++i )
+	{
+		const SOIL_texture_level *level = &texture->levels[i];
+		int blocks = (level->width + 3) / 4;
+		int rows = (level->height + 3) / 4;
+		int rows_per_task = (blocks < SOIL_DXT_BLOCKS_PER_TASK) ? SOIL_DXT_BLOCKS_PER_TASK / blocks : 1;
+		job.compressed[i] = (unsigned char*)malloc(
+			DXT_compressed_size( level->width, level->height, job.DXT5 ) );
+		/*	a level without room for its blocks is left to the driver	*/
+		for( j = 0; (NULL != job.compressed[i]) && (j < rows); j += rows_per_task )
+		{
+			SOIL_DXT_task *task = &job.tasks[task_count++];
+			task->level = i;
+			task->first_row = j;
+			task->rows = (rows - j < rows_per_task) ? rows - j : rows_per_task;
+		}
+	}
+	if( (NULL != parallel_for_function) && (task_count > 1) )
+	{
+		parallel_for_function( parallel_for_context, task_count, compress_DXT_tasks, &job );
+	} else
+	{
+		compress_DXT_tasks( &job, 0, task_count );
+	}
+	for( i = 0; i < texture->level_count; ++i )
+	{
+		SOIL_texture_level *level = &texture->levels[i];
+		if( NULL == job.compressed[i] )
+		{
+			continue;
+		}
+		/*	levels in a pyramid are freed with it	*/
+		if( owned )
+		{
+			SOIL_free_image_data( level->data );
+		}
+		level->data = job.compressed[i];
+		level->size = DXT_compressed_size( level->width, level->height, job.DXT5 );
+		level->compressed = 1;
+	}
+	free( job.tasks );
+}
+
+void
+	SOIL_set_parallel_for
+	(
+		SOIL_parallel_for parallel_for,
+		void *context
+	)
+{
+	parallel_for_function = parallel_for;
+	parallel_for_context = context;
+}
+
+/*	will SOIL_internal_prepare_texture change the size of the image?	*/
+static int
+	SOIL_internal_needs_resize
+	(
+		int width, int height,
+		unsigned int flags,
+		int max_supported_size
+	)
+{
+	if( (width > max_supported_size) || (height > max_supported_size) )
+	{
+		return 1;
+	}
+	/*	made a power of two for these	*/
+	if( flags & (SOIL_FLAG_POWER_OF_TWO | SOIL_FLAG_MIPMAPS) )
+	{
+		return ((width & (width - 1)) != 0) || ((height & (height - 1)) != 0);
+	}
+	return 0;
+}
+
+static int
+	SOIL_internal_prepare_texture
 	(
 		const unsigned char *const data,
 		int width, int height, int channels,
-		unsigned int reuse_texture_ID,
 		unsigned int flags,
 		unsigned int opengl_texture_type,
 		unsigned int opengl_texture_target,
-		unsigned int texture_check_size_enum
+		int max_supported_size,
+		const SOIL_capabilities *capabilities,
+		SOIL_prepared_texture *texture
 	)
 {
 	/*	variables	*/
 	unsigned char* img;
-	unsigned int tex_id;
-	unsigned int internal_texture_format = 0, original_texture_format = 0;
-	int DXT_mode = SOIL_CAPABILITY_UNKNOWN;
-	int max_supported_size;
+	unsigned int transforms, flags_done = 0;
+	int i;
+	memset( texture, 0, sizeof(SOIL_prepared_texture) );
 	/*	If the user wants to use the texture rectangle I kill a few flags	*/
 	if( flags & SOIL_FLAG_TEXTURE_RECTANGLE )
 	{
 		/*	well, the user asked for it, can we do that?	*/
-		if( query_tex_rectangle_capability() == SOIL_CAPABILITY_PRESENT )
+		if( capabilities->texture_rectangle )
 		{
 			/*	only allow this if the user in _NOT_ trying to do a cubemap!	*/
 			if( opengl_texture_type == GL_TEXTURE_2D )
@@ -1025,68 +1185,36 @@ unsigned int
 			return 0;
 		}
 	}
-	/*	create a copy the image data	*/
-	img = (unsigned char*)malloc( width*height*channels );
-	memcpy( img, data, width*height*channels );
-	/*	does the user want me to invert the image?	*/
+	/*	if the user can't support NPOT textures, make sure we force the POT option	*/
+	if( !capabilities->NPOT &&
+		!(flags & SOIL_FLAG_TEXTURE_RECTANGLE) )
+	{
+		/*	add in the POT flag */
+		flags |= SOIL_FLAG_POWER_OF_TWO;
+	}
+	/*	copy the image data, inverting, NTSC scaling and pre-multiplying alpha
+		as it goes; YCoCg too unless the image is resized first	*/
+	transforms = 0;
 	if( flags & SOIL_FLAG_INVERT_Y )
 	{
-		int i, j;
-		for( j = 0; j*2 < height; ++j )
-		{
-			int index1 = j * width * channels;
-			int index2 = (height - 1 - j) * width * channels;
-			for( i = width * channels; i > 0; --i )
-			{
-				unsigned char temp = img[index1];
-				img[index1] = img[index2];
-				img[index2] = temp;
-				++index1;
-				++index2;
-			}
-		}
+		transforms |= IMAGE_TRANSFORM_INVERT_Y;
 	}
-	/*	does the user want me to scale the colors into the NTSC safe RGB range?	*/
 	if( flags & SOIL_FLAG_NTSC_SAFE_RGB )
 	{
-		scale_image_RGB_to_NTSC_safe( img, width, height, channels );
+		transforms |= IMAGE_TRANSFORM_NTSC_SAFE_RGB;
 	}
-	/*	does the user want me to convert from straight to pre-multiplied alpha?
-		(and do we even _have_ alpha?)	*/
 	if( flags & SOIL_FLAG_MULTIPLY_ALPHA )
 	{
-		int i;
-		switch( channels )
-		{
-		case 2:
-			for( i = 0; i < 2*width*height; i += 2 )
-			{
-				img[i] = (img[i] * img[i+1] + 128) >> 8;
-			}
-			break;
-		case 4:
-			for( i = 0; i < 4*width*height; i += 4 )
-			{
-				img[i+0] = (img[i+0] * img[i+3] + 128) >> 8;
-				img[i+1] = (img[i+1] * img[i+3] + 128) >> 8;
-				img[i+2] = (img[i+2] * img[i+3] + 128) >> 8;
-			}
-			break;
-		default:
-			/*	no other number of channels contains alpha data	*/
-			break;
-		}
+		transforms |= IMAGE_TRANSFORM_MULTIPLY_ALPHA;
 	}
-	/*	if the user can't support NPOT textures, make sure we force the POT option	*/
-	if( (query_NPOT_capability() == SOIL_CAPABILITY_NONE) &&
-		!(flags & SOIL_FLAG_TEXTURE_RECTANGLE) )
+	if( (flags & SOIL_FLAG_CoCg_Y) &&
+		!SOIL_internal_needs_resize( width, height, flags, max_supported_size ) )
 	{
-		/*	add in the POT flag */
-		flags |= SOIL_FLAG_POWER_OF_TWO;
+		transforms |= IMAGE_TRANSFORM_RGB_TO_YCoCg;
+		flags_done |= SOIL_FLAG_CoCg_Y;
 	}
-	/*	how large of a texture can this OpenGL implementation handle?	*/
-	/*	texture_check_size_enum will be GL_MAX_TEXTURE_SIZE or SOIL_MAX_CUBE_MAP_TEXTURE_SIZE	*/
-	glGetIntegerv( texture_check_size_enum, &max_supported_size );
+	img = (unsigned char*)malloc( width*height*channels );
+	copy_and_transform_image( data, width, height, channels, img, transforms );
 	/*	do I need to make it a power of 2?	*/
 	if(
 		(flags & SOIL_FLAG_POWER_OF_TWO) ||	/*	user asked for it	*/
@@ -1112,12 +1240,6 @@ unsigned int
 			up_scale_image(
 					img, width, height, channels,
 					resampled, new_width, new_height );
-			/*	OJO	this is for debug only!	*/
-			/*
-			SOIL_save_image( "\\showme.bmp", SOIL_SAVE_TYPE_BMP,
-							new_width, new_height, channels,
-							resampled );
-			*/
 			/*	nuke the old guy, then point it at the new guy	*/
 			SOIL_free_image_data( img );
 			img = resampled;
@@ -1153,14 +1275,152 @@ unsigned int
 		width = new_width;
 		height = new_height;
 	}
-	/*	does the user want us to use YCoCg color space?	*/
-	if( flags & SOIL_FLAG_CoCg_Y )
+	/*	does the user want us to use YCoCg color space, and is it still to do?	*/
+	if( (flags & SOIL_FLAG_CoCg_Y) && !(flags_done & SOIL_FLAG_CoCg_Y) )
 	{
 		/*	this will only work with RGB and RGBA images */
 		convert_RGB_to_YCoCg( img, width, height, channels );
-		/*
-		save_image_as_DDS( "CoCg_Y.dds", width, height, channels, img );
-		*/
+	}
+	/*	and what type am I using as the internal texture format?	*/
+	switch( channels )
+	{
+	case 1:
+		texture->format = GL_LUMINANCE;
+		break;
+	case 2:
+		texture->format = GL_LUMINANCE_ALPHA;
+		break;
+	case 3:
+		texture->format = GL_RGB;
+		break;
+	case 4:
+		texture->format = GL_RGBA;
+		break;
+	}
+	texture->internal_format = texture->format;
+	/*	does the user want me to, and can I, save as DXT?	*/
+	if( (flags & SOIL_FLAG_COMPRESS_TO_DXT) && capabilities->DXT )
+	{
+		/*	1 or 3 channels = DXT1, 2 or 4 channels = DXT5	*/
+		texture->internal_format = ((channels & 1) == 1) ? SOIL_RGB_S3TC_DXT1 : SOIL_RGBA_S3TC_DXT5;
+	}
+	texture->texture_type = opengl_texture_type;
+	texture->texture_target = opengl_texture_target;
+	texture->flags = flags;
+	texture->channels = channels;
+	/*	the main image	*/
+	texture->levels[0].width = width;
+	texture->levels[0].height = height;
+	texture->levels[0].size = width*height*channels;
+	texture->levels[0].data = img;
+	texture->level_count = 1;
+	/*	are any MIPmaps desired?  they are built in one pyramid, each level
+		reduced from the one above it	*/
+	if( flags & SOIL_FLAG_MIPMAPS )
+	{
+		int filter = MIP_FILTER_BOX;
+		int level_count = mip_pyramid_levels( width, height );
+		int MIPwidth = width;
+		int MIPheight = height;
+		if( flags & SOIL_FLAG_MIPMAP_KAISER )
+		{
+			filter = MIP_FILTER_KAISER;
+		} else if( flags & SOIL_FLAG_MIPMAP_LANCZOS )
+		{
+			filter = MIP_FILTER_LANCZOS;
+		}
+		if( level_count > SOIL_MAX_TEXTURE_LEVELS )
+		{
+			level_count = SOIL_MAX_TEXTURE_LEVELS;
+		}
+		texture->pyramid = (unsigned char*)malloc(
+			mip_pyramid_offset( width, height, channels, level_count ) );
+		/*	YCoCg isn't light, it is filtered as it is	*/
+		if( (NULL == texture->pyramid) ||
+			!build_mip_pyramid( img, width, height, channels,
+				texture->pyramid, level_count, filter,
+				(flags & SOIL_FLAG_SRGB_MIPMAPS) && !(flags & SOIL_FLAG_CoCg_Y) ) )
+		{
+			/*	level 0 is still the main image	*/
+			SOIL_free_image_data( texture->pyramid );
+			texture->pyramid = NULL;
+			SOIL_free_prepared_texture( texture );
+			result_string_pointer = "Failed to build the MIPmaps";
+			return 0;
+		}
+		SOIL_free_image_data( img );
+		for( i = 0; i < level_count; ++i )
+		{
+			SOIL_texture_level *level = &texture->levels[i];
+			level->width = MIPwidth;
+			level->height = MIPheight;
+			level->size = channels*MIPwidth*MIPheight;
+			level->data = texture->pyramid +
+				mip_pyramid_offset( width, height, channels, i );
+			/*	prep for the next level	*/
+			MIPwidth = (MIPwidth > 1) ? MIPwidth / 2 : 1;
+			MIPheight = (MIPheight > 1) ? MIPheight / 2 : 1;
+		}
+		texture->level_count = level_count;
+	}
+	/*	compress last, the MIPmaps need the main image's pixels	*/
+	if( texture->internal_format != texture->format )
+	{
+		int compressed = 1;
+		compress_texture_levels( texture, NULL == texture->pyramid );
+		for( i = 0; i < texture->level_count; ++i )
+		{
+			compressed &= texture->levels[i].compressed;
+		}
+		/*	no level needs the pyramid any more	*/
+		if( compressed && texture->pyramid )
+		{
+			SOIL_free_image_data( texture->pyramid );
+			texture->pyramid = NULL;
+		}
+	}
+	result_string_pointer = "Texture prepared";
+	return 1;
+}
+
+int
+	SOIL_prepare_texture
+	(
+		const unsigned char *const data,
+		int width, int height, int channels,
+		unsigned int flags,
+		const SOIL_capabilities *capabilities,
+		SOIL_prepared_texture *texture
+	)
+{
+	/*	wrapper function for 2D textures	*/
+	return SOIL_internal_prepare_texture(
+				data, width, height, channels, flags,
+				GL_TEXTURE_2D, GL_TEXTURE_2D,
+				capabilities->max_texture_size,
+				capabilities, texture );
+}
+
+unsigned int
+	SOIL_upload_prepared_texture
+	(
+		const SOIL_prepared_texture *texture,
+		unsigned int reuse_texture_ID
+	)
+{
+	/*	variables	*/
+	unsigned int tex_id;
+	unsigned int opengl_texture_type = texture->texture_type;
+	int i, compressed = 0;
+	for( i = 0; i < texture->level_count; ++i )
+	{
+		compressed |= texture->levels[i].compressed;
+	}
+	/*	compressed levels need the extension, which also loads the entry point	*/
+	if( compressed && (query_DXT_capability() != SOIL_CAPABILITY_PRESENT) )
+	{
+		result_string_pointer = "DXT compressed textures unsupported";
+		return 0;
 	}
 	/*	create the OpenGL texture ID handle
     	(note: allowing a forced texture ID lets me reload a texture)	*/
@@ -1173,151 +1433,33 @@ unsigned int
 	/* Note: sometimes glGenTextures fails (usually no OpenGL context)	*/
 	if( tex_id )
 	{
-		/*	and what type am I using as the internal texture format?	*/
-		switch( channels )
-		{
-		case 1:
-			original_texture_format = GL_LUMINANCE;
-			break;
-		case 2:
-			original_texture_format = GL_LUMINANCE_ALPHA;
-			break;
-		case 3:
-			original_texture_format = GL_RGB;
-			break;
-		case 4:
-			original_texture_format = GL_RGBA;
-			break;
-		}
-		internal_texture_format = original_texture_format;
-		/*	does the user want me to, and can I, save as DXT?	*/
-		if( flags & SOIL_FLAG_COMPRESS_TO_DXT )
-		{
-			DXT_mode = query_DXT_capability();
-			if( DXT_mode == SOIL_CAPABILITY_PRESENT )
-			{
-				/*	I can use DXT, whether I compress it or OpenGL does	*/
-				if( (channels & 1) == 1 )
-				{
-					/*	1 or 3 channels = DXT1	*/
-					internal_texture_format = SOIL_RGB_S3TC_DXT1;
-				} else
-				{
-					/*	2 or 4 channels = DXT5	*/
-					internal_texture_format = SOIL_RGBA_S3TC_DXT5;
-				}
-			}
-		}
 		/*  bind an OpenGL texture ID	*/
 		glBindTexture( opengl_texture_type, tex_id );
 		check_for_GL_errors( "glBindTexture" );
-		/*  upload the main image	*/
-		if( DXT_mode == SOIL_CAPABILITY_PRESENT )
+		/*  upload the main image and its MIPmaps	*/
+		for( i = 0; i < texture->level_count; ++i )
 		{
-			/*	user wants me to do the DXT conversion!	*/
-			int DDS_size;
-			unsigned char *DDS_data = NULL;
-			if( (channels & 1) == 1 )
-			{
-				/*	RGB, use DXT1	*/
-				DDS_data = convert_image_to_DXT1( img, width, height, channels, &DDS_size );
-			} else
-			{
-				/*	RGBA, use DXT5	*/
-				DDS_data = convert_image_to_DXT5( img, width, height, channels, &DDS_size );
-			}
-			if( DDS_data )
+			const SOIL_texture_level *level = &texture->levels[i];
+			if( level->compressed )
 			{
 				soilGlCompressedTexImage2D(
-					opengl_texture_target, 0,
-					internal_texture_format, width, height, 0,
-					DDS_size, DDS_data );
+					texture->texture_target, i,
+					texture->internal_format, level->width, level->height, 0,
+					level->size, level->data );
 				check_for_GL_errors( "glCompressedTexImage2D" );
-				SOIL_free_image_data( DDS_data );
-				/*	printf( "Internal DXT compressor\n" );	*/
 			} else
 			{
-				/*	my compression failed, try the OpenGL driver's version	*/
+				/*	OpenGL does all the work, compressing too if my compression failed	*/
 				glTexImage2D(
-					opengl_texture_target, 0,
-					internal_texture_format, width, height, 0,
-					original_texture_format, GL_UNSIGNED_BYTE, img );
+					texture->texture_target, i,
+					texture->internal_format, level->width, level->height, 0,
+					texture->format, GL_UNSIGNED_BYTE, level->data );
 				check_for_GL_errors( "glTexImage2D" );
-				/*	printf( "OpenGL DXT compressor\n" );	*/
 			}
-		} else
-		{
-			/*	user want OpenGL to do all the work!	*/
-			glTexImage2D(
-				opengl_texture_target, 0,
-				internal_texture_format, width, height, 0,
-				original_texture_format, GL_UNSIGNED_BYTE, img );
-			check_for_GL_errors( "glTexImage2D" );
-			/*printf( "OpenGL DXT compressor\n" );	*/
 		}
 		/*	are any MIPmaps desired?	*/
-		if( flags & SOIL_FLAG_MIPMAPS )
+		if( texture->flags & SOIL_FLAG_MIPMAPS )
 		{
-			int MIPlevel = 1;
-			int MIPwidth = (width+1) / 2;
-			int MIPheight = (height+1) / 2;
-			unsigned char *resampled = (unsigned char*)malloc( channels*MIPwidth*MIPheight );
-			while( ((1<<MIPlevel) <= width) || ((1<<MIPlevel) <= height) )
-			{
-				/*	do this MIPmap level	*/
-				mipmap_image(
-						img, width, height, channels,
-						resampled,
-						(1 << MIPlevel), (1 << MIPlevel) );
-				/*  upload the MIPmaps	*/
-				if( DXT_mode == SOIL_CAPABILITY_PRESENT )
-				{
-					/*	user wants me to do the DXT conversion!	*/
-					int DDS_size;
-					unsigned char *DDS_data = NULL;
-					if( (channels & 1) == 1 )
-					{
-						/*	RGB, use DXT1	*/
-						DDS_data = convert_image_to_DXT1(
-								resampled, MIPwidth, MIPheight, channels, &DDS_size );
-					} else
-					{
-						/*	RGBA, use DXT5	*/
-						DDS_data = convert_image_to_DXT5(
-								resampled, MIPwidth, MIPheight, channels, &DDS_size );
-					}
-					if( DDS_data )
-					{
-						soilGlCompressedTexImage2D(
-							opengl_texture_target, MIPlevel,
-							internal_texture_format, MIPwidth, MIPheight, 0,
-							DDS_size, DDS_data );
-						check_for_GL_errors( "glCompressedTexImage2D" );
-						SOIL_free_image_data( DDS_data );
-					} else
-					{
-						/*	my compression failed, try the OpenGL driver's version	*/
-						glTexImage2D(
-							opengl_texture_target, MIPlevel,
-							internal_texture_format, MIPwidth, MIPheight, 0,
-							original_texture_format, GL_UNSIGNED_BYTE, resampled );
-						check_for_GL_errors( "glTexImage2D" );
-					}
-				} else
-				{
-					/*	user want OpenGL to do all the work!	*/
-					glTexImage2D(
-						opengl_texture_target, MIPlevel,
-						internal_texture_format, MIPwidth, MIPheight, 0,
-						original_texture_format, GL_UNSIGNED_BYTE, resampled );
-					check_for_GL_errors( "glTexImage2D" );
-				}
-				/*	prep for the next level	*/
-				++MIPlevel;
-				MIPwidth = (MIPwidth + 1) / 2;
-				MIPheight = (MIPheight + 1) / 2;
-			}
-			SOIL_free_image_data( resampled );
 			/*	instruct OpenGL to use the MIPmaps	*/
 			glTexParameteri( opengl_texture_type, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
 			glTexParameteri( opengl_texture_type, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
@@ -1330,7 +1472,7 @@ unsigned int
 			check_for_GL_errors( "GL_TEXTURE_MIN/MAG_FILTER" );
 		}
 		/*	does the user want clamping, or wrapping?	*/
-		if( flags & SOIL_FLAG_TEXTURE_REPEATS )
+		if( texture->flags & SOIL_FLAG_TEXTURE_REPEATS )
 		{
 			glTexParameteri( opengl_texture_type, GL_TEXTURE_WRAP_S, GL_REPEAT );
 			glTexParameteri( opengl_texture_type, GL_TEXTURE_WRAP_T, GL_REPEAT );
@@ -1360,7 +1502,67 @@ unsigned int
 		/*	failed	*/
 		result_string_pointer = "Failed to generate an OpenGL texture name; missing OpenGL context?";
 	}
-	SOIL_free_image_data( img );
+	return tex_id;
+}
+
+void
+	SOIL_free_prepared_texture
+	(
+		SOIL_prepared_texture *texture
+	)
+{
+	int i;
+	for( i = 0; i < texture->level_count; ++i )
+	{
+		/*	uncompressed levels in the pyramid go with it	*/
+		if( (NULL == texture->pyramid) || texture->levels[i].compressed )
+		{
+			SOIL_free_image_data( texture->levels[i].data );
+		}
+		texture->levels[i].data = NULL;
+	}
+	SOIL_free_image_data( texture->pyramid );
+	texture->pyramid = NULL;
+	texture->level_count = 0;
+}
+
+unsigned int
+	SOIL_internal_create_OGL_texture
+	(
+		const unsigned char *const data,
+		int width, int height, int channels,
+		unsigned int reuse_texture_ID,
+		unsigned int flags,
+		unsigned int opengl_texture_type,
+		unsigned int opengl_texture_target,
+		unsigned int texture_check_size_enum
+	)
+{
+	/*	variables	*/
+	SOIL_capabilities capabilities;
+	SOIL_prepared_texture texture;
+	int max_supported_size;
+	unsigned int tex_id = 0;
+	/*	the CPU work, for this context, then the upload	*/
+	SOIL_query_capabilities( &capabilities );
+	/*	how large of a texture can this OpenGL implementation handle?	*/
+	/*	texture_check_size_enum will be GL_MAX_TEXTURE_SIZE, already queried,
+		or SOIL_MAX_CUBE_MAP_TEXTURE_SIZE	*/
+	if( texture_check_size_enum == GL_MAX_TEXTURE_SIZE )
+	{
+		max_supported_size = capabilities.max_texture_size;
+	} else
+	{
+		glGetIntegerv( texture_check_size_enum, &max_supported_size );
+	}
+	if( SOIL_internal_prepare_texture(
+			data, width, height, channels, flags,
+			opengl_texture_type, opengl_texture_target,
+			max_supported_size, &capabilities, &texture ) )
+	{
+		tex_id = SOIL_upload_prepared_texture( &texture, reuse_texture_ID );
+		SOIL_free_prepared_texture( &texture );
+	}
 	return tex_id;
 }
 
@@ -1464,6 +1666,57 @@ unsigned char*
 	return result;
 }
 
+/*	stb_image's formats are numbered like SOIL's	*/
+static int
+	probe_result
+	(
+		int ok,
+		const stbi_image_info *probed,
+		SOIL_image_info *info
+	)
+{
+	info->width = probed->width;
+	info->height = probed->height;
+	info->channels = probed->comp;
+	info->format = probed->format;
+	info->mipmap_count = probed->levels;
+	info->cubemap = probed->cubemap;
+	info->DXT = probed->dxt;
+	if( ok )
+	{
+		result_string_pointer = "Image header read";
+	} else
+	{
+		result_string_pointer = stbi_failure_reason();
+	}
+	return ok;
+}
+
+int
+	SOIL_probe_image
+	(
+		const char *filename,
+		SOIL_image_info *info
+	)
+{
+	stbi_image_info probed;
+	int ok = stbi_probe( filename, &probed );
+	return probe_result( ok, &probed, info );
+}
+
+int
+	SOIL_probe_image_from_memory
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		SOIL_image_info *info
+	)
+{
+	stbi_image_info probed;
+	int ok = stbi_probe_from_memory( buffer, buffer_length, &probed );
+	return probe_result( ok, &probed, info );
+}
+
 int
 	SOIL_save_image
 	(
@@ -1498,6 +1751,12 @@ int
 		save_result = save_image_as_DDS( filename,
 				width, height, channels, (const unsigned char *const)data );
 	} else
+	if( image_type == SOIL_SAVE_TYPE_PNG )
+	{
+		save_result = save_image_as_PNG( filename,
+				width, height, channels, data, SOIL_PNG_DEFAULT,
+				parallel_for_function, parallel_for_context );
+	} else
 	{
 		save_result = 0;
 	}
@@ -1511,6 +1770,56 @@ int
 	return save_result;
 }
 
+int
+	SOIL_save_image_PNG
+	(
+		const char *filename,
+		int width, int height, int channels,
+		const unsigned char *const data,
+		int level
+	)
+{
+	int save_result = save_image_as_PNG( filename,
+			width, height, channels, data, level,
+			parallel_for_function, parallel_for_context );
+	if( save_result == 0 )
+	{
+		result_string_pointer = "Saving the image failed";
+	} else
+	{
+		result_string_pointer = "Image saved";
+	}
+	return save_result;
+}
+
+unsigned char*
+	SOIL_save_image_PNG_to_memory
+	(
+		int width, int height, int channels,
+		const unsigned char *const data,
+		int level,
+		int *size
+	)
+{
+	int png_size;
+	unsigned char *png = convert_image_to_PNG( data,
+			width, height, channels, level,
+			parallel_for_function, parallel_for_context, &png_size );
+	if( NULL == png )
+	{
+		result_string_pointer = "Encoding the image failed";
+		png_size = 0;
+	} else
+	{
+		result_string_pointer = "Image encoded";
+	}
+	if( NULL != size )
+	{
+		*size = png_size;
+	}
+	return png;
+}
+
 void
 	SOIL_free_image_data
 	(
@@ -1529,6 +1838,145 @@ const char*
 	return result_string_pointer;
 }
 
+void
+	SOIL_init_context
+	(
+		SOIL_context *context
+	)
+{
+	stbi_context image;
+	stbi_context_init( &image );
+	memset( context, 0, sizeof(SOIL_context) );
+	context->result_string = "SOIL initialized";
+	context->hdr_gamma = image.hdr_to_ldr_gamma;
+	context->hdr_scale = image.hdr_to_ldr_scale;
+}
+
+static void
+	image_context
+	(
+		const SOIL_context *context,
+		stbi_context *image
+	)
+{
+	stbi_context_init( image );
+	image->hdr_to_ldr_gamma = context->hdr_gamma;
+	image->hdr_to_ldr_scale = context->hdr_scale;
+	image->allocator.alloc = context->allocator.alloc;
+	image->allocator.resize = context->allocator.resize;
+	image->allocator.release = context->allocator.release;
+	image->allocator.user = context->allocator.user;
+}
+
+/*	hands what a load did back to the SOIL context	*/
+static void
+	image_result
+	(
+		SOIL_context *context,
+		const stbi_context *image,
+		int loaded,
+		const char *success
+	)
+{
+	context->result_string = loaded ? success : image->failure_reason;
+	context->allocations = image->stats.allocations;
+	context->allocated_bytes = image->stats.bytes;
+	context->peak_bytes = image->stats.peak_bytes;
+}
+
+void
+	SOIL_free_image_data_ctx
+	(
+		SOIL_context *context,
+		unsigned char *img_data
+	)
+{
+	stbi_context image;
+	image_context( context, &image );
+	stbi_image_free_ctx( &image, img_data );
+}
+
+unsigned char*
+	SOIL_load_image_ctx
+	(
+		SOIL_context *context,
+		const char *filename,
+		int *width, int *height, int *channels,
+		int force_channels
+	)
+{
+	stbi_context image;
+	unsigned char *result;
+	image_context( context, &image );
+	result = stbi_load_ctx( &image, filename,
+			width, height, channels, force_channels );
+	image_result( context, &image, result != NULL, "Image loaded" );
+	return result;
+}
+
+unsigned char*
+	SOIL_load_image_from_memory_ctx
+	(
+		SOIL_context *context,
+		const unsigned char *const buffer,
+		int buffer_length,
+		int *width, int *height, int *channels,
+		int force_channels
+	)
+{
+	stbi_context image;
+	unsigned char *result;
+	image_context( context, &image );
+	result = stbi_load_from_memory_ctx( &image,
+				buffer, buffer_length,
+				width, height, channels,
+				force_channels );
+	image_result( context, &image, result != NULL, "Image loaded from memory" );
+	return result;
+}
+
+int
+	SOIL_load_image_into_ctx
+	(
+		SOIL_context *context,
+		const char *filename,
+		int *width, int *height, int *channels,
+		int force_channels,
+		unsigned char *pixels, size_t size
+	)
+{
+	stbi_context image;
+	int loaded;
+	image_context( context, &image );
+	loaded = stbi_load_into_ctx( &image, filename,
+			width, height, channels, force_channels,
+			pixels, size );
+	image_result( context, &image, loaded, "Image loaded" );
+	return loaded;
+}
+
+int
+	SOIL_load_image_from_memory_into_ctx
+	(
+		SOIL_context *context,
+		const unsigned char *const buffer,
+		int buffer_length,
+		int *width, int *height, int *channels,
+		int force_channels,
+		unsigned char *pixels, size_t size
+	)
+{
+	stbi_context image;
+	int loaded;
+	image_context( context, &image );
+	loaded = stbi_load_from_memory_into_ctx( &image,
+				buffer, buffer_length,
+				width, height, channels,
+				force_channels, pixels, size );
+	image_result( context, &image, loaded, "Image loaded from memory" );
+	return loaded;
+}
+
 unsigned int SOIL_direct_load_DDS_from_memory(
 		const unsigned char *const buffer,
 		int buffer_length,
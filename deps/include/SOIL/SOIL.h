@@ -40,6 +40,8 @@
 #ifndef HEADER_SIMPLE_OPENGL_IMAGE_LIBRARY
 #define HEADER_SIMPLE_OPENGL_IMAGE_LIBRARY
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -91,6 +93,9 @@ enum
 	SOIL_FLAG_NTSC_SAFE_RGB: clamps RGB components to the range [16,235]
 	SOIL_FLAG_CoCg_Y: Google YCoCg; RGB=>CoYCg, RGBA=>CoCgAY
 	SOIL_FLAG_TEXTURE_RECTANGE: uses ARB_texture_rectangle ; pixel indexed & no repeat or MIPmaps or cubemaps
+	SOIL_FLAG_SRGB_MIPMAPS: the colour is sRGB, filter the MIPmaps in linear light (not with SOIL_FLAG_CoCg_Y)
+	SOIL_FLAG_MIPMAP_KAISER: filter the MIPmaps with a Kaiser window instead of a box
+	SOIL_FLAG_MIPMAP_LANCZOS: filter the MIPmaps with Lanczos instead of a box
 **/
 enum
 {
@@ -103,7 +108,10 @@ enum
 	SOIL_FLAG_DDS_LOAD_DIRECT = 64,
 	SOIL_FLAG_NTSC_SAFE_RGB = 128,
 	SOIL_FLAG_CoCg_Y = 256,
-	SOIL_FLAG_TEXTURE_RECTANGLE = 512
+	SOIL_FLAG_TEXTURE_RECTANGLE = 512,
+	SOIL_FLAG_SRGB_MIPMAPS = 1024,
+	SOIL_FLAG_MIPMAP_KAISER = 2048,
+	SOIL_FLAG_MIPMAP_LANCZOS = 4096
 };
 
 /**
@@ -111,12 +119,26 @@ enum
 	(TGA supports uncompressed RGB / RGBA)
 	(BMP supports uncompressed RGB)
 	(DDS supports DXT1 and DXT5)
+	(PNG supports lossless 1 to 4 channels)
 **/
 enum
 {
 	SOIL_SAVE_TYPE_TGA = 0,
 	SOIL_SAVE_TYPE_BMP = 1,
-	SOIL_SAVE_TYPE_DDS = 2
+	SOIL_SAVE_TYPE_DDS = 2,
+	SOIL_SAVE_TYPE_PNG = 3
+};
+
+/**
+	How hard SOIL_save_image_PNG compresses, fastest first.
+	SOIL_save_image uses SOIL_PNG_DEFAULT.
+**/
+enum
+{
+	SOIL_PNG_FASTEST = 0,	/*	for captures and screenshots	*/
+	SOIL_PNG_FAST = 1,
+	SOIL_PNG_DEFAULT = 2,
+	SOIL_PNG_BEST = 3
 };
 
 /**
@@ -390,6 +412,52 @@ unsigned char*
 		int force_channels
 	);
 
+/**
+	The formats SOIL_probe_image tells apart
+**/
+enum
+{
+	SOIL_IMAGE_UNKNOWN = 0,
+	SOIL_IMAGE_JPEG = 1,
+	SOIL_IMAGE_PNG = 2,
+	SOIL_IMAGE_BMP = 3,
+	SOIL_IMAGE_TGA = 4,
+	SOIL_IMAGE_PSD = 5,
+	SOIL_IMAGE_HDR = 6,
+	SOIL_IMAGE_DDS = 7
+};
+
+typedef struct
+{
+	int width, height;		/*	of one face for DDS cubemaps	*/
+	int channels;			/*	as SOIL_load_image reports them; for DDS what the file can hold	*/
+	int format;				/*	SOIL_IMAGE_*	*/
+	int mipmap_count;		/*	levels stored in the file, 1 but for DDS	*/
+	int cubemap;			/*	a DDS cubemap	*/
+	int DXT;				/*	1 to 5 for DXT compressed DDS, 0 otherwise	*/
+} SOIL_image_info;
+
+/**
+	Reads the size, channels and format of an image from its header,
+	without decoding it, for every format SOIL_load_image reads.  Only
+	the first few kilobytes of a file are read.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	SOIL_probe_image
+	(
+		const char *filename,
+		SOIL_image_info *info
+	);
+
+int
+	SOIL_probe_image_from_memory
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		SOIL_image_info *info
+	);
+
 /**
 	Saves an image from an array of unsigned chars (RGBA) to disk
 	\return 0 if failed, otherwise returns 1
@@ -403,6 +471,35 @@ int
 		const unsigned char *const data
 	);
 
+/**
+	Saves an image as PNG, compressed at one of the SOIL_PNG_* levels.
+	Chunks of rows are compressed with the parallel_for set by
+	SOIL_set_parallel_for, the file being the same on any number of threads.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	SOIL_save_image_PNG
+	(
+		const char *filename,
+		int width, int height, int channels,
+		const unsigned char *const data,
+		int level
+	);
+
+/**
+	Encodes an image as a PNG file in memory, as SOIL_save_image_PNG
+	writes it, to be freed with SOIL_free_image_data.
+	\return 0 if failed, otherwise returns a pointer to the file's bytes
+**/
+unsigned char*
+	SOIL_save_image_PNG_to_memory
+	(
+		int width, int height, int channels,
+		const unsigned char *const data,
+		int level,
+		int *size
+	);
+
 /**
 	Frees the image data (note, this is just C's "free()"...this function is
 	present mostly so C++ programmers don't forget to use "free()" and call
@@ -425,6 +522,226 @@ const char*
 		void
 	);
 
+/**
+	Reentrant loading.  SOIL_load_image and friends may be called from
+	several threads at once; SOIL_last_result then describes the last call
+	made on the calling thread.  A context instead keeps the outcome of
+	the calls made with it, and the HDR to LDR conversion settings used
+	by them, so a worker can hand both back with the image.
+
+	A context may also carry an allocator.  Everything a load through it
+	allocates, the image it returns included, then comes from the
+	allocator, and the context counts what the last load allocated.  Free
+	such images with SOIL_free_image_data_ctx.
+**/
+typedef struct
+{
+	void *(*alloc)( void *user, size_t size );
+	/*	may be NULL: SOIL allocates, copies and releases instead	*/
+	void *(*resize)( void *user, void *p, size_t old_size, size_t size );
+	/*	may be NULL, for an arena that is reset as a whole	*/
+	void (*release)( void *user, void *p );
+	void *user;
+} SOIL_allocator;
+
+typedef struct
+{
+	const char *result_string;	/*	what the last call with this context did	*/
+	float hdr_gamma;			/*	HDR images are converted to LDR with these	*/
+	float hdr_scale;
+	SOIL_allocator allocator;	/*	all NULL for malloc	*/
+	unsigned int allocations;	/*	made by the last load, resizes included	*/
+	size_t allocated_bytes;		/*	all of them together	*/
+	size_t peak_bytes;			/*	the most that was live at once	*/
+} SOIL_context;
+
+/**
+	Sets up a context with malloc and stb_image's HDR conversion defaults
+	(gamma 2.2, scale 1).
+**/
+void
+	SOIL_init_context
+	(
+		SOIL_context *context
+	);
+
+/**
+	Frees an image loaded through the context.
+**/
+void
+	SOIL_free_image_data_ctx
+	(
+		SOIL_context *context,
+		unsigned char *img_data
+	);
+
+/**
+	SOIL_load_image, reporting through the context.
+	\return 0 if failed, otherwise the image data
+**/
+unsigned char*
+	SOIL_load_image_ctx
+	(
+		SOIL_context *context,
+		const char *filename,
+		int *width, int *height, int *channels,
+		int force_channels
+	);
+
+/**
+	SOIL_load_image_from_memory, reporting through the context.
+	\return 0 if failed, otherwise the image data
+**/
+unsigned char*
+	SOIL_load_image_from_memory_ctx
+	(
+		SOIL_context *context,
+		const unsigned char *const buffer,
+		int buffer_length,
+		int *width, int *height, int *channels,
+		int force_channels
+	);
+
+/**
+	Loads an image into pixels, which has room for size bytes, decoding
+	it in place when it fits.  An image that doesn't fit fails with its
+	width, height and channels set, so the caller can size a buffer.
+	\return 0 if failed, 1 if the image is in pixels
+**/
+int
+	SOIL_load_image_into_ctx
+	(
+		SOIL_context *context,
+		const char *filename,
+		int *width, int *height, int *channels,
+		int force_channels,
+		unsigned char *pixels, size_t size
+	);
+
+/**
+	SOIL_load_image_into_ctx, from memory.
+	\return 0 if failed, 1 if the image is in pixels
+**/
+int
+	SOIL_load_image_from_memory_into_ctx
+	(
+		SOIL_context *context,
+		const unsigned char *const buffer,
+		int buffer_length,
+		int *width, int *height, int *channels,
+		int force_channels,
+		unsigned char *pixels, size_t size
+	);
+
+/**
+	Texture preparation without OpenGL.  SOIL_create_OGL_texture does its
+	CPU work (copy, invert-Y, NTSC scaling, alpha premultiply, resizing,
+	MIPmaps and DXT compression) and its OpenGL calls in one go.  These
+	split the two: SOIL_prepare_texture builds every level in memory for
+	a given set of capabilities and may run on any thread, then
+	SOIL_upload_prepared_texture creates the texture on the OpenGL thread.
+**/
+#define SOIL_MAX_TEXTURE_LEVELS 32
+
+/**
+	What the target OpenGL implementation supports.  Fill it by hand to
+	prepare textures without a context.
+**/
+typedef struct
+{
+	int max_texture_size;		/*	GL_MAX_TEXTURE_SIZE	*/
+	int NPOT;					/*	non power of two sizes	*/
+	int texture_rectangle;		/*	ARB_texture_rectangle	*/
+	int DXT;					/*	S3TC compressed formats	*/
+} SOIL_capabilities;
+
+typedef struct
+{
+	int width, height;
+	int size;					/*	bytes of data	*/
+	int compressed;				/*	data is DXT blocks, otherwise pixels	*/
+	unsigned char *data;
+} SOIL_texture_level;
+
+typedef struct
+{
+	unsigned int texture_type;		/*	GL_TEXTURE_2D or GL_TEXTURE_RECTANGLE_ARB	*/
+	unsigned int texture_target;	/*	what the levels are uploaded to	*/
+	unsigned int flags;				/*	as requested, less what the capabilities rule out	*/
+	unsigned int internal_format;
+	unsigned int format;			/*	of the pixels of uncompressed levels	*/
+	int channels;
+	int level_count;
+	SOIL_texture_level levels[SOIL_MAX_TEXTURE_LEVELS];
+	unsigned char *pyramid;			/*	holds the MIPmapped levels still uncompressed	*/
+} SOIL_prepared_texture;
+
+/**
+	Reads the capabilities of the current OpenGL context.
+**/
+void
+	SOIL_query_capabilities
+	(
+		SOIL_capabilities *capabilities
+	);
+
+/**
+	Does all the CPU work of SOIL_create_OGL_texture, without OpenGL.
+	The raw data is _NOT_ freed.
+	\param flags as for SOIL_create_OGL_texture
+	\param capabilities of the OpenGL implementation the texture is for
+	\param texture filled with the levels, free it with SOIL_free_prepared_texture
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	SOIL_prepare_texture
+	(
+		const unsigned char *const data,
+		int width, int height, int channels,
+		unsigned int flags,
+		const SOIL_capabilities *capabilities,
+		SOIL_prepared_texture *texture
+	);
+
+/**
+	Creates the OpenGL texture from a prepared one.  Must be called on the
+	OpenGL thread; the prepared texture is left as it is.
+	\param reuse_texture_ID 0-generate a new texture ID, otherwise reuse the texture ID (overwriting the old texture)
+	\return 0-failed, otherwise returns the OpenGL texture handle
+**/
+unsigned int
+	SOIL_upload_prepared_texture
+	(
+		const SOIL_prepared_texture *texture,
+		unsigned int reuse_texture_ID
+	);
+
+void
+	SOIL_free_prepared_texture
+	(
+		SOIL_prepared_texture *texture
+	);
+
+/**
+	How SOIL spreads work over the application's threads.  It calls
+	task( data, begin, end ) on ranges covering [0, count), from any
+	threads, and returns once all of them are done.
+**/
+typedef void (*SOIL_task)( void *data, int begin, int end );
+typedef void (*SOIL_parallel_for)( void *context, int count, SOIL_task task, void *data );
+
+/**
+	Compresses DXT block rows of every MIP level, and chunks of PNG rows,
+	with parallel_for, the bytes being the same on any number of threads.  NULL, the default,
+	does it all on the calling thread.  Set it while nothing is loading.
+**/
+void
+	SOIL_set_parallel_for
+	(
+		SOIL_parallel_for parallel_for,
+		void *context
+	);
+
 
 #ifdef __cplusplus
 }
@@ -98,36 +98,24 @@ int
 	return 1;
 }
 
-unsigned char* convert_image_to_DXT1(
+/*	DXT1 blocks of block rows [first_row, last_row)	*/
+static void convert_block_rows_to_DXT1(
 		const unsigned char *const uncompressed,
 		int width, int height, int channels,
-		int *out_size )
+		int first_row, int last_row,
+		unsigned char *compressed )
 {
-	unsigned char *compressed;
 	int i, j, x, y;
 	unsigned char ublock[16*3];
 	unsigned char cblock[8];
-	int index = 0, chan_step = 1;
-	int block_count = 0;
-	/*	error check	*/
-	*out_size = 0;
-	if( (width < 1) || (height < 1) ||
-		(NULL == uncompressed) ||
-		(channels < 1) || (channels > 4) )
-	{
-		return NULL;
-	}
+	int index = first_row * ((width+3) >> 2) * 8, chan_step = 1;
 	/*	for channels == 1 or 2, I do not step forward for R,G,B values	*/
 	if( channels < 3 )
 	{
 		chan_step = 0;
 	}
-	/*	get the RAM for the compressed image
-		(8 bytes per 4x4 pixel block)	*/
-	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 8;
-	compressed = (unsigned char*)malloc( *out_size );
 	/*	go through each block	*/
-	for( j = 0; j < height; j += 4 )
+	for( j = first_row * 4; (j < height) && (j < last_row * 4); j += 4 )
 	{
 		for( i = 0; i < width; i += 4 )
 		{
@@ -167,7 +155,6 @@ unsigned char* convert_image_to_DXT1(
 				}
 			}
 			/*	compress the block	*/
-			++block_count;
 			compress_DDS_color_block( 3, ublock, cblock );
 			/*	copy the data from the block into the main block	*/
 			for( x = 0; x < 8; ++x )
@@ -176,28 +163,20 @@ unsigned char* convert_image_to_DXT1(
 			}
 		}
 	}
-	return compressed;
 }
 
-unsigned char* convert_image_to_DXT5(
+/*	DXT5 blocks of block rows [first_row, last_row)	*/
+static void convert_block_rows_to_DXT5(
 		const unsigned char *const uncompressed,
 		int width, int height, int channels,
-		int *out_size )
+		int first_row, int last_row,
+		unsigned char *compressed )
 {
-	unsigned char *compressed;
 	int i, j, x, y;
 	unsigned char ublock[16*4];
 	unsigned char cblock[8];
-	int index = 0, chan_step = 1;
-	int block_count = 0, has_alpha;
-	/*	error check	*/
-	*out_size = 0;
-	if( (width < 1) || (height < 1) ||
-		(NULL == uncompressed) ||
-		(channels < 1) || ( channels > 4) )
-	{
-		return NULL;
-	}
+	int index = first_row * ((width+3) >> 2) * 16, chan_step = 1;
+	int has_alpha;
 	/*	for channels == 1 or 2, I do not step forward for R,G,B vales	*/
 	if( channels < 3 )
 	{
@@ -205,12 +184,8 @@ unsigned char* convert_image_to_DXT5(
 	}
 	/*	# channels = 1 or 3 have no alpha, 2 & 4 do have alpha	*/
 	has_alpha = 1 - (channels & 1);
-	/*	get the RAM for the compressed image
-		(16 bytes per 4x4 pixel block)	*/
-	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 16;
-	compressed = (unsigned char*)malloc( *out_size );
 	/*	go through each block	*/
-	for( j = 0; j < height; j += 4 )
+	for( j = first_row * 4; (j < height) && (j < last_row * 4); j += 4 )
 	{
 		for( i = 0; i < width; i += 4 )
 		{
@@ -262,7 +237,6 @@ unsigned char* convert_image_to_DXT5(
 				compressed[index++] = cblock[x];
 			}
 			/*	then compress the color block	*/
-			++block_count;
 			compress_DDS_color_block( 4, ublock, cblock );
 			/*	copy the data from the compressed color block into the main buffer	*/
 			for( x = 0; x < 8; ++x )
@@ -271,6 +245,93 @@ unsigned char* convert_image_to_DXT5(
 			}
 		}
 	}
+}
+
+int DXT_compressed_size(
+		int width, int height,
+		int DXT5 )
+{
+	return ((width+3) >> 2) * ((height+3) >> 2) * (DXT5 ? 16 : 8);
+}
+
+int convert_block_rows_to_DXT(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int DXT5,
+		int first_row, int rows,
+		unsigned char *compressed )
+{
+	/*	error check	*/
+	if( (width < 1) || (height < 1) ||
+		(NULL == uncompressed) || (NULL == compressed) ||
+		(channels < 1) || (channels > 4) ||
+		(first_row < 0) || (rows < 0) )
+	{
+		return 0;
+	}
+	if( DXT5 )
+	{
+		convert_block_rows_to_DXT5( uncompressed, width, height, channels,
+			first_row, first_row + rows, compressed );
+	} else
+	{
+		convert_block_rows_to_DXT1( uncompressed, width, height, channels,
+			first_row, first_row + rows, compressed );
+	}
+	return 1;
+}
+
+unsigned char* convert_image_to_DXT1(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int *out_size )
+{
+	unsigned char *compressed;
+	/*	error check	*/
+	*out_size = 0;
+	if( (width < 1) || (height < 1) ||
+		(NULL == uncompressed) ||
+		(channels < 1) || (channels > 4) )
+	{
+		return NULL;
+	}
+	/*	get the RAM for the compressed image
+		(8 bytes per 4x4 pixel block)	*/
+	compressed = (unsigned char*)malloc( DXT_compressed_size( width, height, 0 ) );
+	if( NULL == compressed )
+	{
+		return NULL;
+	}
+	*out_size = DXT_compressed_size( width, height, 0 );
+	convert_block_rows_to_DXT1( uncompressed, width, height, channels,
+		0, (height+3) >> 2, compressed );
+	return compressed;
+}
+
+unsigned char* convert_image_to_DXT5(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int *out_size )
+{
+	unsigned char *compressed;
+	/*	error check	*/
+	*out_size = 0;
+	if( (width < 1) || (height < 1) ||
+		(NULL == uncompressed) ||
+		(channels < 1) || ( channels > 4) )
+	{
+		return NULL;
+	}
+	/*	get the RAM for the compressed image
+		(16 bytes per 4x4 pixel block)	*/
+	compressed = (unsigned char*)malloc( DXT_compressed_size( width, height, 1 ) );
+	if( NULL == compressed )
+	{
+		return NULL;
+	}
+	*out_size = DXT_compressed_size( width, height, 1 );
+	convert_block_rows_to_DXT5( uncompressed, width, height, channels,
+		0, (height+3) >> 2, compressed );
 	return compressed;
 }
 
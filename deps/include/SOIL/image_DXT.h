@@ -45,6 +45,34 @@ convert_image_to_DXT5
     int *out_size
 );
 
+/**
+	bytes of an image compressed to DXT1 (8 per 4x4 block) or DXT5 (16)
+**/
+int
+DXT_compressed_size
+(
+    int width, int height,
+    int DXT5
+);
+
+/**
+	Compress rows [first_row, first_row + rows) of 4x4 blocks into their
+	place in compressed, which holds the whole image.  Block rows don't
+	depend on each other, so ranges of them may be compressed on different
+	threads, and together they make the same bytes as convert_image_to_DXT1
+	(DXT5 = 0) or convert_image_to_DXT5.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+convert_block_rows_to_DXT
+(
+    const unsigned char *const uncompressed,
+    int width, int height, int channels,
+    int DXT5,
+    int first_row, int rows,
+    unsigned char *compressed
+);
+
 /**	A bunch of DirectDraw Surface structures and flags **/
 typedef struct
 {
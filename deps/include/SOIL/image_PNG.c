@@ -0,0 +1,1200 @@
+/*
+	PNG writing for SOIL: rows get the adaptive filter that suits them,
+	then a built-in deflate encoder compresses chunks of rows on
+	separate threads.
+
+	public domain
+*/
+
+#include "image_PNG.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define IMAGE_PNG_SSE 1
+#endif
+
+/*	Rows are filtered and deflated in chunks of about this many bytes, a
+	task each.  Every chunk ends byte aligned so the pieces join into one
+	zlib stream, and may match the 32KB before it, so the split costs
+	little.  The chunking, not the thread count, decides the bytes.	*/
+#define PNG_CHUNK_BYTES		(256 * 1024)
+#define PNG_WINDOW			32768
+#define PNG_WINDOW_MASK		(PNG_WINDOW - 1)
+#define PNG_HASH_BITS		15
+#define PNG_MIN_MATCH		4
+#define PNG_MAX_MATCH		258
+/*	symbols per deflate block, each block having its own Huffman codes	*/
+#define PNG_BLOCK_SYMBOLS	16384
+#define PNG_LITERALS		286
+#define PNG_DISTANCES		30
+#define PNG_CODE_LENGTHS	19
+/*	zeros before each copied row, for the bytes left of the first pixel	*/
+#define PNG_ROW_PAD			16
+
+typedef struct
+{
+	int chain;			/*	hash chain entries tried per position	*/
+	int lazy;			/*	look a byte ahead for a longer match	*/
+	int insert_matches;	/*	hash the positions inside matches too	*/
+	int nice;			/*	stop searching at a match this long	*/
+} PNG_level;
+
+static const PNG_level PNG_levels[PNG_LEVEL_BEST + 1] =
+{
+	{ 1, 0, 0, 16 },
+	{ 4, 0, 1, 32 },
+	{ 32, 1, 1, 128 },
+	{ 512, 1, 1, 258 }
+};
+
+static const int PNG_length_base[29] =
+{
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const int PNG_length_extra[29] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const int PNG_distance_base[PNG_DISTANCES] =
+{
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const int PNG_distance_extra[PNG_DISTANCES] =
+{
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+/*	the order code length code lengths are stored in	*/
+static const unsigned char PNG_code_length_order[PNG_CODE_LENGTHS] =
+{
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/*	one chunk of rows: a whole IDAT chunk once deflated	*/
+typedef struct
+{
+	int first_row, rows;
+	unsigned char *data;	/*	length, "IDAT", the zlib bytes, CRC	*/
+	int size;
+	unsigned int adler;		/*	of the chunk's filtered bytes	*/
+	int failed;
+} PNG_chunk;
+
+typedef struct
+{
+	const unsigned char *image;
+	int width, height, channels;
+	int row_bytes;			/*	filtered, the filter type byte included	*/
+	const PNG_level *level;
+	unsigned char *filtered;
+	PNG_chunk *chunks;
+	int chunk_count;
+	/*	filled in before the tasks start, then only read	*/
+	unsigned int crc_table[4][256];
+	unsigned char length_code[PNG_MAX_MATCH + 1];
+	unsigned char distance_code[512];
+} PNG_job;
+
+/*	one task's deflate state	*/
+typedef struct
+{
+	const PNG_job *job;
+	const unsigned char *in;
+	unsigned char *out;
+	int out_size;
+	unsigned int bits;
+	int bit_count;
+	int *head;
+	int *prev;
+	unsigned short *lengths;	/*	of the matches, or the literal bytes	*/
+	unsigned short *distances;	/*	0 for literals	*/
+	int symbols;
+	int block_start;			/*	input the pending symbols start at	*/
+	unsigned int literal_freq[PNG_LITERALS];
+	unsigned int distance_freq[PNG_DISTANCES];
+} PNG_deflate;
+
+/********* Checksums *********/
+
+/*	CRC-32 tables for four bytes at a time: table[k][n] is the CRC of n
+	followed by k zero bytes	*/
+static void
+	PNG_make_crc_table
+	(
+		unsigned int table[4][256]
+	)
+{
+	unsigned int c;
+	int n, k;
+	for( n = 0; n < 256; ++n )
+	{
+		c = (unsigned int)n;
+		for( k = 0; k < 8; ++k )
+		{
+			c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		}
+		table[0][n] = c;
+	}
+	for( n = 0; n < 256; ++n )
+	{
+		c = table[0][n];
+		for( k = 1; k < 4; ++k )
+		{
+			c = table[0][c & 0xFF] ^ (c >> 8);
+			table[k][n] = c;
+		}
+	}
+}
+
+static unsigned int
+	PNG_crc
+	(
+		const unsigned int table[4][256],
+		unsigned int crc,
+		const unsigned char *data, int size
+	)
+{
+	crc = ~crc;
+	for( ; size >= 4; size -= 4, data += 4 )
+	{
+		crc ^= data[0] | (data[1] << 8) | (data[2] << 16) | ((unsigned int)data[3] << 24);
+		crc = table[3][crc & 0xFF] ^ table[2][(crc >> 8) & 0xFF] ^
+			table[1][(crc >> 16) & 0xFF] ^ table[0][crc >> 24];
+	}
+	for( ; size > 0; --size )
+	{
+		crc = table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static unsigned int
+	PNG_adler32
+	(
+		const unsigned char *data, int size
+	)
+{
+	unsigned int a = 1, b = 0;
+	while( size > 0 )
+	{
+		/*	the most bytes before b can overflow	*/
+		int n = (size < 5552) ? size : 5552;
+		size -= n;
+		while( n-- > 0 )
+		{
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+/*	the Adler-32 of two runs of bytes joined, from theirs	*/
+static unsigned int
+	PNG_adler32_combine
+	(
+		unsigned int adler1, unsigned int adler2, int size2
+	)
+{
+	const unsigned int base = 65521;
+	unsigned int rem = (unsigned int)size2 % base;
+	unsigned int sum1 = adler1 & 0xFFFF;
+	unsigned int sum2 = (rem * sum1) % base;
+	sum1 += (adler2 & 0xFFFF) + base - 1;
+	sum2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+	if( sum1 >= base ) sum1 -= base;
+	if( sum1 >= base ) sum1 -= base;
+	if( sum2 >= (base << 1) ) sum2 -= (base << 1);
+	if( sum2 >= base ) sum2 -= base;
+	return (sum2 << 16) | sum1;
+}
+
+static void
+	PNG_put_32
+	(
+		unsigned char *out,
+		unsigned int value
+	)
+{
+	out[0] = (unsigned char)(value >> 24);
+	out[1] = (unsigned char)(value >> 16);
+	out[2] = (unsigned char)(value >> 8);
+	out[3] = (unsigned char)value;
+}
+
+/********* Filtering *********/
+
+/*	Filters one row all five ways, into out[0..3] for sub, up, average and
+	Paeth, and returns the filter type whose bytes have the smallest sum
+	taken as signed, the usual guess at what deflates best.  cur and prev
+	are padded with zeros: PNG_ROW_PAD bytes in front and up to a multiple
+	of 16 behind.	*/
+static int
+	PNG_filter_row
+	(
+		const unsigned char *cur, const unsigned char *prev,
+		int size, int bpp,
+		unsigned char *out[4]
+	)
+{
+	unsigned int cost[5];
+	int i, best;
+#ifdef IMAGE_PNG_SSE
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8( 1 );
+	__m128i sums[5];
+	for( i = 0; i < 5; ++i )
+	{
+		sums[i] = zero;
+	}
+	for( i = 0; i < size; i += 16 )
+	{
+		__m128i x = _mm_loadu_si128( (const __m128i*)(cur + i) );
+		__m128i a = _mm_loadu_si128( (const __m128i*)(cur + i - bpp) );
+		__m128i b = _mm_loadu_si128( (const __m128i*)(prev + i) );
+		__m128i c = _mm_loadu_si128( (const __m128i*)(prev + i - bpp) );
+		__m128i f[5];
+		__m128i average, predictor[2];
+		int half, k;
+		/*	(a + b) / 2 rounded down	*/
+		average = _mm_sub_epi8( _mm_avg_epu8( a, b ), _mm_and_si128( _mm_xor_si128( a, b ), one ) );
+		/*	Paeth on 16 bits: p = a + b - c, and whichever of a, b or c is
+			nearest p, in that order on ties	*/
+		for( half = 0; half < 2; ++half )
+		{
+			__m128i a16 = half ? _mm_unpackhi_epi8( a, zero ) : _mm_unpacklo_epi8( a, zero );
+			__m128i b16 = half ? _mm_unpackhi_epi8( b, zero ) : _mm_unpacklo_epi8( b, zero );
+			__m128i c16 = half ? _mm_unpackhi_epi8( c, zero ) : _mm_unpacklo_epi8( c, zero );
+			__m128i bc = _mm_sub_epi16( b16, c16 );
+			__m128i ac = _mm_sub_epi16( a16, c16 );
+			__m128i abc = _mm_add_epi16( ac, bc );
+			__m128i pa = _mm_max_epi16( bc, _mm_sub_epi16( zero, bc ) );
+			__m128i pb = _mm_max_epi16( ac, _mm_sub_epi16( zero, ac ) );
+			__m128i pc = _mm_max_epi16( abc, _mm_sub_epi16( zero, abc ) );
+			__m128i not_a = _mm_or_si128( _mm_cmpgt_epi16( pa, pb ), _mm_cmpgt_epi16( pa, pc ) );
+			__m128i not_b = _mm_cmpgt_epi16( pb, pc );
+			__m128i b_or_c = _mm_or_si128( _mm_and_si128( not_b, c16 ), _mm_andnot_si128( not_b, b16 ) );
+			predictor[half] = _mm_or_si128( _mm_and_si128( not_a, b_or_c ), _mm_andnot_si128( not_a, a16 ) );
+		}
+		f[0] = x;
+		f[1] = _mm_sub_epi8( x, a );
+		f[2] = _mm_sub_epi8( x, b );
+		f[3] = _mm_sub_epi8( x, average );
+		f[4] = _mm_sub_epi8( x, _mm_packus_epi16( predictor[0], predictor[1] ) );
+		for( k = 0; k < 5; ++k )
+		{
+			/*	|f| as a signed byte is min( f, -f ) unsigned	*/
+			__m128i magnitude = _mm_min_epu8( f[k], _mm_sub_epi8( zero, f[k] ) );
+			sums[k] = _mm_add_epi64( sums[k], _mm_sad_epu8( magnitude, zero ) );
+			if( k > 0 )
+			{
+				_mm_storeu_si128( (__m128i*)(out[k - 1] + i), f[k] );
+			}
+		}
+	}
+	for( i = 0; i < 5; ++i )
+	{
+		cost[i] = (unsigned int)_mm_cvtsi128_si32( sums[i] ) +
+			(unsigned int)_mm_cvtsi128_si32( _mm_srli_si128( sums[i], 8 ) );
+	}
+#else
+	for( i = 0; i < 5; ++i )
+	{
+		cost[i] = 0;
+	}
+	for( i = 0; i < size; ++i )
+	{
+		int a = cur[i - bpp], b = prev[i], c = prev[i - bpp];
+		int p = a + b - c;
+		int pa = abs( p - a ), pb = abs( p - b ), pc = abs( p - c );
+		int paeth = ((pa <= pb) && (pa <= pc)) ? a : ((pb <= pc) ? b : c);
+		unsigned char f[5];
+		int k;
+		f[0] = cur[i];
+		f[1] = (unsigned char)(cur[i] - a);
+		f[2] = (unsigned char)(cur[i] - b);
+		f[3] = (unsigned char)(cur[i] - ((a + b) >> 1));
+		f[4] = (unsigned char)(cur[i] - paeth);
+		for( k = 0; k < 5; ++k )
+		{
+			cost[k] += (f[k] < 128) ? f[k] : 256 - f[k];
+			if( k > 0 )
+			{
+				out[k - 1][i] = f[k];
+			}
+		}
+	}
+#endif
+	best = 0;
+	for( i = 1; i < 5; ++i )
+	{
+		if( cost[i] < cost[best] )
+		{
+			best = i;
+		}
+	}
+	return best;
+}
+
+static void
+	PNG_filter_tasks
+	(
+		void *data,
+		int begin, int end
+	)
+{
+	PNG_job *job = (PNG_job*)data;
+	int size = job->width * job->channels;
+	int padded = (size + 15) & ~15;
+	unsigned char *scratch = (unsigned char*)malloc( 2 * (PNG_ROW_PAD + padded) + 4 * padded );
+	unsigned char *cur, *prev, *swap, *out[4];
+	int i, j, y;
+	if( NULL == scratch )
+	{
+		for( i = begin; i < end; ++i )
+		{
+			job->chunks[i].failed = 1;
+		}
+		return;
+	}
+	memset( scratch, 0, 2 * (PNG_ROW_PAD + padded) );
+	prev = scratch + PNG_ROW_PAD;
+	cur = prev + padded + PNG_ROW_PAD;
+	for( j = 0; j < 4; ++j )
+	{
+		out[j] = cur + padded + j * padded;
+	}
+	for( i = begin; i < end; ++i )
+	{
+		const PNG_chunk *chunk = &job->chunks[i];
+		/*	the row above the chunk, or zeros above the image	*/
+		if( chunk->first_row > 0 )
+		{
+			memcpy( prev, job->image + (chunk->first_row - 1) * size, size );
+		} else
+		{
+			memset( prev, 0, size );
+		}
+		for( y = chunk->first_row; y < chunk->first_row + chunk->rows; ++y )
+		{
+			unsigned char *row = job->filtered + y * job->row_bytes;
+			int filter;
+			memcpy( cur, job->image + y * size, size );
+			filter = PNG_filter_row( cur, prev, padded, job->channels, out );
+			row[0] = (unsigned char)filter;
+			memcpy( row + 1, (filter == 0) ? cur : out[filter - 1], size );
+			swap = prev;
+			prev = cur;
+			cur = swap;
+		}
+	}
+	free( scratch );
+}
+
+/********* Huffman codes *********/
+
+/*	Moffat and Katajainen's in-place code lengths: A holds n >= 2 weights
+	sorted ascending, and gets the code lengths.	*/
+static void
+	PNG_minimum_redundancy
+	(
+		int *A, int n
+	)
+{
+	int root, leaf, next, avbl, used, depth;
+	A[0] += A[1];
+	root = 0;
+	leaf = 2;
+	for( next = 1; next < n - 1; ++next )
+	{
+		if( (leaf >= n) || (A[root] < A[leaf]) )
+		{
+			A[next] = A[root];
+			A[root++] = next;
+		} else
+		{
+			A[next] = A[leaf++];
+		}
+		if( (leaf >= n) || ((root < next) && (A[root] < A[leaf])) )
+		{
+			A[next] += A[root];
+			A[root++] = next;
+		} else
+		{
+			A[next] += A[leaf++];
+		}
+	}
+	A[n - 2] = 0;
+	for( next = n - 3; next >= 0; --next )
+	{
+		A[next] = A[A[next]] + 1;
+	}
+	avbl = 1;
+	used = depth = 0;
+	root = n - 2;
+	next = n - 1;
+	while( avbl > 0 )
+	{
+		while( (root >= 0) && (A[root] == depth) )
+		{
+			++used;
+			--root;
+		}
+		while( avbl > used )
+		{
+			A[next--] = depth;
+			--avbl;
+		}
+		avbl = 2 * used;
+		++depth;
+		used = 0;
+	}
+}
+
+/*	Code lengths of at most max_bits for the symbols' frequencies.  At
+	least two symbols must be used, so that the code is complete.	*/
+static void
+	PNG_build_lengths
+	(
+		const unsigned int *freq, int count,
+		int max_bits,
+		unsigned char *lengths
+	)
+{
+	int order[PNG_LITERALS], weight[PNG_LITERALS], length_count[16];
+	int i, j, used = 0;
+	unsigned int total;
+	memset( lengths, 0, count );
+	for( i = 0; i < count; ++i )
+	{
+		if( freq[i] > 0 )
+		{
+			/*	insertion sort by frequency, stable	*/
+			for( j = used++; (j > 0) && (freq[order[j - 1]] > freq[i]); --j )
+			{
+				order[j] = order[j - 1];
+			}
+			order[j] = i;
+		}
+	}
+	if( used < 2 )
+	{
+		return;
+	}
+	for( i = 0; i < used; ++i )
+	{
+		weight[i] = (int)freq[order[i]];
+	}
+	PNG_minimum_redundancy( weight, used );
+	/*	codes too long are cut down, then shorter ones lengthened until
+		the code fits again	*/
+	memset( length_count, 0, sizeof(length_count) );
+	for( i = 0; i < used; ++i )
+	{
+		++length_count[(weight[i] > max_bits) ? max_bits : weight[i]];
+	}
+	total = 0;
+	for( i = 1; i <= max_bits; ++i )
+	{
+		total += (unsigned int)length_count[i] << (max_bits - i);
+	}
+	while( total != (1u << max_bits) )
+	{
+		--length_count[max_bits];
+		for( i = max_bits - 1; i > 0; --i )
+		{
+			if( length_count[i] > 0 )
+			{
+				--length_count[i];
+				length_count[i + 1] += 2;
+				break;
+			}
+		}
+		--total;
+	}
+	/*	the most frequent symbols get the shortest codes	*/
+	j = used;
+	for( i = 1; i <= max_bits; ++i )
+	{
+		int k;
+		for( k = length_count[i]; k > 0; --k )
+		{
+			lengths[order[--j]] = (unsigned char)i;
+		}
+	}
+}
+
+/*	canonical codes for the lengths, bit reversed for writing LSB first	*/
+static void
+	PNG_build_codes
+	(
+		const unsigned char *lengths, int count,
+		unsigned short *codes
+	)
+{
+	int length_count[16], next_code[16];
+	int i, code = 0;
+	memset( length_count, 0, sizeof(length_count) );
+	for( i = 0; i < count; ++i )
+	{
+		++length_count[lengths[i]];
+	}
+	length_count[0] = 0;
+	for( i = 1; i < 16; ++i )
+	{
+		code = (code + length_count[i - 1]) << 1;
+		next_code[i] = code;
+	}
+	for( i = 0; i < count; ++i )
+	{
+		int length = lengths[i], reversed = 0, c, k;
+		if( length == 0 )
+		{
+			continue;
+		}
+		c = next_code[length]++;
+		for( k = 0; k < length; ++k )
+		{
+			reversed = (reversed << 1) | ((c >> k) & 1);
+		}
+		codes[i] = (unsigned short)reversed;
+	}
+}
+
+/*	gives unused symbols a count until two are used	*/
+static void
+	PNG_use_two
+	(
+		unsigned int *freq, int count
+	)
+{
+	int i, used = 0;
+	for( i = 0; i < count; ++i )
+	{
+		used += (freq[i] > 0);
+	}
+	for( i = 0; (used < 2) && (i < count); ++i )
+	{
+		if( freq[i] == 0 )
+		{
+			freq[i] = 1;
+			++used;
+		}
+	}
+}
+
+/********* Deflate *********/
+
+/*	bits are written LSB first, count being at most 16	*/
+static void
+	PNG_put_bits
+	(
+		PNG_deflate *d,
+		unsigned int value, int count
+	)
+{
+	d->bits |= value << d->bit_count;
+	d->bit_count += count;
+	if( d->bit_count >= 16 )
+	{
+		d->out[d->out_size++] = (unsigned char)d->bits;
+		d->out[d->out_size++] = (unsigned char)(d->bits >> 8);
+		d->bits >>= 16;
+		d->bit_count -= 16;
+	}
+}
+
+/*	pads to a byte boundary	*/
+static void
+	PNG_align
+	(
+		PNG_deflate *d
+	)
+{
+	while( d->bit_count > 0 )
+	{
+		d->out[d->out_size++] = (unsigned char)d->bits;
+		d->bits >>= 8;
+		d->bit_count -= 8;
+	}
+	d->bits = 0;
+	d->bit_count = 0;
+}
+
+static void
+	PNG_write_stored
+	(
+		PNG_deflate *d,
+		const unsigned char *data, int size,
+		int final
+	)
+{
+	do
+	{
+		int n = (size < 65535) ? size : 65535;
+		size -= n;
+		PNG_put_bits( d, (final && (size == 0)) ? 1 : 0, 3 );
+		PNG_align( d );
+		d->out[d->out_size++] = (unsigned char)n;
+		d->out[d->out_size++] = (unsigned char)(n >> 8);
+		d->out[d->out_size++] = (unsigned char)~n;
+		d->out[d->out_size++] = (unsigned char)(~n >> 8);
+		memcpy( d->out + d->out_size, data, n );
+		d->out_size += n;
+		data += n;
+	} while( size > 0 );
+}
+
+/*	Writes the pending symbols as a block with their own Huffman codes,
+	or stored when that is smaller, which it is for noise.	*/
+static void
+	PNG_flush_block
+	(
+		PNG_deflate *d,
+		int block_end,
+		int final
+	)
+{
+	unsigned char literal_lengths[PNG_LITERALS], distance_lengths[PNG_DISTANCES];
+	unsigned short literal_codes[PNG_LITERALS], distance_codes[PNG_DISTANCES];
+	unsigned char code_lengths[PNG_LITERALS + PNG_DISTANCES];
+	unsigned char cl_symbols[PNG_LITERALS + PNG_DISTANCES], cl_extra[PNG_LITERALS + PNG_DISTANCES];
+	unsigned char cl_lengths[PNG_CODE_LENGTHS];
+	unsigned short cl_codes[PNG_CODE_LENGTHS];
+	unsigned int cl_freq[PNG_CODE_LENGTHS];
+	const PNG_job *job = d->job;
+	int literals, distances, cl_count = 0, cl_used, i, n;
+	int raw = block_end - d->block_start;
+	unsigned int dynamic_bits, stored_bits;
+	/*	the codes	*/
+	++d->literal_freq[256];
+	PNG_use_two( d->literal_freq, PNG_LITERALS );
+	PNG_use_two( d->distance_freq, PNG_DISTANCES );
+	PNG_build_lengths( d->literal_freq, PNG_LITERALS, 15, literal_lengths );
+	PNG_build_lengths( d->distance_freq, PNG_DISTANCES, 15, distance_lengths );
+	for( literals = PNG_LITERALS; (literals > 257) && (literal_lengths[literals - 1] == 0); --literals );
+	for( distances = PNG_DISTANCES; (distances > 1) && (distance_lengths[distances - 1] == 0); --distances );
+	/*	their lengths, run length coded	*/
+	memcpy( code_lengths, literal_lengths, literals );
+	memcpy( code_lengths + literals, distance_lengths, distances );
+	n = literals + distances;
+	memset( cl_freq, 0, sizeof(cl_freq) );
+	for( i = 0; i < n; )
+	{
+		int length = code_lengths[i], run = 1;
+		while( (i + run < n) && (code_lengths[i + run] == length) )
+		{
+			++run;
+		}
+		i += run;
+		if( length == 0 )
+		{
+			while( run >= 11 )
+			{
+				int r = (run < 138) ? run : 138;
+				cl_symbols[cl_count] = 18;
+				cl_extra[cl_count++] = (unsigned char)(r - 11);
+				run -= r;
+			}
+			if( run >= 3 )
+			{
+				cl_symbols[cl_count] = 17;
+				cl_extra[cl_count++] = (unsigned char)(run - 3);
+				run = 0;
+			}
+		} else
+		{
+			cl_symbols[cl_count] = (unsigned char)length;
+			cl_extra[cl_count++] = 0;
+			--run;
+			while( run >= 3 )
+			{
+				int r = (run < 6) ? run : 6;
+				cl_symbols[cl_count] = 16;
+				cl_extra[cl_count++] = (unsigned char)(r - 3);
+				run -= r;
+			}
+		}
+		while( run-- > 0 )
+		{
+			cl_symbols[cl_count] = (unsigned char)length;
+			cl_extra[cl_count++] = 0;
+		}
+	}
+	for( i = 0; i < cl_count; ++i )
+	{
+		++cl_freq[cl_symbols[i]];
+	}
+	PNG_use_two( cl_freq, PNG_CODE_LENGTHS );
+	PNG_build_lengths( cl_freq, PNG_CODE_LENGTHS, 7, cl_lengths );
+	for( cl_used = PNG_CODE_LENGTHS; (cl_used > 4) && (cl_lengths[PNG_code_length_order[cl_used - 1]] == 0); --cl_used );
+	/*	which is smaller	*/
+	dynamic_bits = 3 + 14 + 3 * cl_used;
+	for( i = 0; i < cl_count; ++i )
+	{
+		static const int extra[3] = { 2, 3, 7 };
+		dynamic_bits += cl_lengths[cl_symbols[i]] + ((cl_symbols[i] >= 16) ? extra[cl_symbols[i] - 16] : 0);
+	}
+	for( i = 0; i < PNG_LITERALS; ++i )
+	{
+		dynamic_bits += d->literal_freq[i] * (literal_lengths[i] + ((i > 256) ? PNG_length_extra[i - 257] : 0));
+	}
+	for( i = 0; i < PNG_DISTANCES; ++i )
+	{
+		dynamic_bits += d->distance_freq[i] * (distance_lengths[i] + PNG_distance_extra[i]);
+	}
+	stored_bits = 8 * (raw + 5 * (raw / 65535 + 1)) + 7;
+	if( dynamic_bits >= stored_bits )
+	{
+		PNG_write_stored( d, d->in + d->block_start, raw, final );
+	} else
+	{
+		PNG_build_codes( literal_lengths, PNG_LITERALS, literal_codes );
+		PNG_build_codes( distance_lengths, PNG_DISTANCES, distance_codes );
+		PNG_build_codes( cl_lengths, PNG_CODE_LENGTHS, cl_codes );
+		PNG_put_bits( d, final ? 5 : 4, 3 );
+		PNG_put_bits( d, literals - 257, 5 );
+		PNG_put_bits( d, distances - 1, 5 );
+		PNG_put_bits( d, cl_used - 4, 4 );
+		for( i = 0; i < cl_used; ++i )
+		{
+			PNG_put_bits( d, cl_lengths[PNG_code_length_order[i]], 3 );
+		}
+		for( i = 0; i < cl_count; ++i )
+		{
+			static const int extra[3] = { 2, 3, 7 };
+			int s = cl_symbols[i];
+			PNG_put_bits( d, cl_codes[s], cl_lengths[s] );
+			if( s >= 16 )
+			{
+				PNG_put_bits( d, cl_extra[i], extra[s - 16] );
+			}
+		}
+		for( i = 0; i < d->symbols; ++i )
+		{
+			int length = d->lengths[i], distance = d->distances[i];
+			if( distance == 0 )
+			{
+				PNG_put_bits( d, literal_codes[length], literal_lengths[length] );
+			} else
+			{
+				int lc = job->length_code[length];
+				int dc = (distance <= 256) ? job->distance_code[distance - 1] : job->distance_code[256 + ((distance - 1) >> 7)];
+				PNG_put_bits( d, literal_codes[257 + lc], literal_lengths[257 + lc] );
+				if( PNG_length_extra[lc] > 0 )
+				{
+					PNG_put_bits( d, length - PNG_length_base[lc], PNG_length_extra[lc] );
+				}
+				PNG_put_bits( d, distance_codes[dc], distance_lengths[dc] );
+				if( PNG_distance_extra[dc] > 0 )
+				{
+					PNG_put_bits( d, distance - PNG_distance_base[dc], PNG_distance_extra[dc] );
+				}
+			}
+		}
+		PNG_put_bits( d, literal_codes[256], literal_lengths[256] );
+	}
+	d->symbols = 0;
+	d->block_start = block_end;
+	memset( d->literal_freq, 0, sizeof(d->literal_freq) );
+	memset( d->distance_freq, 0, sizeof(d->distance_freq) );
+}
+
+static unsigned int
+	PNG_read_32
+	(
+		const unsigned char *p
+	)
+{
+	unsigned int v;
+	memcpy( &v, p, 4 );
+	return v;
+}
+
+static int
+	PNG_hash
+	(
+		const unsigned char *p
+	)
+{
+	return (int)((PNG_read_32( p ) * 2654435761u) >> (32 - PNG_HASH_BITS));
+}
+
+/*	Hashes the positions up to pos, then pos, and returns the longest
+	match for pos among the positions that came before it.	*/
+static int
+	PNG_find_match
+	(
+		PNG_deflate *d,
+		int pos, int end,
+		int *next_insert,
+		int *distance
+	)
+{
+	const PNG_level *level = d->job->level;
+	const unsigned char *in = d->in;
+	int max_length = (end - pos < PNG_MAX_MATCH) ? end - pos : PNG_MAX_MATCH;
+	int nice = (level->nice < max_length) ? level->nice : max_length;
+	int best = PNG_MIN_MATCH - 1, chain = level->chain;
+	int h, candidate;
+	if( max_length < PNG_MIN_MATCH )
+	{
+		return 0;
+	}
+	for( ; *next_insert < pos; ++*next_insert )
+	{
+		h = PNG_hash( in + *next_insert );
+		d->prev[*next_insert & PNG_WINDOW_MASK] = d->head[h];
+		d->head[h] = *next_insert;
+	}
+	h = PNG_hash( in + pos );
+	candidate = d->head[h];
+	d->prev[pos & PNG_WINDOW_MASK] = candidate;
+	d->head[h] = pos;
+	*next_insert = pos + 1;
+	while( (candidate >= 0) && (pos - candidate < PNG_WINDOW) && (chain-- > 0) )
+	{
+		const unsigned char *a = in + candidate, *b = in + pos;
+		if( (a[best] == b[best]) && (PNG_read_32( a ) == PNG_read_32( b )) )
+		{
+			int length = PNG_MIN_MATCH;
+			while( (length + 4 <= max_length) && (PNG_read_32( a + length ) == PNG_read_32( b + length )) )
+			{
+				length += 4;
+			}
+			while( (length < max_length) && (a[length] == b[length]) )
+			{
+				++length;
+			}
+			if( length > best )
+			{
+				best = length;
+				*distance = pos - candidate;
+				if( length >= nice )
+				{
+					break;
+				}
+			}
+		}
+		candidate = d->prev[candidate & PNG_WINDOW_MASK];
+	}
+	return (best >= PNG_MIN_MATCH) ? best : 0;
+}
+
+static void
+	PNG_literal
+	(
+		PNG_deflate *d,
+		int pos
+	)
+{
+	d->lengths[d->symbols] = d->in[pos];
+	d->distances[d->symbols++] = 0;
+	++d->literal_freq[d->in[pos]];
+	if( d->symbols == PNG_BLOCK_SYMBOLS )
+	{
+		PNG_flush_block( d, pos + 1, 0 );
+	}
+}
+
+static void
+	PNG_match
+	(
+		PNG_deflate *d,
+		int pos, int length, int distance
+	)
+{
+	const PNG_job *job = d->job;
+	d->lengths[d->symbols] = (unsigned short)length;
+	d->distances[d->symbols++] = (unsigned short)distance;
+	++d->literal_freq[257 + job->length_code[length]];
+	++d->distance_freq[(distance <= 256) ? job->distance_code[distance - 1] : job->distance_code[256 + ((distance - 1) >> 7)]];
+	if( d->symbols == PNG_BLOCK_SYMBOLS )
+	{
+		PNG_flush_block( d, pos + length, 0 );
+	}
+}
+
+/*	Deflates in[start, end), matching as far back as the window reaches
+	even before start.  Chunks but the last end with an empty stored
+	block, leaving the next one byte aligned.	*/
+static void
+	PNG_deflate_range
+	(
+		PNG_deflate *d,
+		int start, int end,
+		int final
+	)
+{
+	const PNG_level *level = d->job->level;
+	int pos = start, next_insert = (start > PNG_WINDOW) ? start - PNG_WINDOW : 0;
+	memset( d->head, 0xFF, sizeof(int) << PNG_HASH_BITS );
+	d->block_start = start;
+	while( pos < end )
+	{
+		int distance = 0, length = PNG_find_match( d, pos, end, &next_insert, &distance );
+		if( length == 0 )
+		{
+			PNG_literal( d, pos++ );
+			continue;
+		}
+		/*	a longer match a byte on is worth a literal	*/
+		while( level->lazy && (length < level->nice) && (pos + 1 < end) )
+		{
+			int next_distance = 0, next_length = PNG_find_match( d, pos + 1, end, &next_insert, &next_distance );
+			if( next_length <= length )
+			{
+				break;
+			}
+			PNG_literal( d, pos++ );
+			length = next_length;
+			distance = next_distance;
+		}
+		PNG_match( d, pos, length, distance );
+		pos += length;
+		if( !level->insert_matches && (next_insert < pos) )
+		{
+			next_insert = pos;
+		}
+	}
+	PNG_flush_block( d, end, final );
+	if( !final )
+	{
+		PNG_write_stored( d, d->in + end, 0, 0 );
+	}
+}
+
+static void
+	PNG_deflate_tasks
+	(
+		void *data,
+		int begin, int end
+	)
+{
+	PNG_job *job = (PNG_job*)data;
+	PNG_deflate d;
+	int i;
+	memset( &d, 0, sizeof(PNG_deflate) );
+	d.job = job;
+	d.in = job->filtered;
+	d.head = (int*)malloc( sizeof(int) << PNG_HASH_BITS );
+	d.prev = (int*)malloc( sizeof(int) * PNG_WINDOW );
+	d.lengths = (unsigned short*)malloc( sizeof(unsigned short) * PNG_BLOCK_SYMBOLS );
+	d.distances = (unsigned short*)malloc( sizeof(unsigned short) * PNG_BLOCK_SYMBOLS );
+	for( i = begin; i < end; ++i )
+	{
+		PNG_chunk *chunk = &job->chunks[i];
+		int start = chunk->first_row * job->row_bytes;
+		int size = chunk->rows * job->row_bytes;
+		/*	room for it stored, and the chunk around it	*/
+		int capacity = size + size / 1024 + 64;
+		if( chunk->failed || (NULL == d.head) || (NULL == d.prev) ||
+			(NULL == d.lengths) || (NULL == d.distances) ||
+			(NULL == (chunk->data = (unsigned char*)malloc( capacity ))) )
+		{
+			chunk->failed = 1;
+			continue;
+		}
+		d.out = chunk->data;
+		d.out_size = 8;
+		memcpy( d.out + 4, "IDAT", 4 );
+		if( i == 0 )
+		{
+			/*	the zlib header: deflate, 32KB window	*/
+			d.out[d.out_size++] = 0x78;
+			d.out[d.out_size++] = 0x01;
+		}
+		PNG_deflate_range( &d, start, start + size, i == job->chunk_count - 1 );
+		PNG_align( &d );
+		PNG_put_32( d.out, d.out_size - 8 );
+		PNG_put_32( d.out + d.out_size, PNG_crc( d.job->crc_table, 0, d.out + 4, d.out_size - 4 ) );
+		chunk->size = d.out_size + 4;
+		chunk->adler = PNG_adler32( job->filtered + start, size );
+	}
+	free( d.head );
+	free( d.prev );
+	free( d.lengths );
+	free( d.distances );
+}
+
+/********* PNG files *********/
+
+static unsigned char*
+	PNG_write_chunk
+	(
+		const PNG_job *job,
+		unsigned char *out,
+		const char *type,
+		const unsigned char *data, int size
+	)
+{
+	PNG_put_32( out, size );
+	memcpy( out + 4, type, 4 );
+	if( size > 0 )
+	{
+		memcpy( out + 8, data, size );
+	}
+	PNG_put_32( out + 8 + size, PNG_crc( job->crc_table, 0, out + 4, size + 4 ) );
+	return out + 12 + size;
+}
+
+unsigned char*
+	convert_image_to_PNG
+	(
+		const unsigned char *const data,
+		int width, int height, int channels,
+		int level,
+		PNG_parallel_for parallel_for, void *context,
+		int *out_size
+	)
+{
+	static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	/*	colour types for 1 to 4 channels: grey, grey + alpha, RGB, RGBA	*/
+	static const unsigned char colour_type[5] = { 0, 0, 4, 2, 6 };
+	PNG_job job;
+	unsigned char header[13], adler[4], *png = NULL, *out;
+	int rows_per_chunk, i, j, size, failed = 0;
+	unsigned int checksum;
+	/*	error check	*/
+	*out_size = 0;
+	if( (width < 1) || (height < 1) ||
+		(channels < 1) || (channels > 4) ||
+		(data == NULL) ||
+		((double)height * (width * (double)channels + 1) > INT_MAX / 2) )
+	{
+		return NULL;
+	}
+	memset( &job, 0, sizeof(PNG_job) );
+	job.image = data;
+	job.width = width;
+	job.height = height;
+	job.channels = channels;
+	job.row_bytes = width * channels + 1;
+	job.level = &PNG_levels[(level < 0) ? 0 : (level > PNG_LEVEL_BEST) ? PNG_LEVEL_BEST : level];
+	PNG_make_crc_table( job.crc_table );
+	for( i = 0; i < 29; ++i )
+	{
+		for( j = PNG_length_base[i]; (j < PNG_length_base[i] + (1 << PNG_length_extra[i])) && (j <= PNG_MAX_MATCH); ++j )
+		{
+			job.length_code[j] = (unsigned char)i;
+		}
+	}
+	for( i = 0; i < PNG_DISTANCES; ++i )
+	{
+		for( j = PNG_distance_base[i]; j < PNG_distance_base[i] + (1 << PNG_distance_extra[i]); ++j )
+		{
+			job.distance_code[(j <= 256) ? j - 1 : 256 + ((j - 1) >> 7)] = (unsigned char)i;
+		}
+	}
+	/*	cut the rows into chunks	*/
+	rows_per_chunk = PNG_CHUNK_BYTES / job.row_bytes;
+	if( rows_per_chunk < 1 )
+	{
+		rows_per_chunk = 1;
+	}
+	job.chunk_count = (height + rows_per_chunk - 1) / rows_per_chunk;
+	job.chunks = (PNG_chunk*)calloc( job.chunk_count, sizeof(PNG_chunk) );
+	job.filtered = (unsigned char*)malloc( height * job.row_bytes );
+	if( (NULL == job.chunks) || (NULL == job.filtered) )
+	{
+		free( job.chunks );
+		free( job.filtered );
+		return NULL;
+	}
+	for( i = 0; i < job.chunk_count; ++i )
+	{
+		job.chunks[i].first_row = i * rows_per_chunk;
+		job.chunks[i].rows = (height - i * rows_per_chunk < rows_per_chunk) ? height - i * rows_per_chunk : rows_per_chunk;
+	}
+	/*	filter every row first, as chunks match into the rows before them	*/
+	if( (NULL != parallel_for) && (job.chunk_count > 1) )
+	{
+		parallel_for( context, job.chunk_count, PNG_filter_tasks, &job );
+		parallel_for( context, job.chunk_count, PNG_deflate_tasks, &job );
+	} else
+	{
+		PNG_filter_tasks( &job, 0, job.chunk_count );
+		PNG_deflate_tasks( &job, 0, job.chunk_count );
+	}
+	/*	join the chunks	*/
+	size = 8 + (12 + 13) + (12 + 4) + 12;
+	checksum = 1;
+	for( i = 0; i < job.chunk_count; ++i )
+	{
+		failed |= job.chunks[i].failed;
+		size += job.chunks[i].size;
+		checksum = PNG_adler32_combine( checksum, job.chunks[i].adler, job.chunks[i].rows * job.row_bytes );
+	}
+	if( !failed )
+	{
+		png = (unsigned char*)malloc( size );
+	}
+	if( NULL != png )
+	{
+		memcpy( png, signature, 8 );
+		PNG_put_32( header, width );
+		PNG_put_32( header + 4, height );
+		header[8] = 8;
+		header[9] = colour_type[channels];
+		header[10] = header[11] = header[12] = 0;
+		out = PNG_write_chunk( &job, png + 8, "IHDR", header, 13 );
+		for( i = 0; i < job.chunk_count; ++i )
+		{
+			memcpy( out, job.chunks[i].data, job.chunks[i].size );
+			out += job.chunks[i].size;
+		}
+		/*	the zlib stream ends in its own IDAT, once every chunk is summed	*/
+		PNG_put_32( adler, checksum );
+		out = PNG_write_chunk( &job, out, "IDAT", adler, 4 );
+		PNG_write_chunk( &job, out, "IEND", NULL, 0 );
+		*out_size = size;
+	}
+	for( i = 0; i < job.chunk_count; ++i )
+	{
+		free( job.chunks[i].data );
+	}
+	free( job.chunks );
+	free( job.filtered );
+	return png;
+}
+
+int
+	save_image_as_PNG
+	(
+		const char *filename,
+		int width, int height, int channels,
+		const unsigned char *const data,
+		int level,
+		PNG_parallel_for parallel_for, void *context
+	)
+{
+	FILE *fout;
+	unsigned char *png;
+	int png_size, written;
+	if( NULL == filename )
+	{
+		return 0;
+	}
+	png = convert_image_to_PNG( data, width, height, channels, level, parallel_for, context, &png_size );
+	if( NULL == png )
+	{
+		return 0;
+	}
+	fout = fopen( filename, "wb" );
+	written = (NULL != fout) && (fwrite( png, 1, png_size, fout ) == (size_t)png_size);
+	if( (NULL != fout) && (fclose( fout ) != 0) )
+	{
+		written = 0;
+	}
+	free( png );
+	return written;
+}
@@ -0,0 +1,55 @@
+/*
+	PNG writing for SOIL: rows get the adaptive filter that suits them,
+	then a built-in deflate encoder compresses chunks of rows on
+	separate threads.
+
+	public domain
+*/
+
+#ifndef HEADER_IMAGE_PNG
+#define HEADER_IMAGE_PNG
+
+/**
+	Runs task( data, begin, end ) on ranges covering [0, count), as
+	SOIL_parallel_for does.  NULL runs everything on the calling thread.
+**/
+typedef void (*PNG_parallel_for)( void *context, int count, void (*task)( void *data, int begin, int end ), void *data );
+
+/**
+	Compression levels, fastest first.  Out of range levels are clamped.
+	0 takes the first match it hashes to, for captures; 3 searches long
+	hash chains for the smallest files.
+**/
+#define PNG_LEVEL_FASTEST	0
+#define PNG_LEVEL_BEST		3
+
+/**
+	Converts an image from an array of unsigned chars (1 to 4 channels)
+	to PNG, then saves the converted image to disk.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+save_image_as_PNG
+(
+    const char *filename,
+    int width, int height, int channels,
+    const unsigned char *const data,
+    int level,
+    PNG_parallel_for parallel_for, void *context
+);
+
+/**
+	take an image and convert it to a PNG file in memory, to be freed
+	with free().  The bytes are the same on any number of threads.
+**/
+unsigned char*
+convert_image_to_PNG
+(
+    const unsigned char *const data,
+    int width, int height, int channels,
+    int level,
+    PNG_parallel_for parallel_for, void *context,
+    int *out_size
+);
+
+#endif /* HEADER_IMAGE_PNG	*/
@@ -8,8 +8,229 @@
 
 #include "image_helper.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define IMAGE_HELPER_SSE 1
+#endif
+
+/*	bytes of a row transformed at a time: whole pixels for any channel
+	count, whole SSE registers, and small enough to stay in the L1 cache	*/
+#define TRANSFORM_CHUNK 3072
+
+unsigned char clamp_byte( int x );
+
+/*	[0,255] to [16,235] on the colour bytes of a span of whole pixels.
+	((i * 1767 + 1000) >> 11) + 15 equals the float scale of the old
+	look up table for every byte value.	*/
+static void
+	NTSC_safe_span
+	(
+		unsigned char* p,
+		int n, int channels
+	)
+{
+	int i = 0;
+#ifdef IMAGE_HELPER_SSE
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16( 1 );
+	const __m128i offset = _mm_set1_epi16( 15 );
+	/*	(x, 1) lane pairs times (1767, 1000)	*/
+	const __m128i scale = _mm_set1_epi32( (1000 << 16) | 1767 );
+	/*	alpha bytes are kept	*/
+	const __m128i alpha =
+		(channels == 2) ? _mm_set1_epi16( (short)0xFF00 ) :
+		(channels == 4) ? _mm_set1_epi32( (int)0xFF000000 ) : zero;
+	for( ; i + 16 <= n; i += 16 )
+	{
+		__m128i v = _mm_loadu_si128( (const __m128i*)(p + i) );
+		__m128i lo = _mm_unpacklo_epi8( v, zero );
+		__m128i hi = _mm_unpackhi_epi8( v, zero );
+		__m128i a = _mm_srli_epi32( _mm_madd_epi16( _mm_unpacklo_epi16( lo, one ), scale ), 11 );
+		__m128i b = _mm_srli_epi32( _mm_madd_epi16( _mm_unpackhi_epi16( lo, one ), scale ), 11 );
+		__m128i c = _mm_srli_epi32( _mm_madd_epi16( _mm_unpacklo_epi16( hi, one ), scale ), 11 );
+		__m128i d = _mm_srli_epi32( _mm_madd_epi16( _mm_unpackhi_epi16( hi, one ), scale ), 11 );
+		lo = _mm_add_epi16( _mm_packs_epi32( a, b ), offset );
+		hi = _mm_add_epi16( _mm_packs_epi32( c, d ), offset );
+		v = _mm_or_si128( _mm_and_si128( alpha, v ),
+			_mm_andnot_si128( alpha, _mm_packus_epi16( lo, hi ) ) );
+		_mm_storeu_si128( (__m128i*)(p + i), v );
+	}
+#endif
+	for( ; i < n; ++i )
+	{
+		if( ((channels == 2) && ((i & 1) == 1)) ||
+			((channels == 4) && ((i & 3) == 3)) )
+		{
+			continue;
+		}
+		p[i] = (unsigned char)(((p[i] * 1767 + 1000) >> 11) + 15);
+	}
+}
+
+#ifdef IMAGE_HELPER_SSE
+/*	(x * alpha + 128) >> 8 on 16-bit lanes, except where keep is set	*/
+static __m128i
+	multiply_alpha_lanes
+	(
+		__m128i x, __m128i alpha, __m128i keep
+	)
+{
+	__m128i m = _mm_srli_epi16( _mm_add_epi16( _mm_mullo_epi16( x, alpha ), _mm_set1_epi16( 128 ) ), 8 );
+	return _mm_or_si128( _mm_and_si128( keep, x ), _mm_andnot_si128( keep, m ) );
+}
+#endif
+
+/*	straight to pre-multiplied alpha on a span of whole pixels	*/
+static void
+	multiply_alpha_span
+	(
+		unsigned char* p,
+		int n, int channels
+	)
+{
+	int i = 0;
+	if( (channels != 2) && (channels != 4) )
+	{
+		/*	no other number of channels contains alpha data	*/
+		return;
+	}
+#ifdef IMAGE_HELPER_SSE
+	{
+		const __m128i zero = _mm_setzero_si128();
+		if( channels == 4 )
+		{
+			const __m128i keep = _mm_set_epi16( -1, 0, 0, 0, -1, 0, 0, 0 );
+			for( ; i + 16 <= n; i += 16 )
+			{
+				__m128i v = _mm_loadu_si128( (const __m128i*)(p + i) );
+				__m128i lo = _mm_unpacklo_epi8( v, zero );
+				__m128i hi = _mm_unpackhi_epi8( v, zero );
+				lo = multiply_alpha_lanes( lo, _mm_shufflehi_epi16( _mm_shufflelo_epi16( lo,
+					_MM_SHUFFLE( 3, 3, 3, 3 ) ), _MM_SHUFFLE( 3, 3, 3, 3 ) ), keep );
+				hi = multiply_alpha_lanes( hi, _mm_shufflehi_epi16( _mm_shufflelo_epi16( hi,
+					_MM_SHUFFLE( 3, 3, 3, 3 ) ), _MM_SHUFFLE( 3, 3, 3, 3 ) ), keep );
+				_mm_storeu_si128( (__m128i*)(p + i), _mm_packus_epi16( lo, hi ) );
+			}
+		} else
+		{
+			const __m128i keep = _mm_set_epi16( -1, 0, -1, 0, -1, 0, -1, 0 );
+			for( ; i + 16 <= n; i += 16 )
+			{
+				__m128i v = _mm_loadu_si128( (const __m128i*)(p + i) );
+				__m128i lo = _mm_unpacklo_epi8( v, zero );
+				__m128i hi = _mm_unpackhi_epi8( v, zero );
+				lo = multiply_alpha_lanes( lo, _mm_shufflehi_epi16( _mm_shufflelo_epi16( lo,
+					_MM_SHUFFLE( 3, 3, 1, 1 ) ), _MM_SHUFFLE( 3, 3, 1, 1 ) ), keep );
+				hi = multiply_alpha_lanes( hi, _mm_shufflehi_epi16( _mm_shufflelo_epi16( hi,
+					_MM_SHUFFLE( 3, 3, 1, 1 ) ), _MM_SHUFFLE( 3, 3, 1, 1 ) ), keep );
+				_mm_storeu_si128( (__m128i*)(p + i), _mm_packus_epi16( lo, hi ) );
+			}
+		}
+	}
+#endif
+	if( channels == 2 )
+	{
+		for( ; i < n; i += 2 )
+		{
+			p[i] = (p[i] * p[i+1] + 128) >> 8;
+		}
+	} else
+	{
+		for( ; i < n; i += 4 )
+		{
+			p[i+0] = (p[i+0] * p[i+3] + 128) >> 8;
+			p[i+1] = (p[i+1] * p[i+3] + 128) >> 8;
+			p[i+2] = (p[i+2] * p[i+3] + 128) >> 8;
+		}
+	}
+}
+
+#ifdef IMAGE_HELPER_SSE
+/*	four RGBA pixels, one per 32-bit lane, to CoCgAY	*/
+static __m128i
+	RGBA_to_YCoCg_pixels
+	(
+		__m128i v
+	)
+{
+	const __m128i byte = _mm_set1_epi32( 0xFF );
+	const __m128i one = _mm_set1_epi32( 1 );
+	const __m128i half = _mm_set1_epi32( 128 );
+	__m128i r = _mm_and_si128( v, byte );
+	__m128i g = _mm_and_si128( _mm_srli_epi32( v, 8 ), byte );
+	__m128i b = _mm_and_si128( _mm_srli_epi32( v, 16 ), byte );
+	__m128i a = _mm_srli_epi32( v, 24 );
+	__m128i tmp = _mm_srli_epi32( _mm_add_epi32( _mm_add_epi32( r, b ), _mm_set1_epi32( 2 ) ), 2 );
+	__m128i co = _mm_add_epi32( half, _mm_srai_epi32( _mm_add_epi32( _mm_sub_epi32( r, b ), one ), 1 ) );
+	__m128i cg, y;
+	g = _mm_srli_epi32( _mm_add_epi32( g, one ), 1 );
+	cg = _mm_sub_epi32( _mm_add_epi32( half, g ), tmp );
+	y = _mm_add_epi32( g, tmp );
+	/*	all three are in [0,256], so clamp_byte is a 16-bit min with 255	*/
+	co = _mm_min_epi16( co, byte );
+	cg = _mm_min_epi16( cg, byte );
+	y = _mm_min_epi16( y, byte );
+	return _mm_or_si128(
+		_mm_or_si128( co, _mm_slli_epi32( cg, 8 ) ),
+		_mm_or_si128( _mm_slli_epi32( a, 16 ), _mm_slli_epi32( y, 24 ) ) );
+}
+#endif
+
+/*	RGB to CoYCg, RGBA to CoCgAY, on a span of whole pixels	*/
+static void
+	RGB_to_YCoCg_span
+	(
+		unsigned char* p,
+		int n, int channels
+	)
+{
+	int i = 0;
+	if( channels == 3 )
+	{
+		/*	3 byte pixels don't line up with the lanes, this one stays scalar	*/
+		for( ; i < n; i += 3 )
+		{
+			int r = p[i+0];
+			int g = (p[i+1] + 1) >> 1;
+			int b = p[i+2];
+			int tmp = (2 + r + b) >> 2;
+			/*	Co	*/
+			p[i+0] = clamp_byte( 128 + ((r - b + 1) >> 1) );
+			/*	Y	*/
+			p[i+1] = clamp_byte( g + tmp );
+			/*	Cg	*/
+			p[i+2] = clamp_byte( 128 + g - tmp );
+		}
+		return;
+	}
+#ifdef IMAGE_HELPER_SSE
+	for( ; i + 16 <= n; i += 16 )
+	{
+		__m128i v = _mm_loadu_si128( (const __m128i*)(p + i) );
+		_mm_storeu_si128( (__m128i*)(p + i), RGBA_to_YCoCg_pixels( v ) );
+	}
+#endif
+	for( ; i < n; i += 4 )
+	{
+		int r = p[i+0];
+		int g = (p[i+1] + 1) >> 1;
+		int b = p[i+2];
+		unsigned char a = p[i+3];
+		int tmp = (2 + r + b) >> 2;
+		/*	Co	*/
+		p[i+0] = clamp_byte( 128 + ((r - b + 1) >> 1) );
+		/*	Cg	*/
+		p[i+1] = clamp_byte( 128 + g - tmp );
+		/*	Alpha	*/
+		p[i+2] = a;
+		/*	Y	*/
+		p[i+3] = clamp_byte( g + tmp );
+	}
+}
+
 /*	Upscaling the image uses simple bilinear interpolation	*/
 int
 	up_scale_image
@@ -158,11 +379,6 @@ int
 		int width, int height, int channels
 	)
 {
-	const float scale_lo = 16.0f - 0.499f;
-	const float scale_hi = 235.0f + 0.499f;
-	int i, j;
-	int nc = channels;
-	unsigned char scale_LUT[256];
 	/*	error check	*/
 	if( (width < 1) || (height < 1) ||
 		(channels < 1) || (orig == NULL) )
@@ -170,21 +386,8 @@ int
 		/*	nothing to do	*/
 		return 0;
 	}
-	/*	set up the scaling Look Up Table	*/
-	for( i = 0; i < 256; ++i )
-	{
-		scale_LUT[i] = (unsigned char)((scale_hi - scale_lo) * i / 255.0f + scale_lo);
-	}
 	/*	for channels = 2 or 4, ignore the alpha component	*/
-	nc -= 1 - (channels & 1);
-	/*	OK, go through the image and scale any non-alpha components	*/
-	for( i = 0; i < width*height*channels; i += channels )
-	{
-		for( j = 0; j < nc; ++j )
-		{
-			orig[i+j] = scale_LUT[orig[i+j]];
-		}
-	}
+	NTSC_safe_span( orig, width*height*channels, channels );
 	return 1;
 }
 
@@ -204,7 +407,6 @@ int
 		int width, int height, int channels
 	)
 {
-	int i;
 	/*	error check	*/
 	if( (width < 1) || (height < 1) ||
 		(channels < 3) || (channels > 4) ||
@@ -214,40 +416,7 @@ int
 		return -1;
 	}
 	/*	do the conversion	*/
-	if( channels == 3 )
-	{
-		for( i = 0; i < width*height*3; i += 3 )
-		{
-			int r = orig[i+0];
-			int g = (orig[i+1] + 1) >> 1;
-			int b = orig[i+2];
-			int tmp = (2 + r + b) >> 2;
-			/*	Co	*/
-			orig[i+0] = clamp_byte( 128 + ((r - b + 1) >> 1) );
-			/*	Y	*/
-			orig[i+1] = clamp_byte( g + tmp );
-			/*	Cg	*/
-			orig[i+2] = clamp_byte( 128 + g - tmp );
-		}
-	} else
-	{
-		for( i = 0; i < width*height*4; i += 4 )
-		{
-			int r = orig[i+0];
-			int g = (orig[i+1] + 1) >> 1;
-			int b = orig[i+2];
-			unsigned char a = orig[i+3];
-			int tmp = (2 + r + b) >> 2;
-			/*	Co	*/
-			orig[i+0] = clamp_byte( 128 + ((r - b + 1) >> 1) );
-			/*	Cg	*/
-			orig[i+1] = clamp_byte( 128 + g - tmp );
-			/*	Alpha	*/
-			orig[i+2] = a;
-			/*	Y	*/
-			orig[i+3] = clamp_byte( g + tmp );
-		}
-	}
+	RGB_to_YCoCg_span( orig, width*height*channels, channels );
 	/*	done	*/
 	return 0;
 }
@@ -433,3 +602,694 @@ RGBE_to_RGBdivA2
 	}
 	return 1;
 }
+
+int
+	copy_and_transform_image
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* transformed,
+		unsigned int transforms
+	)
+{
+	int row = width * channels;
+	int j, k;
+	/*	error check	*/
+	if( (width < 1) || (height < 1) ||
+		(channels < 1) || (channels > 4) ||
+		(orig == NULL) || (transformed == NULL) )
+	{
+		/*	nothing to do	*/
+		return 0;
+	}
+	if( channels < 3 )
+	{
+		/*	YCoCg needs RGB	*/
+		transforms &= ~IMAGE_TRANSFORM_RGB_TO_YCoCg;
+	}
+	for( j = 0; j < height; ++j )
+	{
+		/*	inverting is only a matter of which row to read	*/
+		const unsigned char *src = orig + (size_t)row *
+			((transforms & IMAGE_TRANSFORM_INVERT_Y) ? height - 1 - j : j);
+		unsigned char *dst = transformed + (size_t)row * j;
+		/*	every transform runs on a chunk while it is still in the cache	*/
+		for( k = 0; k < row; k += TRANSFORM_CHUNK )
+		{
+			int n = (row - k < TRANSFORM_CHUNK) ? row - k : TRANSFORM_CHUNK;
+			memcpy( dst + k, src + k, n );
+			if( transforms & IMAGE_TRANSFORM_NTSC_SAFE_RGB )
+			{
+				NTSC_safe_span( dst + k, n, channels );
+			}
+			if( transforms & IMAGE_TRANSFORM_MULTIPLY_ALPHA )
+			{
+				multiply_alpha_span( dst + k, n, channels );
+			}
+			if( transforms & IMAGE_TRANSFORM_RGB_TO_YCoCg )
+			{
+				RGB_to_YCoCg_span( dst + k, n, channels );
+			}
+		}
+	}
+	return 1;
+}
+
+/*	MIP-map pyramids.  Each level is filtered from the one above it.  The
+	box filter on even sizes is an exact 2x2 average in integers; any other
+	reduction is separable, in floats, with weights worked out per axis.	*/
+
+/*	Kaiser and Lanczos reach this far, in texels of the smaller level	*/
+#define MIP_FILTER_RADIUS 3.0
+#define MIP_KAISER_ALPHA 4.0
+
+typedef struct
+{
+	int taps;			/*	per texel of the smaller level	*/
+	int* index;			/*	[size * taps] of the source texel, times the stride	*/
+	float* weight;		/*	[size * taps], summing to 1	*/
+} mip_axis;
+
+static int
+	mip_reduced_size
+	(
+		int size
+	)
+{
+	return (size > 1) ? size / 2 : 1;
+}
+
+int
+	mip_pyramid_levels
+	(
+		int width, int height
+	)
+{
+	int levels = 1;
+	while( (width > 1) || (height > 1) )
+	{
+		width = mip_reduced_size( width );
+		height = mip_reduced_size( height );
+		++levels;
+	}
+	return levels;
+}
+
+int
+	mip_pyramid_offset
+	(
+		int width, int height, int channels,
+		int level
+	)
+{
+	int offset = 0;
+	int i;
+	for( i = 0; i < level; ++i )
+	{
+		offset += width * height * channels;
+		width = mip_reduced_size( width );
+		height = mip_reduced_size( height );
+	}
+	return offset;
+}
+
+#ifdef IMAGE_HELPER_SSE
+/*	the horizontal pair sums of 16 bytes of whole pixels, from the vertical
+	sums of their low and high halves, as 8 16-bit lanes	*/
+static __m128i
+	mip_box_pairs
+	(
+		__m128i lo, __m128i hi,
+		int channels
+	)
+{
+	if( channels == 4 )
+	{
+		return _mm_add_epi16( _mm_unpacklo_epi64( lo, hi ), _mm_unpackhi_epi64( lo, hi ) );
+	} else if( channels == 2 )
+	{
+		__m128 a = _mm_castsi128_ps( lo );
+		__m128 b = _mm_castsi128_ps( hi );
+		return _mm_add_epi16(
+			_mm_castps_si128( _mm_shuffle_ps( a, b, _MM_SHUFFLE( 2, 0, 2, 0 ) ) ),
+			_mm_castps_si128( _mm_shuffle_ps( a, b, _MM_SHUFFLE( 3, 1, 3, 1 ) ) ) );
+	} else
+	{
+		const __m128i one = _mm_set1_epi16( 1 );
+		return _mm_packs_epi32( _mm_madd_epi16( lo, one ), _mm_madd_epi16( hi, one ) );
+	}
+}
+#endif
+
+/*	one row of 2x2 averages, rounded as mipmap_image rounds them	*/
+static void
+	mip_box_row
+	(
+		const unsigned char* r0, const unsigned char* r1,
+		unsigned char* out,
+		int mip_width, int channels
+	)
+{
+	int n = mip_width * channels;
+	int i = 0;
+#ifdef IMAGE_HELPER_SSE
+	/*	3 byte pixels don't line up with the lanes, they stay scalar	*/
+	if( channels != 3 )
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i two = _mm_set1_epi16( 2 );
+		for( ; i + 16 <= n; i += 16 )
+		{
+			__m128i a0 = _mm_loadu_si128( (const __m128i*)(r0 + 2*i) );
+			__m128i a1 = _mm_loadu_si128( (const __m128i*)(r1 + 2*i) );
+			__m128i b0 = _mm_loadu_si128( (const __m128i*)(r0 + 2*i + 16) );
+			__m128i b1 = _mm_loadu_si128( (const __m128i*)(r1 + 2*i + 16) );
+			__m128i a = mip_box_pairs(
+				_mm_add_epi16( _mm_unpacklo_epi8( a0, zero ), _mm_unpacklo_epi8( a1, zero ) ),
+				_mm_add_epi16( _mm_unpackhi_epi8( a0, zero ), _mm_unpackhi_epi8( a1, zero ) ),
+				channels );
+			__m128i b = mip_box_pairs(
+				_mm_add_epi16( _mm_unpacklo_epi8( b0, zero ), _mm_unpacklo_epi8( b1, zero ) ),
+				_mm_add_epi16( _mm_unpackhi_epi8( b0, zero ), _mm_unpackhi_epi8( b1, zero ) ),
+				channels );
+			a = _mm_srli_epi16( _mm_add_epi16( a, two ), 2 );
+			b = _mm_srli_epi16( _mm_add_epi16( b, two ), 2 );
+			_mm_storeu_si128( (__m128i*)(out + i), _mm_packus_epi16( a, b ) );
+		}
+	}
+#endif
+	for( ; i < n; ++i )
+	{
+		/*	i is channel c of texel x, which reads texels 2x and 2x+1	*/
+		int s = 2*i - i % channels;
+		out[i] = (r0[s] + r0[s + channels] + r1[s] + r1[s + channels] + 2) >> 2;
+	}
+}
+
+/*	halves an image whose sides are each even or 1	*/
+static void
+	mip_box_2x2
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* resampled
+	)
+{
+	int mip_width = mip_reduced_size( width );
+	int mip_height = mip_reduced_size( height );
+	int row = width * channels;
+	int i, j;
+	for( j = 0; j < mip_height; ++j )
+	{
+		/*	a side of 1 averages a texel with itself	*/
+		const unsigned char *r0 = orig + (size_t)row * ((height > 1) ? 2*j : 0);
+		const unsigned char *r1 = (height > 1) ? r0 + row : r0;
+		unsigned char *out = resampled + (size_t)mip_width * channels * j;
+		if( width > 1 )
+		{
+			mip_box_row( r0, r1, out, mip_width, channels );
+		} else
+		{
+			for( i = 0; i < channels; ++i )
+			{
+				out[i] = (r0[i] + r1[i] + 1) >> 1;
+			}
+		}
+	}
+}
+
+static double
+	mip_sinc
+	(
+		double x
+	)
+{
+	const double pi = 3.14159265358979323846;
+	return (fabs( x ) < 1e-9) ? 1.0 : sin( pi * x ) / (pi * x);
+}
+
+static double
+	mip_bessel_I0
+	(
+		double x
+	)
+{
+	double sum = 1.0, term = 1.0;
+	int k;
+	for( k = 1; k < 32; ++k )
+	{
+		term *= (x * x) / (4.0 * k * k);
+		sum += term;
+	}
+	return sum;
+}
+
+/*	t is in texels of the smaller level	*/
+static double
+	mip_filter_weight
+	(
+		int filter,
+		double t
+	)
+{
+	double s;
+	if( fabs( t ) >= MIP_FILTER_RADIUS )
+	{
+		return 0.0;
+	}
+	s = t / MIP_FILTER_RADIUS;
+	if( filter == MIP_FILTER_KAISER )
+	{
+		return mip_sinc( t ) * mip_bessel_I0( MIP_KAISER_ALPHA * sqrt( 1.0 - s * s ) ) /
+			mip_bessel_I0( MIP_KAISER_ALPHA );
+	}
+	return mip_sinc( t ) * mip_sinc( s );
+}
+
+static int
+	mip_axis_taps
+	(
+		int size, int mip_size,
+		int filter
+	)
+{
+	double scale = (double)size / mip_size;
+	double radius = (filter == MIP_FILTER_BOX) ? 0.5 : MIP_FILTER_RADIUS;
+	if( size == mip_size )
+	{
+		/*	a side of 1 stays as it is	*/
+		return 1;
+	}
+	if( (filter == MIP_FILTER_BOX) && (size % mip_size == 0) )
+	{
+		/*	the footprint starts on a texel	*/
+		return size / mip_size;
+	}
+	/*	the texels the footprint touches, wherever it starts	*/
+	return (int)ceil( 2.0 * radius * scale ) + 1;
+}
+
+/*	Texel o of the smaller level covers [o, o+1) * size / mip_size of the
+	source.  The box weights each source texel by how much of it is covered,
+	so odd sizes blend three texels and lose none; the others weigh them
+	by the filter at their centres.  Texels past the edges repeat the edge.	*/
+static void
+	mip_axis_weights
+	(
+		int size, int mip_size,
+		int filter, int stride,
+		mip_axis* axis
+	)
+{
+	double scale = (double)size / mip_size;
+	double radius = ((filter == MIP_FILTER_BOX) ? 0.5 : MIP_FILTER_RADIUS) * scale;
+	int o, k;
+	for( o = 0; o < mip_size; ++o )
+	{
+		double centre = (o + 0.5) * scale;
+		int first = (size == mip_size) ? o : (int)floor( centre - radius );
+		int *index = axis->index + o * axis->taps;
+		float *weight = axis->weight + o * axis->taps;
+		double w[64], sum = 0.0;
+		for( k = 0; k < axis->taps; ++k )
+		{
+			int x = first + k;
+			if( size == mip_size )
+			{
+				w[k] = 1.0;
+			} else if( filter == MIP_FILTER_BOX )
+			{
+				double lo = (x > o * scale) ? x : o * scale;
+				double hi = (x + 1 < (o + 1) * scale) ? x + 1 : (o + 1) * scale;
+				w[k] = (hi > lo) ? hi - lo : 0.0;
+			} else
+			{
+				w[k] = mip_filter_weight( filter, (x + 0.5 - centre) / scale );
+			}
+			sum += w[k];
+			index[k] = ((x < 0) ? 0 : (x >= size) ? size - 1 : x) * stride;
+		}
+		for( k = 0; k < axis->taps; ++k )
+		{
+			weight[k] = (float)(w[k] / sum);
+		}
+	}
+}
+
+static double
+	mip_sRGB_to_linear
+	(
+		double x
+	)
+{
+	return (x <= 0.04045) ? x / 12.92 : pow( (x + 0.055) / 1.055, 2.4 );
+}
+
+/*	floats on the byte scale, and the byte each float rounds to	*/
+typedef struct
+{
+	int channels;
+	int colours;				/*	the channels before alpha	*/
+	int linear_light;
+	float to_float[256];		/*	colour bytes, linear when linear_light	*/
+	float threshold[256];		/*	the least linear value of bytes 1 to 255, then past 255	*/
+	unsigned char guess[1024];	/*	the byte at the start of each 1/1024th of the scale	*/
+} mip_encoding;
+
+static void
+	mip_encoding_init
+	(
+		int channels, int linear_light,
+		mip_encoding* encoding
+	)
+{
+	int i, b;
+	encoding->channels = channels;
+	encoding->colours = ((channels & 1) == 1) ? channels : channels - 1;
+	encoding->linear_light = linear_light;
+	for( i = 0; i < 256; ++i )
+	{
+		encoding->to_float[i] = linear_light ?
+			(float)(255.0 * mip_sRGB_to_linear( i / 255.0 )) : (float)i;
+	}
+	for( i = 0; i < 255; ++i )
+	{
+		/*	halfway between two bytes, in sRGB	*/
+		encoding->threshold[i] = (float)(255.0 * mip_sRGB_to_linear( (i + 0.5) / 255.0 ));
+	}
+	encoding->threshold[255] = 1e30f;
+	/*	the byte a 1/1024th of the scale starts at, which leaves a value a
+		few thresholds at most to step past	*/
+	for( i = 0, b = 0; i < 1024; ++i )
+	{
+		while( i * (255.0f / 1024) >= encoding->threshold[b] )
+		{
+			++b;
+		}
+		encoding->guess[i] = (unsigned char)b;
+	}
+}
+
+static void
+	mip_decode_row
+	(
+		const unsigned char* p,
+		int n,
+		const mip_encoding* encoding,
+		float* out
+	)
+{
+	int i, c;
+	if( encoding->colours == encoding->channels )
+	{
+		for( i = 0; i < n; ++i )
+		{
+			out[i] = encoding->to_float[p[i]];
+		}
+		return;
+	}
+	for( i = 0; i < n; i += encoding->channels )
+	{
+		for( c = 0; c < encoding->colours; ++c )
+		{
+			out[i + c] = encoding->to_float[p[i + c]];
+		}
+		/*	alpha is coverage, already linear	*/
+		out[i + c] = p[i + c];
+	}
+}
+
+static void
+	mip_encode_row
+	(
+		const float* p,
+		int n,
+		const mip_encoding* encoding,
+		unsigned char* out
+	)
+{
+	int i = 0, c;
+	if( encoding->linear_light )
+	{
+		for( ; i < n; i += encoding->channels )
+		{
+			for( c = 0; c < encoding->colours; ++c )
+			{
+				/*	the number of thresholds at or below it	*/
+				float x = p[i + c];
+				int bin = (int)(x * (1024 / 255.0f));
+				int b = (x <= 0.0f) ? 0 : encoding->guess[(bin > 1023) ? 1023 : bin];
+				while( x >= encoding->threshold[b] )
+				{
+					++b;
+				}
+				out[i + c] = (unsigned char)b;
+			}
+			if( c < encoding->channels )
+			{
+				out[i + c] = clamp_byte( (int)(p[i + c] + 0.5f) );
+			}
+		}
+		return;
+	}
+#ifdef IMAGE_HELPER_SSE
+	{
+		const __m128 half = _mm_set1_ps( 0.5f );
+		for( ; i + 16 <= n; i += 16 )
+		{
+			__m128i a = _mm_cvttps_epi32( _mm_add_ps( _mm_loadu_ps( p + i ), half ) );
+			__m128i b = _mm_cvttps_epi32( _mm_add_ps( _mm_loadu_ps( p + i + 4 ), half ) );
+			__m128i c4 = _mm_cvttps_epi32( _mm_add_ps( _mm_loadu_ps( p + i + 8 ), half ) );
+			__m128i d = _mm_cvttps_epi32( _mm_add_ps( _mm_loadu_ps( p + i + 12 ), half ) );
+			_mm_storeu_si128( (__m128i*)(out + i),
+				_mm_packus_epi16( _mm_packs_epi32( a, b ), _mm_packs_epi32( c4, d ) ) );
+		}
+	}
+#endif
+	for( ; i < n; ++i )
+	{
+		out[i] = clamp_byte( (int)(p[i] + 0.5f) );
+	}
+}
+
+/*	floats the separable filter works in	*/
+static int
+	mip_scratch_floats
+	(
+		int width, int height, int channels,
+		int filter
+	)
+{
+	int mip_width = mip_reduced_size( width );
+	int mip_height = mip_reduced_size( height );
+	int x_taps = mip_axis_taps( width, mip_width, filter );
+	int y_taps = mip_axis_taps( height, mip_height, filter );
+	/*	the source rows, a row of vertical sums and one of results	*/
+	int rows = (y_taps + 1) * width * channels + mip_width * channels;
+	/*	weights, and as many ints of indices	*/
+	return rows + 2 * (mip_width * x_taps + mip_height * y_taps) + y_taps;
+}
+
+/*	halves an image with any filter and sides, in floats	*/
+static void
+	mip_reduce_separable
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* resampled,
+		int filter,
+		const mip_encoding* encoding,
+		float* scratch
+	)
+{
+	int mip_width = mip_reduced_size( width );
+	int mip_height = mip_reduced_size( height );
+	int row = width * channels;
+	int mip_row = mip_width * channels;
+	mip_axis x_axis, y_axis;
+	float *ring, *sums, *results;
+	int *ring_rows;
+	int i, j, k, c;
+	x_axis.taps = mip_axis_taps( width, mip_width, filter );
+	y_axis.taps = mip_axis_taps( height, mip_height, filter );
+	/*	carve up the scratch	*/
+	ring = scratch;
+	sums = ring + (size_t)y_axis.taps * row;
+	results = sums + row;
+	x_axis.weight = results + mip_row;
+	y_axis.weight = x_axis.weight + mip_width * x_axis.taps;
+	x_axis.index = (int*)(y_axis.weight + mip_height * y_axis.taps);
+	y_axis.index = x_axis.index + mip_width * x_axis.taps;
+	ring_rows = y_axis.index + mip_height * y_axis.taps;
+	mip_axis_weights( width, mip_width, filter, channels, &x_axis );
+	mip_axis_weights( height, mip_height, filter, 1, &y_axis );
+	/*	the taps of a row span y_taps source rows, each decoded once into
+		the ring and kept there while the rows below still need it	*/
+	for( k = 0; k < y_axis.taps; ++k )
+	{
+		ring_rows[k] = -1;
+	}
+	for( j = 0; j < mip_height; ++j )
+	{
+		const int *y_index = y_axis.index + j * y_axis.taps;
+		const float *y_weight = y_axis.weight + j * y_axis.taps;
+		/*	vertically, every float of the row at once	*/
+		for( k = 0; k < y_axis.taps; ++k )
+		{
+			int y = y_index[k];
+			float w = y_weight[k];
+			float *src = ring + (size_t)(y % y_axis.taps) * row;
+			i = 0;
+			if( ring_rows[y % y_axis.taps] != y )
+			{
+				mip_decode_row( orig + (size_t)y * row, row, encoding, src );
+				ring_rows[y % y_axis.taps] = y;
+			}
+			if( k == 0 )
+			{
+				for( ; i < row; ++i )
+				{
+					sums[i] = w * src[i];
+				}
+				continue;
+			}
+			if( w == 0.0f )
+			{
+				continue;
+			}
+#ifdef IMAGE_HELPER_SSE
+			{
+				const __m128 w4 = _mm_set1_ps( w );
+				for( ; i + 4 <= row; i += 4 )
+				{
+					_mm_storeu_ps( sums + i, _mm_add_ps( _mm_loadu_ps( sums + i ),
+						_mm_mul_ps( w4, _mm_loadu_ps( src + i ) ) ) );
+				}
+			}
+#endif
+			for( ; i < row; ++i )
+			{
+				sums[i] += w * src[i];
+			}
+		}
+		/*	then horizontally, a texel at a time	*/
+		for( i = 0; i < mip_width; ++i )
+		{
+			const int *x_index = x_axis.index + i * x_axis.taps;
+			const float *x_weight = x_axis.weight + i * x_axis.taps;
+			float *out = results + i * channels;
+#ifdef IMAGE_HELPER_SSE
+			if( channels == 4 )
+			{
+				__m128 sum = _mm_setzero_ps();
+				for( k = 0; k < x_axis.taps; ++k )
+				{
+					sum = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( x_weight[k] ),
+						_mm_loadu_ps( sums + x_index[k] ) ) );
+				}
+				_mm_storeu_ps( out, sum );
+				continue;
+			} else if( channels == 3 )
+			{
+				/*	the 4th lane reads the next texel, or past the sums into the
+					results, and is dropped	*/
+				float rgb[4];
+				__m128 sum = _mm_setzero_ps();
+				for( k = 0; k < x_axis.taps; ++k )
+				{
+					sum = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( x_weight[k] ),
+						_mm_loadu_ps( sums + x_index[k] ) ) );
+				}
+				_mm_storeu_ps( rgb, sum );
+				out[0] = rgb[0];
+				out[1] = rgb[1];
+				out[2] = rgb[2];
+				continue;
+			}
+#endif
+			for( c = 0; c < channels; ++c )
+			{
+				float sum = 0.0f;
+				for( k = 0; k < x_axis.taps; ++k )
+				{
+					sum += x_weight[k] * sums[x_index[k] + c];
+				}
+				out[c] = sum;
+			}
+		}
+		mip_encode_row( results, mip_row, encoding, resampled + (size_t)mip_row * j );
+	}
+}
+
+int
+	build_mip_pyramid
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* pyramid,
+		int levels,
+		int filter,
+		int linear_light
+	)
+{
+	mip_encoding encoding;
+	float *scratch = NULL;
+	int scratch_floats = 0;
+	int level, w, h;
+	/*	error check	*/
+	if( (width < 1) || (height < 1) ||
+		(channels < 1) || (channels > 4) ||
+		(orig == NULL) || (pyramid == NULL) || (levels < 1) ||
+		(filter < MIP_FILTER_BOX) || (filter > MIP_FILTER_LANCZOS) )
+	{
+		/*	nothing to do	*/
+		return 0;
+	}
+	if( levels > mip_pyramid_levels( width, height ) )
+	{
+		levels = mip_pyramid_levels( width, height );
+	}
+	/*	the scratch is sized once, for the reduction that needs the most	*/
+	for( level = 1, w = width, h = height; level < levels; ++level )
+	{
+		if( (filter != MIP_FILTER_BOX) || linear_light ||
+			((w > 1) && (w & 1)) || ((h > 1) && (h & 1)) )
+		{
+			int n = mip_scratch_floats( w, h, channels, filter );
+			scratch_floats = (n > scratch_floats) ? n : scratch_floats;
+		}
+		w = mip_reduced_size( w );
+		h = mip_reduced_size( h );
+	}
+	if( scratch_floats > 0 )
+	{
+		scratch = (float*)malloc( scratch_floats * sizeof(float) );
+		if( scratch == NULL )
+		{
+			return 0;
+		}
+	}
+	mip_encoding_init( channels, linear_light, &encoding );
+	/*	level 0 may already be in place	*/
+	if( orig != pyramid )
+	{
+		memcpy( pyramid, orig, (size_t)width * height * channels );
+	}
+	for( level = 1, w = width, h = height; level < levels; ++level )
+	{
+		const unsigned char *src = pyramid + mip_pyramid_offset( width, height, channels, level - 1 );
+		unsigned char *dst = pyramid + mip_pyramid_offset( width, height, channels, level );
+		if( (filter == MIP_FILTER_BOX) && !linear_light &&
+			!((w > 1) && (w & 1)) && !((h > 1) && (h & 1)) )
+		{
+			mip_box_2x2( src, w, h, channels, dst );
+		} else
+		{
+			mip_reduce_separable( src, w, h, channels, dst, filter, &encoding, scratch );
+		}
+		w = mip_reduced_size( w );
+		h = mip_reduced_size( h );
+	}
+	free( scratch );
+	return 1;
+}
@@ -108,6 +108,92 @@ int
 		int rescale_to_max
 	);
 
+/**
+	The transforms copy_and_transform_image can apply, in the order
+	it applies them.
+**/
+enum
+{
+	IMAGE_TRANSFORM_INVERT_Y = 1,
+	IMAGE_TRANSFORM_NTSC_SAFE_RGB = 2,
+	IMAGE_TRANSFORM_MULTIPLY_ALPHA = 4,
+	IMAGE_TRANSFORM_RGB_TO_YCoCg = 8
+};
+
+/**
+	This function copies an image and transforms it in one pass.
+	Each row is read from its place in the original (bottom up
+	when inverting) and every transform runs on a few KB of it
+	straight after the copy, while it is still in the cache.
+	The result is the same as copying, flipping, then calling
+	scale_image_RGB_to_NTSC_safe, premultiplying alpha and
+	convert_RGB_to_YCoCg one after the other.
+**/
+int
+	copy_and_transform_image
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* transformed,
+		unsigned int transforms
+	);
+
+/**
+	The filters build_mip_pyramid can reduce with.  Box averages each
+	texel's footprint, Kaiser and Lanczos are windowed sincs 3 texels
+	wide that keep more detail and alias less.
+**/
+enum
+{
+	MIP_FILTER_BOX = 0,
+	MIP_FILTER_KAISER = 1,
+	MIP_FILTER_LANCZOS = 2
+};
+
+/**
+	The number of levels of a full MIP-map chain, down to 1x1.  Each
+	level's sides are half the last's, rounded down, but at least 1.
+**/
+int
+	mip_pyramid_levels
+	(
+		int width, int height
+	);
+
+/**
+	Where a level starts in a pyramid: levels are packed one after the
+	other, largest first.  The offset of level_count levels is the size.
+**/
+int
+	mip_pyramid_offset
+	(
+		int width, int height, int channels,
+		int level
+	);
+
+/**
+	This function builds the MIP-map chain of an image into a single
+	buffer of mip_pyramid_offset(width, height, channels, levels) bytes,
+	level 0 being a copy of the image (orig may be the pyramid itself,
+	with level 0 already in place).  Each level is reduced from the one
+	above it: the box filter on even sides is a 2x2 average rounded the
+	way mipmap_image rounds it; odd sides and the other filters are
+	weighted by how the smaller texels cover the larger ones, so nothing
+	shifts or is dropped.  With linear_light the colour channels are
+	sRGB and filtered as light, alpha never is.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	build_mip_pyramid
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* pyramid,
+		int levels,
+		int filter,
+		int linear_light
+	);
+
 #ifdef __cplusplus
 }
 #endif
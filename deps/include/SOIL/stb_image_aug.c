@@ -114,20 +114,144 @@ typedef unsigned char validate_uint32[sizeof(uint32)==4];
 // Generic API that works on all image types
 //
 
-// this is not threadsafe
-static char *failure_reason;
+// what a *_ctx call is doing; it lives on the caller's stack
+#define STBI_MAX_LIVE  32
+
+typedef struct
+{
+   stbi_context *ctx;
+   stbi_uc *pixels;        // the caller's buffer for the result, or NULL
+   size_t pixels_size;
+   int pixels_claimed;     // a loader is writing into it
+   size_t live_bytes;
+   int live_count;
+   struct { void *p; size_t size; } live[STBI_MAX_LIVE];
+} stbi__call;
+
+// the legacy calls fail per thread; a *_ctx call points current_call at
+// its state while it runs
+static STBI_THREAD_LOCAL const char *failure_reason;
+static STBI_THREAD_LOCAL stbi__call *current_call;
 
 char *stbi_failure_reason(void)
 {
-   return failure_reason;
+   return (char *) failure_reason;
 }
 
 static int e(char *str)
 {
-   failure_reason = str;
+   if (current_call)
+      current_call->ctx->failure_reason = str;
+   else
+      failure_reason = str;
    return 0;
 }
 
+// Loaders allocate through these. Outside a *_ctx call they are the C heap;
+// inside one they use its allocator and remember sizes, which custom
+// allocators are given on resize and the stats need.
+
+static void *stbi__malloc(size_t size)
+{
+   stbi__call *c = current_call;
+   stbi_allocator *a;
+   void *p;
+   if (!c) return malloc(size);
+   a = &c->ctx->allocator;
+   if (c->live_count == STBI_MAX_LIVE) return NULL;
+   p = a->alloc ? a->alloc(a->user, size) : malloc(size);
+   if (p == NULL) return NULL;
+   c->live[c->live_count].p = p;
+   c->live[c->live_count].size = size;
+   ++c->live_count;
+   c->live_bytes += size;
+   ++c->ctx->stats.allocations;
+   c->ctx->stats.bytes += size;
+   if (c->live_bytes > c->ctx->stats.peak_bytes)
+      c->ctx->stats.peak_bytes = c->live_bytes;
+   return p;
+}
+
+static int stbi__live_index(stbi__call *c, void *p)
+{
+   int i;
+   for (i=c->live_count-1; i >= 0; --i)
+      if (c->live[i].p == p)
+         return i;
+   return -1;
+}
+
+static void stbi__free(void *p)
+{
+   stbi__call *c = current_call;
+   stbi_allocator *a;
+   int i;
+   if (p == NULL) return;
+   if (!c) { free(p); return; }
+   if (p == c->pixels) { c->pixels_claimed = 0; return; }
+   a = &c->ctx->allocator;
+   i = stbi__live_index(c, p);
+   assert(i >= 0);
+   c->live_bytes -= c->live[i].size;
+   c->live[i] = c->live[--c->live_count];
+   if (!a->alloc) free(p);
+   else if (a->release) a->release(a->user, p);
+}
+
+static void *stbi__realloc(void *p, size_t size)
+{
+   stbi__call *c = current_call;
+   stbi_allocator *a;
+   size_t old_size;
+   void *q;
+   int i;
+   if (!c) return realloc(p, size);
+   if (p == NULL) return stbi__malloc(size);
+   a = &c->ctx->allocator;
+   i = stbi__live_index(c, p);
+   assert(i >= 0);
+   old_size = c->live[i].size;
+   if (!a->alloc)
+      q = realloc(p, size);
+   else if (a->resize)
+      q = a->resize(a->user, p, old_size, size);
+   else {
+      q = a->alloc(a->user, size);
+      if (q != NULL) {
+         memcpy(q, p, old_size < size ? old_size : size);
+         if (a->release) a->release(a->user, p);
+      }
+   }
+   if (q == NULL) return NULL;
+   c->live[i].p = q;
+   c->live[i].size = size;
+   c->live_bytes += size - old_size;
+   ++c->ctx->stats.allocations;
+   c->ctx->stats.bytes += size;
+   if (c->live_bytes > c->ctx->stats.peak_bytes)
+      c->ctx->stats.peak_bytes = c->live_bytes;
+   return q;
+}
+
+// for a buffer that becomes the decoded image: the caller's, if it is free
+// and big enough
+static void *stbi__malloc_pixels(size_t size)
+{
+   stbi__call *c = current_call;
+   if (c && c->pixels && !c->pixels_claimed && size <= c->pixels_size) {
+      c->pixels_claimed = 1;
+      return c->pixels;
+   }
+   return stbi__malloc(size);
+}
+
+// is data the caller's buffer, with room for size bytes?
+static int stbi__in_pixels(void *data, size_t size)
+{
+   stbi__call *c = current_call;
+   return c && data == c->pixels && size <= c->pixels_size;
+}
+
 #ifdef STBI_NO_FAILURE_STRINGS
    #define e(x,y)  0
 #elif defined(STBI_FAILURE_USERMSG)
@@ -320,24 +444,129 @@ extern int      stbi_is_hdr_from_file(FILE *f)
 
 #endif
 
-// @TODO: get image dimensions & components without fully decoding
-#ifndef STBI_NO_STDIO
-extern int      stbi_info            (char const *filename,           int *x, int *y, int *comp);
-extern int      stbi_info_from_file  (FILE *f,                  int *x, int *y, int *comp);
-#endif
-extern int      stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp);
+// stbi_info and stbi_probe are at the end, after the loaders whose headers they read
 
-#ifndef STBI_NO_HDR
-static float h2l_gamma_i=1.0f/2.2f, h2l_scale_i=1.0f;
+// process-wide defaults, read by calls without a context
+static float h2l_gamma=2.2f, h2l_scale=1.0f;
 static float l2h_gamma=2.2f, l2h_scale=1.0f;
 
-void   stbi_hdr_to_ldr_gamma(float gamma) { h2l_gamma_i = 1/gamma; }
-void   stbi_hdr_to_ldr_scale(float scale) { h2l_scale_i = 1/scale; }
+#ifndef STBI_NO_HDR
+void   stbi_hdr_to_ldr_gamma(float gamma) { h2l_gamma = gamma; }
+void   stbi_hdr_to_ldr_scale(float scale) { h2l_scale = scale; }
 
 void   stbi_ldr_to_hdr_gamma(float gamma) { l2h_gamma = gamma; }
 void   stbi_ldr_to_hdr_scale(float scale) { l2h_scale = scale; }
 #endif
 
+void stbi_context_init(stbi_context *ctx)
+{
+   memset(ctx, 0, sizeof(*ctx));
+   ctx->hdr_to_ldr_gamma = h2l_gamma;
+   ctx->hdr_to_ldr_scale = h2l_scale;
+   ctx->ldr_to_hdr_gamma = l2h_gamma;
+   ctx->ldr_to_hdr_scale = l2h_scale;
+}
+
+void stbi_image_free_ctx(stbi_context *ctx, void *retval_from_stbi_load_ctx)
+{
+   if (retval_from_stbi_load_ctx == NULL) return;
+   if (!ctx->allocator.alloc) free(retval_from_stbi_load_ctx);
+   else if (ctx->allocator.release) ctx->allocator.release(ctx->allocator.user, retval_from_stbi_load_ctx);
+}
+
+// each *_ctx call runs its legacy twin with its state current; restoring
+// the previous one keeps nested calls (from a registered loader) correct
+static stbi__call *enter_context(stbi__call *call, stbi_context *ctx, stbi_uc *pixels, size_t pixels_size)
+{
+   stbi__call *previous = current_call;
+   memset(&ctx->stats, 0, sizeof(ctx->stats));
+   ctx->failure_reason = NULL;
+   call->ctx = ctx;
+   call->pixels = pixels;
+   call->pixels_size = pixels_size;
+   call->pixels_claimed = 0;
+   call->live_bytes = 0;
+   call->live_count = 0;
+   current_call = call;
+   return previous;
+}
+
+#ifndef STBI_NO_STDIO
+stbi_uc *stbi_load_ctx(stbi_context *ctx, char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__call call, *previous = enter_context(&call, ctx, NULL, 0);
+   stbi_uc *result = stbi_load(filename, x, y, comp, req_comp);
+   current_call = previous;
+   return result;
+}
+#endif
+
+stbi_uc *stbi_load_from_memory_ctx(stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__call call, *previous = enter_context(&call, ctx, NULL, 0);
+   stbi_uc *result = stbi_load_from_memory(buffer, len, x, y, comp, req_comp);
+   current_call = previous;
+   return result;
+}
+
+// a loader that couldn't decode in place (or a registered one) leaves the
+// image elsewhere; copy it over if it fits
+static int finish_into(stbi__call *call, stbi_uc *result, int x, int y, int comp, int req_comp)
+{
+   size_t size;
+   if (result == call->pixels) return 1;
+   size = (size_t) x * y * (req_comp ? req_comp : comp);
+   if (size <= call->pixels_size)
+      memcpy(call->pixels, result, size);
+   stbi__free(result);
+   if (size > call->pixels_size) return e("buffer too small", "Image doesn't fit the buffer");
+   return 1;
+}
+
+#ifndef STBI_NO_STDIO
+int stbi_load_into_ctx(stbi_context *ctx, char const *filename, int *x, int *y, int *comp, int req_comp, stbi_uc *pixels, size_t size)
+{
+   stbi__call call, *previous = enter_context(&call, ctx, pixels, size);
+   int n = 0, ok;
+   stbi_uc *result = stbi_load(filename, x, y, &n, req_comp);
+   ok = result ? finish_into(&call, result, *x, *y, n, req_comp) : 0;
+   if (comp) *comp = n;
+   current_call = previous;
+   return ok;
+}
+#endif
+
+int stbi_load_from_memory_into_ctx(stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_uc *pixels, size_t size)
+{
+   stbi__call call, *previous = enter_context(&call, ctx, pixels, size);
+   int n = 0, ok;
+   stbi_uc *result = stbi_load_from_memory(buffer, len, x, y, &n, req_comp);
+   ok = result ? finish_into(&call, result, *x, *y, n, req_comp) : 0;
+   if (comp) *comp = n;
+   current_call = previous;
+   return ok;
+}
+
+#ifndef STBI_NO_HDR
+#ifndef STBI_NO_STDIO
+float *stbi_loadf_ctx(stbi_context *ctx, char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__call call, *previous = enter_context(&call, ctx, NULL, 0);
+   float *result = stbi_loadf(filename, x, y, comp, req_comp);
+   current_call = previous;
+   return result;
+}
+#endif
+
+float *stbi_loadf_from_memory_ctx(stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__call call, *previous = enter_context(&call, ctx, NULL, 0);
+   float *result = stbi_loadf_from_memory(buffer, len, x, y, comp, req_comp);
+   current_call = previous;
+   return result;
+}
+#endif
+
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -358,14 +587,17 @@ typedef struct
 
    #ifndef STBI_NO_STDIO
    FILE  *img_file;
+   long   img_file_start;
    #endif
    uint8 *img_buffer, *img_buffer_end;
+   uint8 *img_buffer_start;
 } stbi;
 
 #ifndef STBI_NO_STDIO
 static void start_file(stbi *s, FILE *f)
 {
    s->img_file = f;
+   s->img_file_start = ftell(f);
 }
 #endif
 
@@ -376,6 +608,36 @@ static void start_mem(stbi *s, uint8 const *buffer, int len)
 #endif
    s->img_buffer = (uint8 *) buffer;
    s->img_buffer_end = (uint8 *) buffer+len;
+   s->img_buffer_start = (uint8 *) buffer;
+}
+
+// back to where the image started, to read it again as another format
+static void rewind_stbi(stbi *s)
+{
+#ifndef STBI_NO_STDIO
+   if (s->img_file) {
+      fseek(s->img_file, s->img_file_start, SEEK_SET);
+      return;
+   }
+#endif
+   s->img_buffer = s->img_buffer_start;
+}
+
+static void start_info(stbi_image_info *info, int format)
+{
+   memset(info, 0, sizeof(*info));
+   info->format = format;
+   info->levels = 1;
+}
+
+// the stbi_*info calls report what probing found as stbi_load would
+static int report_info(int ok, stbi_image_info const *info, int *x, int *y, int *comp)
+{
+   if (!ok) return 0;
+   if (x) *x = info->width;
+   if (y) *y = info->cubemap ? info->height * 6 : info->height;
+   if (comp) *comp = info->comp;
+   return 1;
 }
 
 __forceinline static int get8(stbi *s)
@@ -460,7 +722,8 @@ static void getn(stbi *s, stbi_uc *buffer, int n)
 //    interleave an alpha=255 channel, but falls back to this for other cases
 //
 //  assume data buffer is malloced, so malloc a new one and free that one
-//  only failure mode is malloc failing
+//  only failure mode is malloc failing; data that is the caller's buffer is
+//  converted in place
 
 static uint8 compute_y(int r, int g, int b)
 {
@@ -475,10 +738,30 @@ static unsigned char *convert_format(unsigned char *data, int img_n, int req_com
    if (req_comp == img_n) return data;
    assert(req_comp >= 1 && req_comp <= 4);
 
-   good = (unsigned char *) malloc(req_comp * x * y);
-   if (good == NULL) {
-      free(data);
-      return epuc("outofmem", "Out of memory");
+   if (stbi__in_pixels(data, req_comp * x * y)) {
+      if (req_comp > img_n) {
+         // growing: back to front, each pixel read before it is overwritten
+         for (i=(int) (x*y)-1; i >= 0; --i) {
+            unsigned char *src = data + i * img_n, *dest = data + i * req_comp;
+            uint8 r = src[0];
+            uint8 g = img_n >= 3 ? src[1] : r;
+            uint8 b = img_n >= 3 ? src[2] : r;
+            uint8 a = img_n == 2 ? src[1] : 255;
+            dest[0] = r;
+            if (req_comp == 2) { dest[1] = a; continue; }
+            dest[1] = g, dest[2] = b;
+            if (req_comp == 4) dest[3] = a;
+         }
+         return data;
+      }
+      // shrinking: the scanline loop below only writes behind what it reads
+      good = data;
+   } else {
+      good = (unsigned char *) stbi__malloc_pixels(req_comp * x * y);
+      if (good == NULL) {
+         stbi__free(data);
+         return epuc("outofmem", "Out of memory");
+      }
    }
 
    for (j=0; j < (int) y; ++j) {
@@ -507,7 +790,7 @@ static unsigned char *convert_format(unsigned char *data, int img_n, int req_com
       #undef CASE
    }
 
-   free(data);
+   if (good != data) stbi__free(data);
    return good;
 }
 
@@ -515,17 +798,19 @@ static unsigned char *convert_format(unsigned char *data, int img_n, int req_com
 static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 {
    int i,k,n;
-   float *output = (float *) malloc(x * y * comp * sizeof(float));
-   if (output == NULL) { free(data); return epf("outofmem", "Out of memory"); }
+   float gamma = current_call ? current_call->ctx->ldr_to_hdr_gamma : l2h_gamma;
+   float scale = current_call ? current_call->ctx->ldr_to_hdr_scale : l2h_scale;
+   float *output = (float *) stbi__malloc(x * y * comp * sizeof(float));
+   if (output == NULL) { stbi__free(data); return epf("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
       for (k=0; k < n; ++k) {
-         output[i*comp + k] = (float) pow(data[i*comp+k]/255.0f, l2h_gamma) * l2h_scale;
+         output[i*comp + k] = (float) pow(data[i*comp+k]/255.0f, gamma) * scale;
       }
       if (k < comp) output[i*comp + k] = data[i*comp+k]/255.0f;
    }
-   free(data);
+   stbi__free(data);
    return output;
 }
 
@@ -533,13 +818,15 @@ static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
 {
    int i,k,n;
-   stbi_uc *output = (stbi_uc *) malloc(x * y * comp);
-   if (output == NULL) { free(data); return epuc("outofmem", "Out of memory"); }
+   float gamma_i = 1 / (current_call ? current_call->ctx->hdr_to_ldr_gamma : h2l_gamma);
+   float scale_i = 1 / (current_call ? current_call->ctx->hdr_to_ldr_scale : h2l_scale);
+   stbi_uc *output = (stbi_uc *) stbi__malloc_pixels(x * y * comp);
+   if (output == NULL) { stbi__free(data); return epuc("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
       for (k=0; k < n; ++k) {
-         float z = (float) pow(data[i*comp+k]*h2l_scale_i, h2l_gamma_i) * 255 + 0.5f;
+         float z = (float) pow(data[i*comp+k]*scale_i, gamma_i) * 255 + 0.5f;
          if (z < 0) z = 0;
          if (z > 255) z = 255;
          output[i*comp + k] = float2int(z);
@@ -551,7 +838,7 @@ static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
          output[i*comp + k] = float2int(z);
       }
    }
-   free(data);
+   stbi__free(data);
    return output;
 }
 #endif
@@ -1151,7 +1438,10 @@ static int process_marker(jpeg *z, int m)
    }
    // check for comment block or APP blocks
    if ((m >= 0xE0 && m <= 0xEF) || m == 0xFE) {
-      skip(&z->s, get16(&z->s)-2);
+      // a truncated file reads a length of 0, which would skip backwards forever
+      L = get16(&z->s);
+      if (L < 2) return e("bad marker len","Corrupt JPEG");
+      skip(&z->s, L-2);
       return 1;
    }
    return 0;
@@ -1239,10 +1529,10 @@ static int process_frame_header(jpeg *z, int scan)
       // discard the extra data until colorspace conversion
       z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
       z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
-      z->img_comp[i].raw_data = malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
+      z->img_comp[i].raw_data = stbi__malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
       if (z->img_comp[i].raw_data == NULL) {
          for(--i; i >= 0; --i) {
-            free(z->img_comp[i].raw_data);
+            stbi__free(z->img_comp[i].raw_data);
             z->img_comp[i].data = NULL;
          }
          return e("outofmem", "Out of memory");
@@ -1402,7 +1692,7 @@ static void YCbCr_to_RGB_row(uint8 *out, uint8 *y, uint8 *pcb, uint8 *pcr, int c
       out[0] = (uint8)r;
       out[1] = (uint8)g;
       out[2] = (uint8)b;
-      out[3] = 255;
+      if (step == 4) out[3] = 255;
       out += step;
    }
 }
@@ -1423,11 +1713,11 @@ static void cleanup_jpeg(jpeg *j)
    int i;
    for (i=0; i < j->s.img_n; ++i) {
       if (j->img_comp[i].data) {
-         free(j->img_comp[i].raw_data);
+         stbi__free(j->img_comp[i].raw_data);
          j->img_comp[i].data = NULL;
       }
       if (j->img_comp[i].linebuf) {
-         free(j->img_comp[i].linebuf);
+         stbi__free(j->img_comp[i].linebuf);
          j->img_comp[i].linebuf = NULL;
       }
    }
@@ -1475,7 +1765,7 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
 
          // allocate line buffer big enough for upsampling off the edges
          // with upsample factor of 4
-         z->img_comp[k].linebuf = (uint8 *) malloc(z->s.img_x + 3);
+         z->img_comp[k].linebuf = (uint8 *) stbi__malloc(z->s.img_x + 3);
          if (!z->img_comp[k].linebuf) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
 
          r->hs      = z->img_h_max / z->img_comp[k].h;
@@ -1492,8 +1782,13 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
          else                               r->resample = resample_row_generic;
       }
 
-      // can't error after this so, this is safe
-      output = (uint8 *) malloc(n * z->s.img_x * z->s.img_y + 1);
+      // can't error after this so, this is safe; the installed converters
+      // may write a fourth byte past the last pixel of a 3-channel image
+      #if STBI_SIMD
+      output = (uint8 *) stbi__malloc_pixels(n * z->s.img_x * z->s.img_y + 1);
+      #else
+      output = (uint8 *) stbi__malloc_pixels(n * z->s.img_x * z->s.img_y);
+      #endif
       if (!output) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
 
       // now go ahead and resample
@@ -1524,7 +1819,7 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
             } else
                for (i=0; i < z->s.img_x; ++i) {
                   out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
+                  if (n == 4) out[3] = 255;
                   out += n;
                }
          } else {
@@ -1589,12 +1884,56 @@ int stbi_jpeg_test_memory(stbi_uc const *buffer, int len)
    return decode_jpeg_header(&j, SCAN_type);
 }
 
-// @TODO:
+static int jpeg_test(stbi *s)
+{
+   jpeg j;
+   j.s = *s;
+   return decode_jpeg_header(&j, SCAN_type);
+}
+
+// reads markers up to the frame header, skipping everything else
+static int jpeg_info(stbi *s, stbi_image_info *info)
+{
+   jpeg j;
+   start_info(info, STBI_jpeg);
+   j.s = *s;
+   if (!decode_jpeg_header(&j, SCAN_header)) return 0;
+   info->width  = j.s.img_x;
+   info->height = j.s.img_y;
+   info->comp   = j.s.img_n;
+   return 1;
+}
+
 #ifndef STBI_NO_STDIO
-extern int      stbi_jpeg_info            (char const *filename,           int *x, int *y, int *comp);
-extern int      stbi_jpeg_info_from_file  (FILE *f,                  int *x, int *y, int *comp);
+int stbi_jpeg_info_from_file(FILE *f, int *x, int *y, int *comp)
+{
+   stbi s;
+   stbi_image_info info;
+   int r;
+   start_file(&s, f);
+   r = jpeg_info(&s, &info);
+   rewind_stbi(&s);
+   return report_info(r, &info, x, y, comp);
+}
+
+int stbi_jpeg_info(char const *filename, int *x, int *y, int *comp)
+{
+   FILE *f = fopen(filename, "rb");
+   int r;
+   if (!f) return e("can't fopen", "Unable to open file");
+   r = stbi_jpeg_info_from_file(f, x, y, comp);
+   fclose(f);
+   return r;
+}
 #endif
-extern int      stbi_jpeg_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp);
+
+int stbi_jpeg_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp)
+{
+   stbi s;
+   stbi_image_info info;
+   start_mem(&s, buffer, len);
+   return report_info(jpeg_info(&s, &info), &info, x, y, comp);
+}
 
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
 //    simple implementation
@@ -1762,7 +2101,7 @@ static int expand(zbuf *z, int n)  // need to make room for n bytes
    limit = (int) (z->zout_end - z->zout_start);
    while (cur + n > limit)
       limit *= 2;
-   q = (char *) realloc(z->zout_start, limit);
+   q = (char *) stbi__realloc(z->zout_start, limit);
    if (q == NULL) return e("outofmem", "Out of memory");
    z->zout_start = q;
    z->zout       = q + cur;
@@ -1815,7 +2154,7 @@ static int parse_huffman_block(zbuf *a)
 static int compute_huffman_codes(zbuf *a)
 {
    static uint8 length_dezigzag[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
-   static zhuffman z_codelength; // static just to save stack space
+   zhuffman z_codelength; // on the stack, so decoders can run on several threads
    uint8 lencodes[286+32+137];//padding for maximum single op
    uint8 codelength_sizes[19];
    int i,n;
@@ -1900,9 +2239,8 @@ static int parse_zlib_header(zbuf *a)
    return 1;
 }
 
-// @TODO: should statically initialize these for optimal thread safety
-static uint8 default_length[288], default_distance[32];
-static void init_defaults(void)
+// filled per block rather than cached in globals, so it's thread safe
+static void init_defaults(uint8 *default_length, uint8 *default_distance)
 {
    int i;   // use <= to match clearly with spec
    for (i=0; i <= 143; ++i)     default_length[i]   = 8;
@@ -1930,7 +2268,8 @@ static int parse_zlib(zbuf *a, int parse_header)
       } else {
          if (type == 1) {
             // use fixed code lengths
-            if (!default_distance[31]) init_defaults();
+            uint8 default_length[288], default_distance[32];
+            init_defaults(default_length, default_distance);
             if (!zbuild_huffman(&a->z_length  , default_length  , 288)) return 0;
             if (!zbuild_huffman(&a->z_distance, default_distance,  32)) return 0;
          } else {
@@ -1955,7 +2294,7 @@ static int do_zlib(zbuf *a, char *obuf, int olen, int exp, int parse_header)
 char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen)
 {
    zbuf a;
-   char *p = (char *) malloc(initial_size);
+   char *p = (char *) stbi__malloc(initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer + len;
@@ -1963,7 +2302,7 @@ char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -1987,7 +2326,7 @@ int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer, int il
 char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
 {
    zbuf a;
-   char *p = (char *) malloc(16384);
+   char *p = (char *) stbi__malloc(16384);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer+len;
@@ -1995,7 +2334,7 @@ char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -2083,7 +2422,7 @@ static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n)
    int k;
    int img_n = s->img_n; // copy it into a local for later
    assert(out_n == s->img_n || out_n == s->img_n+1);
-   a->out = (uint8 *) malloc(s->img_x * s->img_y * out_n);
+   a->out = (uint8 *) stbi__malloc_pixels(s->img_x * s->img_y * out_n);
    if (!a->out) return e("outofmem", "Out of memory");
    if (raw_len != (img_n * s->img_x + 1) * s->img_y) return e("not enough pixels","Corrupt PNG");
    for (j=0; j < s->img_y; ++j) {
@@ -2176,7 +2515,18 @@ static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
    uint32 i, pixel_count = a->s.img_x * a->s.img_y;
    uint8 *p, *temp_out, *orig = a->out;
 
-   p = (uint8 *) malloc(pixel_count * pal_img_n);
+   if (stbi__in_pixels(orig, pixel_count * pal_img_n)) {
+      // the caller's buffer: back to front, each index read before its
+      // colors overwrite it
+      for (i=pixel_count; i-- > 0; ) {
+         int n = orig[i]*4, k;
+         for (k=0; k < pal_img_n; ++k)
+            orig[i*pal_img_n + k] = palette[n+k];
+      }
+      return 1;
+   }
+
+   p = (uint8 *) stbi__malloc_pixels(pixel_count * pal_img_n);
    if (p == NULL) return e("outofmem", "Out of memory");
 
    // between here and free(out) below, exitting would leak
@@ -2200,7 +2550,7 @@ static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
          p += 4;
       }
    }
-   free(a->out);
+   stbi__free(a->out);
    a->out = temp_out;
    return 1;
 }
@@ -2289,7 +2639,7 @@ static int parse_png_file(png *z, int scan, int req_comp)
                if (idata_limit == 0) idata_limit = c.length > 4096 ? c.length : 4096;
                while (ioff + c.length > idata_limit)
                   idata_limit *= 2;
-               p = (uint8 *) realloc(z->idata, idata_limit); if (p == NULL) return e("outofmem", "Out of memory");
+               p = (uint8 *) stbi__realloc(z->idata, idata_limit); if (p == NULL) return e("outofmem", "Out of memory");
                z->idata = p;
             }
             #ifndef STBI_NO_STDIO
@@ -2311,9 +2661,10 @@ static int parse_png_file(png *z, int scan, int req_comp)
             uint32 raw_len;
             if (scan != SCAN_load) return 1;
             if (z->idata == NULL) return e("no IDAT","Corrupt PNG");
-            z->expanded = (uint8 *) stbi_zlib_decode_malloc((char *) z->idata, ioff, (int *) &raw_len);
+            // sized for the filtered scanlines so inflating never grows it
+            z->expanded = (uint8 *) stbi_zlib_decode_malloc_guesssize((char *) z->idata, ioff, (s->img_n * s->img_x + 1) * s->img_y, (int *) &raw_len);
             if (z->expanded == NULL) return 0; // zlib should set error
-            free(z->idata); z->idata = NULL;
+            stbi__free(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
                s->img_out_n = s->img_n+1;
             else
@@ -2329,7 +2680,7 @@ static int parse_png_file(png *z, int scan, int req_comp)
                if (!expand_palette(z, palette, pal_len, s->img_out_n))
                   return 0;
             }
-            free(z->expanded); z->expanded = NULL;
+            stbi__free(z->expanded); z->expanded = NULL;
             return 1;
          }
 
@@ -2337,8 +2688,8 @@ static int parse_png_file(png *z, int scan, int req_comp)
             // if critical, fail
             if ((c.type & (1 << 29)) == 0) {
                #ifndef STBI_NO_FAILURE_STRINGS
-               // not threadsafe
-               static char invalid_chunk[] = "XXXX chunk not known";
+               // per thread, like failure_reason
+               static STBI_THREAD_LOCAL char invalid_chunk[] = "XXXX chunk not known";
                invalid_chunk[0] = (uint8) (c.type >> 24);
                invalid_chunk[1] = (uint8) (c.type >> 16);
                invalid_chunk[2] = (uint8) (c.type >>  8);
@@ -2373,9 +2724,9 @@ static unsigned char *do_png(png *p, int *x, int *y, int *n, int req_comp)
       *y = p->s.img_y;
       if (n) *n = p->s.img_n;
    }
-   free(p->out);      p->out      = NULL;
-   free(p->expanded); p->expanded = NULL;
-   free(p->idata);    p->idata    = NULL;
+   stbi__free(p->out);      p->out      = NULL;
+   stbi__free(p->expanded); p->expanded = NULL;
+   stbi__free(p->idata);    p->idata    = NULL;
 
    return result;
 }
@@ -2427,11 +2778,60 @@ int stbi_png_test_memory(stbi_uc const *buffer, int len)
 }
 
 // TODO: load header from png
+static int png_test(stbi *s)
+{
+   png p;
+   p.s = *s;
+   return parse_png_file(&p, SCAN_type, STBI_default);
+}
+
+// reads IHDR, and for paletted images the chunks up to the first IDAT to
+// see whether there is a tRNS
+static int png_info(stbi *s, stbi_image_info *info)
+{
+   png p;
+   start_info(info, STBI_png);
+   p.s = *s;
+   p.idata = NULL;
+   p.expanded = NULL;
+   p.out = NULL;
+   if (!parse_png_file(&p, SCAN_header, STBI_default)) return 0;
+   info->width  = p.s.img_x;
+   info->height = p.s.img_y;
+   info->comp   = p.s.img_n;
+   return 1;
+}
+
 #ifndef STBI_NO_STDIO
-extern int      stbi_png_info             (char const *filename,           int *x, int *y, int *comp);
-extern int      stbi_png_info_from_file   (FILE *f,                  int *x, int *y, int *comp);
+int stbi_png_info_from_file(FILE *f, int *x, int *y, int *comp)
+{
+   stbi s;
+   stbi_image_info info;
+   int r;
+   start_file(&s, f);
+   r = png_info(&s, &info);
+   rewind_stbi(&s);
+   return report_info(r, &info, x, y, comp);
+}
+
+int stbi_png_info(char const *filename, int *x, int *y, int *comp)
+{
+   FILE *f = fopen(filename, "rb");
+   int r;
+   if (!f) return e("can't fopen", "Unable to open file");
+   r = stbi_png_info_from_file(f, x, y, comp);
+   fclose(f);
+   return r;
+}
 #endif
-extern int      stbi_png_info_from_memory (stbi_uc const *buffer, int len, int *x, int *y, int *comp);
+
+int stbi_png_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp)
+{
+   stbi s;
+   stbi_image_info info;
+   start_mem(&s, buffer, len);
+   return report_info(png_info(&s, &info), &info, x, y, comp);
+}
 
 // Microsoft/Windows BMP image
 
@@ -2468,6 +2868,55 @@ int      stbi_bmp_test_memory      (stbi_uc const *buffer, int len)
    return bmp_test(&s);
 }
 
+// the header checks of bmp_load, without the palette or pixels
+static int bmp_info(stbi *s, stbi_image_info *info)
+{
+   unsigned int mr, mg, mb, ma=0;
+   int offset, hsz, bpp, compress, psize=0;
+   start_info(info, STBI_bmp);
+   if (get8(s) != 'B' || get8(s) != 'M') return e("not BMP", "Corrupt BMP");
+   skip(s, 8); // discard filesize and reserved
+   offset = get32le(s);
+   hsz = get32le(s);
+   if (hsz != 12 && hsz != 40 && hsz != 56 && hsz != 108) return e("unknown BMP", "BMP type not supported: unknown");
+   if (hsz == 12) {
+      info->width  = get16le(s);
+      info->height = get16le(s);
+   } else {
+      info->width  = get32le(s);
+      info->height = abs((int) get32le(s));
+   }
+   if (get16le(s) != 1) return e("bad BMP", "Corrupt BMP");
+   bpp = get16le(s);
+   if (bpp == 1) return e("monochrome", "BMP type not supported: 1-bit");
+   if (hsz == 12) {
+      if (bpp < 24)
+         psize = (offset - 14 - 24) / 3;
+   } else {
+      compress = get32le(s);
+      if (compress == 1 || compress == 2) return e("BMP RLE", "BMP type not supported: RLE");
+      skip(s, 20); // discard sizeof, hres, vres, colorsused, max important
+      if (hsz == 108) {
+         skip(s, 12); // discard the color masks
+         ma = get32le(s);
+      } else {
+         if (hsz == 56) skip(s, 16);
+         if ((bpp == 16 || bpp == 32) && compress != 0) {
+            if (compress != 3) return e("bad BMP", "Corrupt BMP");
+            mr = get32le(s);
+            mg = get32le(s);
+            mb = get32le(s);
+            if (mr == mg && mg == mb) return e("bad BMP", "Corrupt BMP");
+         }
+      }
+      if (bpp < 16)
+         psize = (offset - 14 - hsz) >> 2;
+   }
+   if (bpp < 16 && (psize == 0 || psize > 256)) return e("invalid", "Corrupt BMP");
+   info->comp = ma ? 4 : 3;
+   return 1;
+}
+
 // returns 0..31 for the highest set bit
 static int high_bit(unsigned int z)
 {
@@ -2595,11 +3044,11 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       target = req_comp;
    else
       target = s->img_n; // if they want monochrome, we'll post-convert
-   out = (stbi_uc *) malloc(target * s->img_x * s->img_y);
+   out = (stbi_uc *) stbi__malloc_pixels(target * s->img_x * s->img_y);
    if (!out) return epuc("outofmem", "Out of memory");
    if (bpp < 16) {
       int z=0;
-      if (psize == 0 || psize > 256) { free(out); return epuc("invalid", "Corrupt BMP"); }
+      if (psize == 0 || psize > 256) { stbi__free(out); return epuc("invalid", "Corrupt BMP"); }
       for (i=0; i < psize; ++i) {
          pal[i][2] = get8(s);
          pal[i][1] = get8(s);
@@ -2610,7 +3059,7 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       skip(s, offset - 14 - hsz - psize * (hsz == 12 ? 3 : 4));
       if (bpp == 4) width = (s->img_x + 1) >> 1;
       else if (bpp == 8) width = s->img_x;
-      else { free(out); return epuc("bad bpp", "Corrupt BMP"); }
+      else { stbi__free(out); return epuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       for (j=0; j < (int) s->img_y; ++j) {
          for (i=0; i < (int) s->img_x; i += 2) {
@@ -2770,6 +3219,37 @@ int      stbi_tga_test_memory      (stbi_uc const *buffer, int len)
    return tga_test(&s);
 }
 
+//	the header checks of tga_load
+static int tga_info(stbi *s, stbi_image_info *info)
+{
+	int tga_indexed, tga_image_type, tga_palette_bits, tga_bits_per_pixel;
+	start_info( info, STBI_tga );
+	get8u(s);		//	discard Offset
+	tga_indexed = get8u(s);
+	tga_image_type = get8u(s);
+	skip(s, 4);		//	discard palette start and length
+	tga_palette_bits = get8u(s);
+	skip(s, 4);		//	discard x and y origin
+	info->width = get16le(s);
+	info->height = get16le(s);
+	tga_bits_per_pixel = get8u(s);
+	if( tga_image_type >= 8 )
+	{
+		tga_image_type -= 8;
+	}
+	if( (info->width < 1) || (info->height < 1) ||
+		(tga_image_type < 1) || (tga_image_type > 3) ||
+		((tga_bits_per_pixel != 8) && (tga_bits_per_pixel != 16) &&
+		(tga_bits_per_pixel != 24) && (tga_bits_per_pixel != 32))
+		)
+	{
+		return e("bad TGA", "Corrupt TGA");
+	}
+	//	paletted images have the palette's number of bits
+	info->comp = (tga_indexed ? tga_palette_bits : tga_bits_per_pixel) / 8;
+	return 1;
+}
+
 static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 {
 	//	read in the TGA header stuff
@@ -2834,7 +3314,8 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 		//	force a new number of components
 		*comp = tga_bits_per_pixel/8;
 	}
-	tga_data = (unsigned char*)malloc( tga_width * tga_height * req_comp );
+	tga_data = (unsigned char*)stbi__malloc_pixels( tga_width * tga_height * req_comp );
+	if( tga_data == NULL ) return epuc("outofmem", "Out of memory");
 
 	//	skip to the data's starting position (offset usually = 0)
 	skip(s, tga_offset );
@@ -2844,7 +3325,12 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 		//	any data to skip? (offset usually = 0)
 		skip(s, tga_palette_start );
 		//	load the palette
-		tga_palette = (unsigned char*)malloc( tga_palette_len * tga_palette_bits / 8 );
+		tga_palette = (unsigned char*)stbi__malloc( tga_palette_len * tga_palette_bits / 8 );
+		if( tga_palette == NULL )
+		{
+			stbi__free( tga_data );
+			return epuc("outofmem", "Out of memory");
+		}
 		getn(s, tga_palette, tga_palette_len * tga_palette_bits / 8 );
 	}
 	//	load the data
@@ -2978,7 +3464,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 	//	clear my palette, if I had one
 	if( tga_palette != NULL )
 	{
-		free( tga_palette );
+		stbi__free( tga_palette );
 	}
 	//	the things I do to get rid of an error message, and yet keep
 	//	Microsoft's C compilers happy... [8^(
@@ -3043,6 +3529,27 @@ int stbi_psd_test_memory(stbi_uc const *buffer, int len)
    return psd_test(&s);
 }
 
+// the fixed header psd_load checks before the mode data
+static int psd_info(stbi *s, stbi_image_info *info)
+{
+	start_info(info, STBI_psd);
+	if (get32(s) != 0x38425053)	// "8BPS"
+		return e("not PSD", "Corrupt PSD image");
+	if (get16(s) != 1)
+		return e("wrong version", "Unsupported version of PSD image");
+	skip(s, 6 );
+	info->comp = get16(s);
+	if (info->comp < 0 || info->comp > 16)
+		return e("wrong channel count", "Unsupported number of channels in PSD image");
+	info->height = get32(s);
+	info->width = get32(s);
+	if (get16(s) != 8)
+		return e("unsupported bit depth", "PSD bit depth is not 8 bit");
+	if (get16(s) != 3)
+		return e("wrong color format", "PSD is not in RGB color format");
+	return 1;
+}
+
 static stbi_uc *psd_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 {
 	int	pixelCount;
@@ -3106,7 +3613,7 @@ static stbi_uc *psd_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 		return epuc("bad compression", "PSD has an unknown compression format");
 
 	// Create the destination image.
-	out = (stbi_uc *) malloc(4 * w*h);
+	out = (stbi_uc *) stbi__malloc_pixels(4 * w*h);
 	if (!out) return epuc("outofmem", "Out of memory");
    pixelCount = w*h;
 
@@ -3286,6 +3793,35 @@ static char *hdr_gettoken(stbi *z, char *buffer)
 	return buffer;
 }
 
+// the header lines, up to the resolution
+static int hdr_info(stbi *s, stbi_image_info *info)
+{
+   char buffer[HDR_BUFLEN];
+   char *token;
+   int valid = 0;
+   start_info(info, STBI_hdr);
+
+   if (strcmp(hdr_gettoken(s,buffer), "#?RADIANCE") != 0)
+      return e("not HDR", "Corrupt HDR image");
+   while(1) {
+      token = hdr_gettoken(s,buffer);
+      if (token[0] == 0) break;
+      if (strcmp(token, "FORMAT=32-bit_rle_rgbe") == 0) valid = 1;
+   }
+   if (!valid)    return e("unsupported format", "Unsupported HDR format");
+
+   token = hdr_gettoken(s,buffer);
+   if (strncmp(token, "-Y ", 3))  return e("unsupported data layout", "Unsupported HDR format");
+   token += 3;
+   info->height = strtol(token, &token, 10);
+   while (*token == ' ') ++token;
+   if (strncmp(token, "+X ", 3))  return e("unsupported data layout", "Unsupported HDR format");
+   token += 3;
+   info->width = strtol(token, NULL, 10);
+   info->comp = 3;
+   return 1;
+}
+
 static void hdr_convert(float *output, stbi_uc *input, int req_comp)
 {
 	if( input[3] != 0 ) {
@@ -3358,7 +3894,7 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 	if (req_comp == 0) req_comp = 3;
 
 	// Read data
-	hdr_data = (float *) malloc(height * width * req_comp * sizeof(float));
+	hdr_data = (float *) stbi__malloc(height * width * req_comp * sizeof(float));
 
 	// Load image data
    // image data is stored as some number of sca
@@ -3387,13 +3923,13 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
             hdr_convert(hdr_data, rgbe, req_comp);
             i = 1;
             j = 0;
-            free(scanline);
+            stbi__free(scanline);
             goto main_decode_loop; // yes, this is fucking insane; blame the fucking insane format
          }
          len <<= 8;
          len |= get8(s);
-         if (len != width) { free(hdr_data); free(scanline); return epf("invalid decoded scanline length", "corrupt HDR"); }
-         if (scanline == NULL) scanline = (stbi_uc *) malloc(width * 4);
+         if (len != width) { stbi__free(hdr_data); stbi__free(scanline); return epf("invalid decoded scanline length", "corrupt HDR"); }
+         if (scanline == NULL) scanline = (stbi_uc *) stbi__malloc(width * 4);
 
 			for (k = 0; k < 4; ++k) {
 				i = 0;
@@ -3415,7 +3951,7 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
          for (i=0; i < width; ++i)
             hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
 		}
-      free(scanline);
+      stbi__free(scanline);
 	}
 
    return hdr_data;
@@ -3466,7 +4002,7 @@ static stbi_uc *hdr_load_rgbe(stbi *s, int *x, int *y, int *comp, int req_comp)
 	req_comp = 4;
 
 	// Read data
-	rgbe_data = (stbi_uc *) malloc(height * width * req_comp * sizeof(stbi_uc));
+	rgbe_data = (stbi_uc *) stbi__malloc_pixels(height * width * req_comp * sizeof(stbi_uc));
 	//	point to the beginning
 	scanline = rgbe_data;
 
@@ -3502,7 +4038,7 @@ static stbi_uc *hdr_load_rgbe(stbi *s, int *x, int *y, int *comp, int req_comp)
          }
          len <<= 8;
          len |= get8(s);
-         if (len != width) { free(rgbe_data); return epuc("invalid decoded scanline length", "corrupt HDR"); }
+         if (len != width) { stbi__free(rgbe_data); return epuc("invalid decoded scanline length", "corrupt HDR"); }
 			for (k = 0; k < 4; ++k) {
 				i = 0;
 				while (i < width) {
@@ -3680,3 +4216,95 @@ int stbi_write_tga(char const *filename, int x, int y, int comp, void *data)
 #ifndef STBI_NO_DDS
 #include "stbi_DDS_aug_c.h"
 #endif
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Header probing: the format tests in stbi_load's order, then only as much
+// of the file as the format's header takes. Registered loaders can't be
+// probed.
+
+typedef struct
+{
+   int (*test)(stbi *s);
+   int (*info)(stbi *s, stbi_image_info *info);
+} prober;
+
+static prober const probers[] =
+{
+   { jpeg_test, jpeg_info },
+   { png_test,  png_info  },
+   { bmp_test,  bmp_info  },
+   { psd_test,  psd_info  },
+   #ifndef STBI_NO_DDS
+   { dds_test,  dds_info  },
+   #endif
+   #ifndef STBI_NO_HDR
+   { hdr_test,  hdr_info  },
+   #endif
+   // tga last because it's a crappy test!
+   { tga_test,  tga_info  },
+};
+
+static int probe(stbi *s, stbi_image_info *info)
+{
+   int i, r;
+   for (i=0; i < (int) (sizeof(probers) / sizeof(probers[0])); ++i) {
+      r = probers[i].test(s);
+      rewind_stbi(s);
+      if (r) {
+         r = probers[i].info(s, info);
+         rewind_stbi(s);
+         if (!r) info->format = STBI_unknown;
+         return r;
+      }
+   }
+   start_info(info, STBI_unknown);
+   return e("unknown image type", "Image not of any known type, or corrupt");
+}
+
+int stbi_probe_from_memory(stbi_uc const *buffer, int len, stbi_image_info *info)
+{
+   stbi s;
+   start_mem(&s, buffer, len);
+   return probe(&s, info);
+}
+
+int stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp)
+{
+   stbi_image_info info;
+   return report_info(stbi_probe_from_memory(buffer, len, &info), &info, x, y, comp);
+}
+
+#ifndef STBI_NO_STDIO
+int stbi_probe_from_file(FILE *f, stbi_image_info *info)
+{
+   stbi s;
+   start_file(&s, f);
+   return probe(&s, info);
+}
+
+int stbi_probe(char const *filename, stbi_image_info *info)
+{
+   FILE *f = fopen(filename, "rb");
+   int r;
+   if (!f) {
+      start_info(info, STBI_unknown);
+      return e("can't fopen", "Unable to open file");
+   }
+   r = stbi_probe_from_file(f, info);
+   fclose(f);
+   return r;
+}
+
+int stbi_info_from_file(FILE *f, int *x, int *y, int *comp)
+{
+   stbi_image_info info;
+   return report_info(stbi_probe_from_file(f, &info), &info, x, y, comp);
+}
+
+int stbi_info(char const *filename, int *x, int *y, int *comp)
+{
+   stbi_image_info info;
+   return report_info(stbi_probe(filename, &info), &info, x, y, comp);
+}
+#endif
@@ -15,9 +15,6 @@
       decoded from memory or through stdio FILE (define STBI_NO_STDIO to remove code)
       supports installable dequantizing-IDCT, YCbCr-to-RGB conversion (define STBI_SIMD)
         
-   TODO:
-      stbi_info_*
-  
    history:
       1.16   major bugfix - convert_format converted one too many pixels
       1.15   initialize some fields for thread safety
@@ -154,6 +151,7 @@
 //
 //     stbi_is_hdr(char *filename);
 
+#include <stddef.h>
 #ifndef STBI_NO_STDIO
 #include <stdio.h>
 #endif
@@ -212,8 +210,7 @@ extern void   stbi_ldr_to_hdr_scale(float scale);
 
 #endif // STBI_NO_HDR
 
-// get a VERY brief reason for failure
-// NOT THREADSAFE
+// get a VERY brief reason for failure of the last call on this thread
 extern char    *stbi_failure_reason  (void); 
 
 // free the loaded image -- this is just free()
@@ -228,6 +225,116 @@ extern int      stbi_is_hdr          (char const *filename);
 extern int      stbi_is_hdr_from_file(FILE *f);
 #endif
 
+// Everything the header says, read without decoding: JPEG up to its frame
+// header, paletted PNG up to its first IDAT, the rest only their fixed
+// header. Returns 1 on success, 0 on failure with the reason set. Files
+// are left where they were.
+enum
+{
+   STBI_unknown = 0,
+   STBI_jpeg,
+   STBI_png,
+   STBI_bmp,
+   STBI_tga,
+   STBI_psd,
+   STBI_hdr,
+   STBI_dds,
+};
+
+typedef struct stbi_image_info
+{
+   int width, height;   // of one face for DDS cubemaps
+   int comp;            // as stbi_load reports it; for DDS what the file can hold
+   int format;          // STBI_jpeg, ...
+   int levels;          // MIP levels in the file, 1 but for DDS
+   int cubemap;         // DDS with six faces, decoded one under another
+   int dxt;             // 1 to 5 for DXT1 to DXT5 DDS, 0 otherwise
+} stbi_image_info;
+
+extern int      stbi_probe_from_memory(stbi_uc const *buffer, int len, stbi_image_info *info);
+#ifndef STBI_NO_STDIO
+extern int      stbi_probe           (char const *filename,     stbi_image_info *info);
+extern int      stbi_probe_from_file (FILE *f,                  stbi_image_info *info);
+#endif
+
+// REENTRANT API
+//
+// Decoding keeps no shared state, so any number of threads may decode at
+// once. The calls above report failures per thread and read the HDR
+// conversion settings from process-wide defaults, which should be set
+// before other threads start decoding. A context carries its own failure
+// reason and settings instead: while a *_ctx call runs, everything it
+// decodes uses that context. Installed IDCT/color conversion routines and
+// registered loaders are shared too; install and register them up front.
+//
+// Everything a *_ctx call allocates, the image it returns included, comes
+// from the context's allocator (malloc when it has none), and the call
+// counts what it allocated. Free those images with stbi_image_free_ctx.
+// Registered loaders allocate on their own.
+
+typedef struct stbi_allocator
+{
+   void *(*alloc)  (void *user, size_t size);
+   void *(*resize) (void *user, void *p, size_t old_size, size_t size); // NULL: alloc, copy, release
+   void  (*release)(void *user, void *p);                               // may be NULL (an arena)
+   void  *user;
+} stbi_allocator;
+
+typedef struct stbi_allocation_stats
+{
+   unsigned int allocations;  // resizes included
+   size_t       bytes;        // all of them together
+   size_t       peak_bytes;   // the most that was live at once
+} stbi_allocation_stats;
+
+typedef struct stbi_context
+{
+   const char *failure_reason;   // of the last *_ctx call, NULL if it succeeded
+   float hdr_to_ldr_gamma, hdr_to_ldr_scale;
+   float ldr_to_hdr_gamma, ldr_to_hdr_scale;
+   stbi_allocator allocator;     // all NULL for malloc
+   stbi_allocation_stats stats;  // of the last *_ctx call
+} stbi_context;
+
+// no failure, malloc, and the current process-wide settings
+extern void     stbi_context_init    (stbi_context *ctx);
+
+// free an image returned by a *_ctx call with the same context
+extern void     stbi_image_free_ctx  (stbi_context *ctx, void *retval_from_stbi_load_ctx);
+
+// Decode into pixels, which has room for size bytes. An image that fits is
+// decoded in place, without allocating for the result; one that doesn't
+// fails with x, y and comp set so the caller can size a buffer. Returns 1
+// on success, 0 on failure.
+#ifndef STBI_NO_STDIO
+extern int      stbi_load_into_ctx   (stbi_context *ctx, char const *filename, int *x, int *y, int *comp, int req_comp, stbi_uc *pixels, size_t size);
+#endif
+extern int      stbi_load_from_memory_into_ctx(stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_uc *pixels, size_t size);
+
+#ifndef STBI_NO_STDIO
+extern stbi_uc *stbi_load_ctx        (stbi_context *ctx, char const *filename, int *x, int *y, int *comp, int req_comp);
+#endif
+extern stbi_uc *stbi_load_from_memory_ctx(stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
+
+#ifndef STBI_NO_HDR
+#ifndef STBI_NO_STDIO
+extern float   *stbi_loadf_ctx       (stbi_context *ctx, char const *filename, int *x, int *y, int *comp, int req_comp);
+#endif
+extern float   *stbi_loadf_from_memory_ctx(stbi_context *ctx, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
+#endif
+
+// Thread-local storage for the per-thread state; without it decoding is
+// back to one thread at a time
+#ifndef STBI_THREAD_LOCAL
+   #if defined(_MSC_VER)
+      #define STBI_THREAD_LOCAL __declspec(thread)
+   #elif defined(__GNUC__)
+      #define STBI_THREAD_LOCAL __thread
+   #else
+      #define STBI_THREAD_LOCAL
+   #endif
+#endif
+
 // ZLIB client - used by PNG, available for other purposes
 
 extern char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -101,6 +101,47 @@ int      stbi_dds_test_memory      (stbi_uc const *buffer, int len)
    return dds_test(&s);
 }
 
+static int dds_info(stbi *s, stbi_image_info *info)
+{
+	//	all variables go up front
+	DDS_header header;
+	stbi_uc *bytes = (stbi_uc*)(&header);
+	int i;
+	unsigned int flags;
+	start_info( info, STBI_dds );
+	/*	a byte at a time, so a short file reads as zeros and fails below	*/
+	for( i = 0; i < 128; ++i )
+	{
+		bytes[i] = get8u( s );
+	}
+	//	the checks dds_load makes
+	if( header.dwMagic != (('D' << 0) | ('D' << 8) | ('S' << 16) | (' ' << 24)) ) return e("not DDS", "Corrupt DDS");
+	if( header.dwSize != 124 ) return e("not DDS", "Corrupt DDS");
+	flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT;
+	if( (header.dwFlags & flags) != flags ) return e("bad DDS", "Corrupt DDS");
+	if( header.sPixelFormat.dwSize != 32 ) return e("bad DDS", "Corrupt DDS");
+	flags = DDPF_FOURCC | DDPF_RGB;
+	if( (header.sPixelFormat.dwFlags & flags) == 0 ) return e("bad DDS", "Corrupt DDS");
+	if( (header.sCaps.dwCaps1 & DDSCAPS_TEXTURE) == 0 ) return e("bad DDS", "Corrupt DDS");
+	if( ((int)header.dwWidth <= 0) || ((int)header.dwHeight <= 0) ) return e("bad DDS", "Corrupt DDS");
+	info->width = header.dwWidth;
+	info->height = header.dwHeight;
+	if( header.sPixelFormat.dwFlags & DDPF_FOURCC )
+	{
+		info->dxt = 1 + (header.sPixelFormat.dwFourCC >> 24) - '1';
+		if( (info->dxt < 1) || (info->dxt > 5) ) return e("unsupported DDS", "DDS format not supported");
+	}
+	/*	what the file can hold: the decode drops to RGB when every alpha is 255	*/
+	info->comp = (info->dxt || (header.sPixelFormat.dwFlags & DDPF_ALPHAPIXELS)) ? 4 : 3;
+	if( (header.sCaps.dwCaps1 & DDSCAPS_MIPMAP) && (header.dwMipMapCount > 1) )
+	{
+		info->levels = header.dwMipMapCount;
+	}
+	/*	dds_load needs cubemaps to have square faces	*/
+	info->cubemap = (header.sCaps.dwCaps2 & DDSCAPS2_CUBEMAP) && (header.dwWidth == header.dwHeight);
+	return 1;
+}
+
 //	helper functions
 int stbi_convert_bit_range( int c, int from_bits, int to_bits )
 {
@@ -326,7 +367,8 @@ static stbi_uc *dds_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 			dwPitchOrLinearSize == 0	*/
 		//	passed all the tests, get the RAM for decoding
 		sz = (s->img_x)*(s->img_y)*4*cubemap_faces;
-		dds_data = (unsigned char*)malloc( sz );
+		dds_data = (unsigned char*)stbi__malloc_pixels( sz );
+		if( dds_data == NULL ) return epuc("outofmem", "Out of memory");
 		/*	do this once for each face	*/
 		for( cf = 0; cf < cubemap_faces; ++ cf )
 		{
@@ -414,7 +456,8 @@ static stbi_uc *dds_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 		}
 		*comp = s->img_n;
 		sz = s->img_x*s->img_y*s->img_n*cubemap_faces;
-		dds_data = (unsigned char*)malloc( sz );
+		dds_data = (unsigned char*)stbi__malloc_pixels( sz );
+		if( dds_data == NULL ) return epuc("outofmem", "Out of memory");
 		/*	do this once for each face	*/
 		for( cf = 0; cf < cubemap_faces; ++ cf )
 		{